@@ -40,15 +40,18 @@ view ray with the shadow volume of S, in order to compute light shafts.
 <p>Our fragment shader has the following inputs and outputs:
 */
 
-uniform vec3 camera;
-uniform float exposure;
+// camera, exposure and sun_direction change every frame, and are in the SkyFrame
+// uniform block that Sky declares before this file.
 uniform vec3 white_point;
 uniform vec3 earth_center;
-uniform vec3 sun_direction;
 uniform vec3 sun_radiance;
 uniform vec2 sun_size;
 in vec3 view_ray;
+#ifdef SKY_VIEW_LUT_PASS
+layout(location = 0) out vec4 color;
+#else
 layout(location = 0) out vec3 color;
+#endif
 
 /*
 <p>It uses the following constants, as well as the following atmosphere
@@ -221,6 +224,93 @@ void GetSphereShadowInOut(vec3 view_direction, vec3 sun_direction,
   }
 }
 
+/*<h3>Sky-view LUT</h3>
+
+<p>The sky and the planet P only depend on the view direction, and vary slowly
+with it (except for the Sun disc). Instead of computing them for each pixel,
+<code>Sky::draw</code> can render them once per frame in a small sky-view LUT
+around the camera (with <code>SKY_VIEW_LUT_PASS</code> defined), and then look
+them up for each pixel (with <code>SKY_VIEW_LUT</code> defined), as in <a href=
+"https://sebh.github.io/publications/egsr2020.pdf">A Scalable and Production
+Ready Sky and Atmosphere Rendering Technique</a> (Sebastien Hillaire, 2020).
+The sphere S, which is close to the camera, and the Sun disc, which is smaller
+than a LUT texel, are still computed for each pixel.
+
+<p>The LUT horizontal coordinate is the view azimuth around the vertical,
+measured from the Sun azimuth, and its vertical coordinate is the view zenith
+angle, with a non-linear mapping which puts more texels near the horizon, where
+the radiance varies the most. The upper half of the LUT holds the sky, the lower
+half the ground. The LUT alpha channel holds the ground opacity:
+*/
+
+#if defined(SKY_VIEW_LUT_PASS) || defined(SKY_VIEW_LUT)
+uniform vec2 sky_view_lut_size;
+uniform sampler2D sky_view_lut;
+
+void GetSkyViewFrame(out vec3 up, out vec3 forward, out vec3 right) {
+  up = normalize(camera - earth_center);
+  forward = sun_direction - up * dot(sun_direction, up);
+  // Any horizontal direction if the Sun is at the zenith or at the nadir.
+  if (dot(forward, forward) < 1e-6) {
+    forward = cross(up, abs(up.x) < 0.9 ? vec3(1.0, 0.0, 0.0) :
+        vec3(0.0, 1.0, 0.0));
+  }
+  forward = normalize(forward);
+  right = cross(up, forward);
+}
+
+// The angle between the nadir and the horizon, seen from the camera.
+float GetHorizonNadirAngle() {
+  float r = length(camera - earth_center);
+  float bottom_radius = ATMOSPHERE.bottom_radius;
+  return acos(SafeSqrt(r * r - bottom_radius * bottom_radius) / r);
+}
+
+vec3 GetSkyViewDirection(vec2 frag_coord) {
+  // Texel centers on the full [0, 1] range vertically (to include the zenith
+  // and the nadir), and around the periodic azimuth horizontally.
+  vec2 uv = vec2(frag_coord.x / sky_view_lut_size.x,
+      (frag_coord.y - 0.5) / (sky_view_lut_size.y - 1.0));
+  float beta = GetHorizonNadirAngle();
+  float horizon_zenith_angle = PI - beta;
+  float view_zenith_angle;
+  if (uv.y < 0.5) {
+    float coord = 1.0 - 2.0 * uv.y;
+    view_zenith_angle = horizon_zenith_angle * (1.0 - coord * coord);
+  } else {
+    float coord = 2.0 * uv.y - 1.0;
+    view_zenith_angle = horizon_zenith_angle + beta * coord * coord;
+  }
+  float azimuth = (uv.x - 0.5) * 2.0 * PI;
+  vec3 up;
+  vec3 forward;
+  vec3 right;
+  GetSkyViewFrame(up, forward, right);
+  return up * cos(view_zenith_angle) + sin(view_zenith_angle) *
+      (forward * cos(azimuth) + right * sin(azimuth));
+}
+
+vec2 GetSkyViewLutUv(vec3 view_direction) {
+  vec3 up;
+  vec3 forward;
+  vec3 right;
+  GetSkyViewFrame(up, forward, right);
+  float beta = GetHorizonNadirAngle();
+  float horizon_zenith_angle = PI - beta;
+  float view_zenith_angle = acos(clamp(dot(view_direction, up), -1.0, 1.0));
+  float v;
+  if (view_zenith_angle < horizon_zenith_angle) {
+    v = 0.5 - 0.5 * SafeSqrt(1.0 - view_zenith_angle / horizon_zenith_angle);
+  } else {
+    v = 0.5 + 0.5 * SafeSqrt((view_zenith_angle - horizon_zenith_angle) / beta);
+  }
+  float azimuth =
+      atan(dot(view_direction, right), dot(view_direction, forward));
+  return vec2(azimuth / (2.0 * PI) + 0.5,
+      (v * (sky_view_lut_size.y - 1.0) + 0.5) / sky_view_lut_size.y);
+}
+#endif
+
 /*<h3>Main shading function</h3>
 
 <p>Using these functions we can now implement the main shader function, which
@@ -240,7 +330,11 @@ perspective for the sphere and the planet:
 
 void main() {
     // Normalized view direction vector.
+#ifdef SKY_VIEW_LUT_PASS
+    vec3 view_direction = GetSkyViewDirection(gl_FragCoord.xy);
+#else
     vec3 view_direction = normalize(view_ray);
+#endif
     // Tangent of the angle subtended by this fragment.
     float fragment_angular_size =
         length(dFdx(view_ray) + dFdy(view_ray)) / length(view_ray);
@@ -272,6 +366,7 @@ void main() {
     // Compute the radiance reflected by the sphere, if the ray intersects it.
     float sphere_alpha = 0.0;
     vec3 sphere_radiance = vec3(0.0);
+#ifndef SKY_VIEW_LUT_PASS
     if (distance_to_intersection > 0.0) 
     {
 	    // Compute the distance between the view ray and the sphere, and the
@@ -310,7 +405,27 @@ void main() {
 	        point - earth_center, shadow_length, sun_direction, transmittance);
 	    sphere_radiance = sphere_radiance * transmittance + in_scatter;
     }
+#endif
 
+#ifdef SKY_VIEW_LUT
+	/*
+	<p>With a sky-view LUT, the sky and the ground come from the LUT, and only the
+	Sun disc is added, where the ground does not hide it:
+	*/
+
+    vec4 sky_and_ground = texture(sky_view_lut, GetSkyViewLutUv(view_direction));
+    vec3 radiance = sky_and_ground.rgb;
+    if (dot(view_direction, sun_direction) > sun_size.y)
+    {
+        vec3 camera_position = camera - earth_center;
+        float r = clamp(length(camera_position), ATMOSPHERE.bottom_radius,
+            ATMOSPHERE.top_radius);
+        float mu = dot(camera_position, view_direction) / length(camera_position);
+        radiance = radiance + (1.0 - sky_and_ground.a) * sun_radiance *
+            GetTransmittanceToTopAtmosphereBoundary(ATMOSPHERE,
+                transmittance_texture, r, mu);
+    }
+#else
 	/*
 	<p>In the following we repeat the same steps as above, but for the planet sphere
 	P instead of the sphere S (a smooth opacity is not really needed here, so we
@@ -368,13 +483,21 @@ void main() {
         GetSkyRadiance(camera - earth_center, view_direction, shadow_length, sun_direction,
             transmittance);
 
+#ifndef SKY_VIEW_LUT_PASS
     // If the view ray intersects the Sun, add the Sun radiance.
     if (dot(view_direction, sun_direction) > sun_size.y) 
     {
         radiance = radiance + transmittance * sun_radiance;
     }
+#endif
 
     radiance = mix(radiance, ground_radiance, ground_alpha);
+#endif
     radiance = mix(radiance, sphere_radiance, sphere_alpha);
+#ifdef SKY_VIEW_LUT_PASS
+    // The Sun disc is added, and the tone mapping done, when the LUT is looked up.
+    color = vec4(radiance, ground_alpha);
+#else
     color = pow(vec3(1.0) - exp(-radiance / white_point * exposure), vec3(1.0 / 2.2));
+#endif
 }
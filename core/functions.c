@@ -1418,13 +1418,12 @@ void GetRMuSFromIrradianceTextureUv(IN(AtmosphereParameters) atmosphere,
 the ground irradiance texture, for the direct irradiance:
 */
 
-const vec2 IRRADIANCE_TEXTURE_SIZE =
-    vec2(IRRADIANCE_TEXTURE_WIDTH, IRRADIANCE_TEXTURE_HEIGHT);
-
 IrradianceSpectrum ComputeDirectIrradianceTexture(
     IN(AtmosphereParameters) atmosphere,
     IN(TransmittanceTexture) transmittance_texture,
     IN(vec2) frag_coord) {
+  const vec2 IRRADIANCE_TEXTURE_SIZE =
+      vec2(IRRADIANCE_TEXTURE_WIDTH, IRRADIANCE_TEXTURE_HEIGHT);
   Length r;
   Number mu_s;
   GetRMuSFromIrradianceTextureUv(
@@ -1442,6 +1441,8 @@ IrradianceSpectrum ComputeIndirectIrradianceTexture(
     IN(ReducedScatteringTexture) single_mie_scattering_texture,
     IN(ScatteringTexture) multiple_scattering_texture,
     IN(vec2) frag_coord, int scattering_order) {
+  const vec2 IRRADIANCE_TEXTURE_SIZE =
+      vec2(IRRADIANCE_TEXTURE_WIDTH, IRRADIANCE_TEXTURE_HEIGHT);
   Length r;
   Number mu_s;
   GetRMuSFromIrradianceTextureUv(
@@ -471,6 +471,7 @@ GLboolean ESUTIL_API esCreateWindow(ESContext *esContext, const char *title, GLi
 	EGLint majorVersion;
 	EGLint minorVersion;
 	EGLint contextAttribs[] = { EGL_CONTEXT_CLIENT_VERSION, 3, EGL_NONE };
+	EGLint contextAttribs31[] = { EGL_CONTEXT_MAJOR_VERSION_KHR, 3, EGL_CONTEXT_MINOR_VERSION_KHR, 1, EGL_NONE };
 
 	if (esContext == NULL)
 	{
@@ -552,9 +553,15 @@ GLboolean ESUTIL_API esCreateWindow(ESContext *esContext, const char *title, GLi
 		return GL_FALSE;
 	}
 
-	// Create a GL context
+	// Create a GL context, GLES 3.1 if the implementation has it (the sky
+	// precomputation then uses compute shaders) and GLES 3.0 otherwise
 	esContext->eglContext = eglCreateContext(esContext->eglDisplay, config,
-		EGL_NO_CONTEXT, contextAttribs);
+		EGL_NO_CONTEXT, contextAttribs31);
+	if (esContext->eglContext == EGL_NO_CONTEXT)
+	{
+		esContext->eglContext = eglCreateContext(esContext->eglDisplay, config,
+			EGL_NO_CONTEXT, contextAttribs);
+	}
 
 	if (esContext->eglContext == EGL_NO_CONTEXT)
 	{
@@ -931,6 +938,15 @@ void init(ESContext *esContext)
 	_sky.init();
 	//_panel.init();
 
+	// the meshes drawn after the sky see the scene through its atmosphere
+	_cube.setAerialPerspective(_sky.getAerialPerspective());
+	_terrain.setAerialPerspective(_sky.getAerialPerspective());
+	_panel.setAerialPerspective(_sky.getAerialPerspective());
+	// and are lit by its sky and sun
+	_cube.setSkyLighting(_sky.getSkyLighting());
+	_terrain.setSkyLighting(_sky.getSkyLighting());
+	_panel.setSkyLighting(_sky.getSkyLighting());
+
 	//_fpsLabel.initWithString("fps: ", "DFGB_Y7_0.ttf", 20, 200, 50);
 	//_fpsLabel.setPosition(60, 40);
 	//_fpsLabel.setColor(Color3B(1.0f, 0.0f, 0.0f));
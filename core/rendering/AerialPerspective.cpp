@@ -0,0 +1,179 @@
+#include "AerialPerspective.h"
+
+// renders one depth slice of the volume, each fragment being a froxel center
+// (camera, exposure and sun_direction are in the SkyFrame block of Sky)
+const char kAerialPerspectiveShader[] =
+	R"(
+		uniform vec3 white_point;
+		uniform vec3 earth_center;
+		uniform mat3 frustum_rotation;  // world from view
+		uniform vec2 frustum_scale;     // tangents of the half fields of view
+		uniform vec2 volume_size;
+		uniform float slice_depth;      // view depth of the slice
+		layout(location = 0) out vec4 froxel;
+		#ifdef USE_LUMINANCE
+		#define GetSkyRadianceToPoint GetSkyLuminanceToPoint
+		#endif
+		void main()
+		{
+			if (slice_depth <= 0.0)
+			{
+				froxel = vec4(0.0, 0.0, 0.0, 1.0);
+				return;
+			}
+			vec2 ndc = gl_FragCoord.xy / volume_size * 2.0 - 1.0;
+			vec3 view_ray = frustum_rotation * vec3(ndc * frustum_scale, -1.0);
+			vec3 point = camera + view_ray * slice_depth - earth_center;
+			// the froxels behind the ground only matter for the meshes on it, and
+			// are moved up onto it, where the scattering has no discontinuity
+			float r = length(point);
+			float ground_radius = ATMOSPHERE.bottom_radius + 0.01;  // 10 m above
+			if (r < ground_radius)
+			{
+				point *= ground_radius / r;
+			}
+			vec3 transmittance;
+			vec3 in_scatter = GetSkyRadianceToPoint(camera - earth_center, point,
+				0.0, sun_direction, transmittance);
+			// the tonemapping of the sky (see demo.c), so that the farthest meshes
+			// fade into the horizon. The difference of two lookups giving the
+			// in-scattering can be slightly negative over short distances
+			in_scatter = max(in_scatter, vec3(0.0));
+			froxel.rgb = pow(vec3(1.0) - exp(-in_scatter / white_point * exposure),
+				vec3(1.0 / 2.2));
+			froxel.a = dot(transmittance, vec3(1.0 / 3.0));
+		})";
+
+AerialPerspective::AerialPerspective():
+	max_distance_(32.0f),
+	texture_(0)
+{
+	for (int i = 0; i < AERIAL_PERSPECTIVE_DEPTH; ++i)
+	{
+		framebuffers_[i] = 0;
+	}
+}
+
+AerialPerspective::~AerialPerspective()
+{
+	glDeleteTextures(1, &texture_);
+	glDeleteFramebuffers(AERIAL_PERSPECTIVE_DEPTH, framebuffers_);
+}
+
+const char* AerialPerspective::getFragmentShaderStr()
+{
+	return kAerialPerspectiveShader;
+}
+
+AerialPerspective::ProgramLocations AerialPerspective::initProgram(unsigned int program)
+{
+	glUniform2f(glGetUniformLocation(program, "volume_size"),
+		AERIAL_PERSPECTIVE_WIDTH, AERIAL_PERSPECTIVE_HEIGHT);
+
+	ProgramLocations locations;
+	locations.frustumRotation = glGetUniformLocation(program, "frustum_rotation");
+	locations.frustumScale = glGetUniformLocation(program, "frustum_scale");
+	locations.sliceDepth = glGetUniformLocation(program, "slice_depth");
+	return locations;
+}
+
+void AerialPerspective::createVolume()
+{
+	// RGBA16F like the sky-view LUT, filtered, and clamped to the frustum
+	glGenTextures(1, &texture_);
+	glBindTexture(GL_TEXTURE_3D, texture_);
+	glTexStorage3D(GL_TEXTURE_3D, 1, GL_RGBA16F, AERIAL_PERSPECTIVE_WIDTH,
+		AERIAL_PERSPECTIVE_HEIGHT, AERIAL_PERSPECTIVE_DEPTH);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+	glBindTexture(GL_TEXTURE_3D, 0);
+
+	// a framebuffer per slice rather than a new attachment before each draw
+	glGenFramebuffers(AERIAL_PERSPECTIVE_DEPTH, framebuffers_);
+	for (int i = 0; i < AERIAL_PERSPECTIVE_DEPTH; ++i)
+	{
+		glBindFramebuffer(GL_FRAMEBUFFER, framebuffers_[i]);
+		glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, texture_, 0, i);
+	}
+}
+
+void AerialPerspective::render(const ProgramLocations &locations, const ESContext *esContext)
+{
+	GLint framebuffer;
+	glGetIntegerv(GL_FRAMEBUFFER_BINDING, &framebuffer);
+	if (texture_ == 0)
+	{
+		createVolume();
+	}
+
+	// the froxels follow the projection and the camera of the meshes
+	const glm::mat4 &projection = esContext->perspective_matrix;
+	glm::mat3 rotation = glm::mat3(glm::inverse(esContext->camera_matrix));
+	glUniformMatrix3fv(locations.frustumRotation, 1, GL_FALSE, &rotation[0][0]);
+	glUniform2f(locations.frustumScale, 1.0f / projection[0][0], 1.0f / projection[1][1]);
+
+	glViewport(0, 0, AERIAL_PERSPECTIVE_WIDTH, AERIAL_PERSPECTIVE_HEIGHT);
+	for (int i = 0; i < AERIAL_PERSPECTIVE_DEPTH; ++i)
+	{
+		float slice = (float)i / (AERIAL_PERSPECTIVE_DEPTH - 1);
+		glBindFramebuffer(GL_FRAMEBUFFER, framebuffers_[i]);
+		glUniform1f(locations.sliceDepth, max_distance_ * slice * slice);
+		glDrawArrays(GL_TRIANGLES, 0, 3);
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+	glViewport(0, 0, esContext->width, esContext->height);
+}
+
+void AerialPerspective::bind(GLint parametersLoc, GLint depthLoc, const ESContext *esContext) const
+{
+	// without a volume the unit samples an incomplete texture, (0, 0, 0, 1)
+	glActiveTexture(GL_TEXTURE0 + AERIAL_PERSPECTIVE_UNIT);
+	glBindTexture(GL_TEXTURE_3D, texture_);
+	glActiveTexture(GL_TEXTURE0);
+
+	// the view depth is B / (z_ndc + A), with A and B the terms of the projection
+	// giving the depth of a point from its view space z
+	glUniform4f(parametersLoc, 1.0f / esContext->width, 1.0f / esContext->height,
+		1.0f / max_distance_, (float)AERIAL_PERSPECTIVE_DEPTH);
+	glUniform2f(depthLoc, esContext->perspective_matrix[2][2],
+		esContext->perspective_matrix[3][2]);
+}
+
+void AerialPerspective::unbind()
+{
+	glActiveTexture(GL_TEXTURE0 + AERIAL_PERSPECTIVE_UNIT);
+	glBindTexture(GL_TEXTURE_3D, 0);
+	glActiveTexture(GL_TEXTURE0);
+}
+
+AerialPerspectiveBinding::AerialPerspectiveBinding():
+	aerial_perspective_(nullptr),
+	volume_loc_(-1),
+	parameters_loc_(-1),
+	depth_loc_(-1)
+{
+}
+
+void AerialPerspectiveBinding::init(GLuint program)
+{
+	volume_loc_ = glGetUniformLocation(program, "s_aerialPerspective");
+	parameters_loc_ = glGetUniformLocation(program, "u_aerialPerspective");
+	depth_loc_ = glGetUniformLocation(program, "u_aerialDepth");
+}
+
+void AerialPerspectiveBinding::bind(const ESContext *esContext) const
+{
+	// the volume has its own unit, and leaves the color unchanged when there is none
+	glUniform1i(volume_loc_, AERIAL_PERSPECTIVE_UNIT);
+	if (aerial_perspective_ != nullptr)
+	{
+		aerial_perspective_->bind(parameters_loc_, depth_loc_, esContext);
+	}
+	else
+	{
+		AerialPerspective::unbind();
+	}
+}
@@ -0,0 +1,108 @@
+#ifndef __AERIAL_PERSPECTIVE__
+#define __AERIAL_PERSPECTIVE__
+
+#include <gles_include.h>
+
+// froxels of the camera frustum volume, in x, y and depth slices
+#define AERIAL_PERSPECTIVE_WIDTH  32
+#define AERIAL_PERSPECTIVE_HEIGHT 32
+#define AERIAL_PERSPECTIVE_DEPTH  32
+// texture unit of the volume in the mesh programs, after the ones of Sky
+#define AERIAL_PERSPECTIVE_UNIT   5
+
+// GLSL pasted into the fragment shaders of the meshes, after their precision
+// statement. applyAerialPerspective returns the color of the fragment seen
+// through the atmosphere, with one fetch in the volume at its window position
+// and view depth (recovered from gl_FragCoord.z, so no varying is needed)
+#define AERIAL_PERSPECTIVE_GLSL                                                     \
+	"uniform mediump sampler3D s_aerialPerspective;                             \n" \
+	"uniform highp vec4 u_aerialPerspective; // 1 / viewport size, 1 / max distance, slices\n" \
+	"uniform highp vec2 u_aerialDepth;       // projection terms of the view depth  \n" \
+	"vec3 applyAerialPerspective(vec3 color)                                    \n" \
+	"{                                                                          \n" \
+	"   highp float depth = u_aerialDepth.y / (gl_FragCoord.z * 2.0 - 1.0 + u_aerialDepth.x);\n" \
+	"   highp float slice = sqrt(clamp(depth * u_aerialPerspective.z, 0.0, 1.0));\n" \
+	"   slice = (slice * (u_aerialPerspective.w - 1.0) + 0.5) / u_aerialPerspective.w;\n" \
+	"   vec4 froxel = texture(s_aerialPerspective, vec3(gl_FragCoord.xy * u_aerialPerspective.xy, slice));\n" \
+	"   return color * froxel.a + froxel.rgb;                                   \n" \
+	"}                                                                          \n"
+
+// Aerial perspective of the meshes: a low resolution volume over the camera
+// frustum holding, for the point at the center of each froxel, the in-scattered
+// light between the camera and this point (tonemapped like the sky, in rgb) and
+// the mean transmittance along this segment (in a). Sky renders it once per frame
+// from the precomputed textures of its atmosphere model, a depth slice per draw,
+// and the meshes then apply it with AERIAL_PERSPECTIVE_GLSL. The slices are spread
+// quadratically up to a maximum distance, so that most of them are near the
+// camera where the in-scattering changes the most, and the first one is at the
+// camera (no in-scattering and a full transmittance).
+class AerialPerspective
+{
+public:
+	AerialPerspective();
+	~AerialPerspective();
+
+	// the locations of the uniforms of a program built from getFragmentShaderStr()
+	// that render sets
+	struct ProgramLocations
+	{
+		GLint frustumRotation;
+		GLint frustumScale;
+		GLint sliceDepth;
+	};
+
+	// the fragment shader rendering the volume, to append to the atmosphere shader
+	// of a SkyModel (with USE_LUMINANCE when the sky uses luminance)
+	static const char* getFragmentShaderStr();
+	// sets the uniforms of the current program, built from getFragmentShaderStr(),
+	// that never change, and looks up the others, once when it is linked
+	static ProgramLocations initProgram(unsigned int program);
+
+	// in scene units, the froxels further away use the last slice (32 by default)
+	void setMaxDistance(float distance) { max_distance_ = distance; }
+	float getMaxDistance() const { return max_distance_; }
+
+	// renders the volume of the camera of esContext with the current program, a
+	// program given to initProgram whose atmosphere textures, camera, exposure and
+	// sun direction are set. The bound vertex array must be a full screen triangle
+	void render(const ProgramLocations &locations, const ESContext *esContext);
+
+	// binds the volume to AERIAL_PERSPECTIVE_UNIT and sets the uniforms of
+	// AERIAL_PERSPECTIVE_GLSL in the current program. Until the first render the
+	// volume leaves the colors unchanged
+	void bind(GLint parametersLoc, GLint depthLoc, const ESContext *esContext) const;
+	// for the meshes without a volume, whose AERIAL_PERSPECTIVE_UNIT then samples
+	// an incomplete texture, (0, 0, 0, 1), leaving their colors unchanged
+	static void unbind();
+
+private:
+	void createVolume();
+
+	float max_distance_;
+
+	unsigned int texture_;
+	unsigned int framebuffers_[AERIAL_PERSPECTIVE_DEPTH];   // one per depth slice
+};
+
+// The uniforms of AERIAL_PERSPECTIVE_GLSL in the program of a mesh, and the
+// volume the mesh is seen through, bound with one call before each draw
+class AerialPerspectiveBinding
+{
+public:
+	AerialPerspectiveBinding();
+
+	// looks the uniforms up in program, once it is linked
+	void init(GLuint program);
+	// the volume of the mesh, none by default
+	void setAerialPerspective(const AerialPerspective *aerialPerspective) { aerial_perspective_ = aerialPerspective; }
+	// binds the volume, or no volume, for the current program, the one given to init
+	void bind(const ESContext *esContext) const;
+
+private:
+	const AerialPerspective *aerial_perspective_;
+	GLint volume_loc_;
+	GLint parameters_loc_;
+	GLint depth_loc_;
+};
+
+#endif
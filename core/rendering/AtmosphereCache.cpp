@@ -0,0 +1,194 @@
+#include "AtmosphereCache.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+namespace {
+
+const char kMagic[4] = { 'A', 'T', 'M', 'C' };
+const uint32_t kVersion = 1;
+
+struct FileHeader {
+	char magic[4];
+	uint32_t version;
+	uint64_t key;
+	uint32_t texture_count;
+	uint32_t reserved;
+};
+
+struct TextureHeader {
+	int32_t width;
+	int32_t height;
+	int32_t depth;
+	int32_t channels;
+	int32_t half;
+	int32_t reserved;
+};
+
+}  // anonymous namespace
+
+uint64_t AtmosphereCache::Hash(const void* data, size_t size, uint64_t seed) {
+	const unsigned char* bytes = static_cast<const unsigned char*>(data);
+	uint64_t hash = seed;
+	for (size_t i = 0; i < size; ++i) {
+		hash ^= bytes[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+bool AtmosphereCache::Read(const std::string& filename, uint64_t key,
+	std::vector<Texture>* textures) {
+	std::ifstream file(filename.c_str(), std::ios::binary);
+	if (!file) {
+		return false;
+	}
+
+	FileHeader header;
+	if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+		memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 ||
+		header.version != kVersion || header.key != key) {
+		return false;
+	}
+
+	textures->clear();
+	for (uint32_t i = 0; i < header.texture_count; ++i) {
+		TextureHeader texture_header;
+		if (!file.read(reinterpret_cast<char*>(&texture_header),
+			sizeof(texture_header))) {
+			return false;
+		}
+
+		Texture texture;
+		texture.width = texture_header.width;
+		texture.height = texture_header.height;
+		texture.depth = texture_header.depth;
+		texture.channels = texture_header.channels;
+		texture.half = texture_header.half != 0;
+		if (texture.width <= 0 || texture.height <= 0 || texture.depth <= 0 ||
+			texture.channels <= 0 || texture.channels > 4) {
+			return false;
+		}
+
+		texture.data.resize(texture.GetTexelCount() * (texture.half ? 2 : 4));
+		if (!file.read(reinterpret_cast<char*>(&texture.data[0]),
+			texture.data.size())) {
+			return false;
+		}
+		textures->push_back(texture);
+	}
+	return true;
+}
+
+bool AtmosphereCache::Write(const std::string& filename, uint64_t key,
+	const std::vector<Texture>& textures) {
+	// Written next to the final file and renamed over it at the end, so that a run
+	// interrupted half way never leaves a truncated cache with a valid header.
+	std::string temporary = filename + ".tmp";
+	{
+		std::ofstream file(temporary.c_str(), std::ios::binary | std::ios::trunc);
+		if (!file) {
+			return false;
+		}
+
+		FileHeader header;
+		memcpy(header.magic, kMagic, sizeof(kMagic));
+		header.version = kVersion;
+		header.key = key;
+		header.texture_count = static_cast<uint32_t>(textures.size());
+		header.reserved = 0;
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+		for (size_t i = 0; i < textures.size(); ++i) {
+			const Texture& texture = textures[i];
+			TextureHeader texture_header;
+			texture_header.width = texture.width;
+			texture_header.height = texture.height;
+			texture_header.depth = texture.depth;
+			texture_header.channels = texture.channels;
+			texture_header.half = texture.half ? 1 : 0;
+			texture_header.reserved = 0;
+			file.write(reinterpret_cast<const char*>(&texture_header),
+				sizeof(texture_header));
+			file.write(reinterpret_cast<const char*>(&texture.data[0]),
+				texture.data.size());
+		}
+
+		if (!file) {
+			file.close();
+			remove(temporary.c_str());
+			return false;
+		}
+	}
+
+	remove(filename.c_str());
+	return rename(temporary.c_str(), filename.c_str()) == 0;
+}
+
+unsigned short AtmosphereCache::FloatToHalf(float value) {
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	uint32_t sign = (bits >> 16) & 0x8000;
+	int32_t exponent = static_cast<int32_t>((bits >> 23) & 0xFF) - 127 + 15;
+	uint32_t mantissa = bits & 0x7FFFFF;
+
+	if (((bits >> 23) & 0xFF) == 0xFF) {
+		// Infinity stays infinity, NaN stays NaN.
+		return static_cast<unsigned short>(sign | 0x7C00 | (mantissa ? 0x200 : 0));
+	}
+	if (exponent >= 31) {
+		return static_cast<unsigned short>(sign | 0x7C00);
+	}
+	if (exponent <= 0) {
+		// Subnormal half, or zero below half of the smallest one.
+		if (exponent < -10) {
+			return static_cast<unsigned short>(sign);
+		}
+		mantissa |= 0x800000;
+		uint32_t shift = static_cast<uint32_t>(14 - exponent);
+		uint32_t half_mantissa = mantissa >> shift;
+		uint32_t remainder = mantissa & ((1u << shift) - 1);
+		uint32_t halfway = 1u << (shift - 1);
+		if (remainder > halfway || (remainder == halfway && (half_mantissa & 1))) {
+			++half_mantissa;
+		}
+		return static_cast<unsigned short>(sign | half_mantissa);
+	}
+
+	uint32_t half = sign | (static_cast<uint32_t>(exponent) << 10) | (mantissa >> 13);
+	uint32_t remainder = mantissa & 0x1FFF;
+	if (remainder > 0x1000 || (remainder == 0x1000 && (half & 1))) {
+		// A carry into the exponent is still the correctly rounded value.
+		++half;
+	}
+	return static_cast<unsigned short>(half);
+}
+
+float AtmosphereCache::HalfToFloat(unsigned short value) {
+	uint32_t sign = static_cast<uint32_t>(value & 0x8000) << 16;
+	uint32_t exponent = (value >> 10) & 0x1F;
+	uint32_t mantissa = value & 0x3FF;
+	uint32_t bits;
+	if (exponent == 0x1F) {
+		bits = sign | 0x7F800000 | (mantissa << 13);
+	}
+	else if (exponent != 0) {
+		bits = sign | ((exponent + 127 - 15) << 23) | (mantissa << 13);
+	}
+	else if (mantissa == 0) {
+		bits = sign;
+	}
+	else {
+		// Subnormal half, normalize it.
+		exponent = 127 - 15 + 1;
+		while ((mantissa & 0x400) == 0) {
+			mantissa <<= 1;
+			--exponent;
+		}
+		bits = sign | (exponent << 23) | ((mantissa & 0x3FF) << 13);
+	}
+	float result;
+	memcpy(&result, &bits, sizeof(result));
+	return result;
+}
@@ -0,0 +1,42 @@
+#ifndef ATMOSPHERE_CACHE_H_
+#define ATMOSPHERE_CACHE_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// On-disk copy of the precomputed atmosphere textures, so that SkyModel::Init can
+// upload them instead of running the precomputation again. The file is a header
+// (magic, version, 64-bit key, texture count) followed, for each texture, by its
+// size, channel count and encoding, and then by its texels in native byte order.
+// The key is a hash of everything the textures depend on, a file with another key
+// is a miss.
+class AtmosphereCache {
+public:
+	struct Texture {
+		int width;
+		int height;
+		int depth;                          // 1 for 2D textures
+		int channels;                       // 3 or 4
+		bool half;                          // 16-bit floats, 32-bit floats otherwise
+		std::vector<unsigned char> data;    // texels, x first, then y, then the layers
+
+		size_t GetTexelCount() const { return (size_t)width * height * depth * channels; }
+	};
+
+	static const uint64_t kHashSeed = 14695981039346656037ULL;
+
+	// 64-bit FNV-1a, chained through seed to hash several values into one key.
+	static uint64_t Hash(const void* data, size_t size, uint64_t seed = kHashSeed);
+
+	static bool Read(const std::string& filename, uint64_t key,
+		std::vector<Texture>* textures);
+	static bool Write(const std::string& filename, uint64_t key,
+		const std::vector<Texture>& textures);
+
+	// Round to nearest even, with overflow to infinity.
+	static unsigned short FloatToHalf(float value);
+	static float HalfToFloat(unsigned short value);
+};
+
+#endif  // ATMOSPHERE_CACHE_H_
@@ -0,0 +1,2547 @@
+// Generated by tools/embed_shaders.py from the GLSL files of core, do not
+// edit. The project runs it again when these files change.
+
+#include "ShaderSources.h"
+
+namespace {
+
+// definitions.c
+const char* const kFile0Pieces[] = {
+	"/**\n"
+	" * Copyright (c) 2017 Eric Bruneton\n"
+	" * All rights reserved.\n"
+	" *\n"
+	" * Redistribution and use in source and binary forms, with or without\n"
+	" * modification, are permitted provided that the following conditions\n"
+	" * are met:\n"
+	" * 1. Redistributions of source code must retain the above copyright\n"
+	" *    notice, this list of conditions and the following disclaimer.\n"
+	" * 2. Redistributions in binary form must reproduce the above copyright\n"
+	" *    notice, this list of conditions and the following disclaimer in the\n"
+	" *    documentation and/or other materials provided with the distribution.\n"
+	" * 3. Neither the name of the copyright holders nor the names of its\n"
+	" *    contributors may be used to endorse or promote products derived from\n"
+	" *    this software without specific prior written permission.\n"
+	" *\n"
+	" * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS \"AS IS\"\n"
+	" * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE\n"
+	" * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE\n"
+	" * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE\n"
+	" * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR\n"
+	" * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF\n"
+	" * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS\n"
+	" * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN\n"
+	" * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)\n"
+	" * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF\n"
+	" * THE POSSIBILITY OF SUCH DAMAGE.\n"
+	" */\n"
+	"\n"
+	"/*<h2>atmosphere/definitions.glsl</h2>\n"
+	"\n"
+	"<p>This GLSL file defines the physical types and constants which are used in the\n"
+	"main <a href=\"functions.glsl.html\">functions</a> of our atmosphere model, in\n"
+	"such a way that they can be compiled by a GLSL compiler (a\n"
+	"<a href=\"reference/definitions.h.html\">C++ equivalent</a> of this file\n"
+	"provides the same types and constants in C++, to allow the same functions to be\n"
+	"compiled by a C++ compiler - see the <a href=\"../index.html\">Introduction</a>).\n"
+	"\n"
+	"<h3>Physical quantities</h3>\n"
+	"\n"
+	"<p>The physical quantities we need for our atmosphere model are\n"
+	"<a href=\"https://en.wikipedia.org/wiki/Radiometry\">radiometric</a> and\n"
+	"<a href=\"https://en.wikipedia.org/wiki/Photometry_(optics)\">photometric</a>\n"
+	"quantities. In GLSL we can't define custom numeric types to enforce the\n"
+	"homogeneity of expressions at compile time, so we define all the physical\n"
+	"quantities as <code>float</code>, with preprocessor macros (there is no\n"
+	"<code>typedef</code> in GLSL).\n"
+	"\n"
+	"<p>We start with six base quantities: length, wavelength, angle, solid angle,\n"
+	"power and luminous power (wavelength is also a length, but we distinguish the\n"
+	"two for increased clarity).\n"
+	"*/\n"
+	"\n"
+	"#define Length float\n"
+	"#define Wavelength float\n"
+	"#define Angle float\n"
+	"#define SolidAngle float\n"
+	"#define Power float\n"
+	"#define LuminousPower float\n"
+	"\n"
+	"/*\n"
+	"<p>From this we \"derive\" the irradiance, radiance, spectral irradiance,\n"
+	"spectral radiance, luminance, etc, as well pure numbers, area, volume, etc (the\n"
+	"actual derivation is done in the <a href=\"reference/definitions.h.html\">C++\n"
+	"equivalent</a> of this file).\n"
+	"*/\n"
+	"\n"
+	"#define Number float\n"
+	"#define Area float\n"
+	"#define Volume float\n"
+	"#define NumberDensity float\n"
+	"#define Irradiance float\n"
+	"#define Radiance float\n"
+	"#define SpectralPower float\n"
+	"#define SpectralIrradiance float\n"
+	"#define SpectralRadiance float\n"
+	"#define SpectralRadianceDensity float\n"
+	"#define ScatteringCoefficient float\n"
+	"#define InverseSolidAngle float\n"
+	"#define LuminousIntensity float\n"
+	"#define Luminance float\n"
+	"#define Illuminance float\n"
+	"\n"
+	"/*\n"
+	"<p>We  also need vectors of physical quantities, mostly to represent functions\n"
+	"depending on the wavelength. In this case the vector elements correspond to\n"
+	"values of a function at some predefined wavelengths. Again, in GLSL we can't\n"
+	"define custom vector types to enforce the homogeneity of expressions at compile\n"
+	"time, so we define these vector types as <code>vec3</code>, with preprocessor\n"
+	"macros. The full definitions are given in the\n"
+	"<a href=\"reference/definitions.h.html\">C++ equivalent</a> of this file).\n"
+	"*/\n"
+	"\n"
+	"// A generic function from Wavelength to some other type.\n"
+	"#define AbstractSpectrum vec3\n"
+	"// A function from Wavelength to Number.\n"
+	"#define DimensionlessSpectrum vec3\n"
+	"// A function from Wavelength to SpectralPower.\n"
+	"#define PowerSpectrum vec3\n"
+	"// A function from Wavelength to SpectralIrradiance.\n"
+	"#define IrradianceSpectrum vec3\n"
+	"// A function from Wavelength to SpectralRadiance.\n"
+	"#define RadianceSpectrum vec3\n"
+	"// A function from Wavelength to SpectralRadianceDensity.\n"
+	"#define RadianceDensitySpectrum vec3\n"
+	"// A function from Wavelength to ScaterringCoefficient.\n"
+	"#define ScatteringSpectrum vec3\n"
+	"\n"
+	"// A position in 3D (3 length values).\n"
+	"#define Position vec3\n"
+	"// A unit direction vector in 3D (3 unitless values).\n"
+	"#define Direction vec3\n"
+	"// A vector of 3 luminance values.\n"
+	"#define Luminance3 vec3\n"
+	"// A vector of 3 illuminance values.\n"
+	"#define Illuminance3 vec3\n"
+	"\n"
+	"/*\n"
+	"<p>Finally, we also need precomputed textures containing physical quantities in\n"
+	"each texel. Since we can't define custom sampler types to enforce the\n"
+	"homogeneity of expressions at compile time in GLSL, we define these texture\n"
+	"types as <code>sampler2D</code> and <code>sampler3D</code>, with preprocessor\n"
+	"macros. The full definitions are given in the\n"
+	"<a href=\"reference/definitions.h.html\">C++ equivalent</a> of this file).\n"
+	"*/\n"
+	"\n"
+	"#define TransmittanceTexture sampler2D\n"
+	"#define AbstractScatteringTexture sampler3D\n"
+	"#define ReducedScatteringTexture sampler3D\n"
+	"#define ScatteringTexture sampler3D\n"
+	"#define ScatteringDensityTexture sampler3D\n"
+	"#define IrradianceTexture sampler2D\n"
+	"\n"
+	"/*\n"
+	"<h3>Physical units</h3>\n"
+	"\n"
+	"<p>We can then define the units for our six base physical quantities:\n"
+	"meter (m), nanometer (nm), radian (rad), steradian (sr), watt (watt) and lumen\n"
+	"(lm):\n"
+	"*/\n"
+	"\n"
+	"const Length m = 1.0;\n"
+	"const Wavelength nm = 1.0;\n"
+	"const Angle rad = 1.0;\n"
+	"const SolidAngle sr = 1.0;\n"
+	"const Power watt = 1.0;\n"
+	"const LuminousPower lm = 1.0;\n"
+	"\n"
+	"/*\n"
+	"<p>From which we can derive the units for some derived physical quantities,\n"
+	"as well as some derived units (kilometer km, kilocandela kcd, degree deg):\n"
+	"*/\n"
+	"\n"
+	"const float PI = 3.14159265358979323846;\n"
+	"\n"
+	"const Length km = 1000.0 * m;\n"
+	"const Area m2 = m * m;\n"
+	"const Volume m3 = m * m * m;\n"
+	"const Angle pi = PI * rad;\n"
+	"const Angle deg = pi / 180.0;\n"
+	"const Irradiance watt_per_square_meter = watt / m2;\n"
+	"const Radiance watt_per_square_meter_per_sr = watt / (m2 * sr);\n"
+	"const SpectralIrradiance watt_per_square_meter_per_nm = watt / (m2 * nm);\n"
+	"const SpectralRadiance watt_per_square_meter_per_sr_per_nm =\n"
+	"    watt / (m2 * sr * nm);\n"
+	"const SpectralRadianceDensity watt_per_cubic_meter_per_sr_per_nm =\n"
+	"    watt / (m3 * sr * nm);\n"
+	"const LuminousIntensity cd = lm / sr;\n"
+	"const LuminousIntensity kcd = 1000.0 * cd;\n"
+	"const Luminance cd_per_square_meter = cd / m2;\n"
+	"const Luminance kcd_per_square_meter = kcd / m2;\n"
+	"\n"
+	"/*\n"
+	"<h3>Atmosphere parameters</h3>\n"
+	"\n"
+	"<p>Using the above types, we can now define the parameters of our atmosphere\n"
+	"model:\n"
+	"*/\n"
+	"\n"
+	"struct AtmosphereParameters {\n"
+	"  // The solar irradiance at the top of the atmosphere.\n"
+	"  IrradianceSpectrum solar_irradiance;\n"
+	"  // The sun's angular radius.\n"
+	"  Angle sun_angular_radius;\n"
+	"  // The distance between the planet center and the bottom of the atmosphere.\n"
+	"  Length bottom_radius;\n"
+	"  // The distance between the planet center and the top of the atmosphere.\n"
+	"  Length top_radius;\n"
+	"  // The scale height of air molecules, meaning that their density is\n"
+	"  // proportional to exp(-h / rayleigh_scale_height), with h the altitude\n"
+	"  // (with the bottom of the atmosphere at altitude 0).\n"
+	"  Length rayleigh_scale_height;\n"
+	"  // The scattering coefficient of air molecules at the bottom of the\n"
+	"  // atmosphere, as a function of wavelength.\n"
+	"  ScatteringSpectrum rayleigh_scattering;\n"
+	"  // The scale height of aerosols, meaning that their density is proportional\n"
+	"  // to exp(-h / mie_scale_height), with h the altitude.\n"
+	"  Length mie_scale_height;\n"
+	"  // The scattering coefficient of aerosols at the bottom of the atmosphere,\n"
+	"  // as a function of wavelength.\n"
+	"  ScatteringSpectrum mie_scattering;\n"
+	"  // The extinction coefficient of aerosols at the bottom of the atmosphere,\n"
+	"  // as a function of wavelength.\n"
+	"  ScatteringSpectrum mie_extinction;\n"
+	"  // The asymetry parameter for the Cornette-Shanks phase function for the\n"
+	"  // aerosols.\n"
+	"  Number mie_phase_function_g;\n"
+	"  // The average albedo of the ground.\n"
+	"  DimensionlessSpectrum ground_albedo;\n"
+	"  // The cosine of the maximum Sun zenith angle for which atmospheric scattering\n"
+	"  // must be precomputed (for maximum precision, use the smallest Sun zenith\n"
+	"  // angle yielding negligible sky light radiance values. For instance, for the\n"
+	"  // Earth case, 102 degrees is a good choice - yielding mu_s_min = -0.2).\n"
+	"  Number mu_s_min;\n"
+	"};\n",
+};
+
+// functions.c
+const char* const kFile1Pieces[] = {
+	"\n"
+	"/*<h2>atmosphere/functions.glsl</h2>\n"
+	"\n"
+	"<p>This GLSL file contains the core functions that implement our atmosphere\n"
+	"model. It provides functions to compute the transmittance, the single scattering\n"
+	"and the second and higher orders of scattering, the ground irradiance, as well\n"
+	"as functions to store these in textures and to read them back. It uses physical\n"
+	"types and constants which are provided in two versions: a\n"
+	"<a href=\"definitions.glsl.html\">GLSL version</a> and a\n"
+	"<a href=\"reference/definitions.h.html\">C++ version</a>. This allows this file to\n"
+	"be compiled either with a GLSL compiler or with a C++ compiler (see the\n"
+	"<a href=\"../index.html\">Introduction</a>).\n"
+	"\n"
+	"<p>They use the following utility functions to avoid NaNs due to floating point\n"
+	"values slightly outside their theoretical bounds:\n"
+	"*/\n"
+	"\n"
+	"Number ClampCosine(Number mu) {\n"
+	"  return clamp(mu, Number(-1.0), Number(1.0));\n"
+	"}\n"
+	"\n"
+	"Length ClampDistance(Length d) {\n"
+	"  return max(d, 0.0 * m);\n"
+	"}\n"
+	"\n"
+	"Length ClampRadius(IN(AtmosphereParameters) atmosphere, Length r) {\n"
+	"  return clamp(r, atmosphere.bottom_radius, atmosphere.top_radius);\n"
+	"}\n"
+	"\n"
+	"Length SafeSqrt(Area a) {\n"
+	"  return sqrt(max(a, 0.0 * m2));\n"
+	"}\n"
+	"\n"
+	"/*\n"
+	"<h3 id=\"transmittance\">Transmittance</h3>\n"
+	"\n"
+	"<p>As the light travels from a point $\\bp$ to a point $\\bq$ in the atmosphere,\n"
+	"it is partially absorbed and scattered out of its initial direction because of\n"
+	"the air molecules and the aerosol particles. Thus, the light arriving at $\\bq$\n"
+	"is only a fraction of the light from $\\bp$, and this fraction, which depends on\n"
+	"wavelength, is called the\n"
+	"<a href=\"https://en.wikipedia.org/wiki/Transmittance\">transmittance</a>. The\n"
+	"following sections describe how we compute it, how we store it in a precomputed\n"
+	"texture, and how we read it back.\n"
+	"\n"
+	"<h4 id=\"transmittance_computation\">Computation</h4>\n"
+	"\n"
+	"<p>For 3 aligned points $\\bp$, $\\bq$ and $\\br$ inside the atmosphere, in this\n"
+	"order, the transmittance between $\\bp$ and $\\br$ is the product of the\n"
+	"transmittance between $\\bp$ and $\\bq$ and between $\\bq$ and $\\br$. In\n"
+	"particular, the transmittance between $\\bp$ and $\\bq$ is the transmittance\n"
+	"between $\\bp$ and the nearest intersection $\\bi$ of the half-line $[\\bp,\\bq)$\n"
+	"with the top or bottom atmosphere boundary, divided by the transmittance between\n"
+	"$\\bq$ and $\\bi$ (or 0 if the segment $[\\bp,\\bq]$ intersects the ground):\n"
+	"\n"
+	"\n"
+	"<p>Also, the transmittance between $\\bp$ and $\\bq$ and between $\\bq$ and $\\bp$\n"
+	"are the same. Thus, to compute the transmittance between arbitrary points, it\n"
+	"is sufficient to know the transmittance between a point $\\bp$ in the atmosphere,\n"
+	"and points $\\bi$ on the top atmosphere boundary. This transmittance depends on\n"
+	"only two parameters, which can be taken as the radius $r=\\Vert\\bo\\bp\\Vert$ and\n"
+	"the cosine of the \"view zenith angle\",\n"
+	"$\\mu=\\bo\\bp\\cdot\\bp\\bi/\\Vert\\bo\\bp\\Vert\\Vert\\bp\\bi\\Vert$. To compute it, we\n"
+	"first need to compute the length $\\Vert\\bp\\bi\\Vert$, and we need to know when\n"
+	"the segment $[\\bp,\\bi]$ intersects the ground.\n"
+	"*/\n"
+	"\n"
+	"Length DistanceToTopAtmosphereBoundary(IN(AtmosphereParameters) atmosphere,\n"
+	"    Length r, Number mu) {\n"
+	"  assert(r <= atmosphere.top_radius);\n"
+	"  assert(mu >= -1.0 && mu <= 1.0);\n"
+	"  Area discriminant = r * r * (mu * mu - 1.0) +\n"
+	"      atmosphere.top_radius * atmosphere.top_radius;\n"
+	"  return ClampDistance(-r * mu + SafeSqrt(discriminant));\n"
+	"}\n"
+	"\n"
+	"/*\n"
+	"<p>We will also need, in the other sections, the distance to the bottom\n"
+	"atmosphere boundary, which can be computed in a similar way (this code assumes\n"
+	"that $[\\bp,\\bi)$ intersects the ground):\n"
+	"*/\n"
+	"\n"
+	"Length DistanceToBottomAtmosphereBoundary(IN(AtmosphereParameters) atmosphere,\n"
+	"    Length r, Number mu) {\n"
+	"  assert(r >= atmosphere.bottom_radius);\n"
+	"  assert(mu >= -1.0 && mu <= 1.0);\n"
+	"  Area discriminant = r * r * (mu * mu - 1.0) +\n"
+	"      atmosphere.bottom_radius * atmosphere.bottom_radius;\n"
+	"  return ClampDistance(-r * mu - SafeSqrt(discriminant));\n"
+	"}\n"
+	"\n"
+	"/*\n"
+	"<h5>Intersections with the ground</h5>\n"
+	"\n"
+	"<p>The segment $[\\bp,\\bi]$ intersects the ground when\n"
+	"$d^2+2r\\mu d+r^2=r_{\\mathrm{bottom}}^2$ has a solution with $d \\ge 0$. This\n"
+	"requires the discriminant $r^2(\\mu^2-1)+r_{\\mathrm{bottom}}^2$ to be positive,\n"
+	"from which we deduce the following function:\n"
+	"*/\n"
+	"\n"
+	"bool RayIntersectsGround(IN(AtmosphereParameters) atmosphere,\n"
+	"    Length r, Number mu) {\n"
+	"  assert(r >= atmosphere.bottom_radius);\n"
+	"  assert(mu >= -1.0 && mu <= 1.0);\n"
+	"  return mu < 0.0 && r * r * (mu * mu - 1.0) +\n"
+	"      atmosphere.bottom_radius * atmosphere.bottom_radius >= 0.0 * m2;\n"
+	"}\n"
+	"\n"
+	"/*\n"
+	"<h5>Transmittance to the top atmosphere boundary</h5>\n"
+	"\n"
+	"<p>We can now compute the transmittance between $\\bp$ and $\\bi$. From its\n"
+	"definition and the\n"
+	"<a href=\"https://en.wikipedia.org/wiki/Beer-Lambert_law\">Beer-Lambert law</a>,\n"
+	"this involves the integral of the number density of air molecules along the\n"
+	"segment $[\\bp,\\bi]$, as well as the integral of the number density of aerosols\n"
+	"along this segment. Both integrals have the same form and, when the segment\n"
+	"$[\\bp,\\bi]$ does not intersect the ground, they can be computed numerically with\n"
+	"the help of the following auxilliary function (using the <a href=\n"
+	"\"https://en.wikipedia.org/wiki/Trapezoidal_rule\">trapezoidal rule</a>):\n"
+	"*/\n"
+	"\n"
+	"Length ComputeOpticalLengthToTopAtmosphereBoundary(\n"
+	"    IN(AtmosphereParameters) atmosphere, Length scale_height,\n"
+	"    Length r, Number mu) {\n"
+	"  assert(r >= atmosphere.bottom_radius && r <= atmosphere.top_radius);\n"
+	"  assert(mu >= -1.0 && mu <= 1.0);\n"
+	"  // Number of intervals for the numerical integration.\n"
+	"  const int SAMPLE_COUNT = 500;\n"
+	"  // The integration step, i.e. the length of each integration interval.\n"
+	"  Length dx =\n"
+	"      DistanceToTopAtmosphereBoundary(atmosphere, r, mu) / Number(SAMPLE_COUNT);\n"
+	"  // Integration loop.\n"
+	"  Length result = 0.0 * m;\n"
+	"  for (int i = 0; i <= SAMPLE_COUNT; ++i) {\n"
+	"    Length d_i = Number(i) * dx;\n"
+	"    // Distance between the current sample point and the planet center.\n"
+	"    Length r_i = sqrt(d_i * d_i + 2.0 * r * mu * d_i + r * r);\n"
+	"    // Number density at the current sample point (divided by the number density\n"
+	"    // at the bottom of the atmosphere, yielding a dimensionless number).\n"
+	"    Number y_i = exp(-(r_i - atmosphere.bottom_radius) / scale_height);\n"
+	"    // Sample weight (from the trapezoidal rule).\n"
+	"    Number weight_i = i == 0 || i == SAMPLE_COUNT \? 0.5 : 1.0;\n"
+	"    result += y_i * weight_i * dx;\n"
+	"  }\n"
+	"  return result;\n"
+	"}\n"
+	"\n"
+	"/*\n"
+	"<p>With this function the transmittance between $\\bp$ and $\\bi$ is now easy to\n"
+	"compute (we continue to assume that the segment does not intersect the ground):\n"
+	"*/\n"
+	"\n"
+	"DimensionlessSpectrum ComputeTransmittanceToTopAtmosphereBoundary(\n"
+	"    IN(AtmosphereParameters) atmosphere, Length r, Number mu) {\n"
+	"  assert(r >= atmosphere.bottom_radius && r <= atmosphere.top_radius);\n"
+	"  assert(mu >= -1.0 && mu <= 1.0);\n"
+	"  return exp(-(\n"
+	"      atmosphere.rayleigh_scattering *\n"
+	"          ComputeOpticalLengthToTopAtmosphereBoundary(\n"
+	"              atmosphere, atmosphere.rayleigh_scale_height, r, mu) +\n"
+	"      atmosphere.mie_extinction *\n"
+	"          ComputeOpticalLengthToTopAtmosphereBoundary(\n"
+	"              atmosphere, atmosphere.mie_scale_height, r, mu)));\n"
+	"}\n"
+	"\n"
+	"/*\n"
+	"<h4 id=\"transmittance_precomputation\">Precomputation</h4>\n"
+	"\n"
+	"<p>The above function is quite costly to evaluate, and a lot of evaluations are\n"
+	"needed to compute single and multiple scattering. Fortunately this function\n"
+	"depends on only two parameters and is quite smooth, so we can precompute it in a\n"
+	"small 2D texture to optimize its evaluation.\n"
+	"\n"
+	"<p>For this we need a mapping between the function parameters $(r,\\mu)$ and the\n"
+	"texture coordinates $(u,v)$, and vice-versa, because these parameters do not\n"
+	"have the same units and range of values. And even if it was the case, storing a\n"
+	"function $f$ from the $[0,1]$ interval in a texture of size $n$ would sample the\n"
+	"function at $0.5/n$, $1.5/n$, ... $(n-0.5)/n$, because texture samples are at\n"
+	"the center of texels. Therefore, this texture would only give us extrapolated\n"
+	"function values at the domain boundaries ($0$ and $1$). To avoid this we need\n"
+	"to store $f(0)$ at the center of texel 0 and $f(1)$ at the center of texel\n"
+	"$n-1$. This can be done with the following mapping from values $x$ in $[0,1]$ to\n"
+	"texture coordinates $u$ in $[0.5/n,1-0.5/n]$ - and its inverse:\n"
+	"*/\n"
+	"\n"
+	"Number GetTextureCoordFromUnitRange(Number x, int texture_size) {\n"
+	"  return 0.5 / Number(texture_size) + x * (1.0 - 1.0 / Number(texture_size));\n"
+	"}\n"
+	"\n"
+	"Number GetUnitRangeFromTextureCoord(Number u, int texture_size) {\n"
+	"  return (u - 0.5 / Number(texture_size)) / (1.0 - 1.0 / Number(texture_size));\n"
+	"}\n"
+	"\n"
+	"/*\n"
+	"<p>Using these functions, we can now define a mapping between $(r,\\mu)$ and the\n"
+	"texture coordinates $(u,v)$, and its inverse, which avoid any extrapolation\n"
+	"during texture lookups. In the <a href=\n"
+	"\"http://evasion.inrialpes.fr/~Eric.Bruneton/PrecomputedAtmosphericScattering2.zip\"\n"
+	">original implementation</a> this mapping was using some ad-hoc constants chosen\n"
+	"for the Earth atmosphere case. Here we use a generic mapping, working for any\n"
+	"atmosphere, but still providing an increased sampling rate near the horizon.\n"
+	"Our improved mapping is based on the parameterization described in our\n"
+	"<a href=\"https://hal.inria.fr/inria-00288758/en\">paper</a> for the 4D textures:\n"
+	"we use the same mapping for $r$, and a slightly improved mapping for $\\mu$\n"
+	"(considering only the case where the view ray does not intersect the ground).\n"
+	"More precisely, we map $\\mu$ to a value $x_{\\mu}$ between 0 and 1 by considering\n"
+	"the distance $d$ to the top atmosphere boundary, compared to its minimum and\n"
+	"maximum values $d_{\\mathrm{min}}=r_{\\mathrm{top}}-r$ and\n"
+	"$d_{\\mathrm{max}}=\\rho+H$ (cf. the notations from the\n"
+	"<a href=\"https://hal.inria.fr/inria-00288758/en\">paper</a> and the figure\n"
+	"below):\n"
+	"\n"
+	"<svg width=\"505px\" height=\"195px\">\n"
+	"  <style type=\"text/css\"><![CDATA[\n"
+	"    circle { fill: #000000; stroke: none; }\n"
+	"    path { fill: none; stroke: #000000; }\n"
+	"    text { font-size: 16px; font-style: normal; font-family: Sans; }\n"
+	"    .vector { font-weight: bold; }\n"
+	"  ]]></style>\n"
+	"  <path d=\"m 5,85 a 520,520 0 0 1 372,105\"/>\n"
+	"  <path d=\"m 5,5 a 600,600 0 0 1 490,185\"/>\n"
+	"  <path d=\"m 60,0 0,190\"/>\n"
+	"  <path d=\"m 60,65 180,-35\"/>\n"
+	"  <path d=\"m 55,5 5,-5 5,5\"/>\n"
+	"  <path d=\"m 55,60 5,5 5,-5\"/>\n"
+	"  <path d=\"m 55,70 5,-5 5,5\"/>\n"
+	"  <path d=\"m 60,40 a 25,25 0 0 1 25,20\" style=\"stroke-dasharray:4,2;\"/>\n"
+	"  <path d=\"m 60,65 415,105\"/>\n"
+	"  <circle cx=\"60\" cy=\"65\" r=\"2.5\"/>\n"
+	"  <circle cx=\"240\" cy=\"30\" r=\"2.5\"/>\n"
+	"  <circle cx=\"180\" cy=\"95\" r=\"2.5\"/>\n"
+	"  <circle cx=\"475\" cy=\"170\" r=\"2.5\"/>\n"
+	"  <text x=\"20\" y=\"40\">d<tspan style=\"font-size:10px\" dy=\"2\">min</tspan></text>\n"
+	"  <text x=\"35\" y=\"70\" class=\"vector\">p</text>\n"
+	"  <text x=\"35\" y=\"125\">r</text>\n"
+	"  <text x=\"75\" y=\"40\">\316\274=cos(\316\270)</text>\n"
+	"  <text x=\"120\" y=\"75\">\317\201</text>\n"
+	"  <text x=\"155\" y=\"60\">d</text>\n"
+	"  <text x=\"315\" y=\"125\">H</text>\n"
+	"</svg>\n"
+	"\n"
+	"<p>With these definitions, the mapping from $(r,\\mu)$ to the texture coordinates\n"
+	"$(u,v)$ can be implemented as follows:\n"
+	"*/\n"
+	"\n"
+	"vec2 GetTransmittanceTextureUvFromRMu(IN(AtmosphereParameters) atmosphere,\n"
+	"    Length r, Number mu) {\n"
+	"  assert(r >= atmosphere.bottom_radius && r <= atmosphere.top_radius);\n"
+	"  assert(mu >= -1.0 && mu <= 1.0);\n"
+	"  // Distance to top atmosphere boundary for a horizontal ray at ground level.\n"
+	"  Length H = sqrt(atmosphere.top_radius * atmosphere.top_radius -\n"
+	"      atmosphere.bottom_radius * atmosphere.bottom_radius);\n"
+	"  // Distance to the horizon.\n"
+	"  Length rho =\n"
+	"      SafeSqrt(r * r - atmosphere.bottom_radius * atmosphere.bottom_radius);\n"
+	"  // Distance to the top atmosphere boundary for the ray (r,mu), and its minimum\n"
+	"  // and maximum values over all mu - obtained for (r,1) and (r,mu_horizon).\n"
+	"  Length d = DistanceToTopAtmosphereBoundary(atmosphere, r, mu);\n"
+	"  Length d_min = atmosphere.top_radius - r;\n"
+	"  Length d_max = rho + H;\n"
+	"  Number x_mu = (d - d_min) / (d_max - d_min);\n"
+	"  Number x_r = rho / H;\n"
+	"  return vec2(GetTextureCoordFromUnitRange(x_mu, TRANSMITTANCE_TEXTURE_WIDTH),\n"
+	"              GetTextureCoordFromUnitRange(x_r, TRANSMITTANCE_TEXTURE_HEIGHT));\n"
+	"}\n"
+	"\n"
+	"/*\n"
+	"<p>and the inverse mapping follows immediately:\n"
+	"*/\n"
+	"\n"
+	"void GetRMuFromTransmittanceTextureUv(IN(AtmosphereParameters) atmosphere,\n"
+	"    IN(vec2) uv, OUT(Length) r, OUT(Number) mu) {\n"
+	"  assert(uv.x >= 0.0 && uv.x <= 1.0);\n"
+	"  assert(uv.y >= 0.0 && uv.y <= 1.0);\n"
+	"  Number x_mu = GetUnitRangeFromTextureCoord(uv.x, TRANSMITTANCE_TEXTURE_WIDTH);\n"
+	"  Number x_r = GetUnitRangeFromTextureCoord(uv.y, TRANSMITTANCE_TEXTURE_HEIGHT);\n"
+	"  // Distance to top atmosphere boundary for a horizontal ray at ground level.\n"
+	"  Length H = sqrt(atmosphere.top_radius * atmosphere.top_radius -\n"
+	"      atmosphere.bottom_radius * atmosphere.bottom_radius);\n"
+	"  // Distance to the horizon, from which we can compute r:\n"
+	"  Length rho = H * x_r;\n"
+	"  r = sqrt(rho * rho + atmosphere.bottom_radius * atmosphere.bottom_radius);\n"
+	"  // Distance to the top atmosphere boundary for the ray (r,mu), and its minimum\n"
+	"  // and maximum values over all mu - obtained for (r,1) and (r,mu_horizon) -\n"
+	"  // from which we can recover mu:\n"
+	"  Length d_min = atmosphere.top_radius - r;\n"
+	"  Length d_max = rho + H;\n"
+	"  Length d = d_min + x_mu * (d_max - d_min);\n"
+	"  mu = d == 0.0 * m \? Number(1.0) : (H * H - rho * rho - d * d) / (2.0 * r * d);\n"
+	"  mu = ClampCosine(mu);\n"
+	"}\n"
+	"\n"
+	"/*\n"
+	"<p>It is now easy to define a fragment shader function to precompute a texel of\n"
+	"the transmittance texture:\n"
+	"*/\n"
+	"\n"
+	"DimensionlessSpectrum ComputeTransmittanceToTopAtmosphereBoundaryTexture(\n"
+	"    IN(AtmosphereParameters) atmosphere, IN(vec2) frag_coord) {\n"
+	"  const vec2 TRANSMITTANCE_TEXTURE_SIZE =\n"
+	"      vec2(TRANSMITTANCE_TEXTURE_WIDTH, TRANSMITTANCE_TEXTURE_HEIGHT);\n"
+	"  Length r;\n"
+	"  Number mu;\n"
+	"  GetRMuFromTransmittanceTextureUv(\n"
+	"      atmosphere, frag_coord / TRANSMITTANCE_TEXTURE_SIZE, r, mu);\n"
+	"  return ComputeTransmittanceToTopAtmosphereBoundary(atmosphere, r, mu);\n"
+	"}\n"
+	"\n"
+	"/*\n"
+	"<h4 id=\"transmittance_lookup\">Lookup</h4>\n"
+	"\n"
+	"<p>With the help of the above precomputed texture, we can now get the\n"
+	"transmittance between a point and the top atmosphere boundary with a single\n"
+	"texture lookup (assuming there is no intersection with the ground):\n"
+	"*/\n"
+	"\n"
+	"DimensionlessSpectrum GetTransmittanceToTopAtmosphereBoundary(\n"
+	"    IN(AtmosphereParameters) atmosphere,\n"
+	"    IN(TransmittanceTexture) transmittance_texture,\n"
+	"    Length r, Number mu) {\n"
+	"  assert(r >= atmosphere.bottom_radius && r <= atmosphere.top_radius);\n"
+	"  vec2 uv = GetTransmittanceTextureUvFromRMu(atmosphere, r, mu);\n"
+	"  return DimensionlessSpectrum(texture(transmittance_texture, uv));\n"
+	"}\n"
+	"\n"
+	"/*\n"
+	"<p>Also, with $r_d=\\Vert\\bo\\bq\\Vert=\\sqrt{d^2+2r\\mu d+r^2}$ and $\\mu_d=\n"
+	"\\bo\\bq\\cdot\\bp\\bi/\\Vert\\bo\\bq\\Vert\\Vert\\bp\\bi\\Vert=(r\\mu+d)/r_d$ the values of\n"
+	"$r$ and $\\mu$ at $\\bq$, we can get the transmittance between two arbitrary\n"
+	"points $\\bp$ and $\\bq$ inside the atmosphere with only two texture lookups\n"
+	"(recall that the transmittance between $\\bp$ and $\\bq$ is the transmittance\n"
+	"between $\\bp$ and the top atmosphere boundary, divided by the transmittance\n"
+	"between $\\bq$ and the top atmosphere boundary, or the reverse - we continue to\n"
+	"assume that the segment between the two points does not intersect the ground):\n"
+	"*/\n"
+	"\n"
+	"DimensionlessSpectrum GetTransmittance(\n"
+	"    IN(AtmosphereParameters) atmosphere,\n"
+	"    IN(TransmittanceTexture) transmittance_texture,\n"
+	"    Length r, Number mu, Length d, bool ray_r_mu_intersects_ground) {\n"
+	"  assert(r >= atmosphere.bottom_radius && r <= atmosphere.top_radius);\n"
+	"  assert(mu >= -1.0 && mu <= 1.0);\n"
+	"  assert(d >= 0.0 * m);\n"
+	"\n"
+	"  Length r_d = ClampRadius(atmosphere, sqrt(d * d + 2.0 * r * mu * d + r * r));\n"
+	"  Number mu_d = ClampCosine((r * mu + d) / r_d);\n"
+	"\n"
+	"  if (ray_r_mu_intersects_ground) {\n"
+	"    return min(\n"
+	"        GetTransmittanceToTopAtmosphereBoundary(\n"
+	"            atmosphere, transmittance_texture, r_d, -mu_d) /\n"
+	"        GetTransmittanceToTopAtmosphereBoundary(\n"
+	"            atmosphere, transmittance_texture, r, -mu),\n"
+	"        DimensionlessSpectrum(1.0));\n"
+	"  } else {\n"
+	"    return min(\n"
+	"        GetTransmittanceToTopAtmosphereBoundary(\n"
+	"            atmosphere, transmittance_texture, r, mu) /\n"
+	"        GetTransmittanceToTopAtmosphereBoundary(\n"
+	"            atmosphere, transmittance_texture, r_d, mu_d),\n"
+	"        DimensionlessSpectrum(1.0));\n"
+	"  }\n"
+	"}\n"
+	"\n"
+	"/*\n"
+	"<p>where <code>ray_r_mu_intersects_ground</code> should be true iif the ray\n"
+	"defined by $r$ and $\\mu$ intersects the ground. We don't compute it here with\n"
+	"<code>RayIntersectsGround</code> because the result could be wrong for rays\n"
+	"very close to the horizon, due to the finite precision and rounding errors of\n"
+	"floating point operations. And also because the caller generally has more robust\n"
+	"ways to know whether a ray intersects the ground or not (see below).\n"
+	"\n"
+	"<h3 id=\"single_scattering\">Single scattering</h3>\n"
+	"\n"
+	"<p>The single scattered radiance is the light arriving from the Sun at some\n"
+	"point after exactly one scattering event inside the atmosphere (which can be due\n"
+	"to air molecules or aerosol particles; we exclude reflections from the ground,\n"
+	"computed <a href=\"#irradiance\">separately</a>). The following sections describe\n"
+	"how we compute it, how we store it in a precomputed texture, and how we read it\n"
+	"back.\n"
+	"\n"
+	"<h4 id=\"single_scattering_computation\">Computation</h4>\n"
+	"\n"
+	"<p>Consider the Sun light scattered at a point $\\bq$ by air molecules before\n"
+	"arriving at another point $\\bp$ (for aerosols, replace \"Rayleigh\" with \"Mie\"\n"
+	"below):\n"
+	"\n"
+	"<svg height=\"190px\" width=\"340px\">\n"
+	"  <style type=\"text/css\"><![CDATA[\n"
+	"    circle { fill: #000000; stroke: none; }\n"
+	"    path { fill: none; stroke: #000000; }\n"
+	"    text { font-size: 16px; font-style: normal; font-family: Sans; }\n"
+	"    .vector { font-weight: bold; }\n"
+	"  ]]></style>\n"
+	"  <path d=\"m 0,66 a 600,600 0 0 1 340,0\"/>\n"
+	"  <path d=\"m 0,150 a 520,520 0 0 1 340,0\"/>\n"
+	"  <path d=\"m 170,180 0,-165\"/>\n"
+	"  <path d=\"m 250,180 30,-165\"/>\n"
+	"  <path d=\"m 170,90 -30,-60\"/>\n"
+	"  <path d=\"m 155,70 0,-10 8,6\" />\n"
+	"  <path d=\"m 270,70 -20,-40\" style=\"stroke-width:2;\"/>\n"
+	"  <path d=\"m 170,90 100,-20\" style=\"stroke-width:2;\"/>\n"
+	"  <path d=\"m 270,70 75,-15\" />\n"
+	"  <path d=\"m 170,65 a 25,25 0 0 1 25,20\" style=\"stroke-dasharray:4,2;\"/>\n"
+	"  <path d=\"m 170,30 a 60,60 1 0 0 -26.8,6.3\" style=\"stroke-dasharray:4,2;\"/>\n"
+	"  <path d=\"m 255,40 a 35,35 0 0 1 21,-3.2\" style=\"stroke-dasharray:4,2;\"/>\n"
+	"  <path d=\"m 258,45 a 30,30 0 0 1 41,19\" style=\"stroke-dasharray:4,2;\"/>\n"
+	"  <circle cx=\"170\" cy=\"90\" r=\"2.5\"/>\n"
+	"  <circle cx=\"270\" cy=\"70\" r=\"2.5\"/>\n"
+	"  <text x=\"155\" y=\"105\" class=\"vector\">p</text>\n"
+	"  <text x=\"275\" y=\"85\" class=\"vector\">q</text>\n"
+	"  <text x=\"130\" y=\"70\" class=\"vector\">\317\211<tspan\n"
+	"      dy=\"2\" style=\"font-size:10px;font-weight:normal;\">s</tspan></text>\n"
+	"  <text x=\"155\" y=\"164\">r</text>\n"
+	"  <text x=\"265\" y=\"165\">r<tspan dy=\"2\" style=\"font-size:10px\">d</tspan></text>\n"
+	"  <text x=\"220\" y=\"95\">d</text>\n"
+	"  <text x=\"190\" y=\"65\">\316\274</text>\n"
+	"  <text x=\"145\" y=\"25\">\316\274<tspan dy=\"2\" style=\"font-size:10px\">s</tspan></text>\n"
+	"  <text x=\"290\" y=\"45\">\316\275</text>\n"
+	"  <text x=\"250\" y=\"20\">\316\274<tspan dy=\"2\" style=\"font-size:10px\">s,d</tspan></text>\n"
+	"</svg>\n"
+	"\n"
+	"<p>The radiance arriving at $\\bp$ is the product of:\n"
+	"<ul>\n"
+	"<li>the solar irradiance at the top of the atmosphere,</li>\n"
+	"<li>the transmittance between the top of the atmosphere and $\\bq$ (i.e. the\n"
+	"fraction of the light at the top of the atmosphere that reaches $\\bq$),</li>\n"
+	"<li>the Rayleigh scattering coefficient at $\\bq$ (i.e. the fraction of the\n"
+	"light arriving at $\\bq$ which is scattered, in any direction),</li>\n"
+	"<li>the Rayleigh phase function (i.e. the fraction of the scattered light at\n"
+	"$\\bq$ which is actually scattered towards $\\bp$),</li>\n"
+	"<li>the transmittance between $\\bq$ and $\\bp$ (i.e. the fraction of the light\n"
+	"scattered at $\\bq$ towards $\\bp$ that reaches $\\bp$).</li>\n"
+	"</ul>\n"
+	"\n"
+	"<p>Thus, by noting $\\bw_s$ the unit direction vector towards the Sun, and with\n"
+	"the following definitions:\n"
+	"<ul>\n"
+	"<li>$r=\\Vert\\bo\\bp\\Vert$,</li>\n"
+	"<li>$d=\\Vert\\bp\\bq\\Vert$,</li>\n"
+	"<li>$\\mu=(\\bo\\bp\\cdot\\bp\\bq)/rd$,</li>\n"
+	"<li>$\\mu_s=(\\bo\\bp\\cdot\\bw_s)/r$,</li>\n"
+	"<li>$\\nu=(\\bp\\bq\\cdot\\bw_s)/d$</li>\n"
+	"</ul>\n"
+	"the values of $r$ and $\\mu_s$ for $\\bq$ are\n"
+	"<ul>\n"
+	"<li>$r_d=\\Vert\\bo\\bq\\Vert=\\sqrt{d^2+2r\\mu d +r^2}$,</li>\n"
+	"<li>$\\mu_{s,d}=(\\bo\\bq\\cdot\\bw_s)/r_d=((\\bo\\bp+\\bp\\bq)\\cdot\\bw_s)/r_d=\n"
+	"(r\\mu_s + d\\nu)/r_d$</li>\n"
+	"</ul>\n"
+	"and the Rayleigh and Mie single scattering components can be computed as follows\n"
+	"(note that we omit the solar irradiance and the phase function terms, as well as\n"
+	"the scattering coefficients at the bottom of the atmosphere - we add them later\n"
+	"on for efficiency reasons):\n"
+	"*/\n"
+	"\n"
+	"void ComputeSingleScatteringIntegrand(\n"
+	"    IN(AtmosphereParameters) atmosphere,\n"
+	"    IN(TransmittanceTexture) transmittance_texture,\n"
+	"    Length r, Number mu, Number mu_s, Number nu, Length d,\n"
+	"    bool ray_r_mu_intersects_ground,\n"
+	"    OUT(DimensionlessSpectrum) rayleigh, OUT(DimensionlessSpectrum) mie) \n"
+	"{\n"
+	"  Length r_d = ClampRadius(atmosphere, sqrt(d * d + 2.0 * r * mu * d + r * r));\n"
+	"  Number mu_s_d = ClampCosine((r * mu_s + d * nu) / r_d);\n"
+	"\n"
+	"  if (RayIntersectsGround(atmosphere, r_d, mu_s_d)) {\n"
+	"    rayleigh = DimensionlessSpectrum(0.0);\n"
+	"    mie = DimensionlessSpectrum(0.0);\n"
+	"  } else {\n"
+	"    DimensionlessSpectrum transmittance =\n"
+	"        GetTransmittance(\n"
+	"            atmosphere, transmittance_texture, r, mu, d,\n"
+	"            ray_r_mu_intersects_ground) *\n"
+	"        GetTransmittanceToTopAtmosphereBoundary(\n"
+	"            atmosphere, transmittance_texture, r_d, mu_s_d);\n"
+	"    rayleigh = transmittance * exp(\n"
+	"        -(r_d - atmosphere.bottom_radius) / atmosphere.rayleigh_scale_height);\n"
+	"    mie = transmittance * exp(\n"
+	"        -(r_d - atmosphere.bottom_radius) / atmosphere.mie_scale_height);\n"
+	"  }\n"
+	"}\n"
+	"\n"
+	"/*\n"
+	"<p>Consider now the Sun light arriving at $\\bp$ from a given direction $\\bw$,\n"
+	"after exactly one scattering event. The scattering event can occur at any point\n"
+	"$\\bq$ between $\\bp$ and the intersection $\\bi$ of the half-line $[\\bp,\\bw)$ with\n"
+	"the nearest atmosphere boundary. Thus, the single scattered radiance at $\\bp$\n"
+	"from direction $\\bw$ is the integral of the single scattered radiance from $\\bq$\n"
+	"to $\\bp$ for all points $\\bq$ between $\\bp$ and $\\bi$. To compute it, we first\n"
+	"need the length $\\Vert\\bp\\bi\\Vert$:\n"
+	"*/\n"
+	"\n"
+	"Length DistanceToNearestAtmosphereBoundary(IN(AtmosphereParameters) atmosphere,\n"
+	"    Length r, Number mu, bool ray_r_mu_intersects_ground) {\n"
+	"  if (ray_r_mu_intersects_ground) {\n"
+	"    return DistanceToBottomAtmosphereBoundary(atmosphere, r, mu);\n"
+	"  } else {\n"
+	"    return DistanceToTopAtmosphereBoundary(atmosphere, r, mu);\n"
+	"  }\n"
+	"}\n"
+	"\n"
+	"/*\n"
+	"<p>The single scattering integral can then be computed as follows (using\n"
+	"the <a href=\"https://en.wikipedia.org/wiki/Trapezoidal_rule\">trapezoidal\n"
+	"rule</a>):\n"
+	"*/\n"
+	"\n"
+	"void ComputeSingleScattering(\n"
+	"    IN(AtmosphereParameters) atmosphere,\n"
+	"    IN(TransmittanceTexture) transmittance_texture,\n"
+	"    Length r, Number mu, Number mu_s, Number nu,\n"
+	"    bool ray_r_mu_intersects_ground,\n"
+	"    OUT(IrradianceSpectrum) rayleigh, OUT(IrradianceSpectrum) mie) {\n"
+	"  assert(r >= atmosphere.bottom_radius && r <= atmosphere.top_radius);\n"
+	"  assert(mu >= -1.0 && mu <= 1.0);\n"
+	"  assert(mu_s >= -1.0 && mu_s <= 1.0);\n"
+	"  assert(nu >= -1.0 && nu <= 1.0);\n"
+	"\n"
+	"  // Number of intervals for the numerical integration.\n"
+	"  const int SAMPLE_COUNT = 50;\n"
+	"  // The integration step, i.e. the length of each integration interval.\n"
+	"  Length dx =\n"
+	"      DistanceToNearestAtmosphereBoundary(atmosphere, r, mu,\n"
+	"          ray_r_mu_intersects_ground) / Number(SAMPLE_COUNT);\n"
+	"  // Integration loop.\n"
+	"  DimensionlessSpectrum rayleigh_sum = DimensionlessSpectrum(0.0);\n"
+	"  DimensionlessSpectrum mie_sum = DimensionlessSpectrum(0.0);\n"
+	"  for (int i = 0; i <= SAMPLE_COUNT; ++i) {\n"
+	"    Length d_i = Number(i) * dx;\n"
+	"    // The Rayleigh and Mie single scattering at the current sample point.\n"
+	"    DimensionlessSpectrum rayleigh_i;\n"
+	"    DimensionlessSpectrum mie_i;\n"
+	"    ComputeSingleScatteringIntegrand(atmosphere, transmittance_texture,\n"
+	"        r, mu, mu_s, nu, d_i, ray_r_mu_intersects_ground, rayleigh_i, mie_i);\n"
+	"    // Sample weight (from the trapezoidal rule).\n"
+	"    Number weight_i = (i == 0 || i == SAMPLE_COUNT) \? 0.5 : 1.0;\n"
+	"    rayleigh_sum += rayleigh_i * weight_i;\n"
+	"    mie_sum += mie_i * weight_i;\n"
+	"  }\n"
+	"  rayleigh = rayleigh_sum * dx * atmosphere.solar_irradiance *\n"
+	"      atmosphere.rayleigh_scattering;\n"
+	"  mie = mie_sum * dx * atmosphere.solar_irradiance * atmosphere.mie_scattering;\n"
+	"}\n"
+	"\n"
+	"/*\n"
+	"<p>Note that we added the solar irradiance and the scattering coefficient terms\n"
+	"that we omitted in <code>ComputeSingleScatteringIntegrand</code>, but not the\n"
+	"phase function terms - they are added at <a href=\"#rendering\">render time</a>\n"
+	"for better angular precision. We provide them here for completeness:\n"
+	"*/\n"
+	"\n"
+	"InverseSolidAngle RayleighPhaseFunction(Number nu) {\n"
+	"  InverseSolidAngle k = 3.0 / (16.0 * PI * sr);\n"
+	"  return k * (1.0 + nu * nu);\n"
+	"}\n"
+	"\n"
+	"InverseSolidAngle MiePhaseFunction(Number g, Number nu) {\n"
+	"  InverseSolidAngle k = 3.0 / (8.0 * PI * sr) * (1.0 - g * g) / (2.0 + g * g);\n"
+	"  return k * (1.0 + nu * nu) / pow(1.0 + g * g - 2.0 * g * nu, 1.5);\n"
+	"}\n"
+	"\n"
+	"/*\n"
+	"<h4 id=\"single_scattering_precomputation\">Precomputation</h4>\n"
+	"\n"
+	"<p>The <code>ComputeSingleScattering</code> function is quite costly to\n"
+	"evaluate, and a lot of evaluations are needed to compute multiple scattering.\n"
+	"We therefore want to precompute it in a texture, which requires a mapping from\n"
+	"the 4 function parameters to texture coordinates. Assuming for now that we have\n"
+	"4D textures, we need to define a mapping from $(r,\\mu,\\mu_s,\\nu)$ to texture\n"
+	"coordinates $(u,v,w,z)$. The function below implements the mapping defined in\n"
+	"our <a href=\"https://hal.inria.fr/inria-00288758/en\">paper</a>, with some small\n"
+	"improvements (refer to the paper and to the above figures for the notations):\n"
+	"<ul>\n"
+	"<li>the mapping for $\\mu$ takes the minimal distance to the nearest atmosphere\n"
+	"boundary into account, to map $\\mu$ to the full $[0,1]$ interval (the original\n"
+	"mapping was not covering the full $[0,1]$ interval).</li>\n"
+	"<li>the mapping for $\\mu_s$ is more generic than in the paper (the original\n"
+	"mapping was using ad-hoc constants chosen for the Earth atmosphere case). It is\n"
+	"based on the distance to the top atmosphere boundary (for the sun rays), as for\n"
+	"the $\\mu$ mapping, and uses only one ad-hoc (but configurable) parameter. Yet,\n"
+	"as the original definition, it provides an increased sampling rate near the\n"
+	"horizon.</li>\n"
+	"</ul>\n"
+	"*/\n"
+	"\n"
+	"vec4 GetScatteringTextureUvwzFromRMuMuSNu(IN(AtmosphereParameters) atmosphere,\n"
+	"    Length r, Number mu, Number mu_s, Number nu,\n"
+	"    bool ray_r_mu_intersects_ground) {\n"
+	"  assert(r >= atmosphere.bottom_radius && r <= atmosphere.top_radius);\n"
+	"  assert(mu >= -1.0 && mu <= 1.0);\n"
+	"  assert(mu_s >= -1.0 && mu_s <= 1.0);\n"
+	"  assert(nu >= -1.0 && nu <= 1.0);\n"
+	"\n"
+	"  // Distance to top atmosphere boundary for a horizontal ray at ground level.\n"
+	"  Length H = sqrt(atmosphere.top_radius * atmosphere.top_radius -\n"
+	"      atmosphere.bottom_radius * atmosphere.bottom_radius);\n"
+	"  // Distance to the horizon.\n"
+	"  Length rho =\n"
+	"      SafeSqrt(r * r - atmosphere.bottom_radius * atmosphere.bottom_radius);\n"
+	"  Number u_r = GetTextureCoordFromUnitRange(rho / H, SCATTERING_TEXTURE_R_SIZE);\n"
+	"\n"
+	"  // Discriminant of the quadratic equation for the intersections of the ray\n"
+	"  // (r,mu) with the ground (see RayIntersectsGround).\n"
+	"  Length r_mu = r * mu;\n"
+	"  Area discriminant =\n"
+	"      r_mu * r_mu - r * r + atmosphere.bottom_radius * atmosphere.bottom_radius;\n"
+	"  Number u_mu;\n"
+	"  if (ray_r_mu_intersects_ground) {\n"
+	"    // Distance to the ground for the ray (r,mu), and its minimum and maximum\n"
+	"    // values over all mu - obtained for (r,-1) and (r,mu_horizon).\n"
+	"    Length d = -r_mu - SafeSqrt(discriminant);\n"
+	"    Length d_min = r - atmosphere.bottom_radius;\n"
+	"    Length d_max = rho;\n"
+	"    u_mu = 0.5 - 0.5 * GetTextureCoordFromUnitRange(d_max == d_min \? 0.0 :\n"
+	"        (d - d_min) / (d_max - d_min), SCATTERING_TEXTURE_MU_SIZE / 2);\n"
+	"  } else {\n"
+	"    // Distance to the top atmosphere boundary for the ray (r,mu), and its\n"
+	"    // minimum and maximum values over all mu - obtained for (r,1) and\n"
+	"    // (r,mu_horizon).\n"
+	"    Length d = -r_mu + SafeSqrt(discriminant + H * H);\n"
+	"    Length d_min = atmosphere.top_radius - r;\n"
+	"    Length d_max = rho + H;\n"
+	"    u_mu = 0.5 + 0.5 * GetTextureCoordFromUnitRange(\n"
+	"        (d - d_min) / (d_max - d_min), SCATTERING_TEXTURE_MU_SIZE / 2);\n"
+	"  }\n"
+	"\n"
+	"  Length d = DistanceToTopAtmosphereBoundary(\n"
+	"      atmosphere, atmosphere.bottom_radius, mu_s);\n"
+	"  Length d_min = atmosphere.top_radius - atmosphere.bottom_radius;\n"
+	"  Length d_max = H;\n"
+	"  Number a = (d - d_min) / (d_max - d_min);\n"
+	"  Number A =\n"
+	"      -2.0 * atmosphere.mu_s_min * atmosphere.bottom_radius / (d_max - d_min);\n"
+	"  Number u_mu_s = GetTextureCoordFromUnitRange(\n"
+	"      max(1.0 - a / A, 0.0) / (1.0 + a), SCATTERING_TEXTURE_MU_S_SIZE);\n"
+	"\n"
+	"  Number u_nu = (nu + 1.0) / 2.0;\n"
+	"  return vec4(u_nu, u_mu_s, u_mu, u_r);\n"
+	"}\n"
+	"\n"
+	"/*\n"
+	"<p>The inverse mapping follows immediately:\n"
+	"*/\n"
+	"\n"
+	"void GetRMuMuSNuFromScatteringTextureUvwz(IN(AtmosphereParameters) atmosphere,\n"
+	"    IN(vec4) uvwz, OUT(Length) r, OUT(Number) mu, OUT(Number) mu_s,\n"
+	"    OUT(Number) nu, OUT(bool) ray_r_mu_intersects_ground) {\n"
+	"  assert(uvwz.x >= 0.0 && uvwz.x <= 1.0);\n"
+	"  assert(uvwz.y >= 0.0 && uvwz.y <= 1.0);\n"
+	"  assert(uvwz.z >= 0.0 && uvwz.z <= 1.0);\n"
+	"  assert(uvwz.w >= 0.0 && uvwz.w <= 1.0);\n"
+	"\n"
+	"  // Distance to top atmosphere boundary for a horizontal ray at ground level.\n"
+	"  Length H = sqrt(atmosphere.top_radius * atmosphere.top_radius -\n"
+	"      atmosphere.bottom_radius * atmosphere.bottom_radius);\n"
+	"  // Distance to the horizon.\n"
+	"  Length rho =\n"
+	"      H * GetUnitRangeFromTextureCoord(uvwz.w, SCATTERING_TEXTURE_R_SIZE);\n"
+	"  r = sqrt(rho * rho + atmosphere.bottom_radius * atmosphere.bottom_radius);\n"
+	"\n"
+	"  if (uvwz.z < 0.5) {\n"
+	"    // Distance to the ground for the ray (r,mu), and its minimum and maximum\n"
+	"    // values over all mu - obtained for (r,-1) and (r,mu_horizon) - from which\n"
+	"    // we can recover mu:\n"
+	"    Length d_min = r - atmosphere.bottom_radius;\n"
+	"    Length d_max = rho;\n"
+	"    Length d = d_min + (d_max - d_min) * GetUnitRangeFromTextureCoord(\n"
+	"        1.0 - 2.0 * uvwz.z, SCATTERING_TEXTURE_MU_SIZE / 2);\n"
+	"    mu = d == 0.0 * m \? Number(-1.0) :\n"
+	"        ClampCosine(-(rho * rho + d * d) / (2.0 * r * d));\n"
+	"    ray_r_mu_intersects_ground = true;\n"
+	"  } else {\n"
+	"    // Distance to the top atmosphere boundary for the ray (r,mu), and its\n"
+	"    // minimum and maximum values over all mu - obtained for (r,1) and\n"
+	"    // (r,mu_horizon) - from which we can recover mu:\n"
+	"    Length d_min = atmosphere.top_radius - r;\n"
+	"    Length d_max = rho + H;\n"
+	"    Length d = d_min + (d_max - d_min) * GetUnitRangeFromTextureCoord(\n"
+	"        2.0 * uvwz.z - 1.0, SCATTERING_TEXTURE_MU_SIZE / 2);\n"
+	"    mu = d == 0.0 * m \? Number(1.0) :\n"
+	"        ClampCosine((H * H - rho * rho - d * d) / (2.0 * r * d));\n"
+	"    ray_r_mu_intersects_ground = false;\n"
+	"  }\n"
+	"\n"
+	"  Number x_mu_s =\n"
+	"      GetUnitRangeFromTextureCoord(uvwz.y, SCATTERING_TEXTURE_MU_S_SIZE);\n"
+	"  Length d_min = atmosphere.top_radius - atmosphere.bottom_radius;\n"
+	"  Length d_max = H;\n"
+	"  Number A =\n"
+	"      -2.0 * atmosphere.mu_s_min * atmosphere.bottom_radius / (d_max - d_min);\n"
+	"  Number a = (A - x_mu_s * A) / (1.0 + x_mu_s * A);\n"
+	"  Length d = d_min + min(a, A) * (d_max - d_min);\n"
+	"  mu_s = d == 0.0 * m \? Number(1.0) :\n"
+	"     ClampCosine((H * H - d * d) / (2.0 * atmosphere.bottom_radius * d));\n"
+	"\n"
+	"  nu = ClampCosine(uvwz.x * 2.0 - 1.0);\n"
+	"}\n"
+	"\n"
+	"/*\n"
+	"<p>We assumed above that we have 4D textures, which is not the case in practice.\n"
+	"We therefore need a further mapping, between 3D and 4D texture coordinates. The\n"
+	"function below expands a 3D texel coordinate into a 4D texture coordinate, and\n"
+	"then to $(r,\\mu,\\mu_s,\\nu)$ parameters. It does so by \"unpacking\" two texel\n"
+	"coordinates from the $x$ texel coordinate. Note also how we clamp the $\\nu$\n"
+	"parameter at the end. This is because $\\nu$ is not a fully independent variable:\n"
+	"its range of values depends on $\\mu$ and $\\mu_s$ (this can be seen by computing\n"
+	"$\\mu$, $\\mu_s$ and $\\nu$ from the cartesian coordinates of the zenith, view and\n"
+	"sun unit direction vectors), and the previous functions implicitely assume this\n"
+	"(their assertions can break if this constraint is not respected).\n"
+	"*/\n"
+	"\n"
+	"void GetRMuMuSNuFromScatteringTextureFragCoord(\n"
+	"    IN(AtmosphereParameters) atmosphere, IN(vec3) frag_coord,\n"
+	"    OUT(Length) r, OUT(Number) mu, OUT(Number) mu_s, OUT(Number) nu,\n"
+	"    OUT(bool) ray_r_mu_intersects_ground) {\n"
+	"  const vec4 SCATTERING_TEXTURE_SIZE = vec4(\n"
+	"      SCATTERING_TEXTURE_NU_SIZE - 1,\n"
+	"      SCATTERING_TEXTURE_MU_S_SIZE,\n"
+	"      SCATTERING_TEXTURE_MU_SIZE,\n"
+	"      SCATTERING_TEXTURE_R_SIZE);\n"
+	"  Number frag_coord_nu =\n"
+	"      floor(frag_coord.x / Number(SCATTERING_TEXTURE_MU_S_SIZE));\n"
+	"  Number frag_coord_mu_s =\n"
+	"      mod(frag_coord.x, Number(SCATTERING_TEXTURE_MU_S_SIZE));\n"
+	"  vec4 uvwz =\n"
+	"      vec4(frag_coord_nu, frag_coord_mu_s, frag_coord.y, frag_coord.z) /\n"
+	"          SCATTERING_TEXTURE_SIZE;\n"
+	"  GetRMuMuSNuFromScatteringTextureUvwz(\n"
+	"      atmosphere, uvwz, r, mu, mu_s, nu, ray_r_mu_intersects_ground);\n"
+	"  // Clamp nu to its valid range of values, given mu and mu_s.\n"
+	"  nu = clamp(nu, mu * mu_s - sqrt((1.0 - mu * mu) * (1.0 - mu_s * mu_s)),\n"
+	"      mu * mu_s + sqrt((1.0 - mu * mu) * (1.0 - mu_s * mu_s)));\n"
+	"}\n"
+	"\n"
+	"/*\n"
+	"<p>With this mapping, we can finally write a function to precompute a texel of\n"
+	"the single scattering in a 3D texture:\n"
+	"*/\n"
+	"\n"
+	"void ComputeSingleScatteringTexture(IN(AtmosphereParameters) atmosphere,\n"
+	"    IN(TransmittanceTexture) transmittance_texture, IN(vec3) frag_coord,\n"
+	"    OUT(IrradianceSpectrum) rayleigh, OUT(IrradianceSpectrum) mie) {\n"
+	"  Length r;\n"
+	"  Number mu;\n"
+	"  Number mu_s;\n"
+	"  Number nu;\n"
+	"  bool ray_r_mu_intersects_ground;\n"
+	"  GetRMuMuSNuFromScatteringTextureFragCoord(atmosphere, frag_coord,\n"
+	"      r, mu, mu_s, nu, ray_r_mu_intersects_ground);\n"
+	"  ComputeSingleScattering(atmosphere, transmittance_texture,\n"
+	"      r, mu, mu_s, nu, ray_r_mu_intersects_ground, rayleigh, mie);\n"
+	"}\n"
+	"\n"
+	"/*\n"
+	"<h4 id=\"single_scattering_lookup\">Lookup</h4>\n"
+	"\n"
+	"<p>With the help of the above precomputed texture, we can now get the scattering\n"
+	"between a point and the nearest atmosphere boundary with two texture lookups (we\n"
+	"need two 3D texture lookups to emulate a single 4D texture lookup with\n"
+	"quadrilinear interpolation; the 3D texture coordinates are computed using the\n"
+	"inverse of the 3D-4D mapping defined in\n"
+	"<code>GetRMuMuSNuFromScatteringTextureFragCoord</code>):\n"
+	"*/\n"
+	"\n"
+	"TEMPLATE(AbstractSpectrum)\n"
+	"AbstractSpectrum GetScattering(\n"
+	"    IN(AtmosphereParameters) atmosphere,\n"
+	"    IN(AbstractScatteringTexture TEMPLATE_ARGUMENT(AbstractSpectrum))\n"
+	"        scattering_texture,\n"
+	"    Length r, Number mu, Number mu_s, Number nu,\n"
+	"    bool ray_r_mu_intersects_ground) \n"
+	"{\n"
+	"  vec4 uvwz = GetScatteringTextureUvwzFromRMuMuSNu(\n"
+	"      atmosphere, r, mu, mu_s, nu, ray_r_mu_intersects_ground);\n"
+	"  Number tex_coord_x = uvwz.x * Number(SCATTERING_TEXTURE_NU_SIZE - 1);\n"
+	"  Number tex_x = floor(tex_coord_x);\n"
+	"  Number lerp = tex_coord_x - tex_x;\n"
+	"  vec3 uvw0 = vec3((tex_x + uvwz.y) / Number(SCATTERING_TEXTURE_NU_SIZE),\n"
+	"      uvwz.z, uvwz.w);\n"
+	"  vec3 uvw1 = vec3((tex_x + 1.0 + uvwz.y) / Number(SCATTERING_TEXTURE_NU_SIZE),\n"
+	"      uvwz.z, uvwz.w);\n"
+	"  return AbstractSpectrum(texture(scattering_texture, uvw0) * (1.0 - lerp) +\n"
+	"      texture(scattering_texture, uvw1) * lerp);\n"
+	"}\n"
+	"\n"
+	"/*\n"
+	"<p>Finally, we provide here a convenience lookup function which will be useful\n"
+	"in the next section. This function returns either the single scattering, with\n"
+	"the phase functions included, or the $n$-th order of scattering, with $n>1$. It\n"
+	"assumes that, if <code>scattering_order</code> is strictly greater than 1, then\n"
+	"<code>multiple_scattering_texture</code> corresponds to this scattering order,\n"
+	"with both Rayleigh and Mie included, as well as all the phase function terms.\n"
+	"*/\n"
+	"\n"
+	"RadianceSpectrum GetScattering(\n"
+	"    IN(AtmosphereParameters) atmosphere,\n"
+	"    IN(ReducedScatteringTexture) single_rayleigh_scattering_texture,\n"
+	"    IN(ReducedScatteringTexture) single_mie_scattering_texture,\n"
+	"    IN(ScatteringTexture) multiple_scattering_texture,\n"
+	"    Length r, Number mu, Number mu_s, Number nu,\n"
+	"    bool ray_r_mu_intersects_ground,\n"
+	"    int scattering_order) \n"
+	"{\n"
+	"  if (scattering_order == 1) \n"
+	"  {\n"
+	"    IrradianceSpectrum rayleigh = GetScattering(\n"
+	"        atmosphere, single_rayleigh_scattering_texture, r, mu, mu_s, nu,\n"
+	"        ray_r_mu_intersects_ground);\n"
+	"    IrradianceSpectrum mie = GetScattering(\n"
+	"        atmosphere, single_mie_scattering_texture, r, mu, mu_s, nu,\n"
+	"        ray_r_mu_intersects_ground);\n"
+	"    return rayleigh * RayleighPhaseFunction(nu) +\n"
+	"        mie * MiePhaseFunction(atmosphere.mie_phase_function_g, nu);\n"
+	"  } else {\n"
+	"    return GetScattering(\n"
+	"        atmosphere, multiple_scattering_texture, r, mu, mu_s, nu,\n"
+	"        ray_r_mu_intersects_ground);\n"
+	"  }\n"
+	"}\n"
+	"\n"
+	"/*\n"
+	"<h3 id=\"multiple_scattering\">Multiple scattering</h3>\n"
+	"\n"
+	"<p>The multiply scattered radiance is the light arriving from the Sun at some\n"
+	"point in the atmosphere after two or more <i>bounces</i> (where a bounce is\n"
+	"either a scattering event or a reflection from the ground). The following\n"
+	"sections describe how we compute it, how we store it in a precomputed texture,\n"
+	"and how we read it back.\n"
+	"\n"
+	"<p>Note that, as for single scattering, we exclude here the light paths whose\n"
+	"<i>last</i> bounce is a reflection on the ground. The contribution from these\n"
+	"paths is computed separately, at rendering time, in order to take the actual\n"
+	"ground albedo into account (for intermediate reflections on the ground, which\n"
+	"are precomputed, we use an average, uniform albedo).\n"
+	"\n"
+	"<h4 id=\"multiple_scattering_computation\">Computation</h4>\n"
+	"\n"
+	"<p>Multiple scattering can be decomposed into the sum of double scattering,\n"
+	"triple scattering, etc, where each term corresponds to the light arriving from\n"
+	"the Sun at some point in the atmosphere after <i>exactly</i> 2, 3, etc bounces.\n"
+	"Moreover, each term can be computed from the previous one. Indeed, the light\n"
+	"arriving at some point $\\bp$ from direction $\\bw$ after $n$ bounces is an\n"
+	"integral over all the possible points $\\bq$ for the last bounce, which involves\n"
+	"the light arriving at $\\bq$ from any direction, after $n-1$ bounces.\n"
+	"\n"
+	"<p>This description shows that each scattering order requires a triple integral\n"
+	"to be computed from the previous one (one integral over all the points $\\bq$\n"
+	"on the segment from $\\bp$ to the nearest atmosphere boundary in direction $\\bw$,\n"
+	"and a nested double integral over all directions at each point $\\bq$).\n"
+	"Therefore, if we wanted to compute each order \"from scratch\", we would need a\n"
+	"triple integral for double scattering, a sextuple integral for triple\n"
+	"scattering, etc. This would be clearly inefficient, because of all the redundant\n"
+	"computations (the computations for order $n$ would basically redo all the\n"
+	"computations for all previous orders, leading to quadratic complexity in the\n"
+	"total number of orders). Instead, it is much more efficient to proceed as\n"
+	"follows:\n"
+	"<ul>\n"
+	"<li>precompute single scattering in a texture (as described above),</li>\n"
+	"<li>for $n \\ge 2$:\n"
+	"<ul>\n"
+	"<li>precompute the $n$-th scattering in a texture, with a triple integral whose\n"
+	"integrand uses lookups in the $(n-1)$-th scattering texture</li>\n"
+	"</ul>\n"
+	"</li>\n"
+	"</ul>\n"
+	"\n"
+	"<p>This strategy avoids many redundant computations but does not eliminate all\n"
+	"of them. Consider for instance the points $\\bp$ and $\\bp'$ in the figure below,\n"
+	"and the computations which are necessary to compute the light arriving at these\n"
+	"two points from direction $\\bw$ after $n$ bounces. These computations involve,\n"
+	"in particular, the evaluation of the radiance $L$ which is scattered at $\\bq$ in\n"
+	"direction $-\\bw$, and coming from all directions after $n-1$ bounces:\n"
+	"\n"
+	"<svg width=\"340px\" height=\"150px\">\n"
+	"  <style type=\"text/css\"><![CDATA[\n"
+	"    circle { fill: #000000; stroke: none; }\n"
+	"    path { fill: none; stroke: #000000; }\n"
+	"    text { font-size: 16px; font-style: normal; font-family: Sans; }\n"
+	"    .vector { font-weight: bold; }\n"
+	"  ]]></style>\n"
+	"  <path d=\"m 0,26 a 600,600 0 0 1 340,0\"/>\n"
+	"  <path d=\"m 0,110 a 520,520 0 0 1 340,0\"/>\n"
+	"  <path d=\"m 170,140 0,-135\"/>\n"
+	"  <path d=\"m 20,80 200,-40\" />\n"
+	"  <path d=\"m 209,39 11,1 -10,5\" />\n"
+	"  <circle cx=\"70\" cy=\"70\" r=\"2.5\"/>\n"
+	"  <circle cx=\"120\" cy=\"60\" r=\"2.5\"/>\n"
+	"  <circle cx=\"170\" cy=\"50\" r=\"2.5\"/>\n"
+	"  <text x=\"65\" y=\"60\" class=\"vector\">p</text>\n"
+	"  <text x=\"175\" y=\"65\" class=\"vector\">q</text>\n"
+	"  <text x=\"225\" y=\"35\" class=\"vector\">\317\211</text>\n"
+	"  <text x=\"115\" y=\"50\" class=\"vector\">p<tspan\n"
+	"     style=\"font-weight:normal;\">'</tspan></text>\n"
+	"</svg>\n"
+	"\n"
+	"<p>Therefore, if we computed the n-th scattering with a triple integral as\n"
+	"described above, we would compute $L$ redundantly (in fact, for all points $\\bp$\n"
+	"between $\\bq$ and the nearest atmosphere boundary in direction $-\\bw$). To avoid\n"
+	"this, and thus increase the efficiency of the multiple scattering computations,\n"
+	"we refine the above algorithm as follows:\n"
+	"<ul>\n"
+	"<li>precompute single scattering in a texture (as described above),</li>\n"
+	"<li>for $n \\ge 2$:\n"
+	"<ul>\n"
+	"<li>for each point $\\bq$ and direction $\\bw$, precompute the light which is\n"
+	"scattered at $\\bq$ towards direction $-\\bw$, coming from any direction after\n"
+	"$n-1$ bounces (this involves only a double integral, whose integrand uses\n"
+	"lookups in the $(n-1)$-th scattering texture),</li>\n"
+	"<li>for each point $\\bp$ and direction $\\bw$, precompute the light coming from\n"
+	"direction $\\bw$ after $n$ bounces (this involves only a single integral, whose\n"
+	"integrand uses lookups in the texture computed at the previous line)</li>\n"
+	"</ul>\n"
+	"</li>\n"
+	"</ul>\n"
+	"\n"
+	"<p>To get a complete algorithm, we must now specify how we implement the two\n"
+	"steps in the above loop. This is what we do in the rest of this section.\n"
+	"\n"
+	"<h5 id=\"multiple_scattering_first_step\">First step</h5>\n"
+	"\n"
+	"<p>The first step computes the radiance which is scattered at some point $\\bq$\n"
+	"inside the atmosphere, towards some direction $-\\bw$. Furthermore, we assume\n"
+	"that this scattering event is the $n$-th bounce.\n"
+	"\n"
+	"<p>This radiance is the integral over all the possible incident directions\n"
+	"$\\bw_i$, of the product of\n"
+	"<ul>\n"
+	"<li>the incident radiance $L_i$ arriving at $\\bq$ from direction $\\bw_i$ after\n"
+	"$n-1$ bounces, which is the sum of:\n"
+	"<ul>\n"
+	"<li>a term given by the precomputed scattering texture for the $(n-1)$-th\n"
+	"order,</li>\n"
+	"<li>if the ray $[\\bq, \\bw_i)$ intersects the ground at $\\br$, the contribution\n"
+	"from the light paths with $n-1$ bounces and whose last bounce is at $\\br$, i.e.\n"
+	"on the ground (these paths are excluded, by definition, from our precomputed\n"
+	"textures, but we must take them into account here since the bounce on the ground\n"
+	"is followed by a bounce at $\\bq$). This contribution, in turn, is the product\n"
+	"of:\n"
+	"<ul>\n"
+	"<li>the transmittance between $\\bq$ and $\\br$,</li>\n"
+	"<li>the (average) ground albedo,</li>\n"
+	"<li>the <a href=\"https://www.cs.princeton.edu/~smr/cs348c-97/surveypaper.html\"\n"
+	">Lambertian BRDF</a> $1/\\pi$,</li>\n"
+	"<li>the irradiance received on the ground after $n-2$ bounces. We explain in the\n"
+	"<a href=\"#irradiance\">next section</a> how we precompute it in a texture. For\n"
+	"now, we assume that we can use the following function to retrieve this\n"
+	"irradiance from a precomputed texture:\n"
+	"</li>\n"
+	"</ul>\n"
+	"</li>\n"
+	"</ul>\n"
+	"</li>\n"
+	"</ul>\n"
+	"*/\n"
+	"\n"
+	"IrradianceSpectrum GetIrradiance(\n"
+	"    IN(AtmosphereParameters) atmosphere,\n"
+	"    IN(IrradianceTexture) irradiance_texture,\n"
+	"    Length r, Number mu_s);\n"
+	"\n"
+	"/*\n"
+	"<ul>\n"
+	"<li>the scattering coefficient at $\\bq$,</li>\n"
+	"<li>the scattering phase function for the directions $\\bw$ and $\\bw_i$</li>\n"
+	"</ul>\n"
+	"This leads to the following implementation (where\n"
+	"<code>multiple_scattering_texture</code> is supposed to contain the $(n-1)$-th\n"
+	"order of scattering, if $n>2$, <code>irradiance_texture</code> is the irradiance\n"
+	"received on the ground after $n-2$ bounces, and <code>scattering_order</code> is\n"
+	"equal to $n$):</li>\n"
+	"*/\n"
+	"\n"
+	"RadianceDensitySpectrum ComputeScatteringDensity(\n"
+	"    IN(AtmosphereParameters) atmosphere,\n"
+	"    IN(TransmittanceTexture) transmittance_texture,\n"
+	"    IN(ReducedScatteringTexture) single_rayleigh_scattering_texture,\n"
+	"    IN(ReducedScatteringTexture) single_mie_scattering_texture,\n"
+	"    IN(ScatteringTexture) multiple_scattering_texture,\n"
+	"    IN(IrradianceTexture) irradiance_texture,\n"
+	"    Length r, Number mu, Number mu_s, Number nu, int scattering_order){\n"
+	"  assert(r >= atmosphere.bottom_radius && r <= atmosphere.top_radius);\n"
+	"  assert(mu >= -1.0 && mu <= 1.0);\n"
+	"  assert(mu_s >= -1.0 && mu_s <= 1.0);\n"
+	"  assert(nu >= -1.0 && nu <= 1.0);\n"
+	"  assert(scattering_order >= 2);\n"
+	"\n"
+	"  // Compute unit direction vectors for the zenith, the view direction omega and\n"
+	"  // and the sun direction omega_s, such that the cosine of the view-zenith\n"
+	"  // angle is mu, the cosine of the sun-zenith angle is mu_s, and the cosine of\n"
+	"  // the view-sun angle is nu. The goal is to simplify computations below.\n"
+	"  vec3 zenith_direction = vec3(0.0, 0.0, 1.0);\n"
+	"  vec3 omega = vec3(sqrt(1.0 - mu * mu), 0.0, mu);\n"
+	"  Number sun_dir_x = omega.x == 0.0 \? 0.0 : (nu - mu * mu_s) / omega.x;\n"
+	"  Number sun_dir_y = sqrt(max(1.0 - sun_dir_x * sun_dir_x - mu_s * mu_s, 0.0));\n"
+	"  vec3 omega_s = vec3(sun_dir_x, sun_dir_y, mu_s);\n"
+	"\n"
+	"  const int SAMPLE_COUNT = 16;\n"
+	"  const Angle dphi = pi / Number(SAMPLE_COUNT);\n"
+	"  const Angle dtheta = pi / Number(SAMPLE_COUNT);\n"
+	"  RadianceDensitySpectrum rayleigh_mie =\n"
+	"      RadianceDensitySpectrum(0.0 * watt_per_cubic_meter_per_sr_per_nm);\n"
+	"\n"
+	"  // Nested loops for the integral over all the incident directions omega_i.\n"
+	"  for (int l = 0; l < SAMPLE_COUNT; ++l) {\n"
+	"    Angle theta = (Number(l) + 0.5) * dtheta;\n"
+	"    Number cos_theta = cos(theta);\n"
+	"    Number sin_theta = sin(theta);\n"
+	"    bool ray_r_theta_intersects_ground =\n"
+	"        RayIntersectsGround(atmosphere, r, cos_theta);\n"
+	"\n"
+	"    // The distance and transmittance to the ground only depend on theta, so we\n"
+	"    // can compute them in the outer loop for efficiency.\n"
+	"    Length distance_to_ground = 0.0 * m;\n"
+	"    DimensionlessSpectrum transmittance_to_ground = DimensionlessSpectrum(0.0);\n"
+	"    DimensionlessSpectrum ground_albedo = DimensionlessSpectrum(0.0);\n"
+	"    if (ray_r_theta_intersects_ground) {\n"
+	"      distance_to_ground =\n"
+	"          DistanceToBottomAtmosphereBoundary(atmosphere, r, cos_theta);\n"
+	"      transmittance_to_ground =\n"
+	"          GetTransmittance(atmosphere, transmittance_texture, r, cos_theta,\n"
+	"              distance_to_ground, true /* ray_intersects_ground */);\n"
+	"      ground_albedo = atmosphere.ground_albedo;\n"
+	"    }\n"
+	"\n"
+	"    for (int m = 0; m < 2 * SAMPLE_COUNT; ++m) {\n"
+	"      Angle phi = (Number(m) + 0.5) * dphi;\n"
+	"      vec3 omega_i =\n"
+	"          vec3(cos(phi) * sin_theta, sin(phi) * sin_theta, cos_theta);\n"
+	"      SolidAngle domega_i = (dtheta / rad) * (dphi / rad) * sin(theta) * sr;\n"
+	"\n"
+	"      // The radiance L_i arriving from direction omega_i after n-1 bounces is\n"
+	"      // the sum of a term given by the precomputed scattering texture for the\n"
+	"      // (n-1)-th order:\n"
+	"      Number nu1 = dot(omega_s, omega_i);\n"
+	"      RadianceSpectrum incident_radiance = GetScattering(atmosphere,\n"
+	"          single_rayleigh_scattering_texture, single_mie_scattering_texture,\n"
+	"          multiple_scattering_texture, r, omega_i.z, mu_s, nu1,\n"
+	"          ray_r_theta_intersects_ground, scattering_order - 1);\n"
+	"\n"
+	"      // and of the contribution from the light paths with n-1 bounces and whose\n"
+	"      // last bounce is on the ground. This contribution is the product of the\n"
+	"      // transmittance to the ground, the ground albedo, the ground BRDF, and\n"
+	"      // the irradiance received on the ground after n-2 bounces.\n"
+	"      vec3 ground_normal =\n"
+	"          normalize(zenith_direction * r + omega_i * distance_to_ground);\n"
+	"      IrradianceSpectrum ground_irradiance = GetIrradiance(\n"
+	"          atmosphere, irradiance_texture, atmosphere.bottom_radius,\n"
+	"          dot(ground_normal, omega_s));\n"
+	"      incident_radiance += transmittance_to_ground *\n"
+	"          ground_albedo * (1.0 / (PI * sr)) * ground_irradiance;\n"
+	"\n"
+	"      // The radiance finally scattered from direction omega_i towards direction\n"
+	"      // -omega is the product of the incident radiance, the scattering\n"
+	"      // coefficient, and the phase function for directions omega and omega_i\n"
+	"      // (all this summed over all particle types, i.e. Rayleigh and Mie).\n"
+	"      Number nu2 = dot(omega, omega_i);\n"
+	"      Number rayleigh_density = exp(\n"
+	"          -(r - atmosphere.bottom_radius) / atmosphere.rayleigh_scale_height);\n"
+	"      Number mie_density = exp(\n"
+	"          -(r - atmosphere.bottom_radius) / atmosphere.mie_scale_height);\n"
+	"      rayleigh_mie += incident_radiance * (\n"
+	"          atmosphere.rayleigh_scattering * rayleigh_density *\n"
+	"              RayleighPhaseFunction(nu2) +\n"
+	"          atmosphere.mie_scattering * mie_density *\n"
+	"              MiePhaseFunction(atmosphere.mie_phase_function_g, nu2)) *\n"
+	"          domega_i;\n"
+	"    }\n"
+	"  }\n"
+	"  return rayleigh_mie;\n"
+	"}\n"
+	"\n"
+	"/*\n"
+	"<h5 id=\"multiple_scattering_second_step\">Second step</h5>\n"
+	"\n"
+	"<p>The second step to compute the $n$-th order of scattering is to compute for\n"
+	"each point $\\bp$ and direction $\\bw$, the radiance coming from direction $\\bw$\n"
+	"after $n$ bounces, using a texture precomputed with the previous function.\n"
+	"\n"
+	"<p>This radiance is the integral over all points $\\bq$ between $\\bp$ and the\n"
+	"nearest atmosphere boundary in direction $\\bw$ of the product of:\n"
+	"<ul>\n"
+	"<li>a term given by a texture precomputed with the previous function, namely\n"
+	"the radiance scattered at $\\bq$ towards $\\bp$, coming from any direction after\n"
+	"$n-1$ bounces,</li>\n"
+	"<li>the transmittance betweeen $\\bp$ and $\\bq$</li>\n"
+	"</ul>\n"
+	"Note that this excludes the light paths with $n$ bounces and whose last\n"
+	"bounce is on the ground, on purpose. Indeed, we chose to exclude these paths\n"
+	"from our precomputed textures so that we can compute them at render time\n"
+	"instead, using the actual ground albedo.\n"
+	"\n"
+	"<p>The implementation for this second step is straightforward:\n"
+	"*/\n"
+	"\n"
+	"RadianceSpectrum ComputeMultipleScattering(\n"
+	"    IN(AtmosphereParameters) atmosphere,\n"
+	"    IN(TransmittanceTexture) transmittance_texture,\n"
+	"    IN(ScatteringDensityTexture) scattering_density_texture,\n"
+	"    Length r, Number mu, Number mu_s, Number nu,\n"
+	"    bool ray_r_mu_intersects_ground)\n"
+	"{\n"
+	"  assert(r >= atmosphere.bottom_radius && r <= atmosphere.top_radius);\n"
+	"  assert(mu >= -1.0 && mu <= 1.0);\n"
+	"  assert(mu_s >= -1.0 && mu_s <= 1.0);\n"
+	"  assert(nu >= -1.0 && nu <= 1.0);\n"
+	"\n"
+	"  // Number of intervals for the numerical integration.\n"
+	"  const int SAMPLE_COUNT = 50;\n"
+	"  // The integration step, i.e. the length of each integration interval.\n"
+	"  Length dx =\n"
+	"      DistanceToNearestAtmosphereBoundary(\n"
+	"          atmosphere, r, mu, ray_r_mu_intersects_ground) /\n"
+	"              Number(SAMPLE_COUNT);\n"
+	"  // Integration loop.\n"
+	"  RadianceSpectrum rayleigh_mie_sum =\n"
+	"      RadianceSpectrum(0.0 * watt_per_square_meter_per_sr_per_nm);\n"
+	"  for (int i = 0; i <= SAMPLE_COUNT; ++i) \n"
+	"  {\n"
+	"    Length d_i = Number(i) * dx;\n"
+	"\n"
+	"    // The r, mu and mu_s parameters at the current integration point (see the\n"
+	"    // single scattering section for a detailed explanation).\n"
+	"    Length r_i =\n"
+	"        ClampRadius(atmosphere, sqrt(d_i * d_i + 2.0 * r * mu * d_i + r * r));\n"
+	"    Number mu_i = ClampCosine((r * mu + d_i) / r_i);\n"
+	"    Number mu_s_i = ClampCosine((r * mu_s + d_i * nu) / r_i);\n"
+	"\n"
+	"    // The Rayleigh and Mie multiple scattering at the current sample point.\n"
+	"    RadianceSpectrum rayleigh_mie_i =\n"
+	"        GetScattering(\n"
+	"            atmosphere, scattering_density_texture, r_i, mu_i, mu_s_i, nu,\n"
+	"            ray_r_mu_intersects_ground) *\n"
+	"        GetTransmittance(\n"
+	"            atmosphere, transmittance_texture, r, mu, d_i,\n"
+	"            ray_r_mu_intersects_ground) *\n"
+	"        dx;\n"
+	"    // Sample weight (from the trapezoidal rule).\n"
+	"    Number weight_i = (i == 0 || i == SAMPLE_COUNT) \? 0.5 : 1.0;\n"
+	"    rayleigh_mie_sum += rayleigh_mie_i * weight_i;\n"
+	"  }\n"
+	"\n"
+	"  return rayleigh_mie_sum;\n"
+	"}\n"
+	"\n"
+	"/*\n"
+	"<h4 id=\"multiple_scattering_precomputation\">Precomputation</h4>\n"
+	"\n"
+	"<p>As explained in the <a href=\"#multiple_scattering\">overall algorithm</a> to\n"
+	"compute multiple scattering, we need to precompute each order of scattering in a\n"
+	"texture to save computations while computing the next order. And, in order to\n"
+	"store a function in a texture, we need a mapping from the function parameters to\n"
+	"texture coordinates. Fortunately, all the orders of scattering depend on the\n"
+	"same $(r,\\mu,\\mu_s,\\nu)$ parameters as single scattering, so we can simple reuse\n"
+	"the mappings defined for single scattering. This immediately leads to the\n"
+	"following simple functions to precompute a texel of the textures for the\n"
+	"<a href=\"#multiple_scattering_first_step\">first</a> and\n"
+	"<a href=\"#multiple_scattering_second_step\">second</a> steps of each iteration\n"
+	"over the number of bounces:\n"
+	"*/\n"
+	"\n"
+	"RadianceDensitySpectrum ComputeScatteringDensityTexture(\n"
+	"    IN(AtmosphereParameters) atmosphere,\n"
+	"    IN(TransmittanceTexture) transmittance_texture,\n"
+	"    IN(ReducedScatteringTexture) single_rayleigh_scattering_texture,\n"
+	"    IN(ReducedScatteringTexture) single_mie_scattering_texture,\n"
+	"    IN(ScatteringTexture) multiple_scattering_texture,\n"
+	"    IN(IrradianceTexture) irradiance_texture,\n"
+	"    IN(vec3) frag_coord, int scattering_order) {\n"
+	"  Length r;\n"
+	"  Number mu;\n"
+	"  Number mu_s;\n"
+	"  Number nu;\n"
+	"  bool ray_r_mu_intersects_ground;\n"
+	"  GetRMuMuSNuFromScatteringTextureFragCoord(atmosphere, frag_coord,\n"
+	"      r, mu, mu_s, nu, ray_r_mu_intersects_ground);\n"
+	"  return ComputeScatteringDensity(atmosphere, transmittance_texture,\n"
+	"      single_rayleigh_scattering_texture, single_mie_scattering_texture,\n"
+	"      multiple_scattering_texture, irradiance_texture, r, mu, mu_s, nu,\n"
+	"      scattering_order);\n"
+	"}\n"
+	"\n"
+	"RadianceSpectrum ComputeMultipleScatteringTexture(\n"
+	"    IN(AtmosphereParameters) atmosphere,\n"
+	"    IN(TransmittanceTexture) transmittance_texture,\n"
+	"    IN(ScatteringDensityTexture) scattering_density_texture,\n"
+	"    IN(vec3) frag_coord, OUT(Number) nu) {\n"
+	"  Length r;\n"
+	"  Number mu;\n"
+	"  Number mu_s;\n"
+	"  bool ray_r_mu_intersects_ground;\n"
+	"  GetRMuMuSNuFromScatteringTextureFragCoord(atmosphere, frag_coord,\n"
+	"      r, mu, mu_s, nu, ray_r_mu_intersects_ground);\n"
+	"  return ComputeMultipleScattering(atmosphere, transmittance_texture,\n"
+	"      scattering_density_texture, r, mu, mu_s, nu,\n"
+	"      ray_r_mu_intersects_ground);\n"
+	"}\n"
+	"\n"
+	"vec4 ComputeMultipleScatteringTexture_1(\n"
+	"    IN(AtmosphereParameters) atmosphere,\n"
+	"    IN(ScatteringDensityTexture) scattering_density_texture,\n"
+	"    IN(vec3) frag_coord) \n"
+	"{\n"
+	"\tLength r;\n"
+	"\tNumber mu;\n"
+	"\tNumber mu_s;\n"
+	"\tNumber nu;\n"
+	"\tbool ray_r_mu_intersects_ground;\n"
+	"\n"
+	"\tGetRMuMuSNuFromScatteringTextureFragCoord(atmosphere, frag_coord,\n"
+	"\t    r, mu, mu_s, nu, ray_r_mu_intersects_ground);\n"
+	"\n"
+	"\tassert(r >= atmosphere.bottom_radius && r <= atmosphere.top_radius);\n"
+	"\tassert(mu >= -1.0 && mu <= 1.0);\n"
+	"\tassert(mu_s >= -1.0 && mu_s <= 1.0);\n"
+	"\tassert(nu >= -1.0 && nu <= 1.0);\n"
+	"\n"
+	"\t// Number of intervals for the numerical integration.\n"
+	"\tconst int SAMPLE_COUNT = 50;\n"
+	"\t// The integration step, i.e. the length of each integration interval.\n"
+	"\tLength dx =\n"
+	"\t    DistanceToNearestAtmosphereBoundary(\n"
+	"\t        atmosphere, r, mu, ray_r_mu_intersects_ground) / Number(SAMPLE_COUNT);\n"
+	"\t// Integration loop.\n"
+	"\tvec4 rayleigh_mie_sum =\n"
+	"\t    vec4(0.0 * watt_per_square_meter_per_sr_per_nm);\t    \n"
+	"\tfor (int i = 0; i <= SAMPLE_COUNT; ++i) \n"
+	"\t{\n"
+	"\t    Length d_i = Number(i) * dx;\n"
+	"\n"
+	"\t    // The r, mu and mu_s parameters at the current integration point (see the\n"
+	"\t    // single scattering section for a detailed explanation).\n"
+	"\t    Length r_i =\n"
+	"\t        ClampRadius(atmosphere, sqrt(d_i * d_i + 2.0 * r * mu * d_i + r * r));\n"
+	"\t    Number mu_i = ClampCosine((r * mu + d_i) / r_i);\n"
+	"\t    Number mu_s_i = ClampCosine((r * mu_s + d_i * nu) / r_i);\n"
+	"\n"
+	"\t\tvec4 uvwz = GetScatteringTextureUvwzFromRMuMuSNu(\n"
+	"\t\t    atmosphere, r_i, mu_i, mu_s, mu_s_i, ray_r_mu_intersects_ground);\n"
+	"\t\tNumber tex_coord_x = uvwz.x * Number(SCATTERING_TEXTURE_NU_SIZE - 1);\n"
+	"\t\tNumber tex_x = floor(tex_coord_x);\n"
+	"\t\tNumber lerp = tex_coord_x - tex_x;\n"
+	"\t\tvec3 uvw0 = vec3((tex_x + uvwz.y) / Number(SCATTERING_TEXTURE_NU_SIZE),\n"
+	"\t\t    uvwz.z, uvwz.w);\n"
+	"\t\tvec3 uvw1 = vec3((tex_x + 1.0 + uvwz.y) / Number(SCATTERING_TEXTURE_NU_SIZE),\n"
+	"\t\t    uvwz.z, uvwz.w);\n"
+	"\n"
+	"\t\tvec4 rayleigh_mie_i = vec4(texture(scattering_density_texture, \n"
+	"\t\t\tuvw0) * (1.0 - lerp) + texture(scattering_density_texture, uvw1) * lerp);\n"
+	"\n"
+	"\t    // Sample weight (from the trapezoidal rule).\n"
+	"\t    Number weight_i = (i == 0 || i == SAMPLE_COUNT) \? 0.5 : 1.0;\n"
+	"\t    rayleigh_mie_sum += rayleigh_mie_i * weight_i;\t\t\n"
+	"\t}\n"
+	"\n"
+	"\treturn rayleigh_mie_sum;\n"
+	"}\n"
+	"\n"
+	"/*\n"
+	"<h4 id=\"multiple_scattering_lookup\">Lookup</h4>\n"
+	"\n"
+	"<p>Likewise, we can simply reuse the lookup function <code>GetScattering</code>\n"
+	"implemented for single scattering to read a value from the precomputed textures\n"
+	"for multiple scattering. In fact, this is what we did above in the\n"
+	"<code>ComputeScatteringDensity</code> and <code>ComputeMultipleScattering</code>\n"
+	"functions.\n"
+	"\n"
+	"<h3 id=\"irradiance\">Ground irradiance</h3>\n"
+	"\n"
+	"<p>The ground irradiance is the Sun light received on the ground after $n \\ge 0$\n"
+	"bounces (where a bounce is either a scattering event or a reflection on the\n"
+	"ground). We need this for two purposes:\n"
+	"<ul>\n"
+	"<li>while precomputing the $n$-th order of scattering, with $n \\ge 2$, in order\n"
+	"to compute the contribution of light paths whose $(n-1)$-th bounce is on the\n"
+	"ground (which requires the ground irradiance after $n-2$ bounces - see the\n"
+	"<a href=\"#multiple_scattering_computation\">Multiple scattering</a>\n"
+	"section),</li>\n"
+	"<li>at rendering time, to compute the contribution of light paths whose last\n"
+	"bounce is on the ground (these paths are excluded, by definition, from our\n"
+	"precomputed scattering textures)</li>\n"
+	"</ul>\n"
+	"\n"
+	"<p>In the first case we only need the ground irradiance for horizontal surfaces\n"
+	"at the bottom of the atmosphere (during precomputations we assume a perfectly\n"
+	"spherical ground with a uniform albedo). In the second case, however, we need\n"
+	"the ground irradiance for any altitude and any surface normal, and we want to\n"
+	"precompute it for efficiency. In fact, as described in our\n"
+	"<a href=\"https://hal.inria.fr/inria-00288758/en\">paper</a> we precompute it only\n"
+	"for horizontal surfaces, at any altitude (which requires only 2D textures,\n"
+	"instead of 4D textures for the general case), and we use approximations for\n"
+	"non-horizontal surfaces.\n"
+	"\n"
+	"<p>The following sections describe how we compute the ground irradiance, how we\n"
+	"store it in a precomputed texture, and how we read it back.\n"
+	"\n"
+	"<h4 id=\"irradiance_computation\">Computation</h4>\n"
+	"\n"
+	"<p>The ground irradiance computation is different for the direct irradiance,\n"
+	"i.e. the light received directly from the Sun, without any intermediate bounce,\n"
+	"and for the indirect irradiance (at least one bounce). We start here with the\n"
+	"direct irradiance.\n"
+	"\n"
+	"<p>The irradiance is the integral over an hemisphere of the incident radiance,\n"
+	"times a cosine factor. For the direct ground irradiance, the incident radiance\n"
+	"is the Sun radiance at the top of the atmosphere, times the transmittance\n"
+	"through the atmosphere. And, since this radiance is zero outside the small solid\n"
+	"angle of the Sun, we can approximate the irradiance integral with the Sun\n"
+	"radiance, times the Sun solid angle (yielding the solar irradiance), times the\n"
+	"transmittance and the cosine factor for the Sun direction, i.e. $\\mu_s$. This\n"
+	"yields the following implementation:\n"
+	"*/\n"
+	"\n"
+	"IrradianceSpectrum ComputeDirectIrradiance(\n"
+	"    IN(AtmosphereParameters) atmosphere,\n"
+	"    IN(TransmittanceTexture) transmittance_texture,\n"
+	"    Length r, Number mu_s) {\n"
+	"  assert(r >= atmosphere.bottom_radius && r <= atmosphere.top_radius);\n"
+	"  assert(mu_s >= -1.0 && mu_s <= 1.0);\n"
+	"\n"
+	"  return atmosphere.solar_irradiance *\n"
+	"      GetTransmittanceToTopAtmosphereBoundary(\n"
+	"          atmosphere, transmittance_texture, r, mu_s) * max(mu_s, 0.0);\n"
+	"}\n"
+	"\n"
+	"/*\n"
+	"<p>For the indirect ground irradiance the integral over the hemisphere must be\n"
+	"computed numerically. More precisely we need to compute the integral over all\n"
+	"the directions $\\bw$ of the hemisphere, of the product of:\n"
+	"<ul>\n"
+	"<li>the radiance arriving from direction $\\bw$ after $n$ bounces,\n"
+	"<li>the cosine factor, i.e. $\\omega_z$</li>\n"
+	"</ul>\n"
+	"This leads to the following implementation (where\n"
+	"<code>multiple_scattering_texture</code> is supposed to contain the $n$-th\n"
+	"order of scattering, if $n>1$, and <code>scattering_order</code> is equal to\n"
+	"$n$):</li>\n"
+	"*/\n"
+	"\n"
+	"IrradianceSpectrum ComputeIndirectIrradiance(\n"
+	"    IN(AtmosphereParameters) atmosphere,\n"
+	"    IN(ReducedScatteringTexture) single_rayleigh_scattering_texture,\n"
+	"    IN(ReducedScatteringTexture) single_mie_scattering_texture,\n"
+	"    IN(ScatteringTexture) multiple_scattering_texture,\n"
+	"    Length r, Number mu_s, int scattering_order) {\n"
+	"  assert(r >= atmosphere.bottom_radius && r <= atmosphere.top_radius);\n"
+	"  assert(mu_s >= -1.0 && mu_s <= 1.0);\n"
+	"  assert(scattering_order >= 1);\n"
+	"\n"
+	"  const int SAMPLE_COUNT = 32;\n"
+	"  const Angle dphi = pi / Number(SAMPLE_COUNT);\n"
+	"  const Angle dtheta = pi / Number(SAMPLE_COUNT);\n"
+	"\n"
+	"  IrradianceSpectrum result =\n"
+	"      IrradianceSpectrum(0.0 * watt_per_square_meter_per_nm);\n"
+	"  vec3 omega_s = vec3(sqrt(1.0 - mu_s * mu_s), 0.0, mu_s);\n"
+	"  for (int j = 0; j < SAMPLE_COUNT / 2; ++j) {\n",
+	"    Angle theta = (Number(j) + 0.5) * dtheta;\n"
+	"    bool ray_r_theta_intersects_ground =\n"
+	"        RayIntersectsGround(atmosphere, r, cos(theta));\n"
+	"    for (int i = 0; i < 2 * SAMPLE_COUNT; ++i) {\n"
+	"      Angle phi = (Number(i) + 0.5) * dphi;\n"
+	"      vec3 omega =\n"
+	"          vec3(cos(phi) * sin(theta), sin(phi) * sin(theta), cos(theta));\n"
+	"      SolidAngle domega = (dtheta / rad) * (dphi / rad) * sin(theta) * sr;\n"
+	"\n"
+	"      Number nu = dot(omega, omega_s);\n"
+	"      result += GetScattering(atmosphere, single_rayleigh_scattering_texture,\n"
+	"          single_mie_scattering_texture, multiple_scattering_texture,\n"
+	"          r, omega.z, mu_s, nu, ray_r_theta_intersects_ground,\n"
+	"          scattering_order) *\n"
+	"              omega.z * domega;\n"
+	"    }\n"
+	"  }\n"
+	"  return result;\n"
+	"}\n"
+	"\n"
+	"/*\n"
+	"<h4 id=\"irradiance_precomputation\">Precomputation</h4>\n"
+	"\n"
+	"<p>In order to precompute the ground irradiance in a texture we need a mapping\n"
+	"from the ground irradiance parameters to texture coordinates. Since we\n"
+	"precompute the ground irradiance only for horizontal surfaces, this irradiance\n"
+	"depends only on $r$ and $\\mu_s$, so we need a mapping from $(r,\\mu_s)$ to\n"
+	"$(u,v)$ texture coordinates. The simplest, affine mapping is sufficient here,\n"
+	"because the ground irradiance function is very smooth:\n"
+	"*/\n"
+	"\n"
+	"vec2 GetIrradianceTextureUvFromRMuS(IN(AtmosphereParameters) atmosphere,\n"
+	"    Length r, Number mu_s) {\n"
+	"  assert(r >= atmosphere.bottom_radius && r <= atmosphere.top_radius);\n"
+	"  assert(mu_s >= -1.0 && mu_s <= 1.0);\n"
+	"  Number x_r = (r - atmosphere.bottom_radius) /\n"
+	"      (atmosphere.top_radius - atmosphere.bottom_radius);\n"
+	"  Number x_mu_s = mu_s * 0.5 + 0.5;\n"
+	"  return vec2(GetTextureCoordFromUnitRange(x_mu_s, IRRADIANCE_TEXTURE_WIDTH),\n"
+	"              GetTextureCoordFromUnitRange(x_r, IRRADIANCE_TEXTURE_HEIGHT));\n"
+	"}\n"
+	"\n"
+	"/*\n"
+	"<p>The inverse mapping follows immediately:\n"
+	"*/\n"
+	"\n"
+	"void GetRMuSFromIrradianceTextureUv(IN(AtmosphereParameters) atmosphere,\n"
+	"    IN(vec2) uv, OUT(Length) r, OUT(Number) mu_s) {\n"
+	"  assert(uv.x >= 0.0 && uv.x <= 1.0);\n"
+	"  assert(uv.y >= 0.0 && uv.y <= 1.0);\n"
+	"  Number x_mu_s = GetUnitRangeFromTextureCoord(uv.x, IRRADIANCE_TEXTURE_WIDTH);\n"
+	"  Number x_r = GetUnitRangeFromTextureCoord(uv.y, IRRADIANCE_TEXTURE_HEIGHT);\n"
+	"  r = atmosphere.bottom_radius +\n"
+	"      x_r * (atmosphere.top_radius - atmosphere.bottom_radius);\n"
+	"  mu_s = ClampCosine(2.0 * x_mu_s - 1.0);\n"
+	"}\n"
+	"\n"
+	"/*\n"
+	"<p>It is now easy to define a fragment shader function to precompute a texel of\n"
+	"the ground irradiance texture, for the direct irradiance:\n"
+	"*/\n"
+	"\n"
+	"IrradianceSpectrum ComputeDirectIrradianceTexture(\n"
+	"    IN(AtmosphereParameters) atmosphere,\n"
+	"    IN(TransmittanceTexture) transmittance_texture,\n"
+	"    IN(vec2) frag_coord) {\n"
+	"  const vec2 IRRADIANCE_TEXTURE_SIZE =\n"
+	"      vec2(IRRADIANCE_TEXTURE_WIDTH, IRRADIANCE_TEXTURE_HEIGHT);\n"
+	"  Length r;\n"
+	"  Number mu_s;\n"
+	"  GetRMuSFromIrradianceTextureUv(\n"
+	"      atmosphere, frag_coord / IRRADIANCE_TEXTURE_SIZE, r, mu_s);\n"
+	"  return ComputeDirectIrradiance(atmosphere, transmittance_texture, r, mu_s);\n"
+	"}\n"
+	"\n"
+	"/*\n"
+	"<p>and the indirect one:\n"
+	"*/\n"
+	"\n"
+	"IrradianceSpectrum ComputeIndirectIrradianceTexture(\n"
+	"    IN(AtmosphereParameters) atmosphere,\n"
+	"    IN(ReducedScatteringTexture) single_rayleigh_scattering_texture,\n"
+	"    IN(ReducedScatteringTexture) single_mie_scattering_texture,\n"
+	"    IN(ScatteringTexture) multiple_scattering_texture,\n"
+	"    IN(vec2) frag_coord, int scattering_order) {\n"
+	"  const vec2 IRRADIANCE_TEXTURE_SIZE =\n"
+	"      vec2(IRRADIANCE_TEXTURE_WIDTH, IRRADIANCE_TEXTURE_HEIGHT);\n"
+	"  Length r;\n"
+	"  Number mu_s;\n"
+	"  GetRMuSFromIrradianceTextureUv(\n"
+	"      atmosphere, frag_coord / IRRADIANCE_TEXTURE_SIZE, r, mu_s);\n"
+	"  return ComputeIndirectIrradiance(atmosphere,\n"
+	"      single_rayleigh_scattering_texture, single_mie_scattering_texture,\n"
+	"      multiple_scattering_texture, r, mu_s, scattering_order);\n"
+	"}\n"
+	"\n"
+	"/*\n"
+	"<h4 id=\"irradiance_lookup\">Lookup</h4>\n"
+	"\n"
+	"<p>Thanks to these precomputed textures, we can now get the ground irradiance\n"
+	"with a single texture lookup:\n"
+	"*/\n"
+	"\n"
+	"IrradianceSpectrum GetIrradiance(\n"
+	"    IN(AtmosphereParameters) atmosphere,\n"
+	"    IN(IrradianceTexture) irradiance_texture,\n"
+	"    Length r, Number mu_s) {\n"
+	"  vec2 uv = GetIrradianceTextureUvFromRMuS(atmosphere, r, mu_s);\n"
+	"  return IrradianceSpectrum(texture(irradiance_texture, uv));\n"
+	"}\n"
+	"\n"
+	"/*\n"
+	"<h3 id=\"rendering\">Rendering</h3>\n"
+	"\n"
+	"<p>Here we assume that the transmittance, scattering and irradiance textures\n"
+	"have been precomputed, and we provide functions using them to compute the sky\n"
+	"color, the aerial perspective, and the ground radiance.\n"
+	"\n"
+	"<p>More precisely, we assume that the single Rayleigh scattering, without its\n"
+	"phase function term, plus the multiple scattering terms (divided by the Rayleigh\n"
+	"phase function for dimensional homogeneity) are stored in a\n"
+	"<code>scattering_texture</code>. We also assume that the single Mie scattering\n"
+	"is stored, without its phase function term:\n"
+	"<ul>\n"
+	"<li>either separately, in a <code>single_mie_scattering_texture</code> (this\n"
+	"option was not provided our <a href=\n"
+	"\"http://evasion.inrialpes.fr/~Eric.Bruneton/PrecomputedAtmosphericScattering2.zip\"\n"
+	">original implementation</a>),</li>\n"
+	"<li>or, if the <code>COMBINED_SCATTERING_TEXTURES</code> preprocessor\n"
+	"macro is defined, in the <code>scattering_texture</code>. In this case, which is\n"
+	"only available with a GLSL compiler, Rayleigh and multiple scattering are stored\n"
+	"in the RGB channels, and the red component of the single Mie scattering is\n"
+	"stored in the alpha channel).</li>\n"
+	"</ul>\n"
+	"\n"
+	"<p>In the second case, the green and blue components of the single Mie\n"
+	"scattering are extrapolated as described in our\n"
+	"<a href=\"https://hal.inria.fr/inria-00288758/en\">paper</a>, with the following\n"
+	"function:\n"
+	"*/\n"
+	"\n"
+	"#ifdef COMBINED_SCATTERING_TEXTURES\n"
+	"vec3 GetExtrapolatedSingleMieScattering(\n"
+	"    IN(AtmosphereParameters) atmosphere, IN(vec4) scattering) {\n"
+	"  if (scattering.r == 0.0) {\n"
+	"    return vec3(0.0);\n"
+	"  }\n"
+	"  return scattering.rgb * scattering.a / scattering.r *\n"
+	"\t    (atmosphere.rayleigh_scattering.r / atmosphere.mie_scattering.r) *\n"
+	"\t    (atmosphere.mie_scattering / atmosphere.rayleigh_scattering);\n"
+	"}\n"
+	"#endif\n"
+	"\n"
+	"/*\n"
+	"We can then retrieve all the scattering components (Rayleigh + multiple\n"
+	"scattering on one side, and single Mie scattering on the other side) with the\n"
+	"following function, based on GetScattering (we duplicate some code here, instead of \n"
+	"using two calls to GetScattering, to make sure that the texture coordinates \n"
+	"computation is shared between the lookups in scattering_texture and\n"
+	"single_mie_scattering_texture):\n"
+	"*/\n"
+	"\n"
+	"IrradianceSpectrum GetCombinedScattering(\n"
+	"    IN(AtmosphereParameters) atmosphere,\n"
+	"    IN(ReducedScatteringTexture) scattering_texture,\n"
+	"    IN(ReducedScatteringTexture) single_mie_scattering_texture,\n"
+	"    Length r, Number mu, Number mu_s, Number nu,\n"
+	"    bool ray_r_mu_intersects_ground,\n"
+	"    OUT(IrradianceSpectrum) single_mie_scattering) {\n"
+	"  vec4 uvwz = GetScatteringTextureUvwzFromRMuMuSNu(\n"
+	"      atmosphere, r, mu, mu_s, nu, ray_r_mu_intersects_ground);\n"
+	"  Number tex_coord_x = uvwz.x * Number(SCATTERING_TEXTURE_NU_SIZE - 1);\n"
+	"  Number tex_x = floor(tex_coord_x);\n"
+	"  Number lerp = tex_coord_x - tex_x;\n"
+	"  vec3 uvw0 = vec3((tex_x + uvwz.y) / Number(SCATTERING_TEXTURE_NU_SIZE),\n"
+	"      uvwz.z, uvwz.w);\n"
+	"  vec3 uvw1 = vec3((tex_x + 1.0 + uvwz.y) / Number(SCATTERING_TEXTURE_NU_SIZE),\n"
+	"      uvwz.z, uvwz.w);\n"
+	"#ifdef COMBINED_SCATTERING_TEXTURES\n"
+	"  vec4 combined_scattering =\n"
+	"      texture(scattering_texture, uvw0) * (1.0 - lerp) +\n"
+	"      texture(scattering_texture, uvw1) * lerp;\n"
+	"  IrradianceSpectrum scattering = IrradianceSpectrum(combined_scattering);\n"
+	"  single_mie_scattering =\n"
+	"      GetExtrapolatedSingleMieScattering(atmosphere, combined_scattering);\n"
+	"#else\n"
+	"  IrradianceSpectrum scattering = IrradianceSpectrum(\n"
+	"      texture(scattering_texture, uvw0) * (1.0 - lerp) +\n"
+	"      texture(scattering_texture, uvw1) * lerp);\n"
+	"  single_mie_scattering = IrradianceSpectrum(\n"
+	"      texture(single_mie_scattering_texture, uvw0) * (1.0 - lerp) +\n"
+	"      texture(single_mie_scattering_texture, uvw1) * lerp);\n"
+	"#endif\n"
+	"  return scattering;\n"
+	"}\n"
+	"\n"
+	"/*\n"
+	"<h4 id=\"rendering_sky\">Sky</h4>\n"
+	"\n"
+	"<p>To render the sky we simply need to display the sky radiance, which we can\n"
+	"get with a lookup in the precomputed scattering texture(s), multiplied by the\n"
+	"phase function terms that were omitted during precomputation. We can also return\n"
+	"the transmittance of the atmosphere (which we can get with a single lookup in\n"
+	"the precomputed transmittance texture), which is needed to correctly render the\n"
+	"objects in space (such as the Sun and the Moon). This leads to the following\n"
+	"function, where most of the computations are used to correctly handle the case\n"
+	"of viewers outside the atmosphere, and the case of light shafts:\n"
+	"*/\n"
+	"\n"
+	"RadianceSpectrum GetSkyRadiance(\n"
+	"    IN(AtmosphereParameters) atmosphere,\n"
+	"    IN(TransmittanceTexture) transmittance_texture,\n"
+	"    IN(ReducedScatteringTexture) scattering_texture,\n"
+	"    IN(ReducedScatteringTexture) single_mie_scattering_texture,\n"
+	"    Position camera, IN(Direction) view_ray, Length shadow_length,\n"
+	"    IN(Direction) sun_direction, OUT(DimensionlessSpectrum) transmittance) \n"
+	"{\n"
+	"\t// Compute the distance to the top atmosphere boundary along the view ray,\n"
+	"\t// assuming the viewer is in space (or NaN if the view ray does not intersect\n"
+	"\t// the atmosphere).\n"
+	"\tLength r = length(camera);\n"
+	"\tLength rmu = dot(camera, view_ray);\n"
+	"\tLength distance_to_top_atmosphere_boundary = -rmu -\n"
+	"\t    sqrt(rmu * rmu - r * r + atmosphere.top_radius * atmosphere.top_radius);\n"
+	"\t// If the viewer is in space and the view ray intersects the atmosphere, move\n"
+	"\t// the viewer to the top atmosphere boundary (along the view ray):\n"
+	"\tif (distance_to_top_atmosphere_boundary > 0.0 * m) \n"
+	"\t{\n"
+	"\t\tcamera = camera + view_ray * distance_to_top_atmosphere_boundary;\n"
+	"\t\tr = atmosphere.top_radius;\n"
+	"\t\trmu += distance_to_top_atmosphere_boundary;\n"
+	"\t}\n"
+	"\n"
+	"\t// If the view ray does not intersect the atmosphere, simply return 0.\n"
+	"\tif (r > atmosphere.top_radius) \n"
+	"\t{\n"
+	"\t\ttransmittance = DimensionlessSpectrum(1.0);\n"
+	"\t\treturn RadianceSpectrum(0.0 * watt_per_square_meter_per_sr_per_nm);\n"
+	"\t}\n"
+	"\n"
+	"\t// Compute the r, mu, mu_s and nu parameters needed for the texture lookups.\n"
+	"\tNumber mu = rmu / r;\n"
+	"\tNumber mu_s = dot(camera, sun_direction) / r;\n"
+	"\tNumber nu = dot(view_ray, sun_direction);\n"
+	"\tbool ray_r_mu_intersects_ground = RayIntersectsGround(atmosphere, r, mu);\n"
+	"\n"
+	"\ttransmittance = ray_r_mu_intersects_ground \? DimensionlessSpectrum(0.0) :\n"
+	"\t  GetTransmittanceToTopAtmosphereBoundary(\n"
+	"\t      atmosphere, transmittance_texture, r, mu);\n"
+	"\tIrradianceSpectrum single_mie_scattering;\n"
+	"\tIrradianceSpectrum scattering;\n"
+	"\n"
+	"\tif (shadow_length == 0.0 * m) \n"
+	"\t{\n"
+	"\t\tscattering = GetCombinedScattering(\n"
+	"\t    \tatmosphere, scattering_texture, single_mie_scattering_texture,\n"
+	"\t    \tr, mu, mu_s, nu, ray_r_mu_intersects_ground,\n"
+	"\t    \tsingle_mie_scattering);\n"
+	"\t} \n"
+	"\telse \n"
+	"\t{\n"
+	"\t\t// Case of light shafts (shadow_length is the total length noted l in our\n"
+	"\t\t// paper): we omit the scattering between the camera and the point at\n"
+	"\t\t// distance l, by implementing Eq. (18) of the paper (shadow_transmittance\n"
+	"\t\t// is the T(x,x_s) term, scattering is the S|x_s=x+lv term).\n"
+	"\t\tLength d = shadow_length;\n"
+	"\t\tLength r_p =\n"
+	"\t    \tClampRadius(atmosphere, sqrt(d * d + 2.0 * r * mu * d + r * r));\n"
+	"\t\tNumber mu_p = (r * mu + d) / r_p;\n"
+	"\t\tNumber mu_s_p = (r * mu_s + d * nu) / r_p;\n"
+	"\n"
+	"\t\tscattering = GetCombinedScattering(\n"
+	"\t    \tatmosphere, scattering_texture, single_mie_scattering_texture,\n"
+	"\t    \tr_p, mu_p, mu_s_p, nu, ray_r_mu_intersects_ground,\n"
+	"\t    \tsingle_mie_scattering);\n"
+	"\t\tDimensionlessSpectrum shadow_transmittance =\n"
+	"\t   \t    GetTransmittance(atmosphere, transmittance_texture,\n"
+	"\t        \tr, mu, shadow_length, ray_r_mu_intersects_ground);\n"
+	"\t\tscattering = scattering * shadow_transmittance;\n"
+	"\t\tsingle_mie_scattering = single_mie_scattering * shadow_transmittance;\n"
+	"\t}\n"
+	"\n"
+	"\treturn scattering * RayleighPhaseFunction(nu) + single_mie_scattering *\n"
+	"\t\tMiePhaseFunction(atmosphere.mie_phase_function_g, nu);\n"
+	"}\n"
+	"\n"
+	"/*\n"
+	"<h4 id=\"rendering_aerial_perspective\">Aerial perspective</h4>\n"
+	"\n"
+	"<p>To render the aerial perspective we need the transmittance and the scattering\n"
+	"between two points (i.e. between the viewer and a point on the ground, which can\n"
+	"at an arbibrary altitude). We already have a function to compute the\n"
+	"transmittance between two points (using 2 lookups in a texture which only\n"
+	"contains the transmittance to the top of the atmosphere), but we don't have one\n"
+	"for the scattering between 2 points. Hopefully, the scattering between 2 points\n"
+	"can be computed from two lookups in a texture which contains the scattering to\n"
+	"the nearest atmosphere boundary, as for the transmittance (except that here the\n"
+	"two lookup results must be subtracted, instead of divided). This is what we\n"
+	"implement in the following function (the initial computations are used to\n"
+	"correctly handle the case of viewers outside the atmosphere):\n"
+	"*/\n"
+	"\n"
+	"RadianceSpectrum GetSkyRadianceToPoint(\n"
+	"    IN(AtmosphereParameters) atmosphere,\n"
+	"    IN(TransmittanceTexture) transmittance_texture,\n"
+	"    IN(ReducedScatteringTexture) scattering_texture,\n"
+	"    IN(ReducedScatteringTexture) single_mie_scattering_texture,\n"
+	"    Position camera, IN(Position) point, Length shadow_length,\n"
+	"    IN(Direction) sun_direction, OUT(DimensionlessSpectrum) transmittance) {\n"
+	"  // Compute the distance to the top atmosphere boundary along the view ray,\n"
+	"  // assuming the viewer is in space (or NaN if the view ray does not intersect\n"
+	"  // the atmosphere).\n"
+	"  Direction view_ray = normalize(point - camera);\n"
+	"  Length r = length(camera);\n"
+	"  Length rmu = dot(camera, view_ray);\n"
+	"  Length distance_to_top_atmosphere_boundary = -rmu -\n"
+	"      sqrt(rmu * rmu - r * r + atmosphere.top_radius * atmosphere.top_radius);\n"
+	"  // If the viewer is in space and the view ray intersects the atmosphere, move\n"
+	"  // the viewer to the top atmosphere boundary (along the view ray):\n"
+	"  if (distance_to_top_atmosphere_boundary > 0.0 * m) {\n"
+	"    camera = camera + view_ray * distance_to_top_atmosphere_boundary;\n"
+	"    r = atmosphere.top_radius;\n"
+	"    rmu += distance_to_top_atmosphere_boundary;\n"
+	"  }\n"
+	"\n"
+	"  // Compute the r, mu, mu_s and nu parameters for the first texture lookup.\n"
+	"  Number mu = rmu / r;\n"
+	"  Number mu_s = dot(camera, sun_direction) / r;\n"
+	"  Number nu = dot(view_ray, sun_direction);\n"
+	"  Length d = length(point - camera);\n"
+	"  bool ray_r_mu_intersects_ground = RayIntersectsGround(atmosphere, r, mu);\n"
+	"\n"
+	"  transmittance = GetTransmittance(atmosphere, transmittance_texture,\n"
+	"      r, mu, d, ray_r_mu_intersects_ground);\n"
+	"\n"
+	"  IrradianceSpectrum single_mie_scattering;\n"
+	"  IrradianceSpectrum scattering = GetCombinedScattering(\n"
+	"      atmosphere, scattering_texture, single_mie_scattering_texture,\n"
+	"      r, mu, mu_s, nu, ray_r_mu_intersects_ground,\n"
+	"      single_mie_scattering);\n"
+	"\n"
+	"  // Compute the r, mu, mu_s and nu parameters for the second texture lookup.\n"
+	"  // If shadow_length is not 0 (case of light shafts), we want to ignore the\n"
+	"  // scattering along the last shadow_length meters of the view ray, which we\n"
+	"  // do by subtracting shadow_length from d (this way scattering_p is equal to\n"
+	"  // the S|x_s=x_0-lv term in Eq. (17) of our paper).\n"
+	"  d = max(d - shadow_length, 0.0 * m);\n"
+	"  Length r_p = ClampRadius(atmosphere, sqrt(d * d + 2.0 * r * mu * d + r * r));\n"
+	"  Number mu_p = (r * mu + d) / r_p;\n"
+	"  Number mu_s_p = (r * mu_s + d * nu) / r_p;\n"
+	"\n"
+	"  IrradianceSpectrum single_mie_scattering_p;\n"
+	"  IrradianceSpectrum scattering_p = GetCombinedScattering(\n"
+	"      atmosphere, scattering_texture, single_mie_scattering_texture,\n"
+	"      r_p, mu_p, mu_s_p, nu, ray_r_mu_intersects_ground,\n"
+	"      single_mie_scattering_p);\n"
+	"\n"
+	"  // Combine the lookup results to get the scattering between camera and point.\n"
+	"  DimensionlessSpectrum shadow_transmittance = transmittance;\n"
+	"  if (shadow_length > 0.0 * m) {\n"
+	"    // This is the T(x,x_s) term in Eq. (17) of our paper, for light shafts.\n"
+	"    shadow_transmittance = GetTransmittance(atmosphere, transmittance_texture,\n"
+	"        r, mu, d, ray_r_mu_intersects_ground);\n"
+	"  }\n"
+	"  scattering = scattering - shadow_transmittance * scattering_p;\n"
+	"  single_mie_scattering =\n"
+	"      single_mie_scattering - shadow_transmittance * single_mie_scattering_p;\n"
+	"#ifdef COMBINED_SCATTERING_TEXTURES\n"
+	"  single_mie_scattering = GetExtrapolatedSingleMieScattering(\n"
+	"      atmosphere, vec4(scattering, single_mie_scattering.r));\n"
+	"#endif\n"
+	"\n"
+	"  // Hack to avoid rendering artifacts when the sun is below the horizon.\n"
+	"  single_mie_scattering = single_mie_scattering *\n"
+	"      smoothstep(Number(0.0), Number(0.01), mu_s);\n"
+	"\n"
+	"  return scattering * RayleighPhaseFunction(nu) + single_mie_scattering *\n"
+	"      MiePhaseFunction(atmosphere.mie_phase_function_g, nu);\n"
+	"}\n"
+	"\n"
+	"/*\n"
+	"<h4 id=\"rendering_ground\">Ground</h4>\n"
+	"\n"
+	"<p>To render the ground we need the irradiance received on the ground after 0 or\n"
+	"more bounce(s) in the atmosphere or on the ground. The direct irradiance can be\n"
+	"computed with a lookup in the transmittance texture, while the indirect\n"
+	"irradiance is given by a lookup in the precomputed irradiance texture (this\n"
+	"texture only contains the irradiance for horizontal surfaces; we use the\n"
+	"approximation defined in our\n"
+	"<a href=\"https://hal.inria.fr/inria-00288758/en\">paper</a> for the other cases).\n"
+	"\n"
+	"<p>Note that it is useful here to take the angular size of the sun into account.\n"
+	"With a punctual light source (as we assumed in all the above functions), the\n"
+	"direct irradiance on a slanted surface would be discontinuous when the sun\n"
+	"moves across the horizon. With an area light source this discontinuity issue\n"
+	"disappears because the visible sun area decreases continously as the sun moves\n"
+	"across the horizon.\n"
+	"\n"
+	"<p>Taking the angular size of the sun into account, without approximations, is\n"
+	"quite complex because the visible sun area is restricted both by the distant\n"
+	"horizon and by the local surface. Here we ignore the masking by the local\n"
+	"surface, and we approximate the masking by the horizon with a\n"
+	"<code>smoothstep</code>.\n"
+	"\n"
+	"<p>The smoothstep approximation is justified as follows. When the sun, of\n"
+	"angular radius $\\alpha_s$, is at an angle $\\alpha$ above the horizon (we assume\n"
+	"that $\\alpha$ is between $-\\alpha_s$ and $\\alpha_s$), the fraction $f$ of its\n"
+	"surface which is visible can be computed from the area of a <a\n"
+	"href=\"https://en.wikipedia.org/wiki/Circular_segment\">circular segment</a>:\n"
+	"$f(\\alpha)=(\\theta-\\sin\\theta)/2\\pi$, with\n"
+	"$\\theta=2\\arccos(-\\alpha/\\alpha_s)$. The smoothstep approximation is justified\n"
+	"by the fact that $f$, expressed as a function of the cosine of the sun zenith\n"
+	"angle, $\\mu_s=\\sin\\alpha\\approx\\alpha$, is quite similar to\n"
+	"<code>smoothstep(-alpha_s, alpha_s, mu_s)</code>.\n"
+	"\n"
+	"<p>The function below returns the direct and indirect irradiances separately,\n"
+	"and takes the angular size of the sun into account by using the above\n"
+	"approximation:\n"
+	"*/\n"
+	"\n"
+	"IrradianceSpectrum GetSunAndSkyIrradiance(\n"
+	"    IN(AtmosphereParameters) atmosphere,\n"
+	"    IN(TransmittanceTexture) transmittance_texture,\n"
+	"    IN(IrradianceTexture) irradiance_texture,\n"
+	"    IN(Position) point, IN(Direction) normal, IN(Direction) sun_direction,\n"
+	"    OUT(IrradianceSpectrum) sky_irradiance) {\n"
+	"  Length r = length(point);\n"
+	"  Number mu_s = dot(point, sun_direction) / r;\n"
+	"\n"
+	"  // Indirect irradiance (approximated if the surface is not horizontal).\n"
+	"  sky_irradiance = GetIrradiance(atmosphere, irradiance_texture, r, mu_s) *\n"
+	"      (1.0 + dot(normal, point) / r) * 0.5;\n"
+	"\n"
+	"  // Direct irradiance.\n"
+	"  return atmosphere.solar_irradiance \n"
+	"         *\n"
+	"         GetTransmittanceToTopAtmosphereBoundary(atmosphere, transmittance_texture, r, mu_s) \n"
+	"         *\n"
+	"         smoothstep(-atmosphere.sun_angular_radius / rad, atmosphere.sun_angular_radius / rad, mu_s) \n"
+	"         *\n"
+	"         max(dot(normal, sun_direction), 0.0);\n"
+	"}\n",
+};
+
+// demo.c
+const char* const kFile2Pieces[] = {
+	"/**\n"
+	" * Copyright (c) 2017 Eric Bruneton\n"
+	" * All rights reserved.\n"
+	" *\n"
+	" * Redistribution and use in source and binary forms, with or without\n"
+	" * modification, are permitted provided that the following conditions\n"
+	" * are met:\n"
+	" * 1. Redistributions of source code must retain the above copyright\n"
+	" *    notice, this list of conditions and the following disclaimer.\n"
+	" * 2. Redistributions in binary form must reproduce the above copyright\n"
+	" *    notice, this list of conditions and the following disclaimer in the\n"
+	" *    documentation and/or other materials provided with the distribution.\n"
+	" * 3. Neither the name of the copyright holders nor the names of its\n"
+	" *    contributors may be used to endorse or promote products derived from\n"
+	" *    this software without specific prior written permission.\n"
+	" *\n"
+	" * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS \"AS IS\"\n"
+	" * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE\n"
+	" * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE\n"
+	" * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE\n"
+	" * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR\n"
+	" * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF\n"
+	" * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS\n"
+	" * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN\n"
+	" * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)\n"
+	" * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF\n"
+	" * THE POSSIBILITY OF SUCH DAMAGE.\n"
+	" */\n"
+	"\n"
+	"/*<h2>atmosphere/demo/demo.glsl</h2>\n"
+	"\n"
+	"<p>This GLSL fragment shader is used to render our demo scene, which consists of\n"
+	"a sphere S on a purely spherical planet P. It is rendered by \"ray tracing\", i.e.\n"
+	"the vertex shader outputs the view ray direction, and the fragment shader\n"
+	"computes the intersection of this ray with the spheres S and P to produce the\n"
+	"final pixels. The fragment shader also computes the intersection of the light\n"
+	"rays with the sphere S, to compute shadows, as well as the intersections of the\n"
+	"view ray with the shadow volume of S, in order to compute light shafts.\n"
+	"\n"
+	"<p>Our fragment shader has the following inputs and outputs:\n"
+	"*/\n"
+	"\n"
+	"// camera, exposure and sun_direction change every frame, and are in the SkyFrame\n"
+	"// uniform block that Sky declares before this file.\n"
+	"uniform vec3 white_point;\n"
+	"uniform vec3 earth_center;\n"
+	"uniform vec3 sun_radiance;\n"
+	"uniform vec2 sun_size;\n"
+	"in vec3 view_ray;\n"
+	"#ifdef SKY_VIEW_LUT_PASS\n"
+	"layout(location = 0) out vec4 color;\n"
+	"#else\n"
+	"layout(location = 0) out vec3 color;\n"
+	"#endif\n"
+	"\n"
+	"/*\n"
+	"<p>It uses the following constants, as well as the following atmosphere\n"
+	"rendering functions, defined externally (by the <code>Model</code>'s\n"
+	"<code>GetShader()</code> shader). The <code>USE_LUMINANCE</code> option is used\n"
+	"to select either the functions returning radiance values, or those returning\n"
+	"luminance values (see <a href=\"../model.h.html\">model.h</a>).\n"
+	"*/\n"
+	"\n"
+	"const vec3 kSphereCenter = vec3(0.0, 0.0, 1.0);\n"
+	"const float kSphereRadius = 1.0;\n"
+	"const vec3 kSphereAlbedo = vec3(0.8);\n"
+	"const vec3 kGroundAlbedo = vec3(0.0, 0.0, 0.04);\n"
+	"\n"
+	"#ifdef USE_LUMINANCE\n"
+	"#define GetSkyRadiance GetSkyLuminance\n"
+	"#define GetSkyRadianceToPoint GetSkyLuminanceToPoint\n"
+	"#define GetSunAndSkyIrradiance GetSunAndSkyIlluminance\n"
+	"#endif\n"
+	"\n"
+	"/*<h3>Shadows and light shafts</h3>\n"
+	"\n"
+	"<p>The functions to compute shadows and light shafts must be defined before we\n"
+	"can use them in the main shader function, so we define them first. Testing if\n"
+	"a point is in the shadow of the sphere S is equivalent to test if the\n"
+	"corresponding light ray intersects the sphere, which is very simple to do.\n"
+	"However, this is only valid for a punctual light source, which is not the case\n"
+	"of the Sun. In the following function we compute an approximate (and biased)\n"
+	"soft shadow by taking the angular size of the Sun into account:\n"
+	"*/\n"
+	"\n"
+	"float GetSunVisibility(vec3 point, vec3 sun_direction) {\n"
+	"  vec3 p = point - kSphereCenter;\n"
+	"  float p_dot_v = dot(p, sun_direction);\n"
+	"  float p_dot_p = dot(p, p);\n"
+	"  float ray_sphere_center_squared_distance = p_dot_p - p_dot_v * p_dot_v;\n"
+	"  float distance_to_intersection = -p_dot_v - sqrt(\n"
+	"      kSphereRadius * kSphereRadius - ray_sphere_center_squared_distance);\n"
+	"  if (distance_to_intersection > 0.0) {\n"
+	"    // Compute the distance between the view ray and the sphere, and the\n"
+	"    // corresponding (tangent of the) subtended angle. Finally, use this to\n"
+	"    // compute an approximate sun visibility.\n"
+	"    float ray_sphere_distance =\n"
+	"        kSphereRadius - sqrt(ray_sphere_center_squared_distance);\n"
+	"    float ray_sphere_angular_distance = -ray_sphere_distance / p_dot_v;\n"
+	"    return smoothstep(1.0, 0.0, ray_sphere_angular_distance / sun_size.x);\n"
+	"  }\n"
+	"  return 1.0;\n"
+	"}\n"
+	"\n"
+	"/*\n"
+	"<p>The sphere also partially occludes the sky light, and we approximate this\n"
+	"effect with an ambient occlusion factor. The ambient occlusion factor due to a\n"
+	"sphere is given in <a href=\n"
+	"\"http://webserver.dmt.upm.es/~isidoro/tc3/Radiation%20View%20factors.pdf\"\n"
+	">Radiation View Factors</a> (Isidoro Martinez, 1995). In the simple case where\n"
+	"the sphere is fully visible, it is given by the following function:\n"
+	"*/\n"
+	"\n"
+	"float GetSkyVisibility(vec3 point) {\n"
+	"  vec3 p = point - kSphereCenter;\n"
+	"  float p_dot_p = dot(p, p);\n"
+	"  return\n"
+	"      1.0 + p.z / sqrt(p_dot_p) * kSphereRadius * kSphereRadius / p_dot_p;\n"
+	"}\n"
+	"\n"
+	"/*\n"
+	"<p>To compute light shafts we need the intersections of the view ray with the\n"
+	"shadow volume of the sphere S. Since the Sun is not a punctual light source this\n"
+	"shadow volume is not a cylinder but a cone (for the umbra, plus another cone for\n"
+	"the penumbra, but we ignore it here):\n"
+	"\n"
+	"<svg width=\"505px\" height=\"200px\">\n"
+	"  <style type=\"text/css\"><![CDATA[\n"
+	"    circle { fill: #000000; stroke: none; }\n"
+	"    path { fill: none; stroke: #000000; }\n"
+	"    text { font-size: 16px; font-style: normal; font-family: Sans; }\n"
+	"    .vector { font-weight: bold; }\n"
+	"  ]]></style>\n"
+	"  <path d=\"m 10,75 455,120\"/>\n"
+	"  <path d=\"m 10,125 455,-120\"/>\n"
+	"  <path d=\"m 120,50 160,130\"/>\n"
+	"  <path d=\"m 138,70 7,0 0,-7\"/>\n"
+	"  <path d=\"m 410,65 40,0 m -5,-5 5,5 -5,5\"/>\n"
+	"  <path d=\"m 20,100 430,0\" style=\"stroke-dasharray:8,4,2,4;\"/>\n"
+	"  <path d=\"m 255,25 0,155\" style=\"stroke-dasharray:2,2;\"/>\n"
+	"  <path d=\"m 280,160 -25,0\" style=\"stroke-dasharray:2,2;\"/>\n"
+	"  <path d=\"m 255,140 60,0\" style=\"stroke-dasharray:2,2;\"/>\n"
+	"  <path d=\"m 300,105 5,-5 5,5 m -5,-5 0,40 m -5,-5 5,5 5,-5\"/>\n"
+	"  <path d=\"m 265,105 5,-5 5,5 m -5,-5 0,60 m -5,-5 5,5 5,-5\"/>\n"
+	"  <path d=\"m 260,80 -5,5 5,5 m -5,-5 85,0 m -5,5 5,-5 -5,-5\"/>\n"
+	"  <path d=\"m 335,95 5,5 5,-5 m -5,5 0,-60 m -5,5 5,-5 5,5\"/>\n"
+	"  <path d=\"m 50,100 a 50,50 0 0 1 2,-14\" style=\"stroke-dasharray:2,1;\"/>\n"
+	"  <circle cx=\"340\" cy=\"100\" r=\"60\" style=\"fill: none; stroke: #000000;\"/>\n"
+	"  <circle cx=\"340\" cy=\"100\" r=\"2.5\"/>\n"
+	"  <circle cx=\"255\" cy=\"160\" r=\"2.5\"/>\n"
+	"  <circle cx=\"120\" cy=\"50\" r=\"2.5\"/>\n"
+	"  <text x=\"105\" y=\"45\" class=\"vector\">p</text>\n"
+	"  <text x=\"240\" y=\"170\" class=\"vector\">q</text>\n"
+	"  <text x=\"425\" y=\"55\" class=\"vector\">s</text>\n"
+	"  <text x=\"135\" y=\"55\" class=\"vector\">v</text>\n"
+	"  <text x=\"345\" y=\"75\">R</text>\n"
+	"  <text x=\"275\" y=\"135\">r</text>\n"
+	"  <text x=\"310\" y=\"125\">\317\201</text>\n"
+	"  <text x=\"215\" y=\"120\">d</text>\n"
+	"  <text x=\"290\" y=\"80\">\316\264</text>\n"
+	"  <text x=\"30\" y=\"95\">\316\261</text>\n"
+	"</svg>\n"
+	"\n"
+	"<p>Noting, as in the above figure, $\\bp$ the camera position, $\\bv$ and $\\bs$\n"
+	"the unit view ray and sun direction vectors and $R$ the sphere radius (supposed\n"
+	"to be centered on the origin), the point at distance $d$ from the camera is\n"
+	"$\\bq=\\bp+d\\bv$. This point is at a distance $\\delta=-\\bq\\cdot\\bs$ from the\n"
+	"sphere center along the umbra cone axis, and at a distance $r$ from this axis\n"
+	"given by $r^2=\\bq\\cdot\\bq-\\delta^2$. Finally, at distance $\\delta$ along the\n"
+	"axis the umbra cone has radius $\\rho=R-\\delta\\tan\\alpha$, where $\\alpha$ is\n"
+	"the Sun's angular radius. The point at distance $d$ from the camera is on the\n"
+	"shadow cone only if $r^2=\\rho^2$, i.e. only if\n"
+	"\\begin{equation}\n"
+	"(\\bp+d\\bv)\\cdot(\\bp+d\\bv)-((\\bp+d\\bv)\\cdot\\bs)^2=\n"
+	"(R+((\\bp+d\\bv)\\cdot\\bs)\\tan\\alpha)^2\n"
+	"\\end{equation}\n"
+	"Developping this gives a quadratic equation for $d$:\n"
+	"\\begin{equation}\n"
+	"ad^2+2bd+c=0\n"
+	"\\end{equation}\n"
+	"where\n"
+	"<ul>\n"
+	"<li>$a=1-l(\\bv\\cdot\\bs)^2$,</li>\n"
+	"<li>$b=\\bp\\cdot\\bv-l(\\bp\\cdot\\bs)(\\bv\\cdot\\bs)-\\tan(\\alpha)R(\\bv\\cdot\\bs)$,</li>\n"
+	"<li>$c=\\bp\\cdot\\bp-l(\\bp\\cdot\\bs)^2-2\\tan(\\alpha)R(\\bp\\cdot\\bs)-R^2$,</li>\n"
+	"<li>$l=1+\\tan^2\\alpha$</li>\n"
+	"</ul>\n"
+	"From this we deduce the two possible solutions for $d$, which must be clamped to\n"
+	"the actual shadow part of the mathematical cone (i.e. the slab between the\n"
+	"sphere center and the cone apex or, in other words, the points for which\n"
+	"$\\delta$ is between $0$ and $R/\\tan\\alpha$). The following function implements\n"
+	"these equations:\n"
+	"*/\n"
+	"\n"
+	"void GetSphereShadowInOut(vec3 view_direction, vec3 sun_direction,\n"
+	"    out float d_in, out float d_out) {\n"
+	"  vec3 pos = camera - kSphereCenter;\n"
+	"  float pos_dot_sun = dot(pos, sun_direction);\n"
+	"  float view_dot_sun = dot(view_direction, sun_direction);\n"
+	"  float k = sun_size.x;\n"
+	"  float l = 1.0 + k * k;\n"
+	"  float a = 1.0 - l * view_dot_sun * view_dot_sun;\n"
+	"  float b = dot(pos, view_direction) - l * pos_dot_sun * view_dot_sun -\n"
+	"      k * kSphereRadius * view_dot_sun;\n"
+	"  float c = dot(pos, pos) - l * pos_dot_sun * pos_dot_sun -\n"
+	"      2.0 * k * kSphereRadius * pos_dot_sun - kSphereRadius * kSphereRadius;\n"
+	"  float discriminant = b * b - a * c;\n"
+	"  if (discriminant > 0.0) {\n"
+	"    d_in = max(0.0, (-b - sqrt(discriminant)) / a);\n"
+	"    d_out = (-b + sqrt(discriminant)) / a;\n"
+	"    // The values of d for which delta is equal to 0 and kSphereRadius / k.\n"
+	"    float d_base = -pos_dot_sun / view_dot_sun;\n"
+	"    float d_apex = -(pos_dot_sun + kSphereRadius / k) / view_dot_sun;\n"
+	"    if (view_dot_sun > 0.0) {\n"
+	"      d_in = max(d_in, d_apex);\n"
+	"      d_out = a > 0.0 \? min(d_out, d_base) : d_base;\n"
+	"    } else {\n"
+	"      d_in = a > 0.0 \? max(d_in, d_base) : d_base;\n"
+	"      d_out = min(d_out, d_apex);\n"
+	"    }\n"
+	"  } else {\n"
+	"    d_in = 0.0;\n"
+	"    d_out = 0.0;\n"
+	"  }\n"
+	"}\n"
+	"\n"
+	"/*<h3>Sky-view LUT</h3>\n"
+	"\n"
+	"<p>The sky and the planet P only depend on the view direction, and vary slowly\n"
+	"with it (except for the Sun disc). Instead of computing them for each pixel,\n"
+	"<code>Sky::draw</code> can render them once per frame in a small sky-view LUT\n"
+	"around the camera (with <code>SKY_VIEW_LUT_PASS</code> defined), and then look\n"
+	"them up for each pixel (with <code>SKY_VIEW_LUT</code> defined), as in <a href=\n"
+	"\"https://sebh.github.io/publications/egsr2020.pdf\">A Scalable and Production\n"
+	"Ready Sky and Atmosphere Rendering Technique</a> (Sebastien Hillaire, 2020).\n"
+	"The sphere S, which is close to the camera, and the Sun disc, which is smaller\n"
+	"than a LUT texel, are still computed for each pixel.\n"
+	"\n"
+	"<p>The LUT horizontal coordinate is the view azimuth around the vertical,\n"
+	"measured from the Sun azimuth, and its vertical coordinate is the view zenith\n"
+	"angle, with a non-linear mapping which puts more texels near the horizon, where\n"
+	"the radiance varies the most. The upper half of the LUT holds the sky, the lower\n"
+	"half the ground. The LUT alpha channel holds the ground opacity:\n"
+	"*/\n"
+	"\n"
+	"#if defined(SKY_VIEW_LUT_PASS) || defined(SKY_VIEW_LUT)\n"
+	"uniform vec2 sky_view_lut_size;\n"
+	"uniform sampler2D sky_view_lut;\n"
+	"\n"
+	"void GetSkyViewFrame(out vec3 up, out vec3 forward, out vec3 right) {\n"
+	"  up = normalize(camera - earth_center);\n"
+	"  forward = sun_direction - up * dot(sun_direction, up);\n"
+	"  // Any horizontal direction if the Sun is at the zenith or at the nadir.\n"
+	"  if (dot(forward, forward) < 1e-6) {\n"
+	"    forward = cross(up, abs(up.x) < 0.9 \? vec3(1.0, 0.0, 0.0) :\n"
+	"        vec3(0.0, 1.0, 0.0));\n"
+	"  }\n"
+	"  forward = normalize(forward);\n"
+	"  right = cross(up, forward);\n"
+	"}\n"
+	"\n"
+	"// The angle between the nadir and the horizon, seen from the camera.\n"
+	"float GetHorizonNadirAngle() {\n"
+	"  float r = length(camera - earth_center);\n"
+	"  float bottom_radius = ATMOSPHERE.bottom_radius;\n"
+	"  return acos(SafeSqrt(r * r - bottom_radius * bottom_radius) / r);\n"
+	"}\n"
+	"\n"
+	"vec3 GetSkyViewDirection(vec2 frag_coord) {\n"
+	"  // Texel centers on the full [0, 1] range vertically (to include the zenith\n"
+	"  // and the nadir), and around the periodic azimuth horizontally.\n"
+	"  vec2 uv = vec2(frag_coord.x / sky_view_lut_size.x,\n"
+	"      (frag_coord.y - 0.5) / (sky_view_lut_size.y - 1.0));\n"
+	"  float beta = GetHorizonNadirAngle();\n"
+	"  float horizon_zenith_angle = PI - beta;\n"
+	"  float view_zenith_angle;\n"
+	"  if (uv.y < 0.5) {\n"
+	"    float coord = 1.0 - 2.0 * uv.y;\n"
+	"    view_zenith_angle = horizon_zenith_angle * (1.0 - coord * coord);\n"
+	"  } else {\n"
+	"    float coord = 2.0 * uv.y - 1.0;\n"
+	"    view_zenith_angle = horizon_zenith_angle + beta * coord * coord;\n"
+	"  }\n"
+	"  float azimuth = (uv.x - 0.5) * 2.0 * PI;\n"
+	"  vec3 up;\n"
+	"  vec3 forward;\n"
+	"  vec3 right;\n"
+	"  GetSkyViewFrame(up, forward, right);\n"
+	"  return up * cos(view_zenith_angle) + sin(view_zenith_angle) *\n"
+	"      (forward * cos(azimuth) + right * sin(azimuth));\n"
+	"}\n"
+	"\n"
+	"vec2 GetSkyViewLutUv(vec3 view_direction) {\n"
+	"  vec3 up;\n"
+	"  vec3 forward;\n"
+	"  vec3 right;\n"
+	"  GetSkyViewFrame(up, forward, right);\n"
+	"  float beta = GetHorizonNadirAngle();\n"
+	"  float horizon_zenith_angle = PI - beta;\n"
+	"  float view_zenith_angle = acos(clamp(dot(view_direction, up), -1.0, 1.0));\n"
+	"  float v;\n"
+	"  if (view_zenith_angle < horizon_zenith_angle) {\n"
+	"    v = 0.5 - 0.5 * SafeSqrt(1.0 - view_zenith_angle / horizon_zenith_angle);\n"
+	"  } else {\n"
+	"    v = 0.5 + 0.5 * SafeSqrt((view_zenith_angle - horizon_zenith_angle) / beta);\n"
+	"  }\n"
+	"  float azimuth =\n"
+	"      atan(dot(view_direction, right), dot(view_direction, forward));\n"
+	"  return vec2(azimuth / (2.0 * PI) + 0.5,\n"
+	"      (v * (sky_view_lut_size.y - 1.0) + 0.5) / sky_view_lut_size.y);\n"
+	"}\n"
+	"#endif\n"
+	"\n"
+	"/*<h3>Main shading function</h3>\n"
+	"\n"
+	"<p>Using these functions we can now implement the main shader function, which\n"
+	"computes the radiance from the scene for a given view ray. This function first\n"
+	"tests if the view ray intersects the sphere S. If so it computes the sun and\n"
+	"sky light received by the sphere at the intersection point, combines this with\n"
+	"the sphere BRDF and the aerial perspective between the camera and the sphere.\n"
+	"It then does the same with the ground, i.e. with the planet sphere P, and then\n"
+	"computes the sky radiance and transmittance. Finally, all these terms are\n"
+	"composited together (an opacity is also computed for each object, using an\n"
+	"approximate view cone - sphere intersection factor) to get the final radiance.\n"
+	"\n"
+	"<p>We start with the computation of the intersections of the view ray with the\n"
+	"shadow volume of the sphere, because they are needed to get the aerial\n"
+	"perspective for the sphere and the planet:\n"
+	"*/\n"
+	"\n"
+	"void main() {\n"
+	"    // Normalized view direction vector.\n"
+	"#ifdef SKY_VIEW_LUT_PASS\n"
+	"    vec3 view_direction = GetSkyViewDirection(gl_FragCoord.xy);\n"
+	"#else\n"
+	"    vec3 view_direction = normalize(view_ray);\n"
+	"#endif\n"
+	"    // Tangent of the angle subtended by this fragment.\n"
+	"    float fragment_angular_size =\n"
+	"        length(dFdx(view_ray) + dFdy(view_ray)) / length(view_ray);\n"
+	"\n"
+	"    float shadow_in;\n"
+	"    float shadow_out;\n"
+	"    GetSphereShadowInOut(view_direction, sun_direction, shadow_in, shadow_out);\n"
+	"\n"
+	"    // Hack to fade out light shafts when the Sun is very close to the horizon.\n"
+	"    float lightshaft_fadein_hack = smoothstep(\n"
+	"        0.02, 0.04, dot(normalize(camera - earth_center), sun_direction));\n"
+	"\n"
+	"\t/*\n"
+	"\t<p>We then test whether the view ray intersects the sphere S or not. If it does,\n"
+	"\twe compute an approximate (and biased) opacity value, using the same\n"
+	"\tapproximation as in <code>GetSunVisibility</code>:\n"
+	"\t*/\n"
+	"\n"
+	"    // Compute the distance between the view ray line and the sphere center,\n"
+	"    // and the distance between the camera and the intersection of the view\n"
+	"    // ray with the sphere (or NaN if there is no intersection).\n"
+	"    vec3 p = camera - kSphereCenter;\n"
+	"    float p_dot_v = dot(p, view_direction);\n"
+	"    float p_dot_p = dot(p, p);\n"
+	"    float ray_sphere_center_squared_distance = p_dot_p - p_dot_v * p_dot_v;\n"
+	"    float distance_to_intersection = -p_dot_v - sqrt(\n"
+	"        kSphereRadius * kSphereRadius - ray_sphere_center_squared_distance);\n"
+	"\n"
+	"    // Compute the radiance reflected by the sphere, if the ray intersects it.\n"
+	"    float sphere_alpha = 0.0;\n"
+	"    vec3 sphere_radiance = vec3(0.0);\n"
+	"#ifndef SKY_VIEW_LUT_PASS\n"
+	"    if (distance_to_intersection > 0.0) \n"
+	"    {\n"
+	"\t    // Compute the distance between the view ray and the sphere, and the\n"
+	"\t    // corresponding (tangent of the) subtended angle. Finally, use this to\n"
+	"\t    // compute the approximate analytic antialiasing factor sphere_alpha.\n"
+	"\t    float ray_sphere_distance =\n"
+	"\t        kSphereRadius - sqrt(ray_sphere_center_squared_distance);\n"
+	"\t    float ray_sphere_angular_distance = -ray_sphere_distance / p_dot_v;\n"
+	"\t    sphere_alpha =\n"
+	"\t        min(ray_sphere_angular_distance / fragment_angular_size, 1.0);\n"
+	"\n"
+	"\t\t/*\n"
+	"\t\t<p>We can then compute the intersection point and its normal, and use them to\n"
+	"\t\tget the sun and sky irradiance received at this point. The reflected radiance\n"
+	"\t\tfollows, by multiplying the irradiance with the sphere BRDF:\n"
+	"\t\t*/\n"
+	"\t    vec3 point = camera + view_direction * distance_to_intersection;\n"
+	"\t    vec3 normal = normalize(point - kSphereCenter);\n"
+	"\n"
+	"\t    // Compute the radiance reflected by the sphere.\n"
+	"\t    vec3 sky_irradiance;\n"
+	"\t    vec3 sun_irradiance = GetSunAndSkyIrradiance(\n"
+	"\t        point - earth_center, normal, sun_direction, sky_irradiance);\n"
+	"\t    sphere_radiance =\n"
+	"\t        kSphereAlbedo * (1.0 / PI) * (sun_irradiance + sky_irradiance);\n"
+	"\n"
+	"\t\t/*\n"
+	"\t\t<p>Finally, we take into account the aerial perspective between the camera and\n"
+	"\t\tthe sphere, which depends on the length of this segment which is in shadow:\n"
+	"\t\t*/\n"
+	"\t    float shadow_length =\n"
+	"\t        max(0.0, min(shadow_out, distance_to_intersection) - shadow_in) *\n"
+	"\t        lightshaft_fadein_hack;\n"
+	"\t    vec3 transmittance;\n"
+	"\t    vec3 in_scatter = GetSkyRadianceToPoint(camera - earth_center,\n"
+	"\t        point - earth_center, shadow_length, sun_direction, transmittance);\n"
+	"\t    sphere_radiance = sphere_radiance * transmittance + in_scatter;\n"
+	"    }\n"
+	"#endif\n"
+	"\n"
+	"#ifdef SKY_VIEW_LUT\n"
+	"\t/*\n"
+	"\t<p>With a sky-view LUT, the sky and the ground come from the LUT, and only the\n"
+	"\tSun disc is added, where the ground does not hide it:\n"
+	"\t*/\n"
+	"\n"
+	"    vec4 sky_and_ground = texture(sky_view_lut, GetSkyViewLutUv(view_direction));\n"
+	"    vec3 radiance = sky_and_ground.rgb;\n"
+	"    if (dot(view_direction, sun_direction) > sun_size.y)\n"
+	"    {\n"
+	"        vec3 camera_position = camera - earth_center;\n"
+	"        float r = clamp(length(camera_position), ATMOSPHERE.bottom_radius,\n"
+	"            ATMOSPHERE.top_radius);\n"
+	"        float mu = dot(camera_position, view_direction) / length(camera_position);\n"
+	"        radiance = radiance + (1.0 - sky_and_ground.a) * sun_radiance *\n"
+	"            GetTransmittanceToTopAtmosphereBoundary(ATMOSPHERE,\n"
+	"                transmittance_texture, r, mu);\n"
+	"    }\n"
+	"#else\n"
+	"\t/*\n"
+	"\t<p>In the following we repeat the same steps as above, but for the planet sphere\n"
+	"\tP instead of the sphere S (a smooth opacity is not really needed here, so we\n"
+	"\tdon't compute it. Note also how we modulate the sun and sky irradiance received\n"
+	"\ton the ground by the sun and sky visibility factors):\n"
+	"\t*/\n"
+	"\n"
+	"    // Compute the distance between the view ray line and the Earth center,\n"
+	"    // and the distance between the camera and the intersection of the view\n"
+	"    // ray with the ground (or NaN if there is no intersection).\n"
+	"\tp = camera - earth_center;\n"
+	"\tp_dot_v = dot(p, view_direction);\n"
+	"\tp_dot_p = dot(p, p);\n"
+	"\tfloat ray_earth_center_squared_distance = p_dot_p - p_dot_v * p_dot_v;\n"
+	"\tdistance_to_intersection = -p_dot_v - sqrt(\n"
+	"    earth_center.y * earth_center.y - ray_earth_center_squared_distance);\n"
+	"\n"
+	"    // Compute the radiance reflected by the ground, if the ray intersects it.\n"
+	"    float ground_alpha = 0.0;\n"
+	"    vec3 ground_radiance = vec3(0.0);\n"
+	"    if (distance_to_intersection > 0.0) \n"
+	"    {\n"
+	"\t    vec3 point = camera + view_direction * distance_to_intersection;\n"
+	"\t    vec3 normal = normalize(point - earth_center);\n"
+	"\n"
+	"\t    // Compute the radiance reflected by the ground.\n"
+	"\t    vec3 sky_irradiance;\n"
+	"\t    vec3 sun_irradiance = GetSunAndSkyIrradiance(\n"
+	"\t         point - earth_center, normal, sun_direction, sky_irradiance);\n"
+	"\t    ground_radiance = kGroundAlbedo * (1.0 / PI) * (\n"
+	"\t        sun_irradiance * GetSunVisibility(point, sun_direction) +\n"
+	"\t        sky_irradiance * GetSkyVisibility(point));\n"
+	"\n"
+	"\t    float shadow_length =\n"
+	"\t        max(0.0, min(shadow_out, distance_to_intersection) - shadow_in) *\n"
+	"\t        lightshaft_fadein_hack;\n"
+	"\t    vec3 transmittance;\n"
+	"\t    vec3 in_scatter = GetSkyRadianceToPoint(camera - earth_center,\n"
+	"\t        point - earth_center, shadow_length, sun_direction, transmittance);\n"
+	"\t    ground_radiance = ground_radiance * transmittance + in_scatter;\n"
+	"\t    ground_alpha = 1.0;\n"
+	"    }\n"
+	"\n"
+	"\t/*\n"
+	"\t<p>Finally, we compute the radiance and transmittance of the sky, and composite\n"
+	"\ttogether, from back to front, the radiance and opacities of all the ojects of\n"
+	"\tthe scene:\n"
+	"\t*/\n"
+	"\n"
+	"    // Compute the radiance of the sky.\n"
+	"    float shadow_length = max(0.0, shadow_out - shadow_in) *\n"
+	"        lightshaft_fadein_hack;\n"
+	"    vec3 transmittance;\n"
+	"    vec3 radiance = \n"
+	"        GetSkyRadiance(camera - earth_center, view_direction, shadow_length, sun_direction,\n"
+	"            transmittance);\n"
+	"\n"
+	"#ifndef SKY_VIEW_LUT_PASS\n"
+	"    // If the view ray intersects the Sun, add the Sun radiance.\n"
+	"    if (dot(view_direction, sun_direction) > sun_size.y) \n"
+	"    {\n"
+	"        radiance = radiance + transmittance * sun_radiance;\n"
+	"    }\n"
+	"#endif\n"
+	"\n"
+	"    radiance = mix(radiance, ground_radiance, ground_alpha);\n"
+	"#endif\n"
+	"    radiance = mix(radiance, sphere_radiance, sphere_alpha);\n"
+	"#ifdef SKY_VIEW_LUT_PASS\n"
+	"    // The Sun disc is added, and the tone mapping done, when the LUT is looked up.\n"
+	"    color = vec4(radiance, ground_alpha);\n"
+	"#else\n"
+	"    color = pow(vec3(1.0) - exp(-radiance / white_point * exposure), vec3(1.0 / 2.2));\n"
+	"#endif\n"
+	"}\n",
+};
+
+}  // anonymous namespace
+
+const ShaderSources::File ShaderSources::kFiles[] = {
+	{ "definitions.c", kFile0Pieces, sizeof(kFile0Pieces) / sizeof(kFile0Pieces[0]) },
+	{ "functions.c", kFile1Pieces, sizeof(kFile1Pieces) / sizeof(kFile1Pieces[0]) },
+	{ "demo.c", kFile2Pieces, sizeof(kFile2Pieces) / sizeof(kFile2Pieces[0]) },
+};
+
+const size_t ShaderSources::kFileCount =
+	sizeof(ShaderSources::kFiles) / sizeof(ShaderSources::kFiles[0]);
@@ -0,0 +1,74 @@
+#include "Frustum.h"
+
+Frustum::Frustum()
+{
+	for (int i = 0; i < 6; ++i)
+	{
+		m_planes[i] = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+	}
+}
+
+Frustum::~Frustum()
+{
+
+}
+
+void Frustum::extract(const glm::mat4 &viewProjection)
+{
+	// glm is column major, so row r of the matrix is (m[0][r], m[1][r], m[2][r], m[3][r])
+	glm::vec4 row0(viewProjection[0][0], viewProjection[1][0], viewProjection[2][0], viewProjection[3][0]);
+	glm::vec4 row1(viewProjection[0][1], viewProjection[1][1], viewProjection[2][1], viewProjection[3][1]);
+	glm::vec4 row2(viewProjection[0][2], viewProjection[1][2], viewProjection[2][2], viewProjection[3][2]);
+	glm::vec4 row3(viewProjection[0][3], viewProjection[1][3], viewProjection[2][3], viewProjection[3][3]);
+
+	m_planes[0] = row3 + row0;
+	m_planes[1] = row3 - row0;
+	m_planes[2] = row3 + row1;
+	m_planes[3] = row3 - row1;
+	m_planes[4] = row3 + row2;
+	m_planes[5] = row3 - row2;
+
+	for (int i = 0; i < 6; ++i)
+	{
+		float length = glm::length(glm::vec3(m_planes[i]));
+		if (length > 0.0f)
+		{
+			m_planes[i] /= length;
+		}
+	}
+}
+
+FrustumResult Frustum::classifyBox(const glm::vec3 &boxMin, const glm::vec3 &boxMax) const
+{
+	FrustumResult result = FRUSTUM_INSIDE;
+
+	for (int i = 0; i < 6; ++i)
+	{
+		const glm::vec4 &plane = m_planes[i];
+
+		// the corner furthest along the plane normal, and the one opposite to it
+		glm::vec3 positive(plane.x > 0.0f ? boxMax.x : boxMin.x,
+			plane.y > 0.0f ? boxMax.y : boxMin.y,
+			plane.z > 0.0f ? boxMax.z : boxMin.z);
+		glm::vec3 negative(plane.x > 0.0f ? boxMin.x : boxMax.x,
+			plane.y > 0.0f ? boxMin.y : boxMax.y,
+			plane.z > 0.0f ? boxMin.z : boxMax.z);
+
+		if (glm::dot(glm::vec3(plane), positive) + plane.w < 0.0f)
+		{
+			return FRUSTUM_OUTSIDE;
+		}
+
+		if (glm::dot(glm::vec3(plane), negative) + plane.w < 0.0f)
+		{
+			result = FRUSTUM_INTERSECT;
+		}
+	}
+
+	return result;
+}
+
+bool Frustum::intersectsBox(const glm::vec3 &boxMin, const glm::vec3 &boxMax) const
+{
+	return classifyBox(boxMin, boxMax) != FRUSTUM_OUTSIDE;
+}
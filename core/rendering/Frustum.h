@@ -0,0 +1,32 @@
+#ifndef FRUSTUM_H
+#define FRUSTUM_H
+
+#include <glm/glm.hpp>
+
+enum FrustumResult
+{
+	FRUSTUM_OUTSIDE,
+	FRUSTUM_INTERSECT,
+	FRUSTUM_INSIDE,
+};
+
+class Frustum
+{
+public:
+	Frustum();
+	~Frustum();
+
+	// extract the six clip planes from a view-projection matrix
+	void extract(const glm::mat4 &viewProjection);
+
+	FrustumResult classifyBox(const glm::vec3 &boxMin, const glm::vec3 &boxMax) const;
+	bool intersectsBox(const glm::vec3 &boxMin, const glm::vec3 &boxMax) const;
+
+	const glm::vec4 &getPlane(int index) const { return m_planes[index]; }
+
+private:
+	// left, right, bottom, top, near, far; xyz is the inward normal
+	glm::vec4 m_planes[6];
+};
+
+#endif // FRUSTUM_H
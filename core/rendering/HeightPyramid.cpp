@@ -0,0 +1,389 @@
+#include "HeightPyramid.h"
+#include <algorithm>
+#include <cmath>
+#include <cfloat>
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE2__)
+#define HEIGHT_PYRAMID_USE_SSE
+#include <emmintrin.h>
+#endif
+
+HeightPyramid::HeightPyramid()
+{
+	m_heights = nullptr;
+	m_rows = 0;
+	m_columns = 0;
+	m_spacing = 1.0f;
+}
+
+HeightPyramid::~HeightPyramid()
+{
+
+}
+
+void HeightPyramid::build(const float *heights, int rows, int columns, float spacing)
+{
+	clear();
+	if (heights == nullptr || rows < 2 || columns < 2)
+	{
+		return;
+	}
+
+	m_heights = heights;
+	m_rows = rows;
+	m_columns = columns;
+	m_spacing = spacing;
+
+	// level 0 has a cell per grid quad, every level above halves the one below, an odd
+	// last row or column keeping its single child
+	Level level;
+	level.rows = rows - 1;
+	level.columns = columns - 1;
+	for (;;)
+	{
+		level.minHeights.resize(level.rows * level.columns);
+		level.maxHeights.resize(level.rows * level.columns);
+		m_levels.push_back(level);
+		if (level.rows == 1 && level.columns == 1)
+		{
+			break;
+		}
+		level.rows = (level.rows + 1) / 2;
+		level.columns = (level.columns + 1) / 2;
+	}
+
+	update(0, 0, rows - 1, columns - 1);
+}
+
+void HeightPyramid::update(int i0, int j0, int i1, int j1)
+{
+	if (isEmpty())
+	{
+		return;
+	}
+
+	// the quads that have one of the samples as a corner
+	int ci0 = std::max(i0 - 1, 0);
+	int cj0 = std::max(j0 - 1, 0);
+	int ci1 = std::min(i1, m_levels[0].rows - 1);
+	int cj1 = std::min(j1, m_levels[0].columns - 1);
+
+	// level 0 bounds each grid quad by its corners, which also bounds the bilinear surface
+	Level &base = m_levels[0];
+	for (int i = ci0; i <= ci1; ++i)
+	{
+		const float *row0 = m_heights + i * m_columns;
+		const float *row1 = row0 + m_columns;
+		for (int j = cj0; j <= cj1; ++j)
+		{
+			float a = std::min(row0[j], row0[j + 1]);
+			float b = std::min(row1[j], row1[j + 1]);
+			float c = std::max(row0[j], row0[j + 1]);
+			float d = std::max(row1[j], row1[j + 1]);
+			base.minHeights[j + i * base.columns] = std::min(a, b);
+			base.maxHeights[j + i * base.columns] = std::max(c, d);
+		}
+	}
+
+	for (size_t l = 1; l < m_levels.size(); ++l)
+	{
+		const Level &fine = m_levels[l - 1];
+		Level &coarse = m_levels[l];
+
+		ci0 /= 2;
+		cj0 /= 2;
+		ci1 /= 2;
+		cj1 /= 2;
+		for (int i = ci0; i <= ci1; ++i)
+		{
+			for (int j = cj0; j <= cj1; ++j)
+			{
+				float low = FLT_MAX;
+				float high = -FLT_MAX;
+				for (int fi = 2 * i; fi < std::min(2 * i + 2, fine.rows); ++fi)
+				{
+					for (int fj = 2 * j; fj < std::min(2 * j + 2, fine.columns); ++fj)
+					{
+						low = std::min(low, fine.minHeights[fj + fi * fine.columns]);
+						high = std::max(high, fine.maxHeights[fj + fi * fine.columns]);
+					}
+				}
+				coarse.minHeights[j + i * coarse.columns] = low;
+				coarse.maxHeights[j + i * coarse.columns] = high;
+			}
+		}
+	}
+}
+
+float HeightPyramid::getCellMinHeight(int level, int i, int j) const
+{
+	if (m_levels.empty())
+	{
+		return 0.0f;
+	}
+
+	const Level &cells = m_levels[std::min(std::max(level, 0), (int)m_levels.size() - 1)];
+	i = std::min(std::max(i, 0), cells.rows - 1);
+	j = std::min(std::max(j, 0), cells.columns - 1);
+	return cells.minHeights[j + i * cells.columns];
+}
+
+void HeightPyramid::clear()
+{
+	m_heights = nullptr;
+	m_rows = 0;
+	m_columns = 0;
+	m_levels.clear();
+}
+
+float HeightPyramid::sample(float x, float z) const
+{
+	if (isEmpty())
+	{
+		return 0.0f;
+	}
+
+	float invSpacing = 1.0f / m_spacing;
+	float gi = std::min(std::max(x * invSpacing, 0.0f), (float)(m_rows - 1));
+	float gj = std::min(std::max(z * invSpacing, 0.0f), (float)(m_columns - 1));
+	int i = std::min((int)gi, m_rows - 2);
+	int j = std::min((int)gj, m_columns - 2);
+	float u = gi - (float)i;
+	float v = gj - (float)j;
+
+	const float *row0 = m_heights + j + i * m_columns;
+	const float *row1 = row0 + m_columns;
+	float h0 = row0[0] + (row1[0] - row0[0]) * u;
+	float h1 = row0[1] + (row1[1] - row0[1]) * u;
+	return h0 + (h1 - h0) * v;
+}
+
+void HeightPyramid::sampleBatch(const float *x, const float *z, float *heights, int count) const
+{
+	if (isEmpty())
+	{
+		std::fill(heights, heights + count, 0.0f);
+		return;
+	}
+
+	int k = 0;
+#ifdef HEIGHT_PYRAMID_USE_SSE
+	// the same operations in the same order as sample(), so both give identical results
+	__m128 invSpacing = _mm_set1_ps(1.0f / m_spacing);
+	__m128 zero = _mm_setzero_ps();
+	__m128 lastRow = _mm_set1_ps((float)(m_rows - 1));
+	__m128 lastColumn = _mm_set1_ps((float)(m_columns - 1));
+	__m128 lastCellRow = _mm_set1_ps((float)(m_rows - 2));
+	__m128 lastCellColumn = _mm_set1_ps((float)(m_columns - 2));
+
+	for (; k + 4 <= count; k += 4)
+	{
+		__m128 gi = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(x + k), invSpacing), zero), lastRow);
+		__m128 gj = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(z + k), invSpacing), zero), lastColumn);
+
+		// truncation is floor here, the coordinates are not negative
+		__m128i i = _mm_cvttps_epi32(_mm_min_ps(gi, lastCellRow));
+		__m128i j = _mm_cvttps_epi32(_mm_min_ps(gj, lastCellColumn));
+		__m128 u = _mm_sub_ps(gi, _mm_cvtepi32_ps(i));
+		__m128 v = _mm_sub_ps(gj, _mm_cvtepi32_ps(j));
+
+		// SSE2 has no gather, the corners are fetched one lane at a time
+		int rows[4];
+		int columns[4];
+		_mm_storeu_si128((__m128i *)rows, i);
+		_mm_storeu_si128((__m128i *)columns, j);
+
+		float h00[4];
+		float h01[4];
+		float h10[4];
+		float h11[4];
+		for (int lane = 0; lane < 4; ++lane)
+		{
+			const float *row0 = m_heights + columns[lane] + rows[lane] * m_columns;
+			const float *row1 = row0 + m_columns;
+			h00[lane] = row0[0];
+			h01[lane] = row0[1];
+			h10[lane] = row1[0];
+			h11[lane] = row1[1];
+		}
+
+		__m128 a = _mm_loadu_ps(h00);
+		__m128 b = _mm_loadu_ps(h01);
+		__m128 h0 = _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(h10), a), u));
+		__m128 h1 = _mm_add_ps(b, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(h11), b), u));
+		_mm_storeu_ps(heights + k, _mm_add_ps(h0, _mm_mul_ps(_mm_sub_ps(h1, h0), v)));
+	}
+#endif
+	for (; k < count; ++k)
+	{
+		heights[k] = sample(x[k], z[k]);
+	}
+}
+
+bool HeightPyramid::raycast(const glm::vec3 &origin, const glm::vec3 &direction, float maxT, float &t) const
+{
+	if (isEmpty())
+	{
+		return false;
+	}
+
+	// grid space: one unit per sample horizontally, heights as they are; t is unchanged
+	glm::vec3 o(origin.x / m_spacing, origin.y, origin.z / m_spacing);
+	glm::vec3 d(direction.x / m_spacing, direction.y, direction.z / m_spacing);
+
+	// clip the ray to the box around the whole grid. Everything below the surface counts
+	// as solid, so a ray coming in under the border hits right there
+	glm::vec3 boxMin(0.0f, -FLT_MAX, 0.0f);
+	glm::vec3 boxMax((float)(m_rows - 1), getMaxHeight(), (float)(m_columns - 1));
+	float tEnter = 0.0f;
+	float tExit = maxT;
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		if (d[axis] == 0.0f)
+		{
+			if (o[axis] < boxMin[axis] || o[axis] > boxMax[axis])
+			{
+				return false;
+			}
+			continue;
+		}
+
+		float ta = (boxMin[axis] - o[axis]) / d[axis];
+		float tb = (boxMax[axis] - o[axis]) / d[axis];
+		tEnter = std::max(tEnter, std::min(ta, tb));
+		tExit = std::min(tExit, std::max(ta, tb));
+	}
+	if (tEnter > tExit)
+	{
+		return false;
+	}
+
+	// how far t moves to get a thousandth of a sample past a cell border
+	float horizontal = std::max(fabsf(d.x), fabsf(d.z));
+	float nudge = horizontal > 0.0f ? 1e-3f / horizontal : 0.0f;
+
+	// walk the cells along the ray, going down a level wherever the ray dips below a
+	// cell's maximum and back up once it has passed a cell
+	const int top = (int)m_levels.size() - 1;
+	int level = top;
+	float tCurrent = tEnter;
+	while (tCurrent <= tExit)
+	{
+		const Level &cells = m_levels[level];
+		float size = (float)(1 << level);
+		glm::vec3 p = o + d * tCurrent;
+
+		int i = std::min(std::max((int)floorf(p.x / size), 0), cells.rows - 1);
+		int j = std::min(std::max((int)floorf(p.z / size), 0), cells.columns - 1);
+
+		float tCell = tExit;
+		if (d.x > 0.0f)
+		{
+			tCell = std::min(tCell, ((i + 1) * size - o.x) / d.x);
+		}
+		else if (d.x < 0.0f)
+		{
+			tCell = std::min(tCell, (i * size - o.x) / d.x);
+		}
+		if (d.z > 0.0f)
+		{
+			tCell = std::min(tCell, ((j + 1) * size - o.z) / d.z);
+		}
+		else if (d.z < 0.0f)
+		{
+			tCell = std::min(tCell, (j * size - o.z) / d.z);
+		}
+		tCell = std::max(tCell, tCurrent);
+
+		float lowest = std::min(p.y, o.y + d.y * tCell);
+		if (lowest <= cells.maxHeights[j + i * cells.columns])
+		{
+			if (level > 0)
+			{
+				--level;
+				continue;
+			}
+
+			if (intersectCell(i, j, o, d, tCurrent, tCell, t))
+			{
+				return true;
+			}
+		}
+
+		if (tCell >= tExit)
+		{
+			break;
+		}
+		tCurrent = tCell + nudge;
+		level = std::min(level + 1, top);
+	}
+
+	return false;
+}
+
+bool HeightPyramid::intersectCell(int i, int j, const glm::vec3 &origin, const glm::vec3 &direction, float t0, float t1, float &t) const
+{
+	const float *row0 = m_heights + j + i * m_columns;
+	const float *row1 = row0 + m_columns;
+	double h00 = row0[0];
+	double a1 = row1[0] - row0[0];
+	double a2 = row0[1] - row0[0];
+	double k = (double)row0[0] - row0[1] - row1[0] + row1[1];
+
+	// along the ray the bilinear surface is quadratic in t, so is the ray's height above it
+	double u0 = origin.x - i;
+	double v0 = origin.z - j;
+	double du = direction.x;
+	double dv = direction.z;
+	double a = -k * du * dv;
+	double b = direction.y - (a1 * du + a2 * dv + k * (u0 * dv + v0 * du));
+	double c = origin.y - (h00 + a1 * u0 + a2 * v0 + k * u0 * v0);
+
+	if ((a * t0 + b) * t0 + c <= 0.0)
+	{
+		// already at or below the surface where the ray enters the cell
+		t = t0;
+		return true;
+	}
+
+	double roots[2];
+	int rootCount = 0;
+	if (fabs(a) < 1e-12)
+	{
+		if (b != 0.0)
+		{
+			roots[rootCount++] = -c / b;
+		}
+	}
+	else
+	{
+		double discriminant = b * b - 4.0 * a * c;
+		if (discriminant >= 0.0)
+		{
+			// the stable form of the quadratic formula
+			double q = -0.5 * (b + (b < 0.0 ? -sqrt(discriminant) : sqrt(discriminant)));
+			roots[rootCount++] = q / a;
+			if (q != 0.0)
+			{
+				roots[rootCount++] = c / q;
+			}
+		}
+	}
+
+	bool hit = false;
+	double best = t1;
+	for (int r = 0; r < rootCount; ++r)
+	{
+		if (roots[r] >= t0 && roots[r] <= best)
+		{
+			best = roots[r];
+			hit = true;
+		}
+	}
+
+	if (hit)
+	{
+		t = (float)best;
+	}
+	return hit;
+}
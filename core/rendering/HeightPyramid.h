@@ -0,0 +1,56 @@
+#ifndef HEIGHT_PYRAMID_H
+#define HEIGHT_PYRAMID_H
+
+#include <glm/glm.hpp>
+#include <vector>
+
+// min/max mip chain over the cells of a height grid, for CPU height and ray queries.
+// Sample (i, j) is heights[j + i * columns] and lies at world (i * spacing, height, j * spacing)
+class HeightPyramid
+{
+public:
+	HeightPyramid();
+	~HeightPyramid();
+
+	// the heights are not copied and must stay alive and in place while the pyramid is used
+	void build(const float *heights, int rows, int columns, float spacing);
+	void clear();
+	// refreshes the cells touching samples [i0, i1] x [j0, j1] after the heights changed there
+	void update(int i0, int j0, int i1, int j1);
+	bool isEmpty() const { return m_heights == nullptr; }
+
+	// bilinear height between the four samples around (x, z), clamped to the grid
+	float sample(float x, float z) const;
+	// the same for count points at once, four at a time with SSE
+	void sampleBatch(const float *x, const float *z, float *heights, int count) const;
+
+	// first t in [0, maxT] where origin + t * direction is on or below the bilinear surface,
+	// walking down the pyramid only where the ray comes below a cell's maximum
+	bool raycast(const glm::vec3 &origin, const glm::vec3 &direction, float maxT, float &t) const;
+
+	int getLevelCount() const { return (int)m_levels.size(); }
+	float getMinHeight() const { return m_levels.empty() ? 0.0f : m_levels.back().minHeights[0]; }
+	float getMaxHeight() const { return m_levels.empty() ? 0.0f : m_levels.back().maxHeights[0]; }
+	// lowest height under cell (i, j) of a level, which covers 2^level grid quads per side.
+	// The level and the cell are clamped to what exists
+	float getCellMinHeight(int level, int i, int j) const;
+
+private:
+	struct Level
+	{
+		int rows;                       // cells, level 0 has one cell per grid quad
+		int columns;
+		std::vector<float> minHeights;
+		std::vector<float> maxHeights;
+	};
+
+	bool intersectCell(int i, int j, const glm::vec3 &origin, const glm::vec3 &direction, float t0, float t1, float &t) const;
+
+	const float *m_heights;
+	int m_rows;
+	int m_columns;
+	float m_spacing;
+	std::vector<Level> m_levels;        // up to a single cell covering the whole grid
+};
+
+#endif // HEIGHT_PYRAMID_H
@@ -0,0 +1,289 @@
+#include "IndexOptimizer.h"
+#include <cmath>
+#include <algorithm>
+#include <string.h>
+
+static float vertexScore(int cachePosition, int remainingTriangles)
+{
+	if (remainingTriangles == 0)
+	{
+		// no triangle needs this vertex any more
+		return -1.0f;
+	}
+
+	float score = 0.0f;
+	if (cachePosition >= 0)
+	{
+		if (cachePosition < 3)
+		{
+			// used by the last triangle, a fixed score so a strip is not simply followed
+			score = 0.75f;
+		}
+		else
+		{
+			const float scale = 1.0f / (INDEX_OPTIMIZER_CACHE_SIZE - 3);
+			score = powf(1.0f - (cachePosition - 3) * scale, 1.5f);
+		}
+	}
+
+	// finish off vertices with few triangles left, so they leave the cache for good
+	score += 2.0f * powf((float)remainingTriangles, -0.5f);
+	return score;
+}
+
+void IndexOptimizer::optimizeVertexCache(GLuint *indices, int numIndices, int numVertices)
+{
+	int numTriangles = numIndices / 3;
+	if (numTriangles == 0)
+	{
+		return;
+	}
+
+	// triangles of every vertex, the first remaining[v] entries are the ones not emitted yet
+	std::vector<int> remaining(numVertices, 0);
+	for (int i = 0; i < numIndices; ++i)
+	{
+		remaining[indices[i]]++;
+	}
+
+	std::vector<int> first(numVertices + 1, 0);
+	for (int v = 0; v < numVertices; ++v)
+	{
+		first[v + 1] = first[v] + remaining[v];
+	}
+
+	std::vector<int> adjacency(numIndices);
+	std::vector<int> fill(first.begin(), first.end() - 1);
+	for (int i = 0; i < numIndices; ++i)
+	{
+		adjacency[fill[indices[i]]++] = i / 3;
+	}
+
+	std::vector<int> cachePosition(numVertices, -1);
+	std::vector<float> score(numVertices);
+	for (int v = 0; v < numVertices; ++v)
+	{
+		score[v] = vertexScore(-1, remaining[v]);
+	}
+
+	std::vector<float> triangleScore(numTriangles);
+	std::vector<char> emitted(numTriangles, 0);
+	for (int t = 0; t < numTriangles; ++t)
+	{
+		triangleScore[t] = score[indices[3 * t]] + score[indices[3 * t + 1]] + score[indices[3 * t + 2]];
+	}
+
+	std::vector<GLuint> output;
+	output.reserve(numIndices);
+
+	int cache[INDEX_OPTIMIZER_CACHE_SIZE + 3];
+	int cacheCount = 0;
+	int bestTriangle = 0;
+	int nextUnemitted = 0;
+
+	for (int n = 0; n < numTriangles; ++n)
+	{
+		if (bestTriangle < 0)
+		{
+			// nothing in the cache leads anywhere, carry on with the first triangle left
+			while (emitted[nextUnemitted])
+			{
+				++nextUnemitted;
+			}
+			bestTriangle = nextUnemitted;
+		}
+
+		emitted[bestTriangle] = 1;
+		const GLuint *corners = &indices[3 * bestTriangle];
+
+		int newCache[INDEX_OPTIMIZER_CACHE_SIZE + 3];
+		int newCount = 0;
+		for (int k = 0; k < 3; ++k)
+		{
+			int v = corners[k];
+			output.push_back(v);
+
+			// take the triangle off the vertex's list
+			int *list = &adjacency[first[v]];
+			for (int a = 0; a < remaining[v]; ++a)
+			{
+				if (list[a] == bestTriangle)
+				{
+					list[a] = list[remaining[v] - 1];
+					remaining[v]--;
+					break;
+				}
+			}
+
+			// degenerate triangles name a vertex twice
+			bool duplicate = false;
+			for (int c = 0; c < newCount; ++c)
+			{
+				duplicate = duplicate || newCache[c] == v;
+			}
+			if (!duplicate)
+			{
+				newCache[newCount++] = v;
+			}
+		}
+
+		// the triangle's vertices move to the front of the cache, the rest shift back
+		int cornerCount = newCount;
+		for (int c = 0; c < cacheCount; ++c)
+		{
+			int v = cache[c];
+			bool corner = false;
+			for (int k = 0; k < cornerCount; ++k)
+			{
+				corner = corner || newCache[k] == v;
+			}
+			if (!corner)
+			{
+				newCache[newCount++] = v;
+			}
+		}
+
+		for (int c = 0; c < newCount; ++c)
+		{
+			int v = newCache[c];
+			cachePosition[v] = c < INDEX_OPTIMIZER_CACHE_SIZE ? c : -1;
+			score[v] = vertexScore(cachePosition[v], remaining[v]);
+		}
+
+		// rescore the triangles touching the cache and pick the best for the next step
+		bestTriangle = -1;
+		float bestScore = -1.0f;
+		for (int c = 0; c < newCount; ++c)
+		{
+			int v = newCache[c];
+			const int *list = &adjacency[first[v]];
+			for (int a = 0; a < remaining[v]; ++a)
+			{
+				int t = list[a];
+				triangleScore[t] = score[indices[3 * t]] + score[indices[3 * t + 1]] + score[indices[3 * t + 2]];
+				if (triangleScore[t] > bestScore)
+				{
+					bestScore = triangleScore[t];
+					bestTriangle = t;
+				}
+			}
+		}
+
+		cacheCount = std::min(newCount, INDEX_OPTIMIZER_CACHE_SIZE);
+		memcpy(cache, newCache, cacheCount * sizeof (int));
+	}
+
+	memcpy(indices, &output[0], numIndices * sizeof (GLuint));
+}
+
+template <typename Index>
+static float fifoACMR(const Index *indices, int numIndices, int cacheSize)
+{
+	if (numIndices < 3)
+	{
+		return 0.0f;
+	}
+
+	std::vector<GLuint> fifo(cacheSize, 0xffffffff);
+	int head = 0;
+	int misses = 0;
+
+	for (int i = 0; i < numIndices; ++i)
+	{
+		GLuint v = indices[i];
+		bool hit = false;
+		for (int c = 0; c < cacheSize; ++c)
+		{
+			if (fifo[c] == v)
+			{
+				hit = true;
+				break;
+			}
+		}
+
+		if (!hit)
+		{
+			fifo[head] = v;
+			head = (head + 1) % cacheSize;
+			++misses;
+		}
+	}
+
+	return (float)misses / (numIndices / 3);
+}
+
+float IndexOptimizer::computeACMR(const GLuint *indices, int numIndices, int cacheSize)
+{
+	return fifoACMR(indices, numIndices, cacheSize);
+}
+
+float IndexOptimizer::computeACMR(const GLushort *indices, int numIndices, int cacheSize)
+{
+	return fifoACMR(indices, numIndices, cacheSize);
+}
+
+void IndexOptimizer::splitIndices16(const GLuint *indices, int numIndices, int numVertices, int maxVertices,
+	std::vector<GLushort> &indices16, std::vector<GLuint> &remap, std::vector<IndexBatch> &batches)
+{
+	maxVertices = std::min(maxVertices, INDEX_MAX_BATCH_VERTICES);
+
+	std::vector<int> batchOf(numVertices, -1);
+	std::vector<int> local(numVertices);
+
+	indices16.clear();
+	remap.clear();
+	batches.clear();
+	indices16.reserve(numIndices);
+
+	IndexBatch batch = { 0, 0, 0, 0 };
+	for (int t = 0; t + 2 < numIndices; t += 3)
+	{
+		int batchId = (int)batches.size();
+
+		int added = 0;
+		for (int k = 0; k < 3; ++k)
+		{
+			if (batchOf[indices[t + k]] != batchId)
+			{
+				++added;
+			}
+		}
+
+		// start a new batch rather than let a triangle straddle two
+		if (batch.numVertices + added > maxVertices)
+		{
+			batches.push_back(batch);
+			batch.firstIndex += batch.numIndices;
+			batch.firstVertex += batch.numVertices;
+			batch.numIndices = 0;
+			batch.numVertices = 0;
+			++batchId;
+		}
+
+		for (int k = 0; k < 3; ++k)
+		{
+			GLuint v = indices[t + k];
+			if (batchOf[v] != batchId)
+			{
+				batchOf[v] = batchId;
+				local[v] = batch.numVertices++;
+				remap.push_back(v);
+			}
+			indices16.push_back((GLushort)local[v]);
+		}
+		batch.numIndices += 3;
+	}
+
+	if (batch.numIndices > 0)
+	{
+		batches.push_back(batch);
+	}
+}
+
+void IndexOptimizer::remapVertices(const GLfloat *src, int components, const std::vector<GLuint> &remap, GLfloat *dst)
+{
+	for (size_t k = 0; k < remap.size(); ++k)
+	{
+		memcpy(&dst[k * components], &src[remap[k] * components], components * sizeof (GLfloat));
+	}
+}
@@ -0,0 +1,45 @@
+#ifndef INDEX_OPTIMIZER_H
+#define INDEX_OPTIMIZER_H
+
+#include <gles_include.h>
+#include <vector>
+
+// LRU cache modelled while reordering, larger than any real post-transform cache
+#define INDEX_OPTIMIZER_CACHE_SIZE  32
+// FIFO cache used to report ACMR, a typical size for GLES hardware
+#define INDEX_ACMR_CACHE_SIZE       16
+// define INDEX_OPTIMIZER_REPORT to print the ACMR of the meshes before and after
+// reordering, when they are built
+// vertices a GL_UNSIGNED_SHORT batch can address
+#define INDEX_MAX_BATCH_VERTICES    65536
+
+struct IndexBatch
+{
+	int firstIndex;     // into the 16-bit index array
+	int numIndices;
+	int firstVertex;    // into the remapped vertex arrays, added to the attribute offsets when drawing
+	int numVertices;
+};
+
+class IndexOptimizer
+{
+public:
+	// reorders the triangles of a triangle list for the post-transform vertex cache,
+	// Tom Forsyth's "Linear-Speed Vertex Cache Optimisation"
+	static void optimizeVertexCache(GLuint *indices, int numIndices, int numVertices);
+
+	// average cache miss ratio: vertices transformed per triangle with a FIFO cache
+	static float computeACMR(const GLuint *indices, int numIndices, int cacheSize = INDEX_ACMR_CACHE_SIZE);
+	static float computeACMR(const GLushort *indices, int numIndices, int cacheSize = INDEX_ACMR_CACHE_SIZE);
+
+	// cuts a triangle list into batches of at most maxVertices vertices each so they can be
+	// drawn with 16-bit indices. Vertices are renumbered in order of first use per batch,
+	// remap[k] is the original vertex of new vertex k; a vertex used by two batches appears twice.
+	static void splitIndices16(const GLuint *indices, int numIndices, int numVertices, int maxVertices,
+		std::vector<GLushort> &indices16, std::vector<GLuint> &remap, std::vector<IndexBatch> &batches);
+
+	// gathers one vertex attribute into the order given by splitIndices16
+	static void remapVertices(const GLfloat *src, int components, const std::vector<GLuint> &remap, GLfloat *dst);
+};
+
+#endif // INDEX_OPTIMIZER_H
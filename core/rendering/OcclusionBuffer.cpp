@@ -0,0 +1,172 @@
+#include "OcclusionBuffer.h"
+#include <algorithm>
+#include <cmath>
+#include <cfloat>
+
+OcclusionBuffer::OcclusionBuffer()
+{
+	m_viewProjection = glm::mat4(1.0f);
+	m_width = 0;
+	m_height = 0;
+}
+
+OcclusionBuffer::~OcclusionBuffer()
+{
+
+}
+
+void OcclusionBuffer::resize(int width, int height)
+{
+	m_width = std::max(width, 1);
+	m_height = std::max(height, 1);
+	m_depth.resize(m_width * m_height);
+}
+
+void OcclusionBuffer::begin(const glm::mat4 &viewProjection)
+{
+	m_viewProjection = viewProjection;
+	std::fill(m_depth.begin(), m_depth.end(), FLT_MAX);
+}
+
+glm::vec4 OcclusionBuffer::project(const glm::vec3 &position) const
+{
+	glm::vec4 clip = m_viewProjection * glm::vec4(position, 1.0f);
+	if (clip.w <= 0.0f || clip.z < -clip.w)
+	{
+		return glm::vec4(0.0f, 0.0f, 0.0f, -1.0f);
+	}
+
+	float invW = 1.0f / clip.w;
+	return glm::vec4((clip.x * invW * 0.5f + 0.5f) * m_width,
+		(clip.y * invW * 0.5f + 0.5f) * m_height,
+		clip.z * invW, 1.0f);
+}
+
+void OcclusionBuffer::drawMesh(const glm::vec3 *vertices, int vertexCount, const unsigned short *indices, int indexCount)
+{
+	m_projected.resize(vertexCount);
+	for (int i = 0; i < vertexCount; ++i)
+	{
+		m_projected[i] = project(vertices[i]);
+	}
+
+	for (int i = 0; i + 2 < indexCount; i += 3)
+	{
+		const glm::vec4 &a = m_projected[indices[i]];
+		const glm::vec4 &b = m_projected[indices[i + 1]];
+		const glm::vec4 &c = m_projected[indices[i + 2]];
+		if (a.w > 0.0f && b.w > 0.0f && c.w > 0.0f)
+		{
+			drawTriangle(a, b, c);
+		}
+	}
+}
+
+void OcclusionBuffer::drawTriangle(const glm::vec4 &a, const glm::vec4 &b, const glm::vec4 &c)
+{
+	float area = (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+	if (fabsf(area) < 1e-6f)
+	{
+		return;
+	}
+
+	// both windings are occluders, make the edge functions positive inside
+	glm::vec4 v[3] = { a, area > 0.0f ? b : c, area > 0.0f ? c : b };
+	area = fabsf(area);
+
+	int x0 = std::max((int)floorf(std::min(v[0].x, std::min(v[1].x, v[2].x))), 0);
+	int x1 = std::min((int)ceilf(std::max(v[0].x, std::max(v[1].x, v[2].x))), m_width) - 1;
+	int y0 = std::max((int)floorf(std::min(v[0].y, std::min(v[1].y, v[2].y))), 0);
+	int y1 = std::min((int)ceilf(std::max(v[0].y, std::max(v[1].y, v[2].y))), m_height) - 1;
+	if (x0 > x1 || y0 > y1)
+	{
+		return;
+	}
+
+	// edge k runs from v[k] to v[k + 1], E(x, y) = A x + B y + C. Lowering C by half of
+	// |A| + |B| gives the value at the pixel corner furthest inside, so a pixel passes
+	// only when all of it is covered
+	float edgeA[3], edgeB[3], edgeC[3];
+	for (int k = 0; k < 3; ++k)
+	{
+		const glm::vec4 &p0 = v[k];
+		const glm::vec4 &p1 = v[(k + 1) % 3];
+		edgeA[k] = p0.y - p1.y;
+		edgeB[k] = p1.x - p0.x;
+		edgeC[k] = p0.x * p1.y - p0.y * p1.x - 0.5f * (fabsf(edgeA[k]) + fabsf(edgeB[k]));
+	}
+
+	// depth plane, again taken at the pixel corner furthest away
+	float dzdx = ((v[1].z - v[0].z) * (v[2].y - v[0].y) - (v[2].z - v[0].z) * (v[1].y - v[0].y)) / area;
+	float dzdy = ((v[2].z - v[0].z) * (v[1].x - v[0].x) - (v[1].z - v[0].z) * (v[2].x - v[0].x)) / area;
+	float slack = 0.5f * (fabsf(dzdx) + fabsf(dzdy));
+	float farthest = std::max(v[0].z, std::max(v[1].z, v[2].z));
+
+	for (int y = y0; y <= y1; ++y)
+	{
+		float py = y + 0.5f;
+		float *row = &m_depth[y * m_width];
+		for (int x = x0; x <= x1; ++x)
+		{
+			float px = x + 0.5f;
+			if (edgeA[0] * px + edgeB[0] * py + edgeC[0] < 0.0f ||
+				edgeA[1] * px + edgeB[1] * py + edgeC[1] < 0.0f ||
+				edgeA[2] * px + edgeB[2] * py + edgeC[2] < 0.0f)
+			{
+				continue;
+			}
+
+			float depth = std::min(v[0].z + dzdx * (px - v[0].x) + dzdy * (py - v[0].y) + slack, farthest);
+			row[x] = std::min(row[x], depth);
+		}
+	}
+}
+
+bool OcclusionBuffer::isBoxOccluded(const glm::vec3 &boxMin, const glm::vec3 &boxMax) const
+{
+	if (m_depth.empty())
+	{
+		return false;
+	}
+
+	float minX = FLT_MAX, minY = FLT_MAX, maxX = -FLT_MAX, maxY = -FLT_MAX;
+	float nearest = FLT_MAX;
+	for (int k = 0; k < 8; ++k)
+	{
+		glm::vec3 corner((k & 1) ? boxMax.x : boxMin.x, (k & 2) ? boxMax.y : boxMin.y, (k & 4) ? boxMax.z : boxMin.z);
+		glm::vec4 p = project(corner);
+		if (p.w < 0.0f)
+		{
+			// reaches behind the near plane, the screen rectangle is unbounded
+			return false;
+		}
+		minX = std::min(minX, p.x);
+		minY = std::min(minY, p.y);
+		maxX = std::max(maxX, p.x);
+		maxY = std::max(maxY, p.y);
+		nearest = std::min(nearest, p.z);
+	}
+
+	int x0 = std::max((int)floorf(minX), 0);
+	int x1 = std::min((int)ceilf(maxX), m_width) - 1;
+	int y0 = std::max((int)floorf(minY), 0);
+	int y1 = std::min((int)ceilf(maxY), m_height) - 1;
+	if (x0 > x1 || y0 > y1)
+	{
+		return false;
+	}
+
+	for (int y = y0; y <= y1; ++y)
+	{
+		const float *row = &m_depth[y * m_width];
+		for (int x = x0; x <= x1; ++x)
+		{
+			if (row[x] >= nearest)
+			{
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
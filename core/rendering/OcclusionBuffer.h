@@ -0,0 +1,40 @@
+#ifndef OCCLUSION_BUFFER_H
+#define OCCLUSION_BUFFER_H
+
+#include <glm/glm.hpp>
+#include <vector>
+
+// coarse CPU depth buffer for software occlusion culling. Occluders are rasterized
+// conservatively: a pixel is only written when a triangle covers all of it, with the
+// farthest depth the triangle has inside it, so a box reported hidden is really hidden
+class OcclusionBuffer
+{
+public:
+	OcclusionBuffer();
+	~OcclusionBuffer();
+
+	void resize(int width, int height);
+	// clears to the far plane and sets the view-projection used by the calls below
+	void begin(const glm::mat4 &viewProjection);
+
+	// triangles reaching behind the near plane are left out, which only loses occlusion
+	void drawMesh(const glm::vec3 *vertices, int vertexCount, const unsigned short *indices, int indexCount);
+	// true when every pixel the box can cover already holds something nearer than the box
+	bool isBoxOccluded(const glm::vec3 &boxMin, const glm::vec3 &boxMax) const;
+
+	int getWidth() const { return m_width; }
+	int getHeight() const { return m_height; }
+
+private:
+	// x and y in pixels, z the NDC depth, w < 0 when the point is behind the near plane
+	glm::vec4 project(const glm::vec3 &position) const;
+	void drawTriangle(const glm::vec4 &a, const glm::vec4 &b, const glm::vec4 &c);
+
+	glm::mat4 m_viewProjection;
+	int m_width;
+	int m_height;
+	std::vector<float> m_depth;         // NDC depth, row by row from the bottom of the screen
+	std::vector<glm::vec4> m_projected; // scratch for drawMesh
+};
+
+#endif // OCCLUSION_BUFFER_H
@@ -7,7 +7,6 @@
 
 Panel::Panel()
 {
-
 }
 
 Panel::~Panel()
@@ -21,10 +20,14 @@ bool Panel::init()
 		"#version 300 es                                      \n"
 		"uniform mat4 u_mvpMatrix;                            \n"
 		"uniform vec3 u_color;                                \n"
+		SKY_LIGHTING_GLSL
 		"layout(location = 0) in vec4 a_position;             \n"
 		"out vec4 v_color;                                    \n"
+		"out vec3 v_lighting;                                 \n"
 		"void main()                                          \n"
 		"{                                                    \n"
+		"   // the panel is horizontal                        \n"
+		"   v_lighting = skyLighting(vec3(0.0, 1.0, 0.0));    \n"
 		"   v_color = vec4(u_color, 1);                       \n"
 		"   gl_Position = u_mvpMatrix * a_position;           \n"
 		"}                                                    \n";
@@ -32,17 +35,24 @@ bool Panel::init()
 	const char fShaderStr[] =
 		"#version 300 es                                        \n"
 		"precision mediump float;                               \n"
+		AERIAL_PERSPECTIVE_GLSL
+		SKY_LIGHTING_FRAGMENT_GLSL
 		"in vec4 v_color;                                       \n"
+		"in vec3 v_lighting;                                    \n"
 		"layout(location = 0) out vec4 outColor;                \n"
 		"void main()                                            \n"
 		"{                                                      \n"
-		"  outColor = v_color;                                  \n"
+		"  vec3 color = u_useSkyLighting ?                      \n"
+		"    shadeSkyLighting(v_color.rgb, v_lighting) : v_color.rgb;\n"
+		"  outColor = vec4(applyAerialPerspective(color), v_color.a);\n"
 		"}                                                      \n";
 
 	m_program = esLoadProgram(vShaderStr, fShaderStr);
 
 	m_mvpLoc = glGetUniformLocation(m_program, "u_mvpMatrix");
 	m_colorLoc = glGetUniformLocation(m_program, "u_color");
+	m_aerialPerspective.init(m_program);
+	m_skyLighting.init(m_program);
 
 	m_width = 20560;
 	m_height = 20560;
@@ -57,11 +67,11 @@ bool Panel::init()
 		 m_width, 0,  m_height
 	};
 
-	GLuint indices[4] = { 0, 1, 2, 3 };
+	GLushort indices[4] = { 0, 1, 2, 3 };
 
 	glGenBuffers(1, &m_indicesVBO);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_indicesVBO);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, 4 * sizeof (GLuint), indices, GL_STATIC_DRAW);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, 4 * sizeof (GLushort), indices, GL_STATIC_DRAW);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 
 	glGenBuffers(1, &m_verticesVBO);
@@ -95,7 +105,13 @@ void Panel::draw(ESContext *esContext)
 
 	glUniform3f(m_colorLoc, 0.9f, 0.9f, 0.9f);
 
-	glDrawElements(GL_TRIANGLE_FAN, 4, GL_UNSIGNED_INT, (const void *)NULL);
+	// the volume of the atmosphere between the camera and the mesh, if any
+	m_aerialPerspective.bind(esContext);
+
+	// the block of the sky lighting, unlit when there is none
+	m_skyLighting.bind();
+
+	glDrawElements(GL_TRIANGLE_FAN, 4, GL_UNSIGNED_SHORT, (const void *)NULL);
 
 	glDisableVertexAttribArray(POSITION_LOC);
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
@@ -2,6 +2,8 @@
 #define __PANEL__
 
 #include <gles_include.h>
+#include <AerialPerspective.h>
+#include <SkyLighting.h>
 
 class Panel
 {
@@ -14,6 +16,11 @@ public:
 
 	int genPanelModelInfo(GLfloat **vertices, GLuint **indices);
 
+	// the atmosphere between the camera and the panel, none by default
+	void setAerialPerspective(const AerialPerspective *aerialPerspective) { m_aerialPerspective.setAerialPerspective(aerialPerspective); }
+	// the ambient and sun lighting of the sky, unlit by default
+	void setSkyLighting(const SkyLighting *skyLighting) { m_skyLighting.setSkyLighting(skyLighting); }
+
 private:
 	int m_width;
 	int m_height;
@@ -29,6 +36,8 @@ private:
 	GLuint m_program;
 	
 	glm::mat4 m_modelMatrix;
+	AerialPerspectiveBinding m_aerialPerspective;
+	SkyLightingBinding m_skyLighting;
 };
 
 
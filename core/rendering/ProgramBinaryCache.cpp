@@ -0,0 +1,179 @@
+#include "ProgramBinaryCache.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <utility>
+
+namespace {
+
+const char kMagic[4] = { 'P', 'R', 'G', 'B' };
+const uint32_t kVersion = 2;
+
+struct FileHeader {
+	char magic[4];
+	uint32_t version;
+	uint32_t binary_count;
+	uint32_t save_count;
+};
+
+struct BinaryHeader {
+	uint64_t key;
+	uint32_t format;
+	uint32_t size;
+	uint32_t last_used;
+	uint32_t reserved;
+};
+
+}  // anonymous namespace
+
+ProgramBinaryCache::ProgramBinaryCache(const std::string& filename) :
+	filename_(filename),
+	save_count_(0),
+	modified_(false) {
+	if (filename_.empty()) {
+		return;
+	}
+	std::ifstream file(filename_.c_str(), std::ios::binary);
+	if (!file) {
+		return;
+	}
+	file.seekg(0, std::ios::end);
+	const std::streamoff file_size = file.tellg();
+	file.seekg(0, std::ios::beg);
+
+	FileHeader header;
+	if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+		memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 ||
+		header.version != kVersion) {
+		return;
+	}
+	save_count_ = header.save_count;
+
+	// A truncated file keeps the binaries read before the truncation. A size
+	// larger than the rest of the file means a corrupted header, which must
+	// not be allocated.
+	for (uint32_t i = 0; i < header.binary_count; ++i) {
+		BinaryHeader binary_header;
+		if (!file.read(reinterpret_cast<char*>(&binary_header),
+			sizeof(binary_header)) || binary_header.size == 0 ||
+			binary_header.size > file_size - file.tellg()) {
+			return;
+		}
+
+		Entry entry;
+		entry.binary.format = binary_header.format;
+		entry.binary.data.resize(binary_header.size);
+		entry.last_used = binary_header.last_used;
+		if (!file.read(reinterpret_cast<char*>(&entry.binary.data[0]),
+			entry.binary.data.size())) {
+			return;
+		}
+		binaries_[binary_header.key] = entry;
+	}
+}
+
+const ProgramBinaryCache::Binary* ProgramBinaryCache::Find(uint64_t key) {
+	std::map<uint64_t, Entry>::const_iterator it = binaries_.find(key);
+	if (it == binaries_.end()) {
+		return NULL;
+	}
+	used_.insert(key);
+	// The file must be written to record this use, unless the binary was
+	// already used in the last save.
+	modified_ = it->second.last_used != save_count_ || modified_;
+	return &it->second.binary;
+}
+
+void ProgramBinaryCache::Insert(uint64_t key, const Binary& binary) {
+	if (!IsEnabled() || binary.data.empty()) {
+		return;
+	}
+	// A binary replaced under the same key is dropped here.
+	Entry& entry = binaries_[key];
+	entry.binary = binary;
+	entry.last_used = save_count_;
+	used_.insert(key);
+	modified_ = true;
+}
+
+void ProgramBinaryCache::Erase(uint64_t key) {
+	used_.erase(key);
+	modified_ = binaries_.erase(key) > 0 || modified_;
+}
+
+bool ProgramBinaryCache::Save() {
+	if (!IsEnabled() || !modified_) {
+		return true;
+	}
+	++save_count_;
+	for (std::set<uint64_t>::const_iterator it = used_.begin();
+		it != used_.end(); ++it) {
+		binaries_[*it].last_used = save_count_;
+	}
+	Evict();
+
+	// Written next to the final file and renamed over it, as AtmosphereCache does.
+	std::string temporary = filename_ + ".tmp";
+	{
+		std::ofstream file(temporary.c_str(), std::ios::binary | std::ios::trunc);
+		if (!file) {
+			return false;
+		}
+
+		FileHeader header;
+		memcpy(header.magic, kMagic, sizeof(kMagic));
+		header.version = kVersion;
+		header.binary_count = static_cast<uint32_t>(binaries_.size());
+		header.save_count = save_count_;
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+		for (std::map<uint64_t, Entry>::const_iterator it = binaries_.begin();
+			it != binaries_.end(); ++it) {
+			const Binary& binary = it->second.binary;
+			BinaryHeader binary_header;
+			binary_header.key = it->first;
+			binary_header.format = binary.format;
+			binary_header.size = static_cast<uint32_t>(binary.data.size());
+			binary_header.last_used = it->second.last_used;
+			binary_header.reserved = 0;
+			file.write(reinterpret_cast<const char*>(&binary_header),
+				sizeof(binary_header));
+			file.write(reinterpret_cast<const char*>(&binary.data[0]),
+				binary.data.size());
+		}
+
+		if (!file) {
+			file.close();
+			remove(temporary.c_str());
+			return false;
+		}
+	}
+
+	remove(filename_.c_str());
+	if (rename(temporary.c_str(), filename_.c_str()) != 0) {
+		return false;
+	}
+	modified_ = false;
+	return true;
+}
+
+void ProgramBinaryCache::Evict() {
+	uint64_t file_size = sizeof(FileHeader);
+	std::vector<std::pair<uint32_t, uint64_t> > unused;
+	for (std::map<uint64_t, Entry>::const_iterator it = binaries_.begin();
+		it != binaries_.end(); ++it) {
+		file_size += sizeof(BinaryHeader) + it->second.binary.data.size();
+		if (used_.count(it->first) == 0) {
+			unused.push_back(std::make_pair(it->second.last_used, it->first));
+		}
+	}
+	// Oldest first.
+	std::sort(unused.begin(), unused.end());
+	for (size_t i = 0; i < unused.size() && file_size > kMaxFileSize; ++i) {
+		std::map<uint64_t, Entry>::iterator it = binaries_.find(unused[i].second);
+		file_size -= sizeof(BinaryHeader) + it->second.binary.data.size();
+		binaries_.erase(it);
+	}
+}
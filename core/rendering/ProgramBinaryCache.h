@@ -0,0 +1,62 @@
+#ifndef PROGRAM_BINARY_CACHE_H_
+#define PROGRAM_BINARY_CACHE_H_
+
+#include <cstdint>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+// On-disk copy of linked program binaries (glGetProgramBinary), so that SkyModel
+// does not compile its precomputation shaders again on the next run. The file is
+// a header (magic, version, binary count) followed, for each binary, by its key,
+// binary format and size, and then by its bytes. A binary is only valid for the
+// driver which produced it, so the keys hash the driver strings together with the
+// shader sources. The driver may still reject a binary (after an update for
+// instance), the caller then links from the sources and replaces it. Each binary
+// records the last save in which it was used. The binaries of other parameters
+// or drivers are kept, so that switching between them does not relink, until
+// the file exceeds kMaxFileSize; the least recently used ones are then dropped.
+class ProgramBinaryCache {
+public:
+	struct Binary {
+		uint32_t format;
+		std::vector<unsigned char> data;
+	};
+
+	// Reads the file, if any. An empty file name disables the cache.
+	explicit ProgramBinaryCache(const std::string& filename);
+
+	bool IsEnabled() const { return !filename_.empty(); }
+
+	// Returns null if there is no binary for this key. Otherwise marks the
+	// binary as used, which makes it the most recently used one on Save.
+	const Binary* Find(uint64_t key);
+	void Insert(uint64_t key, const Binary& binary);
+	void Erase(uint64_t key);
+
+	// Writes the binaries to the file, if binaries were inserted or erased
+	// since it was read, or if a binary which was not among the most recently
+	// used ones was used.
+	bool Save();
+
+	static const uint64_t kMaxFileSize = 32 * 1024 * 1024;
+
+private:
+	struct Entry {
+		Binary binary;
+		uint32_t last_used;  // save count when it was last used
+	};
+
+	// Drops the least recently used binaries, but not the used ones, until
+	// the file fits in kMaxFileSize.
+	void Evict();
+
+	std::string filename_;
+	std::map<uint64_t, Entry> binaries_;
+	std::set<uint64_t> used_;
+	uint32_t save_count_;
+	bool modified_;
+};
+
+#endif  // PROGRAM_BINARY_CACHE_H_
@@ -0,0 +1,118 @@
+#include "ShaderSources.h"
+
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <utility>
+
+namespace {
+
+const char kInclude[] = "#include \"";
+
+const std::string kEmpty;
+
+}  // anonymous namespace
+
+const std::string& ShaderSources::GetFile(const std::string& name) {
+	static std::map<std::string, std::string> files;
+	std::map<std::string, std::string>::const_iterator it = files.find(name);
+	if (it != files.end()) {
+		return it->second;
+	}
+	for (size_t i = 0; i < kFileCount; ++i) {
+		const File& file = kFiles[i];
+		if (name != file.name) {
+			continue;
+		}
+		size_t size = 0;
+		for (size_t j = 0; j < file.piece_count; ++j) {
+			size += strlen(file.pieces[j]);
+		}
+		std::string& content = files[name];
+		content.reserve(size);
+		for (size_t j = 0; j < file.piece_count; ++j) {
+			content += file.pieces[j];
+		}
+		return content;
+	}
+	std::cerr << "unknown embedded shader file " << name << std::endl;
+	return kEmpty;
+}
+
+const std::string& ShaderSources::Assemble(const std::string& source,
+	const std::vector<std::string>& defines) {
+	// Keyed by the defines, then the source. A define cannot contain a newline.
+	std::string key;
+	for (size_t i = 0; i < defines.size(); ++i) {
+		key += defines[i] + '\n';
+	}
+	key += '\0';
+	key += source;
+	static std::map<std::string, std::string> variants;
+	std::map<std::string, std::string>::const_iterator it = variants.find(key);
+	if (it != variants.end()) {
+		return it->second;
+	}
+
+	// Splits the source at its includes, to allocate the result only once.
+	std::vector<std::pair<size_t, size_t> > chunks;  // [begin, end) of source
+	std::vector<const std::string*> files;           // the file after each chunk
+	size_t size = 0;
+	size_t begin = 0;
+	size_t position = 0;
+	while (position < source.size()) {
+		size_t end = source.find('\n', position);
+		end = end == std::string::npos ? source.size() : end + 1;
+		if (source.compare(position, sizeof(kInclude) - 1, kInclude) == 0) {
+			size_t name_begin = position + sizeof(kInclude) - 1;
+			size_t name_end = source.find('"', name_begin);
+			const std::string* file = NULL;
+			if (name_end != std::string::npos && name_end < end) {
+				file = &GetFile(source.substr(name_begin, name_end - name_begin));
+			}
+			// An unknown file keeps its #include line, which the GLSL compiler
+			// rejects, so that the shader fails to compile instead of missing
+			// its functions silently.
+			if (file != NULL && file != &kEmpty) {
+				chunks.push_back(std::make_pair(begin, position));
+				files.push_back(file);
+				size += position - begin + file->size() + 1;
+				begin = end;
+			}
+		}
+		position = end;
+	}
+	chunks.push_back(std::make_pair(begin, source.size()));
+	size += source.size() - begin;
+
+	// The defines go after the #version line, which must come first.
+	size_t defines_position = 0;
+	if (source.compare(0, 8, "#version") == 0) {
+		defines_position = source.find('\n');
+		defines_position = defines_position == std::string::npos ?
+			source.size() : defines_position + 1;
+	}
+	std::string defines_lines;
+	for (size_t i = 0; i < defines.size(); ++i) {
+		defines_lines += "#define " + defines[i] + "\n";
+	}
+
+	std::string& result = variants[key];
+	result.reserve(size + defines_lines.size());
+	for (size_t i = 0; i < chunks.size(); ++i) {
+		size_t chunk_begin = chunks[i].first;
+		size_t chunk_end = chunks[i].second;
+		if (chunk_begin <= defines_position && defines_position <= chunk_end) {
+			result.append(source, chunk_begin, defines_position - chunk_begin);
+			result += defines_lines;
+			chunk_begin = defines_position;
+			defines_position = std::string::npos;
+		}
+		result.append(source, chunk_begin, chunk_end - chunk_begin);
+		if (i < files.size()) {
+			result += *files[i];
+			result += '\n';
+		}
+	}
+	return result;
+}
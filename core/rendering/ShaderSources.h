@@ -0,0 +1,42 @@
+#ifndef SHADER_SOURCES_H_
+#define SHADER_SOURCES_H_
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// The GLSL files of core (definitions.c, functions.c and demo.c), embedded into
+// the executable at build time by tools/embed_shaders.py, so that the shaders do
+// not read them from the working directory. Assemble is a small preprocessor for
+// the shader variants built from them: it replaces the #include "file" lines of
+// a template with the embedded files and adds #define lines after its #version
+// line. Each file and each variant is assembled once and then cached for the
+// rest of the run. Must only be used from the thread of the GL context.
+class ShaderSources {
+public:
+	// An embedded file, in pieces shorter than the longest MSVC string literal.
+	struct File {
+		const char* name;
+		const char* const* pieces;
+		size_t piece_count;
+	};
+
+	// Returns the embedded file with this name ("functions.c" for instance), or
+	// an empty string, after printing an error, if there is none.
+	static const std::string& GetFile(const std::string& name);
+
+	// Returns the source with each line #include "name" replaced with the
+	// embedded file of this name (whose own includes are not expanded), and with
+	// a #define line for each of the defines ("NAME" or "NAME value") after its
+	// #version line, or at its start if it has none. The #include line of an
+	// unknown file is kept, so that the shader does not compile.
+	static const std::string& Assemble(const std::string& source,
+		const std::vector<std::string>& defines = std::vector<std::string>());
+
+private:
+	// Defined in EmbeddedShaderFiles.cpp, which tools/embed_shaders.py writes.
+	static const File kFiles[];
+	static const size_t kFileCount;
+};
+
+#endif  // SHADER_SOURCES_H_
@@ -1,8 +1,8 @@
 #include "Sky.h"
+#include "ShaderSources.h"
 
 #include <string>
-#include <fstream>
-#include <sstream>
+#include <cstring>
 #include <iostream>
 
 #define POSITION_LOC    0
@@ -14,13 +14,135 @@ const double kSunAngularRadius = 0.00935 / 2.0;
 const double kSunSolidAngle = 2.0 * M_PI * (1.0 - cos(kSunAngularRadius));
 const double kLengthUnitInMeters = 1000.0;
 
+// resolution of the sky-view LUT, in azimuth and zenith angle
+const int kSkyViewLutWidth = 192;
+const int kSkyViewLutHeight = 108;
+// texture unit of the sky-view LUT, after the ones of SkyModel
+const int kSkyViewLutUnit = 4;
+
+// uniform buffer binding of the SkyFrame block, after the one of SkyLighting
+const int kSkyFrameBinding = 1;
+
+// the uniforms that change every frame, in the vertex shader of all the programs
+// of Sky and in the fragment shaders that need them (see Sky::FrameUniforms)
+#define SKY_FRAME_GLSL                                                          \
+	"layout(std140) uniform SkyFrame                                        \n" \
+	"{                                                                      \n" \
+	"   layout(row_major) highp mat4 model_from_view;                       \n" \
+	"   layout(row_major) highp mat4 view_from_clip;                        \n" \
+	"   highp vec3 camera;                                                  \n" \
+	"   highp float exposure;                                               \n" \
+	"   highp vec3 sun_direction;                                           \n" \
+	"};                                                                     \n"
+
+// resolution of a face of the sky cubemap, the sun disc is about 3 texels wide
+const int kSkyCubemapSize = 512;
+// texture unit of the sky cubemap, after the one of the aerial perspective
+const int kSkyCubemapUnit = 6;
+
+// model_from_view of each cubemap face, in the order of GL_TEXTURE_CUBE_MAP_POSITIVE_X
+// and the following targets, and in rows as view_from_clip. Face texel (x, y) of
+// the clip space square has the direction of (x, y, -1) in view space
+const float kSkyCubemapFaces[6][16] = {
+	{  0,  0, -1, 0,   0, -1,  0, 0,  -1,  0,  0, 0,  0, 0, 0, 1 },  // +x
+	{  0,  0,  1, 0,   0, -1,  0, 0,   1,  0,  0, 0,  0, 0, 0, 1 },  // -x
+	{  1,  0,  0, 0,   0,  0, -1, 0,   0,  1,  0, 0,  0, 0, 0, 1 },  // +y
+	{  1,  0,  0, 0,   0,  0,  1, 0,   0, -1,  0, 0,  0, 0, 0, 1 },  // -y
+	{  1,  0,  0, 0,   0, -1,  0, 0,   0,  0, -1, 0,  0, 0, 0, 1 },  // +z
+	{ -1,  0,  0, 0,   0, -1,  0, 0,   0,  0,  1, 0,  0, 0, 0, 1 },  // -z
+};
+// view_from_clip of a cubemap face, a square with a 90 degrees field of view
+const float kSkyCubemapViewFromClip[16] = {
+	1.0, 0.0, 0.0, 0.0,
+	0.0, 1.0, 0.0, 0.0,
+	0.0, 0.0, 0.0, -1.0,
+	0.0, 0.0, 1.0, 1.0
+};
+
+// draws the sky cubemap, once it is rendered
+const char kSkyboxFragmentShader[] =
+	R"(#version 300 es
+		precision mediump float;
+		uniform samplerCube sky_cubemap;
+		in vec3 view_ray;
+		layout(location = 0) out vec4 color;
+		void main()
+		{
+			color = vec4(texture(sky_cubemap, view_ray).rgb, 1.0);
+		})";
+
+// drawn until the first atmosphere model is precomputed: a gradient from the horizon
+// to the zenith that darkens as the sun sets, and the sun disc
+const char kFallbackFragmentShader[] =
+	R"(#version 300 es
+		precision mediump float;
+		)" SKY_FRAME_GLSL R"(
+		uniform vec2 sun_size;
+		in vec3 view_ray;
+		layout(location = 0) out vec4 color;
+		void main()
+		{
+			vec3 direction = normalize(view_ray);
+			float day = smoothstep(-0.1, 0.3, sun_direction.z);
+			vec3 zenith = mix(vec3(0.01, 0.01, 0.03), vec3(0.2, 0.4, 0.8), day);
+			vec3 horizon = mix(vec3(0.06, 0.05, 0.08), vec3(0.75, 0.8, 0.85), day);
+			vec3 sky = mix(horizon, zenith, sqrt(clamp(direction.z, 0.0, 1.0)));
+			float sun = step(sun_size.y, dot(direction, sun_direction));
+			color = vec4(mix(sky, vec3(1.0, 0.95, 0.85), sun), 1.0);
+		})";
+
+// binds the SkyFrame block of a program to kSkyFrameBinding
+static void setFrameBlockBinding(GLuint program)
+{
+	GLuint index = glGetUniformBlockIndex(program, "SkyFrame");
+	if (index != GL_INVALID_INDEX)
+	{
+		glUniformBlockBinding(program, index, kSkyFrameBinding);
+	}
+}
+
 Sky::Sky():
 	use_constant_solar_spectrum_(false),
 	use_combined_textures_(false),
+	texture_sizes_(SkyTextureSizes::High()),
+	use_sky_view_lut_(false),
+	use_aerial_perspective_(false),
+	use_sky_cubemap_(false),
+	use_sky_lighting_(false),
 	use_luminance_(true),
 	do_white_balance_(false),
 	show_help_(true),
 	program_(0),
+	pending_program_(0),
+	fallback_program_(0),
+	lut_program_(0),
+	pending_lut_program_(0),
+	sky_view_lut_texture_(0),
+	sky_view_lut_fbo_(0),
+	aerial_program_(0),
+	pending_aerial_program_(0),
+	aerial_locations_(),
+	pending_aerial_locations_(),
+	lighting_program_(0),
+	pending_lighting_program_(0),
+	sky_lighting_valid_(false),
+	sky_lighting_sun_zenith_(0.0),
+	sky_lighting_sun_azimuth_(0.0),
+	sky_lighting_exposure_(0.0),
+	skybox_program_(0),
+	sky_cubemap_texture_(0),
+	sky_cubemap_valid_(false),
+	sky_cubemap_sun_threshold_(0.002),
+	sky_cubemap_camera_threshold_(0.01),
+	sky_cubemap_sun_zenith_(0.0),
+	sky_cubemap_sun_azimuth_(0.0),
+	sky_cubemap_exposure_(0.0),
+	full_screen_vao_(0),
+	full_screen_vbo_(0),
+	frame_uniforms_buffer_(0),
+	frame_uniforms_stride_(0),
+	frame_uniforms_valid_(false),
+	precompute_steps_per_frame_(4),
 	view_distance_meters_(9000.0),
 	view_zenith_angle_radians_(1.47),
 	view_azimuth_angle_radians_(0.1),
@@ -29,11 +151,33 @@ Sky::Sky():
 	exposure_(10.0)
 {
 	m_theta = 5.0f;
+	for (int i = 0; i < 6; ++i)
+	{
+		sky_cubemap_fbos_[i] = 0;
+	}
+	setTextureFormats(SkyModel::FULL_PRECISION, SkyModel::FULL_PRECISION,
+		SkyModel::FULL_PRECISION);
 }
 
 Sky::~Sky()
 {
-
+	glDeleteProgram(program_);
+	glDeleteProgram(pending_program_);
+	glDeleteProgram(fallback_program_);
+	glDeleteProgram(lut_program_);
+	glDeleteProgram(pending_lut_program_);
+	glDeleteProgram(aerial_program_);
+	glDeleteProgram(pending_aerial_program_);
+	glDeleteProgram(lighting_program_);
+	glDeleteProgram(pending_lighting_program_);
+	glDeleteProgram(skybox_program_);
+	glDeleteTextures(1, &sky_view_lut_texture_);
+	glDeleteFramebuffers(1, &sky_view_lut_fbo_);
+	glDeleteTextures(1, &sky_cubemap_texture_);
+	glDeleteFramebuffers(6, sky_cubemap_fbos_);
+	glDeleteVertexArrays(1, &full_screen_vao_);
+	glDeleteBuffers(1, &full_screen_vbo_);
+	glDeleteBuffers(1, &frame_uniforms_buffer_);
 }
 
 bool Sky::init()
@@ -45,26 +189,9 @@ bool Sky::init()
 
 void Sky::InitModel() 
 {
-	// Values from "Reference Solar Spectral Irradiance: ASTM G-173", ETR column
-	// (see http://rredc.nrel.gov/solar/spectra/am1.5/ASTMG173/ASTMG173.html),
-	// summed and averaged in each bin (e.g. the value for 360nm is the average
-	// of the ASTM G-173 values for all wavelengths between 360 and 370nm).
-	const int kLambdaMin = 360;
-	const int kLambdaMax = 830;
-	const double kSolarIrradiance[48] = 
-	{
-		1.11776, 1.14259, 1.01249, 1.14716, 1.72765, 1.73054, 1.6887, 1.61253,
-		1.91198, 2.03474, 2.02042, 2.02212, 1.93377, 1.95809, 1.91686, 1.8298,
-		1.8685, 1.8931, 1.85149, 1.8504, 1.8341, 1.8345, 1.8147, 1.78158, 1.7533,
-		1.6965, 1.68194, 1.64654, 1.6048, 1.52143, 1.55622, 1.5113, 1.474, 1.4482,
-		1.41018, 1.36775, 1.34188, 1.31429, 1.28303, 1.26758, 1.2367, 1.2082,
-		1.18737, 1.14683, 1.12362, 1.1058, 1.07124, 1.04992
-	};
-
 	const char* kVertexShader = 
 	     R"(#version 300 es
-			uniform mat4 model_from_view;
-			uniform mat4 view_from_clip;
+			)" SKY_FRAME_GLSL R"(
 			layout(location = 0) in vec4 vertex;
 			out vec3 view_ray;
 			void main() 
@@ -73,150 +200,370 @@ void Sky::InitModel()
 				gl_Position = vertex;
 			})";
 
-	// Wavelength independent solar irradiance "spectrum" (not physically
-	// realistic, but was used in the original implementation).
-	const double kConstantSolarIrradiance = 1.5;
-	const double kBottomRadius = 6360000.0;
-	const double kTopRadius = 6420000.0;
-	const double kRayleigh = 1.24062e-6;
-	const double kRayleighScaleHeight = 8000.0;
-	const double kMieScaleHeight = 1200.0;
-	const double kMieAngstromAlpha = 0.0;
-	const double kMieAngstromBeta = 5.328e-3;
-	const double kMieSingleScatteringAlbedo = 0.9;
-	const double kMiePhaseFunctionG = 0.8;
-	const double kGroundAlbedo = 0.1;
-	const double kMaxSunZenithAngle = 102.0 / 180.0 * M_PI;
-
-	std::vector<double> wavelengths;
-	std::vector<double> solar_irradiance;
-	std::vector<double> rayleigh_scattering;
-	std::vector<double> mie_scattering;
-	std::vector<double> mie_extinction;
-	std::vector<double> ground_albedo;
-	for (int l = kLambdaMin; l <= kLambdaMax; l += 10) 
-	{
-		double lambda = static_cast<double>(l)* 1e-3;  // micro-meters
-		double mie =
-			kMieAngstromBeta / kMieScaleHeight * pow(lambda, -kMieAngstromAlpha);
-		wavelengths.push_back(l);
-		if (use_constant_solar_spectrum_) {
-			solar_irradiance.push_back(kConstantSolarIrradiance);
-		}
-		else {
-			solar_irradiance.push_back(kSolarIrradiance[(l - kLambdaMin) / 10]);
-		}
-		rayleigh_scattering.push_back(kRayleigh * pow(lambda, -4));
-		mie_scattering.push_back(mie * kMieSingleScatteringAlbedo);
-		mie_extinction.push_back(mie);
-		ground_albedo.push_back(kGroundAlbedo);
-	}
-
-	model_.reset(new SkyModel(wavelengths, solar_irradiance, kSunAngularRadius,
-		kBottomRadius, kTopRadius, kRayleighScaleHeight, rayleigh_scattering,
-		kMieScaleHeight, mie_scattering, mie_extinction, kMiePhaseFunctionG,
-		ground_albedo, kMaxSunZenithAngle, kLengthUnitInMeters,
-		use_combined_textures_));
-	model_->Init();
+	SkyModelParameters parameters = SkyModelParameters::Earth(
+		use_constant_solar_spectrum_, use_combined_textures_);
+	parameters.texture_sizes = texture_sizes_;
+	// The precomputation runs a few steps per frame in draw, which meanwhile shows
+	// the previous model, or a plain gradient for the first one.
+	std::unique_ptr<SkyModel> model(new SkyModel(parameters));
+	model->SetTextureFormats(texture_formats_[0], texture_formats_[1],
+		texture_formats_[2]);
+	model->BeginInit();
 	/*
 	<p>Then, it creates and compiles the vertex and fragment shaders used to render
 	our demo scene, and link them with the <code>Model</code>'s atmosphere shader
 	to get the final scene rendering program:
 	*/
 	GLuint vertex_shader = esLoadShader(GL_VERTEX_SHADER, kVertexShader);
-	const std::string fragment_shader_str =
-		model_->getAtmosphereShaderStr() +
-		std::string(use_luminance_ ? "\n#define USE_LUMINANCE\n" : "") +
-		getStringFromFile("core/demo.c");
+	// demo.c is embedded in the executable, see ShaderSources.
+	std::vector<std::string> defines;
+	if (use_luminance_)
+	{
+		defines.push_back("USE_LUMINANCE");
+	}
+	if (use_sky_view_lut_)
+	{
+		defines.push_back("SKY_VIEW_LUT");
+	}
+	const std::string demo_shader_str =
+		model->getAtmosphereShaderStr() + "\n" SKY_FRAME_GLSL "#include \"demo.c\"\n";
+	const std::string& fragment_shader_str =
+		ShaderSources::Assemble(demo_shader_str, defines);
 
 	const char* fragment_shader_source = fragment_shader_str.c_str();
 	GLuint fragment_shader = esLoadShader(GL_FRAGMENT_SHADER, fragment_shader_source);
 
-	if (program_ != 0) {
-		glDeleteProgram(program_);
-	}
-	program_ = glCreateProgram();
-	glAttachShader(program_, vertex_shader);
-	glAttachShader(program_, fragment_shader);
-	glLinkProgram(program_);
+	GLuint program = glCreateProgram();
+	glAttachShader(program, vertex_shader);
+	glAttachShader(program, fragment_shader);
+	glLinkProgram(program);
 
 	GLint linked;
 	// Check the link status
-	glGetProgramiv(program_, GL_LINK_STATUS, &linked);
+	glGetProgramiv(program, GL_LINK_STATUS, &linked);
 
 	if (!linked)
 	{
 		GLint infoLen = 0;
 
-		glGetProgramiv(program_, GL_INFO_LOG_LENGTH, &infoLen);
+		glGetProgramiv(program, GL_INFO_LOG_LENGTH, &infoLen);
 
 		if (infoLen > 1)
 		{
 			char *infoLog = (char *)malloc(sizeof(char)* infoLen);
 
-			glGetProgramInfoLog(program_, infoLen, NULL, infoLog);
+			glGetProgramInfoLog(program, infoLen, NULL, infoLog);
 			esLogMessage("Error linking program:\n%s\n", infoLog);
 
 			free(infoLog);
 		}
 
-		glDeleteProgram(program_);
+		glDeleteProgram(program);
 		//return 0;
 	}
-	glDetachShader(program_, vertex_shader);
-	glDetachShader(program_, fragment_shader);
-	//glDetachShader(program_, model_->GetShader());
+	glDetachShader(program, vertex_shader);
+	glDetachShader(program, fragment_shader);
+	//glDetachShader(program, model_->GetShader());
 	glDeleteShader(vertex_shader);
 	glDeleteShader(fragment_shader);
+
+	// the same shader, rendering the sky and the ground in the sky-view LUT
+	GLuint lut_program = 0;
+	if (use_sky_view_lut_)
+	{
+		defines.back() = "SKY_VIEW_LUT_PASS";
+		lut_program = esLoadProgram(kVertexShader,
+			ShaderSources::Assemble(demo_shader_str, defines).c_str());
+	}
+	// the aerial perspective volume, from the same atmosphere shader
+	GLuint aerial_program = 0;
+	if (use_aerial_perspective_)
+	{
+		std::vector<std::string> aerial_defines;
+		if (use_luminance_)
+		{
+			aerial_defines.push_back("USE_LUMINANCE");
+		}
+		aerial_program = esLoadProgram(kVertexShader,
+			ShaderSources::Assemble(model->getAtmosphereShaderStr() + "\n" SKY_FRAME_GLSL +
+				AerialPerspective::getFragmentShaderStr(), aerial_defines).c_str());
+	}
+	// and the map of the sky lighting
+	GLuint lighting_program = 0;
+	if (use_sky_lighting_)
+	{
+		std::vector<std::string> lighting_defines;
+		if (use_luminance_)
+		{
+			lighting_defines.push_back("USE_LUMINANCE");
+		}
+		lighting_program = esLoadProgram(kVertexShader,
+			ShaderSources::Assemble(model->getAtmosphereShaderStr() + "\n" SKY_FRAME_GLSL +
+				SkyLighting::getFragmentShaderStr(), lighting_defines).c_str());
+	}
 	/*
-	<p>Finally, it sets the uniforms of this program that can be set once and for
-	all (in our case this includes the <code>Model</code>'s texture uniforms,
+	<p>Finally, it sets the uniforms of these programs that can be set once and
+	for all (in our case this includes the <code>Model</code>'s texture uniforms,
 	because our demo app does not have any texture of its own):
 	*/
-	glUseProgram(program_);
-	CHECK_GL_ERROR_DEBUG();
-	model_->SetProgramUniforms(program_, 0, 1, 2, 3);
 	double white_point_r = 1.0;
 	double white_point_g = 1.0;
 	double white_point_b = 1.0;
 	if (do_white_balance_) {
-		SkyModel::ConvertSpectrumToLinearSrgb(wavelengths, solar_irradiance,
+		SkyModel::ConvertSpectrumToLinearSrgb(parameters.wavelengths,
+			parameters.solar_irradiance,
 			&white_point_r, &white_point_g, &white_point_b);
 		double white_point = (white_point_r + white_point_g + white_point_b) / 3.0;
 		white_point_r /= white_point;
 		white_point_g /= white_point;
 		white_point_b /= white_point;
 	}
-	glUniform3f(glGetUniformLocation(program_, "white_point"),
-		white_point_r, white_point_g, white_point_b);
-	glUniform3f(glGetUniformLocation(program_, "earth_center"),
-		0.0, -kBottomRadius / kLengthUnitInMeters, 0.0f);
-	glUniform3f(glGetUniformLocation(program_, "sun_radiance"),
-		kSolarIrradiance[0] / kSunSolidAngle,
-		kSolarIrradiance[1] / kSunSolidAngle,
-		kSolarIrradiance[2] / kSunSolidAngle);
-	glUniform2f(glGetUniformLocation(program_, "sun_size"),
-		tan(kSunAngularRadius),
-		cos(kSunAngularRadius));
-}
+	AerialPerspective::ProgramLocations aerial_locations = {};
+	const GLuint programs[] = { program, lut_program, aerial_program, lighting_program };
+	for (GLuint p : programs)
+	{
+		if (p == 0)
+		{
+			continue;
+		}
+		glUseProgram(p);
+		CHECK_GL_ERROR_DEBUG();
+		setFrameBlockBinding(p);
+		model->SetProgramUniforms(p, 0, 1, 2, 3);
+		glUniform3f(glGetUniformLocation(p, "white_point"),
+			white_point_r, white_point_g, white_point_b);
+		glUniform3f(glGetUniformLocation(p, "earth_center"),
+			0.0, -parameters.bottom_radius / kLengthUnitInMeters, 0.0f);
+		glUniform3f(glGetUniformLocation(p, "sun_radiance"),
+			kSkySolarIrradiance[0] / kSunSolidAngle,
+			kSkySolarIrradiance[1] / kSunSolidAngle,
+			kSkySolarIrradiance[2] / kSunSolidAngle);
+		glUniform2f(glGetUniformLocation(p, "sun_size"),
+			tan(kSunAngularRadius),
+			cos(kSunAngularRadius));
+		glUniform2f(glGetUniformLocation(p, "sky_view_lut_size"),
+			kSkyViewLutWidth, kSkyViewLutHeight);
+		glUniform1i(glGetUniformLocation(p, "sky_view_lut"), kSkyViewLutUnit);
+		// and the ones of the aerial perspective and the sky lighting, whose other
+		// uniforms are set every frame at the locations looked up here
+		if (p == aerial_program)
+		{
+			aerial_locations = AerialPerspective::initProgram(p);
+		}
+		else if (p == lighting_program)
+		{
+			SkyLighting::initProgram(p);
+		}
+	}
 
-std::string Sky::getStringFromFile(const char* filename)
-{
-	std::ifstream ifile(filename);
-	//ļ뵽ostringstreambuf
-	std::ostringstream buf;
-	char ch;
-	while (buf&&ifile.get(ch))
+	if (model_ && model_->IsReady())
+	{
+		glDeleteProgram(pending_program_);
+		glDeleteProgram(pending_lut_program_);
+		glDeleteProgram(pending_aerial_program_);
+		glDeleteProgram(pending_lighting_program_);
+		pending_model_ = std::move(model);
+		pending_program_ = program;
+		pending_lut_program_ = lut_program;
+		pending_aerial_program_ = aerial_program;
+		pending_aerial_locations_ = aerial_locations;
+		pending_lighting_program_ = lighting_program;
+	}
+	else
+	{
+		glDeleteProgram(program_);
+		glDeleteProgram(lut_program_);
+		glDeleteProgram(aerial_program_);
+		glDeleteProgram(lighting_program_);
+		model_ = std::move(model);
+		program_ = program;
+		lut_program_ = lut_program;
+		aerial_program_ = aerial_program;
+		aerial_locations_ = aerial_locations;
+		lighting_program_ = lighting_program;
+		sky_cubemap_valid_ = false;
+		sky_lighting_valid_ = false;
+		// the meshes go back to their own shading without sky lighting
+		if (lighting_program_ == 0)
+		{
+			sky_lighting_.reset();
+		}
+	}
+
+	if (use_sky_view_lut_ && sky_view_lut_texture_ == 0)
 	{
-		buf.put(ch);
+		// RGBA16F, filtered, and periodic in azimuth
+		glGenTextures(1, &sky_view_lut_texture_);
+		glBindTexture(GL_TEXTURE_2D, sky_view_lut_texture_);
+		glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA16F, kSkyViewLutWidth,
+			kSkyViewLutHeight);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glBindTexture(GL_TEXTURE_2D, 0);
+
+		glGenFramebuffers(1, &sky_view_lut_fbo_);
+		glBindFramebuffer(GL_FRAMEBUFFER, sky_view_lut_fbo_);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+			GL_TEXTURE_2D, sky_view_lut_texture_, 0);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
 	}
-	//bufַ
-	return buf.str();
+	else if (!use_sky_view_lut_ && lut_program_ == 0)
+	{
+		// turned off since the last call, and no longer used by model_. With a
+		// pending model, model_ still uses it until draw replaces it
+		deleteSkyViewLut();
+	}
+
+	if (use_sky_cubemap_ && sky_cubemap_texture_ == 0)
+	{
+		// RGBA8 is enough for the tonemapped sky, and is always renderable. The
+		// mipmaps are for the blurry reflections of other passes
+		int levels = 1;
+		while ((kSkyCubemapSize >> levels) > 0)
+		{
+			++levels;
+		}
+		glGenTextures(1, &sky_cubemap_texture_);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, sky_cubemap_texture_);
+		glTexStorage2D(GL_TEXTURE_CUBE_MAP, levels, GL_RGBA8, kSkyCubemapSize,
+			kSkyCubemapSize);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER,
+			GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+
+		glGenFramebuffers(6, sky_cubemap_fbos_);
+		for (int i = 0; i < 6; ++i)
+		{
+			glBindFramebuffer(GL_FRAMEBUFFER, sky_cubemap_fbos_[i]);
+			glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+				GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, sky_cubemap_texture_, 0);
+		}
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+		skybox_program_ = esLoadProgram(kVertexShader, kSkyboxFragmentShader);
+		setFrameBlockBinding(skybox_program_);
+		glUseProgram(skybox_program_);
+		glUniform1i(glGetUniformLocation(skybox_program_, "sky_cubemap"),
+			kSkyCubemapUnit);
+	}
+	else if (!use_sky_cubemap_ && sky_cubemap_texture_ != 0)
+	{
+		// turned off since the last call: draw uses the cubemap whenever there
+		// is one, so it goes away, and the sky is drawn directly again
+		glDeleteProgram(skybox_program_);
+		glDeleteTextures(1, &sky_cubemap_texture_);
+		glDeleteFramebuffers(6, sky_cubemap_fbos_);
+		skybox_program_ = 0;
+		sky_cubemap_texture_ = 0;
+		for (int i = 0; i < 6; ++i)
+		{
+			sky_cubemap_fbos_[i] = 0;
+		}
+		sky_cubemap_valid_ = false;
+	}
+
+	if (fallback_program_ == 0)
+	{
+		fallback_program_ = esLoadProgram(kVertexShader, kFallbackFragmentShader);
+		setFrameBlockBinding(fallback_program_);
+		glUseProgram(fallback_program_);
+		glUniform2f(glGetUniformLocation(fallback_program_, "sun_size"),
+			tan(kSunAngularRadius),
+			cos(kSunAngularRadius));
+	}
+
+	if (full_screen_vao_ == 0)
+	{
+		// a triangle covering the screen, rather than a quad whose diagonal is
+		// shaded twice, in a vertex array of its own
+		const GLfloat vertices[] =
+		{
+			-1.0, -1.0, 0.0, 1.0,
+			+3.0, -1.0, 0.0, 1.0,
+			-1.0, +3.0, 0.0, 1.0
+		};
+		glGenVertexArrays(1, &full_screen_vao_);
+		glBindVertexArray(full_screen_vao_);
+		glGenBuffers(1, &full_screen_vbo_);
+		glBindBuffer(GL_ARRAY_BUFFER, full_screen_vbo_);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+		glVertexAttribPointer(POSITION_LOC, 4, GL_FLOAT, GL_FALSE, 0, (const void *)NULL);
+		glEnableVertexAttribArray(POSITION_LOC);
+		glBindVertexArray(0);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+		// the uniforms of the frame, followed by the ones of the cubemap faces,
+		// each at the offset alignment of the uniform buffer ranges
+		GLint alignment;
+		glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+		frame_uniforms_stride_ = (sizeof(FrameUniforms) + alignment - 1) / alignment * alignment;
+		glGenBuffers(1, &frame_uniforms_buffer_);
+		glBindBuffer(GL_UNIFORM_BUFFER, frame_uniforms_buffer_);
+		glBufferData(GL_UNIFORM_BUFFER, 7 * frame_uniforms_stride_, NULL, GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	}
+}
+
+void Sky::deleteSkyViewLut()
+{
+	glDeleteTextures(1, &sky_view_lut_texture_);
+	glDeleteFramebuffers(1, &sky_view_lut_fbo_);
+	sky_view_lut_texture_ = 0;
+	sky_view_lut_fbo_ = 0;
+}
+
+float Sky::getPrecomputeProgress() const
+{
+	const SkyModel *model = pending_model_ ? pending_model_.get() : model_.get();
+	return model ? model->GetProgress() : 0.0f;
 }
 
 void Sky::draw(ESContext *esContext)
 {
-	glUseProgram(program_);
+	// run the next steps of the pending precomputation, swapping in the new model
+	// once it is done
+	if (pending_model_)
+	{
+		if (pending_model_->Update(precompute_steps_per_frame_))
+		{
+			model_ = std::move(pending_model_);
+			glDeleteProgram(program_);
+			glDeleteProgram(lut_program_);
+			glDeleteProgram(aerial_program_);
+			glDeleteProgram(lighting_program_);
+			program_ = pending_program_;
+			lut_program_ = pending_lut_program_;
+			aerial_program_ = pending_aerial_program_;
+			aerial_locations_ = pending_aerial_locations_;
+			lighting_program_ = pending_lighting_program_;
+			pending_program_ = 0;
+			pending_lut_program_ = 0;
+			pending_aerial_program_ = 0;
+			pending_lighting_program_ = 0;
+			sky_cubemap_valid_ = false;
+			sky_lighting_valid_ = false;
+			// the meshes go back to their own shading without sky lighting
+			if (lighting_program_ == 0)
+			{
+				sky_lighting_.reset();
+			}
+			if (lut_program_ == 0)
+			{
+				deleteSkyViewLut();
+			}
+		}
+	}
+	else if (!model_->IsReady())
+	{
+		model_->Update(precompute_steps_per_frame_);
+	}
+
+	GLuint program = model_->IsReady() ? program_ : fallback_program_;
 
 	const float kFovY = 50.0 / 180.0 * M_PI;
 	const float kTanFovY = tan(kFovY / 2.0);
@@ -229,36 +576,152 @@ void Sky::draw(ESContext *esContext)
 		0.0, 0.0, 0.0, -1.0,
 		0.0, 0.0, 1.0, 1.0
 	};
-	glUniformMatrix4fv(glGetUniformLocation(program_, "view_from_clip"), 1, true,
-		view_from_clip);
-
-	glUniform3f(glGetUniformLocation(program_, "camera"),
-		esContext->camera_pos.x,
-		esContext->camera_pos.y,
-		esContext->camera_pos.z);
-	glUniform1f(glGetUniformLocation(program_, "exposure"),
-		use_luminance_ ? exposure_ * 1e-5 : exposure_);
-	glUniformMatrix4fv(glGetUniformLocation(program_, "model_from_view"),
-		1, true, &esContext->camera_matrix[0][0]);
-	glUniform3f(glGetUniformLocation(program_, "sun_direction"),
+	glm::vec3 sun_direction(
 		cos(sun_azimuth_angle_radians_) * sin(sun_zenith_angle_radians_),
 		sin(sun_azimuth_angle_radians_) * sin(sun_zenith_angle_radians_),
 		cos(sun_zenith_angle_radians_));
 
-	GLfloat vertexPos[] =
+	// the uniforms of the frame, shared by all the programs through the SkyFrame
+	// block, and only sent again when they changed
+	FrameUniforms frame = {};
+	memcpy(frame.model_from_view, &esContext->camera_matrix[0][0],
+		sizeof(frame.model_from_view));
+	memcpy(frame.view_from_clip, view_from_clip, sizeof(frame.view_from_clip));
+	frame.camera[0] = esContext->camera_pos.x;
+	frame.camera[1] = esContext->camera_pos.y;
+	frame.camera[2] = esContext->camera_pos.z;
+	frame.exposure = use_luminance_ ? exposure_ * 1e-5 : exposure_;
+	frame.sun_direction[0] = sun_direction.x;
+	frame.sun_direction[1] = sun_direction.y;
+	frame.sun_direction[2] = sun_direction.z;
+	if (!frame_uniforms_valid_ || memcmp(&frame, &frame_uniforms_, sizeof(frame)) != 0)
 	{
-		-1.0, -1.0, 0.0, 1.0,   // v0
-		+1.0, -1.0, 0.0, 1.0,   // v1
-		-1.0, +1.0, 0.0, 1.0,   // v2
-		+1.0, +1.0, 0.0, 1.0    // v3
-	};
+		glBindBuffer(GL_UNIFORM_BUFFER, frame_uniforms_buffer_);
+		glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(frame), &frame);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+		frame_uniforms_ = frame;
+		frame_uniforms_valid_ = true;
+	}
+	glBindBufferRange(GL_UNIFORM_BUFFER, kSkyFrameBinding, frame_uniforms_buffer_, 0,
+		sizeof(FrameUniforms));
+
+	glBindVertexArray(full_screen_vao_);
 
-	glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 0, vertexPos);
-	glEnableVertexAttribArray(0);
+	// with the cubemap the sky is only rendered again when what it depends on
+	// moved past the thresholds, and is otherwise drawn with one fetch per pixel
+	bool use_cubemap = program == program_ && sky_cubemap_texture_ != 0;
+	bool render_sky = !use_cubemap || !sky_cubemap_valid_ ||
+		fabs(sun_zenith_angle_radians_ - sky_cubemap_sun_zenith_) > sky_cubemap_sun_threshold_ ||
+		fabs(sun_azimuth_angle_radians_ - sky_cubemap_sun_azimuth_) > sky_cubemap_sun_threshold_ ||
+		glm::distance(esContext->camera_pos, sky_cubemap_camera_) > sky_cubemap_camera_threshold_ ||
+		exposure_ != sky_cubemap_exposure_;
+
+	if (program == program_ && lut_program_ != 0 && render_sky)
+	{
+		// renders the sky and the ground around the camera in the sky-view LUT,
+		// which program_ then looks up for each pixel
+		GLint framebuffer;
+		glGetIntegerv(GL_FRAMEBUFFER_BINDING, &framebuffer);
+		glBindFramebuffer(GL_FRAMEBUFFER, sky_view_lut_fbo_);
+		glViewport(0, 0, kSkyViewLutWidth, kSkyViewLutHeight);
+		glUseProgram(lut_program_);
+		// the samplers are set once in InitModel, but the precomputation and the
+		// passes creating their textures may have used the units since then
+		model_->BindTextures(0, 1, 2, 3);
+		glDrawArrays(GL_TRIANGLES, 0, 3);
+		glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+		glViewport(0, 0, esContext->width, esContext->height);
+
+		glActiveTexture(GL_TEXTURE0 + kSkyViewLutUnit);
+		glBindTexture(GL_TEXTURE_2D, sky_view_lut_texture_);
+	}
+
+	if (program == program_ && aerial_program_ != 0)
+	{
+		// the meshes drawn after the sky look their aerial perspective up in it
+		glUseProgram(aerial_program_);
+		model_->BindTextures(0, 1, 2, 3);
+		aerial_perspective_.render(aerial_locations_, esContext);
+	}
+
+	if (program == program_ && lighting_program_ != 0 && (!sky_lighting_valid_ ||
+		sun_zenith_angle_radians_ != sky_lighting_sun_zenith_ ||
+		sun_azimuth_angle_radians_ != sky_lighting_sun_azimuth_ ||
+		exposure_ != sky_lighting_exposure_))
+	{
+		// the meshes drawn after the sky are lit with it, the projection waits for
+		// its map to be rendered and is thus only done again when the sun moves
+		glUseProgram(lighting_program_);
+		model_->BindTextures(0, 1, 2, 3);
+		sky_lighting_.update(esContext, sun_direction);
+
+		sky_lighting_valid_ = true;
+		sky_lighting_sun_zenith_ = sun_zenith_angle_radians_;
+		sky_lighting_sun_azimuth_ = sun_azimuth_angle_radians_;
+		sky_lighting_exposure_ = exposure_;
+	}
+
+	if (use_cubemap && render_sky)
+	{
+		// the faces only differ from the frame by their square 90 degrees frustum
+		// and their orientation, and have the next slots of the buffer
+		glBindBuffer(GL_UNIFORM_BUFFER, frame_uniforms_buffer_);
+		for (int i = 0; i < 6; ++i)
+		{
+			FrameUniforms face = frame;
+			memcpy(face.model_from_view, kSkyCubemapFaces[i], sizeof(face.model_from_view));
+			memcpy(face.view_from_clip, kSkyCubemapViewFromClip, sizeof(face.view_from_clip));
+			glBufferSubData(GL_UNIFORM_BUFFER, (i + 1) * frame_uniforms_stride_,
+				sizeof(face), &face);
+		}
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+		glUseProgram(program_);
+		model_->BindTextures(0, 1, 2, 3);
+
+		GLint framebuffer;
+		glGetIntegerv(GL_FRAMEBUFFER_BINDING, &framebuffer);
+		glViewport(0, 0, kSkyCubemapSize, kSkyCubemapSize);
+		for (int i = 0; i < 6; ++i)
+		{
+			glBindFramebuffer(GL_FRAMEBUFFER, sky_cubemap_fbos_[i]);
+			glBindBufferRange(GL_UNIFORM_BUFFER, kSkyFrameBinding, frame_uniforms_buffer_,
+				(i + 1) * frame_uniforms_stride_, sizeof(FrameUniforms));
+			glDrawArrays(GL_TRIANGLES, 0, 3);
+		}
+		glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+		glViewport(0, 0, esContext->width, esContext->height);
+		glBindBufferRange(GL_UNIFORM_BUFFER, kSkyFrameBinding, frame_uniforms_buffer_, 0,
+			sizeof(FrameUniforms));
+
+		glActiveTexture(GL_TEXTURE0 + kSkyCubemapUnit);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, sky_cubemap_texture_);
+		glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
+
+		sky_cubemap_valid_ = true;
+		sky_cubemap_sun_zenith_ = sun_zenith_angle_radians_;
+		sky_cubemap_sun_azimuth_ = sun_azimuth_angle_radians_;
+		sky_cubemap_exposure_ = exposure_;
+		sky_cubemap_camera_ = esContext->camera_pos;
+	}
+
+	if (use_cubemap)
+	{
+		glUseProgram(skybox_program_);
+		glActiveTexture(GL_TEXTURE0 + kSkyCubemapUnit);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, sky_cubemap_texture_);
+	}
+	else
+	{
+		glUseProgram(program);
+		if (program == program_)
+		{
+			model_->BindTextures(0, 1, 2, 3);
+		}
+	}
 
-	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+	glDrawArrays(GL_TRIANGLES, 0, 3);
 
-	glDisableVertexAttribArray(0);
+	glBindVertexArray(0);
 
 	CHECK_GL_ERROR_DEBUG();
 
@@ -4,6 +4,8 @@
 
 #include <gles_include.h>
 #include <SkyModel.h>
+#include <AerialPerspective.h>
+#include <SkyLighting.h>
 #include <memory>
 
 class Sky
@@ -13,12 +15,73 @@ public:
 	~Sky();
 
 	bool init();
+	// starts the precomputation of a new atmosphere model, draw runs it a few steps
+	// per frame and shows the previous model (or a plain gradient) until it is done
 	void InitModel();
 	void draw(ESContext *esContext);
 
-	std::string getStringFromFile(const char* filename);
+	// fraction of the pending precomputation done, 1 when there is none
+	float getPrecomputeProgress() const;
+	// precomputation steps per frame, a step being one layer of a 3D pass
+	void setPrecomputeStepsPerFrame(unsigned int steps) { precompute_steps_per_frame_ = steps; }
+	// resolution of the precomputed textures of the next InitModel, e.g.
+	// SkyTextureSizes::Low() on low-end devices (High by default)
+	void setTextureSizes(const SkyTextureSizes& sizes) { texture_sizes_ = sizes; }
+	// storage formats of the final textures of the next InitModel, e.g.
+	// SkyModel::R11F_G11F_B10F for the scattering and irradiance textures
+	// (full precision by default)
+	void setTextureFormats(SkyModel::TextureFormat transmittance,
+		SkyModel::TextureFormat scattering, SkyModel::TextureFormat irradiance)
+	{
+		texture_formats_[0] = transmittance;
+		texture_formats_[1] = scattering;
+		texture_formats_[2] = irradiance;
+	}
+	// renders the sky and the ground once per frame in a small sky-view LUT around
+	// the camera, and then draws each pixel with a lookup in this LUT instead of
+	// the full atmosphere shader (see demo.c). Applies from the next InitModel
+	void setUseSkyViewLut(bool use) { use_sky_view_lut_ = use; }
+	// renders the aerial perspective volume of the meshes once per frame, from the
+	// textures of the atmosphere model. Applies from the next InitModel
+	void setUseAerialPerspective(bool use) { use_aerial_perspective_ = use; }
+	// the volume to give to the meshes, left unchanged when it is not rendered
+	AerialPerspective *getAerialPerspective() { return &aerial_perspective_; }
+	// projects the sky radiance and the sun irradiance on the spherical harmonics
+	// of the ambient and sun lighting of the meshes, only again when the sun or
+	// the exposure changed. Applies from the next InitModel
+	void setUseSkyLighting(bool use) { use_sky_lighting_ = use; }
+	// the lighting to give to the meshes, a fixed sun until it is projected
+	SkyLighting *getSkyLighting() { return &sky_lighting_; }
+	// renders the sky into a cubemap around the camera, only again when the sun
+	// or the camera moved past the thresholds (in radians, and in scene units),
+	// and otherwise draws it with one cubemap fetch per pixel. Nearby objects of
+	// the scene, like the sphere of demo.c, are seen from where it was rendered.
+	// Applies from the next InitModel
+	void setUseSkyCubemap(bool use) { use_sky_cubemap_ = use; }
+	void setSkyCubemapThresholds(double sunAngle, double cameraDistance)
+	{
+		sky_cubemap_sun_threshold_ = sunAngle;
+		sky_cubemap_camera_threshold_ = cameraDistance;
+	}
+	// the RGBA8 cubemap of the sky, tonemapped and with mipmaps, for the
+	// reflections of other passes. 0 until the sky is drawn with it
+	unsigned int getSkyCubemap() const { return sky_cubemap_texture_; }
 
 private:
+	// once no program renders or looks the sky-view LUT up any more
+	void deleteSkyViewLut();
+
+	// std140 layout of the SkyFrame uniform block, with row-major matrices
+	struct FrameUniforms
+	{
+		float model_from_view[16];
+		float view_from_clip[16];
+		float camera[3];
+		float exposure;
+		float sun_direction[3];
+		float padding;
+	};
+
 	float m_radius;
 	int m_numIndices;
 
@@ -52,12 +115,63 @@ private:
 
 	bool use_constant_solar_spectrum_;
 	bool use_combined_textures_;
+	SkyTextureSizes texture_sizes_;
+	SkyModel::TextureFormat texture_formats_[3];
+	bool use_sky_view_lut_;
+	bool use_aerial_perspective_;
+	bool use_sky_cubemap_;
+	bool use_sky_lighting_;
 	bool use_luminance_;
 	bool do_white_balance_;
 	bool show_help_;
 
 	std::unique_ptr<SkyModel> model_;
 	unsigned int program_;
+	std::unique_ptr<SkyModel> pending_model_;   // replaces model_ once precomputed
+	unsigned int pending_program_;
+	unsigned int fallback_program_;
+	// the programs rendering the sky-view LUT of model_ and pending_model_, 0
+	// without use_sky_view_lut_ (program_ then looks the LUT up)
+	unsigned int lut_program_;
+	unsigned int pending_lut_program_;
+	unsigned int sky_view_lut_texture_;
+	unsigned int sky_view_lut_fbo_;
+	// the programs rendering the aerial perspective volume of model_ and
+	// pending_model_, 0 without use_aerial_perspective_, and their uniforms
+	unsigned int aerial_program_;
+	unsigned int pending_aerial_program_;
+	AerialPerspective::ProgramLocations aerial_locations_;
+	AerialPerspective::ProgramLocations pending_aerial_locations_;
+	AerialPerspective aerial_perspective_;
+	// the programs projecting the sky lighting of model_ and pending_model_, 0
+	// without use_sky_lighting_, and what it was projected with
+	unsigned int lighting_program_;
+	unsigned int pending_lighting_program_;
+	SkyLighting sky_lighting_;
+	bool sky_lighting_valid_;
+	double sky_lighting_sun_zenith_;
+	double sky_lighting_sun_azimuth_;
+	double sky_lighting_exposure_;
+	// the sky cubemap and what it was rendered with, invalidated by a new model
+	unsigned int skybox_program_;
+	unsigned int sky_cubemap_texture_;
+	unsigned int sky_cubemap_fbos_[6];
+	bool sky_cubemap_valid_;
+	double sky_cubemap_sun_threshold_;
+	double sky_cubemap_camera_threshold_;
+	double sky_cubemap_sun_zenith_;
+	double sky_cubemap_sun_azimuth_;
+	double sky_cubemap_exposure_;
+	glm::vec3 sky_cubemap_camera_;
+	// the full screen triangle, and the uniform buffer of the frame with what was
+	// last sent to it
+	unsigned int full_screen_vao_;
+	unsigned int full_screen_vbo_;
+	unsigned int frame_uniforms_buffer_;
+	int frame_uniforms_stride_;
+	FrameUniforms frame_uniforms_;
+	bool frame_uniforms_valid_;
+	unsigned int precompute_steps_per_frame_;
 	int window_id_;
 
 	double view_distance_meters_;
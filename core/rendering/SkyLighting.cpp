@@ -0,0 +1,270 @@
+#include "SkyLighting.h"
+
+#include <cmath>
+#include <cstring>
+
+// renders the sky radiance of each direction of the latitude-longitude map (the
+// zenith angle from +y in rows, the azimuth in columns) with the ground below
+// the horizon, and the sun irradiance in the last row, exposed like the sky
+// (camera, exposure and sun_direction are in the SkyFrame block of Sky)
+const char kSkyLightingShader[] =
+	R"(
+		uniform vec3 white_point;
+		uniform vec3 earth_center;
+		uniform vec2 sky_lighting_map_size;
+		layout(location = 0) out vec4 sky_lighting;
+		#ifdef USE_LUMINANCE
+		#define GetSkyRadiance GetSkyLuminance
+		#define GetSkyRadianceToPoint GetSkyLuminanceToPoint
+		#define GetSunAndSkyIrradiance GetSunAndSkyIlluminance
+		#endif
+		const vec3 kGroundAlbedo = vec3(0.0, 0.0, 0.04);  // as in demo.c
+		void main()
+		{
+			vec3 p = camera - earth_center;
+			vec3 scale = vec3(exposure) / white_point;
+			vec3 sky_irradiance;
+			if (gl_FragCoord.y > sky_lighting_map_size.y)
+			{
+				// on a surface facing the sun, divided by pi like the sky radiance
+				vec3 sun_irradiance = GetSunAndSkyIrradiance(p, sun_direction,
+					sun_direction, sky_irradiance);
+				sky_lighting = vec4(sun_irradiance * scale / PI, 1.0);
+				return;
+			}
+			float theta = gl_FragCoord.y / sky_lighting_map_size.y * PI;
+			float phi = gl_FragCoord.x / sky_lighting_map_size.x * 2.0 * PI;
+			vec3 v = vec3(sin(theta) * cos(phi), cos(theta), sin(theta) * sin(phi));
+
+			// the ground, as in demo.c but without the shadows of its sphere
+			float p_dot_v = dot(p, v);
+			float ray_earth_center_squared_distance = dot(p, p) - p_dot_v * p_dot_v;
+			float distance_to_intersection = -p_dot_v - sqrt(
+				earth_center.y * earth_center.y - ray_earth_center_squared_distance);
+			vec3 transmittance;
+			vec3 radiance;
+			if (distance_to_intersection > 0.0)
+			{
+				vec3 point = p + v * distance_to_intersection;
+				vec3 sun_irradiance = GetSunAndSkyIrradiance(point, normalize(point),
+					sun_direction, sky_irradiance);
+				vec3 in_scatter = GetSkyRadianceToPoint(p, point, 0.0, sun_direction,
+					transmittance);
+				radiance = kGroundAlbedo * (1.0 / PI) * (sun_irradiance + sky_irradiance) *
+					transmittance + max(in_scatter, vec3(0.0));
+			}
+			else
+			{
+				radiance = GetSkyRadiance(p, v, 0.0, sun_direction, transmittance);
+			}
+			sky_lighting = vec4(radiance * scale, 1.0);
+		})";
+
+// the block of the meshes without sky lighting, which they do not read but
+// still need a buffer for: no sky and no sun
+static SkyLighting::Block defaultBlock()
+{
+	SkyLighting::Block block;
+	memset(&block, 0, sizeof(block));
+	return block;
+}
+
+SkyLighting::SkyLighting():
+	block_(defaultBlock()),
+	updated_(false),
+	buffer_(0),
+	map_texture_(0),
+	map_framebuffer_(0)
+{
+}
+
+SkyLighting::~SkyLighting()
+{
+	glDeleteBuffers(1, &buffer_);
+	glDeleteTextures(1, &map_texture_);
+	glDeleteFramebuffers(1, &map_framebuffer_);
+}
+
+const char* SkyLighting::getFragmentShaderStr()
+{
+	return kSkyLightingShader;
+}
+
+void SkyLighting::initProgram(unsigned int program)
+{
+	glUniform2f(glGetUniformLocation(program, "sky_lighting_map_size"),
+		SKY_LIGHTING_MAP_WIDTH, SKY_LIGHTING_MAP_HEIGHT);
+}
+
+void SkyLighting::createMap()
+{
+	// RGBA16F like the sky-view LUT, with the row of the sun irradiance on top
+	glGenTextures(1, &map_texture_);
+	glBindTexture(GL_TEXTURE_2D, map_texture_);
+	glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA16F, SKY_LIGHTING_MAP_WIDTH,
+		SKY_LIGHTING_MAP_HEIGHT + 1);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	glGenFramebuffers(1, &map_framebuffer_);
+	glBindFramebuffer(GL_FRAMEBUFFER, map_framebuffer_);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+		map_texture_, 0);
+}
+
+void SkyLighting::update(const ESContext *esContext, const glm::vec3 &sunDirection)
+{
+	GLint framebuffer;
+	glGetIntegerv(GL_FRAMEBUFFER_BINDING, &framebuffer);
+	if (map_texture_ == 0)
+	{
+		createMap();
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, map_framebuffer_);
+	glViewport(0, 0, SKY_LIGHTING_MAP_WIDTH, SKY_LIGHTING_MAP_HEIGHT + 1);
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+
+	// RGBA and FLOAT, the combination every float color buffer supports
+	std::vector<float> rgba(SKY_LIGHTING_MAP_WIDTH * (SKY_LIGHTING_MAP_HEIGHT + 1) * 4);
+	glReadPixels(0, 0, SKY_LIGHTING_MAP_WIDTH, SKY_LIGHTING_MAP_HEIGHT + 1, GL_RGBA,
+		GL_FLOAT, rgba.data());
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+	glViewport(0, 0, esContext->width, esContext->height);
+
+	project(rgba, sunDirection);
+
+	if (buffer_ == 0)
+	{
+		glGenBuffers(1, &buffer_);
+		glBindBuffer(GL_UNIFORM_BUFFER, buffer_);
+		glBufferData(GL_UNIFORM_BUFFER, sizeof(Block), &block_, GL_DYNAMIC_DRAW);
+	}
+	else
+	{
+		glBindBuffer(GL_UNIFORM_BUFFER, buffer_);
+		glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(Block), &block_);
+	}
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	updated_ = true;
+}
+
+void SkyLighting::project(const std::vector<float> &rgba, const glm::vec3 &sunDirection)
+{
+	const float kPi = 3.14159265358979f;
+	// the real L2 basis, in the order of SKY_LIGHTING_GLSL
+	const float kBasis[9] = {
+		0.282095f, 0.488603f, 0.488603f, 0.488603f,
+		1.092548f, 1.092548f, 0.315392f, 1.092548f, 0.546274f
+	};
+	// the convolution with the cosine lobe, divided by pi, of each band
+	const float kLobe[9] = {
+		1.0f, 2.0f / 3.0f, 2.0f / 3.0f, 2.0f / 3.0f,
+		0.25f, 0.25f, 0.25f, 0.25f, 0.25f
+	};
+
+	double sh[9][3] = {};
+	for (int y = 0; y < SKY_LIGHTING_MAP_HEIGHT; ++y)
+	{
+		float theta = (y + 0.5f) / SKY_LIGHTING_MAP_HEIGHT * kPi;
+		// the solid angle of the texels of this row
+		float weight = (2.0f * kPi / SKY_LIGHTING_MAP_WIDTH) *
+			(kPi / SKY_LIGHTING_MAP_HEIGHT) * sin(theta);
+		for (int x = 0; x < SKY_LIGHTING_MAP_WIDTH; ++x)
+		{
+			float phi = (x + 0.5f) / SKY_LIGHTING_MAP_WIDTH * 2.0f * kPi;
+			float dx = sin(theta) * cos(phi);
+			float dy = cos(theta);
+			float dz = sin(theta) * sin(phi);
+			const float basis[9] = {
+				kBasis[0], kBasis[1] * dy, kBasis[2] * dz, kBasis[3] * dx,
+				kBasis[4] * dx * dy, kBasis[5] * dy * dz, kBasis[6] * (3.0f * dz * dz - 1.0f),
+				kBasis[7] * dx * dz, kBasis[8] * (dx * dx - dy * dy)
+			};
+			const float *radiance = &rgba[(y * SKY_LIGHTING_MAP_WIDTH + x) * 4];
+			for (int i = 0; i < 9; ++i)
+			{
+				for (int c = 0; c < 3; ++c)
+				{
+					sh[i][c] += radiance[c] * basis[i] * weight;
+				}
+			}
+		}
+	}
+
+	for (int i = 0; i < 9; ++i)
+	{
+		for (int c = 0; c < 3; ++c)
+		{
+			block_.skyRadianceSh[i][c] = (float)sh[i][c];
+			block_.skyIrradianceSh[i][c] = (float)sh[i][c] * kLobe[i] * kBasis[i];
+		}
+		block_.skyRadianceSh[i][3] = 0.0f;
+		block_.skyIrradianceSh[i][3] = 0.0f;
+	}
+	block_.sunDirection[0] = sunDirection.x;
+	block_.sunDirection[1] = sunDirection.y;
+	block_.sunDirection[2] = sunDirection.z;
+	block_.sunDirection[3] = 0.0f;
+	const float *sun = &rgba[SKY_LIGHTING_MAP_HEIGHT * SKY_LIGHTING_MAP_WIDTH * 4];
+	block_.sunIrradiance[0] = sun[0];
+	block_.sunIrradiance[1] = sun[1];
+	block_.sunIrradiance[2] = sun[2];
+	block_.sunIrradiance[3] = 0.0f;
+}
+
+void SkyLighting::bind(GLint useLoc) const
+{
+	// the meshes do not read the block before the first update, but still need
+	// a buffer bound for it
+	if (buffer_ == 0)
+	{
+		glGenBuffers(1, &buffer_);
+		glBindBuffer(GL_UNIFORM_BUFFER, buffer_);
+		glBufferData(GL_UNIFORM_BUFFER, sizeof(Block), &block_, GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	}
+	glBindBufferBase(GL_UNIFORM_BUFFER, SKY_LIGHTING_BINDING, buffer_);
+	glUniform1i(useLoc, updated_ ? 1 : 0);
+}
+
+void SkyLighting::reset()
+{
+	// the buffer is kept for the next update, unread until then
+	updated_ = false;
+	block_ = defaultBlock();
+}
+
+void SkyLighting::setProgramBinding(GLuint program)
+{
+	GLuint index = glGetUniformBlockIndex(program, "SkyLighting");
+	if (index != GL_INVALID_INDEX)
+	{
+		glUniformBlockBinding(program, index, SKY_LIGHTING_BINDING);
+	}
+}
+
+SkyLightingBinding::SkyLightingBinding():
+	sky_lighting_(nullptr),
+	use_loc_(-1)
+{
+}
+
+void SkyLightingBinding::init(GLuint program)
+{
+	SkyLighting::setProgramBinding(program);
+	use_loc_ = glGetUniformLocation(program, "u_useSkyLighting");
+}
+
+void SkyLightingBinding::bind() const
+{
+	if (sky_lighting_ != nullptr)
+	{
+		sky_lighting_->bind(use_loc_);
+	}
+	else
+	{
+		unlit_.bind(use_loc_);
+	}
+}
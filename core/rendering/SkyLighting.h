@@ -0,0 +1,136 @@
+#ifndef __SKY_LIGHTING__
+#define __SKY_LIGHTING__
+
+#include <gles_include.h>
+#include <vector>
+
+// resolution of the latitude-longitude map of the sky radiance projected on the
+// spherical harmonics, more than enough for their low frequencies
+#define SKY_LIGHTING_MAP_WIDTH  64
+#define SKY_LIGHTING_MAP_HEIGHT 32
+// uniform buffer binding of the SkyLighting block in the mesh programs
+#define SKY_LIGHTING_BINDING    0
+
+// GLSL pasted into the vertex shaders of the meshes. skyLighting returns the
+// light reflected by a white lambertian surface of world normal n (the sky
+// irradiance and the sun irradiance, divided by pi), in the linear and exposed
+// units of the sky, from the L2 spherical harmonics of the block. The irradiance
+// coefficients are premultiplied by the cosine lobe convolution and the basis
+// constants, so this is a few multiply-adds per vertex. u_useSkyLighting is
+// false without sky lighting, or before its first update: the block is then
+// bound but meaningless, and the meshes keep their own shading
+#define SKY_LIGHTING_GLSL                                                           \
+	"uniform bool u_useSkyLighting;                                             \n" \
+	"layout(std140) uniform SkyLighting                                         \n" \
+	"{                                                                          \n" \
+	"   vec4 skyRadianceSh[9];                                                  \n" \
+	"   vec4 skyIrradianceSh[9];                                                \n" \
+	"   vec4 sunDirection;                                                      \n" \
+	"   vec4 sunIrradiance;                                                     \n" \
+	"} u_skyLighting;                                                           \n" \
+	"vec3 skyLighting(vec3 n)                                                   \n" \
+	"{                                                                          \n" \
+	"   vec4 e = u_skyLighting.skyIrradianceSh[0]                               \n" \
+	"      + u_skyLighting.skyIrradianceSh[1] * n.y                             \n" \
+	"      + u_skyLighting.skyIrradianceSh[2] * n.z                             \n" \
+	"      + u_skyLighting.skyIrradianceSh[3] * n.x                             \n" \
+	"      + u_skyLighting.skyIrradianceSh[4] * (n.x * n.y)                     \n" \
+	"      + u_skyLighting.skyIrradianceSh[5] * (n.y * n.z)                     \n" \
+	"      + u_skyLighting.skyIrradianceSh[6] * (3.0 * n.z * n.z - 1.0)         \n" \
+	"      + u_skyLighting.skyIrradianceSh[7] * (n.x * n.z)                     \n" \
+	"      + u_skyLighting.skyIrradianceSh[8] * (n.x * n.x - n.y * n.y);        \n" \
+	"   return max(e.rgb, 0.0) + u_skyLighting.sunIrradiance.rgb *              \n" \
+	"      max(dot(n, u_skyLighting.sunDirection.xyz), 0.0);                    \n" \
+	"}                                                                          \n"
+
+// GLSL pasted into the fragment shaders of the meshes, after their precision
+// statement: the color of an albedo (in sRGB, as in the textures) lit by
+// skyLighting, tonemapped like the sky (see demo.c), when u_useSkyLighting is
+// true
+#define SKY_LIGHTING_FRAGMENT_GLSL                                                  \
+	"uniform bool u_useSkyLighting;                                             \n" \
+	"vec3 shadeSkyLighting(vec3 albedo, vec3 lighting)                          \n" \
+	"{                                                                          \n" \
+	"   vec3 radiance = pow(albedo, vec3(2.2)) * lighting;                      \n" \
+	"   return pow(vec3(1.0) - exp(-radiance), vec3(1.0 / 2.2));                \n" \
+	"}                                                                          \n"
+
+// Ambient and sun lighting of the meshes, consistent with the sky: Sky renders
+// the sky radiance around the camera (with the ground below the horizon) in a
+// small latitude-longitude map, and the sun irradiance in one more texel, from
+// the precomputed textures of its atmosphere model. This map is read back and
+// projected on the L2 spherical harmonics, which go to a uniform buffer for the
+// SKY_LIGHTING_GLSL block. This only happens when the sun moves, since reading
+// the map back waits for the GPU
+class SkyLighting
+{
+public:
+	// std140 layout of the SkyLighting block
+	struct Block
+	{
+		float skyRadianceSh[9][4];      // rgb coefficients of the radiance
+		float skyIrradianceSh[9][4];    // of the irradiance / pi, premultiplied
+		float sunDirection[4];
+		float sunIrradiance[4];         // rgb / pi
+	};
+
+	SkyLighting();
+	~SkyLighting();
+
+	// the fragment shader rendering the map, to append to the atmosphere shader
+	// of a SkyModel (with USE_LUMINANCE when the sky uses luminance)
+	static const char* getFragmentShaderStr();
+	// sets the uniforms of the current program, built from getFragmentShaderStr(),
+	// once when it is linked
+	static void initProgram(unsigned int program);
+
+	// renders the map with the current program, a program given to initProgram
+	// whose atmosphere textures, camera, exposure and sun direction are set, and
+	// updates the block with its projection. The bound vertex array must be a
+	// full screen triangle
+	void update(const ESContext *esContext, const glm::vec3 &sunDirection);
+	const Block &getBlock() const { return block_; }
+
+	// binds the block to SKY_LIGHTING_BINDING and sets the u_useSkyLighting
+	// uniform at useLoc, to false until the first update (the block is then empty)
+	void bind(GLint useLoc) const;
+	// forgets the last update, when the sky lighting is turned off
+	void reset();
+	// sets the binding of the SkyLighting block of a mesh program
+	static void setProgramBinding(GLuint program);
+
+private:
+	void createMap();
+	void project(const std::vector<float> &rgba, const glm::vec3 &sunDirection);
+
+	Block block_;
+	bool updated_;
+
+	// created by the first update or bind, whichever comes first
+	mutable unsigned int buffer_;
+	unsigned int map_texture_;
+	unsigned int map_framebuffer_;
+};
+
+// The SkyLighting block and u_useSkyLighting uniform in the program of a mesh,
+// and the lighting the mesh is lit by, bound with one call before each draw
+class SkyLightingBinding
+{
+public:
+	SkyLightingBinding();
+
+	// sets the block binding of program and looks its uniform up, once it is linked
+	void init(GLuint program);
+	// the lighting of the mesh, none by default
+	void setSkyLighting(const SkyLighting *skyLighting) { sky_lighting_ = skyLighting; }
+	// binds the block of the lighting, or an empty one, for the current program,
+	// the one given to init
+	void bind() const;
+
+private:
+	const SkyLighting *sky_lighting_;
+	SkyLighting unlit_;                 // never updated, for the meshes without lighting
+	GLint use_loc_;
+};
+
+#endif
@@ -42,16 +42,23 @@ of the following C++ code.
 */
 
 #include "SkyModel.h"
+#include "AtmosphereCache.h"
+#include "ProgramBinaryCache.h"
+#include "ShaderSources.h"
+#include "SkyModelShaders.h"
 
 #include <gles_include.h>
 
 #include <string>
-#include <fstream>
-#include <sstream>
 #include <iostream>
 
 #include <cassert>
 #include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <map>
 #include <iostream>
 #include <memory>
 
@@ -60,152 +67,18 @@ of the following C++ code.
 /*
 <p>The rest of this file is organized in 3 parts:
 <ul>
-<li>the <a href="#shaders">first part</a> defines the shaders used to precompute
-the atmospheric textures,</li>
+<li>the first part, in <code>SkyModelShaders.h</code>, defines the shaders used
+to precompute the atmospheric textures,</li>
 <li>the <a href="#utilities">second part</a> provides utility classes and
 functions used to compile shaders, create textures, draw quads, etc,</li>
 <li>the <a href="#implementation">third part</a> provides the actual
 implementation of the <code>Model</code> class, using the above tools.</li>
 </ul>
-
-<h3 id="shaders">Shader definitions</h3>
-
-<p>In order to precompute a texture we attach it to a framebuffer object (FBO)
-and we render a full quad in this FBO. For this we need a basic vertex shader:
 */
 
-const char* kVertexShader = 
-R"( #version 300 es
-    layout(location = 0) in vec2 vertex;
-    void main() {
-      gl_Position = vec4(vertex, 0.0, 1.0);
-    })";
-
 /*
-<p>a basic geometry shader (only for 3D textures, to specify in which layer we
-want to write):
-*/
-
-const char* kGeometryShader = R"(
-    #version 300 es
-    #extension GL_EXT_geometry_shader4 : enable
-    layout(triangles) in;
-    layout(triangle_strip, max_vertices = 3) out;
-    uniform int layer;
-    void main() {
-      gl_Position = gl_PositionIn[0];
-      gl_Layer = layer;
-      EmitVertex();
-      gl_Position = gl_PositionIn[1];
-      gl_Layer = layer;
-      EmitVertex();
-      gl_Position = gl_PositionIn[2];
-      gl_Layer = layer;
-      EmitVertex();
-      EndPrimitive();
-    })";
-
-/*
-<p>and a fragment shader, which depends on the texture we want to compute. This
-is the role of the following shaders, which simply wrap the precomputation
-functions from <a href="functions.glsl.html">functions.glsl</a> in complete
-shaders (with a <code>main</code> function and a proper declaration of the
-shader inputs and outputs). Note that these strings must be concatenated with
-<code>definitions.glsl</code> and <code>functions.glsl</code> (provided as C++
-string literals by the generated <code>.glsl.inc</code> files), as well as with
-a definition of the <code>ATMOSPHERE</code> constant - containing the atmosphere
-parameters, to really get a complete shader:
-*/
-
-const char* kComputeTransmittanceShader = R"(
-    layout(location = 0) out vec3 transmittance;
-    void main() {
-      transmittance = ComputeTransmittanceToTopAtmosphereBoundaryTexture(
-          ATMOSPHERE, gl_FragCoord.xy);
-    })";
-
-const char* kComputeDirectIrradianceShader = R"(
-    layout(location = 0) out vec3 delta_irradiance;
-    layout(location = 1) out vec3 irradiance;
-    uniform sampler2D transmittance_texture;
-    void main() {
-      delta_irradiance = ComputeDirectIrradianceTexture(
-          ATMOSPHERE, transmittance_texture, gl_FragCoord.xy);
-      irradiance = vec3(0.0);
-    })";
-
-const char* kComputeSingleScatteringShader = R"(
-    layout(location = 0) out vec3 delta_rayleigh;
-    layout(location = 1) out vec3 delta_mie;
-    layout(location = 2) out vec4 scattering;
-    uniform sampler2D transmittance_texture;
-    uniform float layer;
-    void main() {
-		ComputeSingleScatteringTexture(
-			ATMOSPHERE, transmittance_texture, vec3(gl_FragCoord.xy, layer + 0.5),
-			delta_rayleigh, delta_mie);
-		scattering = vec4(delta_rayleigh.rgb, delta_mie.r);
-    })";
-
-const char* kComputeScatteringDensityShader = R"(
-    layout(location = 0) out vec3 scattering_density;
-    uniform sampler2D transmittance_texture;
-    uniform sampler3D single_rayleigh_scattering_texture;
-    uniform sampler3D single_mie_scattering_texture;
-    uniform sampler3D multiple_scattering_texture;
-    uniform sampler2D irradiance_texture;
-    uniform int scattering_order;
-    uniform float layer;
-    void main() {
-		scattering_density = ComputeScatteringDensityTexture(
-			ATMOSPHERE, transmittance_texture, single_rayleigh_scattering_texture,
-			single_mie_scattering_texture, multiple_scattering_texture,
-			irradiance_texture, vec3(gl_FragCoord.xy, layer + 0.5),
-			scattering_order);
-    })";
-
-const char* kComputeIndirectIrradianceShader = R"(
-    layout(location = 0) out vec3 delta_irradiance;
-    layout(location = 1) out vec3 irradiance;
-    uniform sampler3D single_rayleigh_scattering_texture;
-    uniform sampler3D single_mie_scattering_texture;
-    uniform sampler3D multiple_scattering_texture;
-    uniform int scattering_order;
-    void main() {
-		delta_irradiance = ComputeIndirectIrradianceTexture(
-			ATMOSPHERE, single_rayleigh_scattering_texture,
-			single_mie_scattering_texture, multiple_scattering_texture,
-			gl_FragCoord.xy, scattering_order - 1);
-		irradiance = delta_irradiance;
-    })";
-
-const char* kComputeMultipleScatteringShader = R"(
-    layout(location = 0) out vec4 delta_multiple_scattering;
-    uniform sampler2D transmittance_texture;
-    uniform sampler3D scattering_density_texture;
-    uniform float layer;
-    void main() {
-		float nu;
-		delta_multiple_scattering = vec4(ComputeMultipleScatteringTexture(
-			ATMOSPHERE, transmittance_texture, scattering_density_texture,
-			vec3(gl_FragCoord.xy, layer + 0.5), nu)
-		, 0.0);
-		delta_multiple_scattering.a = nu;
-    })";
-
-const char* kComputeMultipleScatteringShader_1 = R"(
-	layout(location = 0) out vec4 scattering;
-	uniform sampler3D delta_multiple_scattering;
-	uniform float layer;
-	void main() {
-		vec4 color = ComputeMultipleScatteringTexture_1(
-			ATMOSPHERE, delta_multiple_scattering, 
-			vec3(gl_FragCoord.xy, layer + 0.5));	
-		scattering = vec4(color.rgb / RayleighPhaseFunction(color.a), 0.0);
-	})";
-
-/*
-<p>We finally need a shader implementing the GLSL functions exposed in our API,
+<p>Besides the precomputation shaders, we need a shader implementing the GLSL
+functions exposed in our API,
 which can be done by calling the corresponding functions in functions.glsl,
 with the precomputed texture arguments taken from uniform variables (note also the
 _RADIANCE_TO_LUMINANCE conversion constants in the last functions:
@@ -274,6 +147,29 @@ const char* kAtmosphereShader = R"(
 
 /*<h3 id="utilities">Utility classes and functions</h3>
 
+<p>The compute shader path needs a few GLES 3.1 definitions, which the GLES 3.0
+headers do not have. Its entry points are loaded at runtime (see
+<code>LoadComputeFunctions</code> below), so that the application still starts
+with a GLES 3.0 library:
+*/
+
+#ifndef GL_COMPUTE_SHADER
+#define GL_COMPUTE_SHADER                 0x91B9
+#endif
+#ifndef GL_WRITE_ONLY
+#define GL_WRITE_ONLY                     0x88B9
+#endif
+#ifndef GL_TEXTURE_FETCH_BARRIER_BIT
+#define GL_TEXTURE_FETCH_BARRIER_BIT      0x00000008
+#endif
+#ifndef GL_SHADER_IMAGE_ACCESS_BARRIER_BIT
+#define GL_SHADER_IMAGE_ACCESS_BARRIER_BIT 0x00000020
+#endif
+#ifndef GL_FRAMEBUFFER_BARRIER_BIT
+#define GL_FRAMEBUFFER_BARRIER_BIT        0x00000400
+#endif
+
+/*
 <p>To compile and link these shaders into programs, and to set their uniforms,
 we use the following utility class:
 */
@@ -281,19 +177,28 @@ we use the following utility class:
 class Program 
 {
 public:
+	// With a binary_cache, the program is loaded from its binary when there is
+	// one for these sources and this driver, and its binary is added otherwise.
 	Program(
 		const std::string& vertex_shader_source,
-		const std::string& fragment_shader_source)
-		: Program(vertex_shader_source, "", fragment_shader_source)
+		const std::string& fragment_shader_source,
+		ProgramBinaryCache* binary_cache = NULL)
+		: Program(vertex_shader_source, "", fragment_shader_source, binary_cache)
 	{
 	}
 
 	Program(
 		const std::string& vertex_shader_source,
 		const std::string& geometry_shader_source,
-		const std::string& fragment_shader_source)
+		const std::string& fragment_shader_source,
+		ProgramBinaryCache* binary_cache = NULL)
 	{
 		program_ = glCreateProgram();
+		uint64_t key = GetBinaryKey(vertex_shader_source, fragment_shader_source);
+		if (LoadBinary(binary_cache, key))
+		{
+			return;
+		}
 
 		const char* source;
 		source = vertex_shader_source.c_str();
@@ -321,8 +226,10 @@ public:
 		CheckShader(fragment_shader);
 		glAttachShader(program_, fragment_shader);
 
+		glProgramParameteri(program_, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
 		glLinkProgram(program_);
 		CheckProgram(program_);
+		StoreBinary(binary_cache, key);
 
 		glDetachShader(program_, vertex_shader);
 		glDeleteShader(vertex_shader);
@@ -335,6 +242,32 @@ public:
 		glDeleteShader(fragment_shader);
 	}
 
+	explicit Program(const std::string& compute_shader_source,
+		ProgramBinaryCache* binary_cache = NULL)
+	{
+		program_ = glCreateProgram();
+		uint64_t key = GetBinaryKey(compute_shader_source, "");
+		if (LoadBinary(binary_cache, key))
+		{
+			return;
+		}
+
+		const char* source = compute_shader_source.c_str();
+		GLuint compute_shader = glCreateShader(GL_COMPUTE_SHADER);
+		glShaderSource(compute_shader, 1, &source, NULL);
+		glCompileShader(compute_shader);
+		CheckShader(compute_shader);
+		glAttachShader(program_, compute_shader);
+
+		glProgramParameteri(program_, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+		glLinkProgram(program_);
+		CheckProgram(program_);
+		StoreBinary(binary_cache, key);
+
+		glDetachShader(program_, compute_shader);
+		glDeleteShader(compute_shader);
+	}
+
 	~Program() 
 	{
 		glDeleteProgram(program_);
@@ -347,12 +280,12 @@ public:
 
 	void BindInt(const std::string& uniform_name, int value) const 
 	{
-		glUniform1i(glGetUniformLocation(program_, uniform_name.c_str()), value);
+		glUniform1i(GetUniformLocation(uniform_name), value);
 	}
 
 	void BindFloat(const std::string& uniform_name, float value) const
 	{
-		glUniform1f(glGetUniformLocation(program_, uniform_name.c_str()), value);
+		glUniform1f(GetUniformLocation(uniform_name), value);
 	}
 
 	void BindTexture2d(const std::string& sampler_uniform_name, GLuint texture,
@@ -372,6 +305,89 @@ public:
 	}
 
 private:
+	// The locations are looked up once, the precomputation binds the same
+	// uniforms at each of its steps.
+	GLint GetUniformLocation(const std::string& uniform_name) const
+	{
+		std::map<std::string, GLint>::const_iterator it =
+			uniform_locations_.find(uniform_name);
+		if (it != uniform_locations_.end())
+		{
+			return it->second;
+		}
+		GLint location = glGetUniformLocation(program_, uniform_name.c_str());
+		uniform_locations_[uniform_name] = location;
+		return location;
+	}
+
+	// A binary is only valid for the driver which produced it.
+	static uint64_t GetBinaryKey(const std::string& first_shader_source,
+		const std::string& second_shader_source)
+	{
+		uint64_t key = AtmosphereCache::kHashSeed;
+		const GLenum kDriverStrings[2] = { GL_RENDERER, GL_VERSION };
+		for (int i = 0; i < 2; ++i)
+		{
+			const char* value =
+				reinterpret_cast<const char*>(glGetString(kDriverStrings[i]));
+			if (value != NULL)
+			{
+				key = AtmosphereCache::Hash(value, strlen(value), key);
+			}
+		}
+		key = AtmosphereCache::Hash(first_shader_source.data(),
+			first_shader_source.size(), key);
+		return AtmosphereCache::Hash(second_shader_source.data(),
+			second_shader_source.size(), key);
+	}
+
+	bool LoadBinary(ProgramBinaryCache* binary_cache, uint64_t key)
+	{
+		const ProgramBinaryCache::Binary* binary =
+			binary_cache != NULL ? binary_cache->Find(key) : NULL;
+		if (binary == NULL)
+		{
+			return false;
+		}
+		glProgramBinary(program_, binary->format, &binary->data[0],
+			static_cast<GLsizei>(binary->data.size()));
+		GLint link_status;
+		glGetProgramiv(program_, GL_LINK_STATUS, &link_status);
+		if (link_status == GL_TRUE)
+		{
+			return true;
+		}
+		// Rejected by the driver (an unknown format is a GL_INVALID_ENUM), the
+		// caller links from the sources and replaces it.
+		while (glGetError() != GL_NO_ERROR)
+		{
+		}
+		binary_cache->Erase(key);
+		return false;
+	}
+
+	void StoreBinary(ProgramBinaryCache* binary_cache, uint64_t key) const
+	{
+		if (binary_cache == NULL || !binary_cache->IsEnabled())
+		{
+			return;
+		}
+		// 0 if the driver has no binary format.
+		GLint length = 0;
+		glGetProgramiv(program_, GL_PROGRAM_BINARY_LENGTH, &length);
+		if (length <= 0)
+		{
+			return;
+		}
+		ProgramBinaryCache::Binary binary;
+		binary.data.resize(length);
+		GLenum format;
+		glGetProgramBinary(program_, length, &length, &format, &binary.data[0]);
+		binary.data.resize(length);
+		binary.format = format;
+		binary_cache->Insert(key, binary);
+	}
+
 	static void CheckShader(GLuint shader) 
 	{
 		GLint compile_status;
@@ -422,6 +438,7 @@ private:
 	}
 
 	GLuint program_;
+	mutable std::map<std::string, GLint> uniform_locations_;
 };
 
 /*
@@ -470,6 +487,131 @@ GLuint NewTexture3d(int width, int height, int depth, GLenum format)
 	return texture;
 }
 
+/*
+<p>Once complete, the final textures can be replaced with textures in a compact
+format, such as <code>GL_R11F_G11F_B10F</code> or <code>GL_RGB9_E5</code>. These
+are not color-renderable (at least not without extensions), so the driver
+converts the full precision values at upload time:
+*/
+
+GLenum GetCompactFormat(SkyModel::TextureFormat format)
+{
+	switch (format)
+	{
+	case SkyModel::R11F_G11F_B10F:
+		return GL_R11F_G11F_B10F;
+	case SkyModel::RGB9_E5:
+		return GL_RGB9_E5;
+	default:
+		return GL_NONE;
+	}
+}
+
+GLuint NewCompactTexture(GLenum internal_format,
+	const AtmosphereCache::Texture& source)
+{
+	GLenum target = source.depth == 1 ? GL_TEXTURE_2D : GL_TEXTURE_3D;
+	GLenum type = source.half ? GL_HALF_FLOAT : GL_FLOAT;
+	GLuint texture;
+	glGenTextures(1, &texture);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(target, texture);
+	glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	if (target == GL_TEXTURE_2D)
+	{
+		glTexImage2D(GL_TEXTURE_2D, 0, internal_format, source.width,
+			source.height, 0, GL_RGB, type, &source.data[0]);
+	}
+	else
+	{
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+		glTexImage3D(GL_TEXTURE_3D, 0, internal_format, source.width,
+			source.height, source.depth, 0, GL_RGB, type, &source.data[0]);
+	}
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glBindTexture(target, 0);
+	return texture;
+}
+
+/*
+<p>The compute shader path writes the textures as images, which must have an
+immutable storage and a 4 channel format (with an unused alpha channel where
+the fragment shader path has 3 channels):
+*/
+
+GLuint NewStorageTexture2d(int width, int height)
+{
+	GLuint texture;
+	glGenTextures(1, &texture);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA32F, width, height);
+	return texture;
+}
+
+GLuint NewStorageTexture3d(int width, int height, int depth)
+{
+	GLuint texture;
+	glGenTextures(1, &texture);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_3D, texture);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+	glTexStorage3D(GL_TEXTURE_3D, 1, GL_RGBA16F, width, height, depth);
+	return texture;
+}
+
+/*
+<p>The GLES 3.1 entry points of the compute shader path are loaded with
+<code>eglGetProcAddress</code>, and only if the current context is a GLES 3.1
+one:
+*/
+
+struct ComputeFunctions
+{
+	void (GL_APIENTRY* dispatch_compute)(GLuint num_groups_x,
+		GLuint num_groups_y, GLuint num_groups_z);
+	void (GL_APIENTRY* bind_image_texture)(GLuint unit, GLuint texture,
+		GLint level, GLboolean layered, GLint layer, GLenum access, GLenum format);
+	void (GL_APIENTRY* memory_barrier)(GLbitfield barriers);
+};
+
+bool LoadComputeFunctions(ComputeFunctions* functions)
+{
+	GLint major_version = 0;
+	GLint minor_version = 0;
+	glGetIntegerv(GL_MAJOR_VERSION, &major_version);
+	glGetIntegerv(GL_MINOR_VERSION, &minor_version);
+	if (major_version < 3 || (major_version == 3 && minor_version < 1))
+	{
+		return false;
+	}
+	functions->dispatch_compute = reinterpret_cast<
+		void (GL_APIENTRY*)(GLuint, GLuint, GLuint)>(
+		eglGetProcAddress("glDispatchCompute"));
+	functions->bind_image_texture = reinterpret_cast<
+		void (GL_APIENTRY*)(GLuint, GLuint, GLint, GLboolean, GLint, GLenum, GLenum)>(
+		eglGetProcAddress("glBindImageTexture"));
+	functions->memory_barrier = reinterpret_cast<
+		void (GL_APIENTRY*)(GLbitfield)>(
+		eglGetProcAddress("glMemoryBarrier"));
+	return functions->dispatch_compute != NULL &&
+		functions->bind_image_texture != NULL &&
+		functions->memory_barrier != NULL;
+}
+
 /*
 <p>and a function to draw a full screen quad in an offscreen framebuffer:
 */
@@ -492,6 +634,530 @@ void DrawQuad()
 	glDisableVertexAttribArray(0);
 }
 
+/*
+<p>We also need functions to copy a precomputed texture to and from main memory,
+for the cache file. The texture is read back through the currently bound
+framebuffer object, one layer at a time:
+*/
+
+void ReadTexture(GLuint texture, int width, int height, int depth, int channels,
+	bool half, AtmosphereCache::Texture* result)
+{
+	result->width = width;
+	result->height = height;
+	result->depth = depth;
+	result->channels = channels;
+	result->half = half;
+	result->data.resize(result->GetTexelCount() * (half ? 2 : 4));
+
+	// GL_RGBA with GL_FLOAT is the combination every float color buffer supports.
+	std::vector<float> rgba(width * height * 4);
+	glReadBuffer(GL_COLOR_ATTACHMENT0);
+	for (int layer = 0; layer < depth; ++layer)
+	{
+		if (depth == 1)
+		{
+			glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+				GL_TEXTURE_2D, texture, 0);
+		}
+		else
+		{
+			glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+				texture, 0, layer);
+		}
+		glReadPixels(0, 0, width, height, GL_RGBA, GL_FLOAT, &rgba[0]);
+
+		size_t first = (size_t)layer * width * height * channels;
+		for (int p = 0; p < width * height; ++p)
+		{
+			for (int c = 0; c < channels; ++c)
+			{
+				size_t index = first + p * channels + c;
+				if (half)
+				{
+					unsigned short value = AtmosphereCache::FloatToHalf(rgba[p * 4 + c]);
+					memcpy(&result->data[index * 2], &value, 2);
+				}
+				else
+				{
+					memcpy(&result->data[index * 4], &rgba[p * 4 + c], 4);
+				}
+			}
+		}
+	}
+}
+
+// Replaces the texture with a new one if compact_format is not GL_NONE.
+bool UploadTexture(GLuint* texture, GLenum compact_format, int width, int height,
+	int depth, int channels, bool half, const AtmosphereCache::Texture& source)
+{
+	// 32-bit textures must stay 32-bit, the transmittance has artifacts in 16F.
+	if (source.width != width || source.height != height ||
+		source.depth != depth || source.channels != channels ||
+		(source.half && !half))
+	{
+		return false;
+	}
+	if (compact_format != GL_NONE)
+	{
+		glDeleteTextures(1, texture);
+		*texture = NewCompactTexture(compact_format, source);
+		return true;
+	}
+
+	GLenum format = channels == 4 ? GL_RGBA : GL_RGB;
+	GLenum type = source.half ? GL_HALF_FLOAT : GL_FLOAT;
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glActiveTexture(GL_TEXTURE0);
+	if (depth == 1)
+	{
+		glBindTexture(GL_TEXTURE_2D, *texture);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, format, type,
+			&source.data[0]);
+		glBindTexture(GL_TEXTURE_2D, 0);
+	}
+	else
+	{
+		glBindTexture(GL_TEXTURE_3D, *texture);
+		glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, width, height, depth, format,
+			type, &source.data[0]);
+		glBindTexture(GL_TEXTURE_3D, 0);
+	}
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	return true;
+}
+
+/*
+<p>The shaders of the 3D passes are generated with the following function, for
+a given number of layers per draw call. This number is the largest divisor of
+the texture depth for which the outputs of all the layers fit in the draw
+buffers:
+*/
+
+std::string MultiLayerShader(const char* uniforms, const char* const* outputs,
+	int output_count, const char* layer_code, unsigned int layer_count)
+{
+	auto replace = [](std::string text, const std::string& from,
+		const std::string& to)
+	{
+		for (size_t i = text.find(from); i != std::string::npos;
+			i = text.find(from, i + to.size()))
+		{
+			text.replace(i, from.size(), to);
+		}
+		return text;
+	};
+
+	std::string source = uniforms;
+	for (unsigned int i = 0; i < layer_count; ++i)
+	{
+		for (int j = 0; j < output_count; ++j)
+		{
+			source += "layout(location = " + std::to_string(i * output_count + j) +
+				") out " + replace(outputs[j], "$I", std::to_string(i)) + ";\n";
+		}
+	}
+	source += "void main() {\n";
+	for (unsigned int i = 0; i < layer_count; ++i)
+	{
+		std::string code = replace(layer_code, "$I", std::to_string(i));
+		code = replace(code, "$LAYER", "layer + " + std::to_string(i) + ".5");
+		source += "  {" + code + "  }\n";
+	}
+	source += "}\n";
+	return source;
+}
+
+unsigned int GetLayersPerDraw(int output_count, int max_draw_buffers,
+	unsigned int max_layers_per_draw, int depth)
+{
+	unsigned int layers = max_draw_buffers / output_count;
+	if (max_layers_per_draw != 0 && layers > max_layers_per_draw)
+	{
+		layers = max_layers_per_draw;
+	}
+	while (layers > 1 && depth % layers != 0)
+	{
+		--layers;
+	}
+	return layers > 0 ? layers : 1;
+}
+
+const int kMaxColorAttachments = 16;
+const GLenum kDrawBuffers[kMaxColorAttachments] = {
+	GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2,
+	GL_COLOR_ATTACHMENT3, GL_COLOR_ATTACHMENT4, GL_COLOR_ATTACHMENT5,
+	GL_COLOR_ATTACHMENT6, GL_COLOR_ATTACHMENT7, GL_COLOR_ATTACHMENT8,
+	GL_COLOR_ATTACHMENT9, GL_COLOR_ATTACHMENT10, GL_COLOR_ATTACHMENT11,
+	GL_COLOR_ATTACHMENT12, GL_COLOR_ATTACHMENT13, GL_COLOR_ATTACHMENT14,
+	GL_COLOR_ATTACHMENT15
+};
+
+/*
+<p>The precomputation is split in steps of one draw call, i.e. one or more
+layers for the 3D textures, so that <code>Update</code> can spread it over
+several frames. Its temporary resources are kept between two steps in the
+following structure (the programs are compiled on first use, to spread their
+compilation too):
+*/
+
+struct SkyModel::Precomputation
+{
+	enum Stage
+	{
+		TRANSMITTANCE,
+		DIRECT_IRRADIANCE,
+		SINGLE_SCATTERING,
+		SCATTERING_DENSITY,
+		INDIRECT_IRRADIANCE,
+		MULTIPLE_SCATTERING,
+		ACCUMULATE_MULTIPLE_SCATTERING,
+		DONE
+	};
+
+	// Uses the compute shader path if compute_functions is not null.
+	Precomputation(uint64_t key, const SkyTextureSizes& sizes,
+		unsigned int num_scattering_orders,
+		GLuint single_mie_scattering_texture, unsigned int max_layers_per_draw,
+		const ComputeFunctions* compute_functions,
+		const std::string& program_cache_file, double tolerance) :
+		key(key),
+		sizes(sizes),
+		num_scattering_orders(num_scattering_orders),
+		stage(TRANSMITTANCE),
+		scattering_order(2),
+		layer(0),
+		steps_done(0),
+		attachment_count(1),
+		compute(compute_functions != NULL),
+		gl31(),
+		program_binaries(program_cache_file),
+		tolerance(tolerance),
+		total_energy(0.0),
+		converged(false),
+		energy_texture(0)
+	{
+		if (compute)
+		{
+			gl31 = *compute_functions;
+		}
+		GLint max_draw_buffers;
+		GLint max_color_attachments;
+		glGetIntegerv(GL_MAX_DRAW_BUFFERS, &max_draw_buffers);
+		glGetIntegerv(GL_MAX_COLOR_ATTACHMENTS, &max_color_attachments);
+		max_draw_buffers = std::min(max_draw_buffers,
+			std::min(max_color_attachments, kMaxColorAttachments));
+		single_scattering_layers = GetLayersPerDraw(3, max_draw_buffers,
+			max_layers_per_draw, sizes.GetScatteringDepth());
+		layers = GetLayersPerDraw(1, max_draw_buffers, max_layers_per_draw,
+			sizes.GetScatteringDepth());
+
+		if (compute)
+		{
+			// A single dispatch per pass.
+			single_scattering_layers = sizes.GetScatteringDepth();
+			layers = sizes.GetScatteringDepth();
+		}
+		step_count = 2 + sizes.GetScatteringDepth() / single_scattering_layers;
+		if (num_scattering_orders >= 2)
+		{
+			step_count += (num_scattering_orders - 1) *
+				(3 * sizes.GetScatteringDepth() / layers + 1);
+		}
+
+		// The precomputations require temporary textures, in particular to store
+		// the contribution of one scattering order, which is needed to compute the
+		// next order of scattering (the final precomputed textures store the sum of
+		// all the scattering orders).
+		owns_delta_mie_scattering_texture = single_mie_scattering_texture == 0;
+		if (compute)
+		{
+			delta_irradiance_texture = NewStorageTexture2d(
+				sizes.irradiance_width, sizes.irradiance_height);
+			delta_rayleigh_scattering_texture = NewStorageTexture3d(
+				sizes.GetScatteringWidth(),
+				sizes.GetScatteringHeight(),
+				sizes.GetScatteringDepth());
+			delta_mie_scattering_texture = owns_delta_mie_scattering_texture ?
+				NewStorageTexture3d(
+					sizes.GetScatteringWidth(),
+					sizes.GetScatteringHeight(),
+					sizes.GetScatteringDepth()) :
+				single_mie_scattering_texture;
+			delta_scattering_density_texture = NewStorageTexture3d(
+				sizes.GetScatteringWidth(),
+				sizes.GetScatteringHeight(),
+				sizes.GetScatteringDepth());
+		}
+		else
+		{
+			delta_irradiance_texture = NewTexture2d(
+				sizes.irradiance_width, sizes.irradiance_height);
+			delta_rayleigh_scattering_texture = NewTexture3d(
+				sizes.GetScatteringWidth(),
+				sizes.GetScatteringHeight(),
+				sizes.GetScatteringDepth(),
+				GL_RGBA);
+			delta_mie_scattering_texture = owns_delta_mie_scattering_texture ?
+				NewTexture3d(
+					sizes.GetScatteringWidth(),
+					sizes.GetScatteringHeight(),
+					sizes.GetScatteringDepth(),
+					GL_RGB) :
+				single_mie_scattering_texture;
+			delta_scattering_density_texture = NewTexture3d(
+				sizes.GetScatteringWidth(),
+				sizes.GetScatteringHeight(),
+				sizes.GetScatteringDepth(),
+				GL_RGB);
+		}
+		delta_multiple_scattering_texture = delta_rayleigh_scattering_texture;
+
+		// The partial sums of the adaptive mode (nearest filtering, the default
+		// minification filter would need mipmaps).
+		if (tolerance > 0.0)
+		{
+			glGenTextures(1, &energy_texture);
+			glActiveTexture(GL_TEXTURE0);
+			glBindTexture(GL_TEXTURE_2D, energy_texture);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, GetEnergyWidth(),
+				GetEnergyHeight(), 0, GL_RGBA, GL_FLOAT, NULL);
+		}
+
+		// The precomputations also require a temporary framebuffer object.
+		glGenFramebuffers(1, &fbo);
+	}
+
+	~Precomputation()
+	{
+		glDeleteFramebuffers(1, &fbo);
+		if (energy_texture != 0)
+		{
+			glDeleteTextures(1, &energy_texture);
+		}
+		glDeleteTextures(1, &delta_scattering_density_texture);
+		if (owns_delta_mie_scattering_texture)
+		{
+			glDeleteTextures(1, &delta_mie_scattering_texture);
+		}
+		glDeleteTextures(1, &delta_rayleigh_scattering_texture);
+		glDeleteTextures(1, &delta_irradiance_texture);
+	}
+
+	const Program& GetProgram(std::unique_ptr<Program>& program,
+		const std::string& glsl_header, const char* shader)
+	{
+		if (!program)
+		{
+			program.reset(new Program(kVertexShader, glsl_header + shader,
+				&program_binaries));
+		}
+		return *program;
+	}
+
+	const Program& GetProgram(std::unique_ptr<Program>& program,
+		const std::string& glsl_header, const char* uniforms,
+		const char* const* outputs, int output_count, const char* layer_code,
+		unsigned int layer_count)
+	{
+		if (!program)
+		{
+			program.reset(new Program(kVertexShader, glsl_header +
+				MultiLayerShader(uniforms, outputs, output_count, layer_code,
+					layer_count), &program_binaries));
+		}
+		return *program;
+	}
+
+	// Draws to the first count color attachments, and detaches the ones after
+	// them which the previous step used.
+	void UseAttachments(int count)
+	{
+		for (int i = count; i < attachment_count; ++i)
+		{
+			glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i,
+				GL_TEXTURE_2D, 0, 0);
+		}
+		attachment_count = count;
+		glDrawBuffers(count, kDrawBuffers);
+	}
+
+	// Attaches the layers [layer, layer + count) of the given 3D textures, with
+	// the textures of the i-th layer on the attachments i * texture_count + j.
+	void AttachLayers(const GLuint* textures, int texture_count,
+		unsigned int count)
+	{
+		for (unsigned int i = 0; i < count; ++i)
+		{
+			for (int j = 0; j < texture_count; ++j)
+			{
+				glFramebufferTextureLayer(GL_FRAMEBUFFER,
+					GL_COLOR_ATTACHMENT0 + i * texture_count + j, textures[j], 0,
+					layer + i);
+			}
+		}
+		UseAttachments(count * texture_count);
+	}
+
+	const Program& GetComputeProgram(std::unique_ptr<Program>& program,
+		const std::string& glsl_header, const char* shader)
+	{
+		if (!program)
+		{
+			// The header of the fragment shaders, but for GLSL ES 3.10. Built
+			// once for all the compute programs.
+			if (compute_glsl_header.empty())
+			{
+				compute_glsl_header = glsl_header;
+				compute_glsl_header.replace(0, compute_glsl_header.find('\n'),
+					"#version 310 es");
+				compute_glsl_header += kComputeShaderHeader;
+			}
+			program.reset(new Program(compute_glsl_header + shader,
+				&program_binaries));
+		}
+		return *program;
+	}
+
+	void BindImage(GLuint unit, GLuint texture, bool layered, GLenum format)
+	{
+		gl31.bind_image_texture(unit, texture, 0, layered ? GL_TRUE : GL_FALSE, 0,
+			GL_WRITE_ONLY, format);
+	}
+
+	// Runs the bound compute program over a width x height x depth texture, and
+	// makes its image stores visible to the next passes and to the read back.
+	void Dispatch(int width, int height, int depth)
+	{
+		gl31.dispatch_compute(
+			(width + kComputeGroupSize - 1) / kComputeGroupSize,
+			(height + kComputeGroupSize - 1) / kComputeGroupSize,
+			depth);
+		gl31.memory_barrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT |
+			GL_TEXTURE_FETCH_BARRIER_BIT | GL_FRAMEBUFFER_BARRIER_BIT);
+	}
+
+	int GetEnergyWidth() const
+	{
+		return (sizes.GetScatteringWidth() + kEnergyBlockSize - 1) /
+			kEnergyBlockSize;
+	}
+
+	int GetEnergyHeight() const
+	{
+		return (sizes.GetScatteringHeight() + kEnergyBlockSize - 1) /
+			kEnergyBlockSize;
+	}
+
+	// Sum of the RGB values of a scattering texture, with the framebuffer of the
+	// precomputation bound. Waits for the GPU.
+	double MeasureEnergy(GLuint texture)
+	{
+		const Program& program =
+			GetProgram(compute_energy, std::string(), kComputeEnergyShader);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+			GL_TEXTURE_2D, energy_texture, 0);
+		UseAttachments(1);
+		glViewport(0, 0, GetEnergyWidth(), GetEnergyHeight());
+		program.Use();
+		program.BindTexture3d("source", texture, 0);
+		DrawQuad();
+
+		std::vector<float> sums(GetEnergyWidth() * GetEnergyHeight() * 4);
+		glReadBuffer(GL_COLOR_ATTACHMENT0);
+		glReadPixels(0, 0, GetEnergyWidth(), GetEnergyHeight(), GL_RGBA,
+			GL_FLOAT, &sums[0]);
+		double energy = 0.0;
+		for (size_t i = 0; i < sums.size(); ++i)
+		{
+			energy += sums[i];
+		}
+		return energy;
+	}
+
+	// Called once the single scattering textures are complete, and then once the
+	// multiple scattering of each order is, in the adaptive mode.
+	void MeasureSingleScattering()
+	{
+		if (tolerance > 0.0)
+		{
+			total_energy = MeasureEnergy(delta_rayleigh_scattering_texture) +
+				MeasureEnergy(delta_mie_scattering_texture);
+		}
+	}
+
+	void MeasureMultipleScattering()
+	{
+		if (tolerance > 0.0)
+		{
+			double energy = MeasureEnergy(delta_multiple_scattering_texture);
+			total_energy += energy;
+			converged = energy <= tolerance * total_energy;
+		}
+	}
+
+	// Whether to go on with the next order after the current one.
+	bool HasNextOrder() const
+	{
+		return scattering_order < num_scattering_orders && !converged;
+	}
+
+	// Moves to the next layers of a 3D stage, returns true after the last ones.
+	bool NextLayers(unsigned int count)
+	{
+		layer += count;
+		if (layer < (unsigned int)sizes.GetScatteringDepth())
+		{
+			return false;
+		}
+		layer = 0;
+		return true;
+	}
+
+	uint64_t key;
+	SkyTextureSizes sizes;
+	unsigned int num_scattering_orders;
+	Stage stage;
+	unsigned int scattering_order;
+	unsigned int layer;
+	unsigned int steps_done;
+	unsigned int step_count;
+	// layers per draw call of the single scattering pass (3 outputs per layer)
+	// and of the other 3D passes (1 output per layer)
+	unsigned int single_scattering_layers;
+	unsigned int layers;
+	int attachment_count;
+	bool compute;
+	ComputeFunctions gl31;
+	std::string compute_glsl_header;
+	// binaries of the programs below, written once the precomputation is done
+	ProgramBinaryCache program_binaries;
+	// adaptive mode, tolerance is 0 for a fixed number of orders
+	double tolerance;
+	double total_energy;
+	bool converged;
+	GLuint energy_texture;
+
+	GLuint fbo;
+	GLuint delta_irradiance_texture;
+	GLuint delta_rayleigh_scattering_texture;
+	GLuint delta_mie_scattering_texture;
+	GLuint delta_scattering_density_texture;
+	GLuint delta_multiple_scattering_texture;
+	bool owns_delta_mie_scattering_texture;
+
+	std::unique_ptr<Program> compute_transmittance;
+	std::unique_ptr<Program> compute_direct_irradiance;
+	std::unique_ptr<Program> compute_single_scattering;
+	std::unique_ptr<Program> compute_scattering_density;
+	std::unique_ptr<Program> compute_indirect_irradiance;
+	std::unique_ptr<Program> compute_multiple_scattering;
+	std::unique_ptr<Program> compute_multiple_scattering_1;
+	std::unique_ptr<Program> compute_energy;
+};
+
 /*
 <p>Finally, we need a utility function to compute the value of the conversion
 constants *<code>_RADIANCE_TO_LUMINANCE</code>, used above to convert the
@@ -607,9 +1273,20 @@ folding and propagation optimizations in the GLSL compiler), concatenated with
 initialize them.
 */
 
-double SkyModel::kLambdaR = 680.0;
-double SkyModel::kLambdaG = 550.0;
-double SkyModel::kLambdaB = 440.0;
+double SkyModel::kLambdaR = kSkyLambdaR;
+double SkyModel::kLambdaG = kSkyLambdaG;
+double SkyModel::kLambdaB = kSkyLambdaB;
+
+SkyModel::SkyModel(const SkyModelParameters& parameters) :
+	SkyModel(parameters.wavelengths, parameters.solar_irradiance,
+		parameters.sun_angular_radius, parameters.bottom_radius,
+		parameters.top_radius, parameters.rayleigh_scale_height,
+		parameters.rayleigh_scattering, parameters.mie_scale_height,
+		parameters.mie_scattering, parameters.mie_extinction,
+		parameters.mie_phase_function_g, parameters.ground_albedo,
+		parameters.max_sun_zenith_angle, parameters.length_unit_in_meters,
+		parameters.combine_scattering_textures, parameters.texture_sizes) {
+}
 
 SkyModel::SkyModel(
 	const std::vector<double>& wavelengths,
@@ -626,7 +1303,24 @@ SkyModel::SkyModel(
 	const std::vector<double>& ground_albedo,
 	double max_sun_zenith_angle,
 	double length_unit_in_meters,
-	bool combine_scattering_textures) {
+	bool combine_scattering_textures,
+	const SkyTextureSizes& texture_sizes) :
+	texture_sizes_(texture_sizes),
+	storage_textures_(false),
+	compact_textures_(false),
+	transmittance_format_(FULL_PRECISION),
+	scattering_format_(FULL_PRECISION),
+	irradiance_format_(FULL_PRECISION),
+	cache_file_("atmosphere.cache"),
+	loaded_from_cache_(false),
+	ready_(false),
+	program_cache_file_("atmosphere_programs.cache"),
+	max_layers_per_draw_(1),
+	use_compute_shaders_(true),
+	using_compute_shaders_(false),
+	scattering_order_tolerance_(0.0),
+	scattering_order_count_(0),
+	precomputation_time_(0.0) {
 	auto to_string = [&wavelengths](const std::vector<double>& v, double scale) {
 		double r = Interpolate(wavelengths, v, kLambdaR) * scale;
 		double g = Interpolate(wavelengths, v, kLambdaG) * scale;
@@ -640,35 +1334,40 @@ SkyModel::SkyModel(
 	double sun_k_r, sun_k_g, sun_k_b;
 	ComputeSpectralRadianceToLuminanceFactors(wavelengths, solar_irradiance,
 		0 /* lambda_power */, &sun_k_r, &sun_k_g, &sun_k_b);
-	glsl_header_ =
+	// The GLSL files are embedded in the executable, see ShaderSources.
+	const std::string& definitions = ShaderSources::GetFile("definitions.c");
+	const std::string& functions = ShaderSources::GetFile("functions.c");
+	std::vector<std::string> defines;
+	defines.push_back("IN(x) const in x");
+	defines.push_back("OUT(x) out x");
+	defines.push_back("TEMPLATE(x)");
+	defines.push_back("TEMPLATE_ARGUMENT(x)");
+	defines.push_back("assert(x)");
+	if (combine_scattering_textures) {
+		defines.push_back("COMBINED_SCATTERING_TEXTURES");
+	}
+	const std::string header_template =
 		"#version 300 es\n"
-		"#define IN(x) const in x\n"
-		"#define OUT(x) out x\n"
-		"#define TEMPLATE(x)\n"
-		"#define TEMPLATE_ARGUMENT(x)\n"
-		"#define assert(x)\n"
 		"precision mediump float;\n"
 		"precision mediump sampler2D;\n"
 		"precision mediump sampler3D;\n"
 		"const int TRANSMITTANCE_TEXTURE_WIDTH = " +
-		std::to_string(TRANSMITTANCE_TEXTURE_WIDTH) + ";\n" +
+		std::to_string(texture_sizes_.transmittance_width) + ";\n" +
 		"const int TRANSMITTANCE_TEXTURE_HEIGHT = " +
-		std::to_string(TRANSMITTANCE_TEXTURE_HEIGHT) + ";\n" +
+		std::to_string(texture_sizes_.transmittance_height) + ";\n" +
 		"const int SCATTERING_TEXTURE_R_SIZE = " +
-		std::to_string(SCATTERING_TEXTURE_R_SIZE) + ";\n" +
+		std::to_string(texture_sizes_.scattering_r_size) + ";\n" +
 		"const int SCATTERING_TEXTURE_MU_SIZE = " +
-		std::to_string(SCATTERING_TEXTURE_MU_SIZE) + ";\n" +
+		std::to_string(texture_sizes_.scattering_mu_size) + ";\n" +
 		"const int SCATTERING_TEXTURE_MU_S_SIZE = " +
-		std::to_string(SCATTERING_TEXTURE_MU_S_SIZE) + ";\n" +
+		std::to_string(texture_sizes_.scattering_mu_s_size) + ";\n" +
 		"const int SCATTERING_TEXTURE_NU_SIZE = " +
-		std::to_string(SCATTERING_TEXTURE_NU_SIZE) + ";\n" +
+		std::to_string(texture_sizes_.scattering_nu_size) + ";\n" +
 		"const int IRRADIANCE_TEXTURE_WIDTH = " +
-		std::to_string(IRRADIANCE_TEXTURE_WIDTH) + ";\n" +
+		std::to_string(texture_sizes_.irradiance_width) + ";\n" +
 		"const int IRRADIANCE_TEXTURE_HEIGHT = " +
-		std::to_string(IRRADIANCE_TEXTURE_HEIGHT) + ";\n" +
-		(combine_scattering_textures ?
-		"#define COMBINED_SCATTERING_TEXTURES\n" : "") +
-		getStringFromFile("core/definitions.c") +
+		std::to_string(texture_sizes_.irradiance_height) + ";\n" +
+		"#include \"definitions.c\"\n" +
 		"const AtmosphereParameters ATMOSPHERE = AtmosphereParameters(\n" +
 		to_string(solar_irradiance, 1.0) + ",\n" +
 		std::to_string(sun_angular_radius) + ",\n" +
@@ -691,28 +1390,40 @@ SkyModel::SkyModel(
 		std::to_string(sun_k_r) + "," +
 		std::to_string(sun_k_g) + "," +
 		std::to_string(sun_k_b) + ");\n" +
-		getStringFromFile("core/functions.c");
+		"#include \"functions.c\"\n";
+	glsl_header_ = ShaderSources::Assemble(header_template, defines);
 	transmittance_texture_ = NewTexture2d(
-		TRANSMITTANCE_TEXTURE_WIDTH, TRANSMITTANCE_TEXTURE_HEIGHT);
+		texture_sizes_.transmittance_width, texture_sizes_.transmittance_height);
 	scattering_texture_ = NewTexture3d(
-		SCATTERING_TEXTURE_WIDTH,
-		SCATTERING_TEXTURE_HEIGHT,
-		SCATTERING_TEXTURE_DEPTH,
+		texture_sizes_.GetScatteringWidth(),
+		texture_sizes_.GetScatteringHeight(),
+		texture_sizes_.GetScatteringDepth(),
 		combine_scattering_textures ? GL_RGBA : GL_RGB);
 	if (combine_scattering_textures) {
 		optional_single_mie_scattering_texture_ = 0;
 	}
 	else {
 		optional_single_mie_scattering_texture_ = NewTexture3d(
-			SCATTERING_TEXTURE_WIDTH,
-			SCATTERING_TEXTURE_HEIGHT,
-			SCATTERING_TEXTURE_DEPTH,
+			texture_sizes_.GetScatteringWidth(),
+			texture_sizes_.GetScatteringHeight(),
+			texture_sizes_.GetScatteringDepth(),
 			GL_RGB);
 	}
 	irradiance_texture_ = NewTexture2d(
-		IRRADIANCE_TEXTURE_WIDTH, IRRADIANCE_TEXTURE_HEIGHT);
+		texture_sizes_.irradiance_width, texture_sizes_.irradiance_height);
 
 	atmosphere_shader_str_ = glsl_header_ + kAtmosphereShader;
+
+	// The same key as the one of the offline baker (tools/AtmosphereBaker), so
+	// that a cache file it writes is loaded here. The key hashes the shaders of
+	// SkyModelShaders.h, but changes to the passes below must bump
+	// kPrecomputationVersion in SkyModelParameters.cpp.
+	SkyModelParameters parameters = { wavelengths, solar_irradiance,
+		sun_angular_radius, bottom_radius, top_radius, rayleigh_scale_height,
+		rayleigh_scattering, mie_scale_height, mie_scattering, mie_extinction,
+		mie_phase_function_g, ground_albedo, max_sun_zenith_angle,
+		length_unit_in_meters, combine_scattering_textures, texture_sizes_ };
+	cache_key_ = parameters.GetCacheKey(definitions, functions);
 	//const char* source = atmosphere_shader_str_.c_str();
 	//atmosphere_shader_ = glCreateShader(GL_FRAGMENT_SHADER);
 	//glShaderSource(atmosphere_shader_, 1, &source, NULL);
@@ -735,265 +1446,617 @@ SkyModel::~SkyModel()
 	glDeleteShader(atmosphere_shader_);
 }
 
-std::string SkyModel::getStringFromFile(const char* filename)
-{
-	std::ifstream ifile(filename);
-	//ļ뵽ostringstreambuf
-	std::ostringstream buf;
-	char ch;
-	while (buf&&ifile.get(ch))
-	{
-		buf.put(ch);
+/*
+<p>The final textures are replaced when the compute shaders need immutable ones,
+and when they are converted to a compact format. <code>NewTextures</code>
+allocates them again, as the constructor or the compute path does:
+*/
+
+void SkyModel::NewTextures(bool storage) {
+	const SkyTextureSizes& sizes = texture_sizes_;
+	const int width = sizes.GetScatteringWidth();
+	const int height = sizes.GetScatteringHeight();
+	const int depth = sizes.GetScatteringDepth();
+	bool combined = optional_single_mie_scattering_texture_ == 0;
+	glDeleteTextures(1, &transmittance_texture_);
+	glDeleteTextures(1, &scattering_texture_);
+	if (!combined) {
+		glDeleteTextures(1, &optional_single_mie_scattering_texture_);
+	}
+	glDeleteTextures(1, &irradiance_texture_);
+
+	if (storage) {
+		transmittance_texture_ = NewStorageTexture2d(
+			sizes.transmittance_width, sizes.transmittance_height);
+		scattering_texture_ = NewStorageTexture3d(width, height, depth);
+		if (!combined) {
+			optional_single_mie_scattering_texture_ =
+				NewStorageTexture3d(width, height, depth);
+		}
+		irradiance_texture_ = NewStorageTexture2d(
+			sizes.irradiance_width, sizes.irradiance_height);
+	}
+	else {
+		transmittance_texture_ = NewTexture2d(
+			sizes.transmittance_width, sizes.transmittance_height);
+		scattering_texture_ = NewTexture3d(width, height, depth,
+			combined ? GL_RGBA : GL_RGB);
+		if (!combined) {
+			optional_single_mie_scattering_texture_ =
+				NewTexture3d(width, height, depth, GL_RGB);
+		}
+		irradiance_texture_ = NewTexture2d(
+			sizes.irradiance_width, sizes.irradiance_height);
 	}
-	//bufַ
-	return buf.str();
+	storage_textures_ = storage;
+	compact_textures_ = false;
+}
+
+size_t SkyModel::GetTextureMemorySize() const {
+	const SkyTextureSizes& sizes = texture_sizes_;
+	bool combined = optional_single_mie_scattering_texture_ == 0;
+	// Bytes per texel of the 2D and 3D textures in full precision.
+	size_t texel_2d = storage_textures_ ? 16 : 12;
+	size_t texel_3d = storage_textures_ || combined ? 8 : 6;
+	auto texel = [&](TextureFormat format, size_t full_precision) {
+		return compact_textures_ && format != FULL_PRECISION ? 4 : full_precision;
+	};
+	size_t scattering_size = static_cast<size_t>(sizes.GetScatteringWidth()) *
+		sizes.GetScatteringHeight() * sizes.GetScatteringDepth();
+	size_t size = static_cast<size_t>(sizes.transmittance_width) *
+		sizes.transmittance_height * texel(transmittance_format_, texel_2d);
+	if (combined) {
+		size += scattering_size * texel_3d;
+	}
+	else {
+		size += 2 * scattering_size * texel(scattering_format_, texel_3d);
+	}
+	size += static_cast<size_t>(sizes.irradiance_width) *
+		sizes.irradiance_height * texel(irradiance_format_, texel_2d);
+	return size;
 }
 
 /*
-<p>The most complex method is the following, which precomputes the atmosphere
-textures. This method first allocates the temporary resources it needs, then
-performs the precomputations, and finally destroys the temporary resources.
-Each phase is explained by the inline comments below.
+<p>The most complex part is the precomputation of the atmosphere textures.
+<code>BeginInit</code> allocates the temporary resources it needs, each call to
+<code>Update</code> then performs some of the precomputation steps, and the last
+one destroys the temporary resources. <code>Init</code> does everything at once.
 */
 
 void SkyModel::Init(unsigned int num_scattering_orders) {
-	// The precomputations require temporary textures, in particular to store the
-	// contribution of one scattering order, which is needed to compute the next
-	// order of scattering (the final precomputed textures store the sum of all
-	// the scattering orders). We allocate them here, and destroy them at the end
-	// of this method.
-	GLuint delta_irradiance_texture = NewTexture2d(
-		IRRADIANCE_TEXTURE_WIDTH, IRRADIANCE_TEXTURE_HEIGHT);
-	GLuint delta_rayleigh_scattering_texture = NewTexture3d(
-		SCATTERING_TEXTURE_WIDTH,
-		SCATTERING_TEXTURE_HEIGHT,
-		SCATTERING_TEXTURE_DEPTH,
-		GL_RGBA);
-	GLuint delta_mie_scattering_texture;
-	if (optional_single_mie_scattering_texture_ == 0) {
-		delta_mie_scattering_texture = NewTexture3d(
-			SCATTERING_TEXTURE_WIDTH,
-			SCATTERING_TEXTURE_HEIGHT,
-			SCATTERING_TEXTURE_DEPTH,
-			GL_RGB);
+	BeginInit(num_scattering_orders);
+	Update(std::numeric_limits<unsigned int>::max());
+}
+
+void SkyModel::BeginInit(unsigned int num_scattering_orders) {
+	precomputation_.reset();
+	scattering_order_count_ = 0;
+	precomputation_time_ = 0.0;
+	// The cache and the fragment shaders need the textures of the constructor.
+	if (storage_textures_ || compact_textures_) {
+		NewTextures(false);
 	}
-	else {
-		delta_mie_scattering_texture = optional_single_mie_scattering_texture_;
-	}
-	GLuint delta_scattering_density_texture = NewTexture3d(
-		SCATTERING_TEXTURE_WIDTH,
-		SCATTERING_TEXTURE_HEIGHT,
-		SCATTERING_TEXTURE_DEPTH,
-		GL_RGB);
-	GLuint delta_multiple_scattering_texture = delta_rayleigh_scattering_texture;
-
-	// The precomputations also require a temporary framebuffer object, created
-	// here (and destroyed at the end of this method).
-	GLuint fbo, depth_render_buffer;
-	glGenFramebuffers(1, &fbo);
-	glGenRenderbuffers(1, &depth_render_buffer);
-
-	// bind renderbuffer and create a 16-bit depth buffer
-	// width and height of renderbuffer = width and height of
-	// the texture
-	//glBindRenderbuffer(GL_RENDERBUFFER, depth_render_buffer);
-	//glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT16, TRANSMITTANCE_TEXTURE_WIDTH, TRANSMITTANCE_TEXTURE_HEIGHT);
-	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
 
-	const GLuint kDrawBuffers[3] = {
-		GL_COLOR_ATTACHMENT0,
-		GL_COLOR_ATTACHMENT1,
-		GL_COLOR_ATTACHMENT2
-	};
+	// A cache file written by an earlier run with the same key already holds the
+	// final textures, in which case there is nothing to precompute. In the
+	// adaptive mode the textures also depend on the tolerance.
+	uint64_t key = AtmosphereCache::Hash(&num_scattering_orders,
+		sizeof(num_scattering_orders), cache_key_);
+	if (scattering_order_tolerance_ > 0.0) {
+		key = AtmosphereCache::Hash(&scattering_order_tolerance_,
+			sizeof(scattering_order_tolerance_), key);
+	}
+	loaded_from_cache_ = !cache_file_.empty() && LoadCache(key);
+	ready_ = loaded_from_cache_;
+	if (ready_) {
+		return;
+	}
 
-	glDrawBuffers(1, kDrawBuffers);
+	ComputeFunctions compute_functions;
+	using_compute_shaders_ =
+		use_compute_shaders_ && LoadComputeFunctions(&compute_functions);
+	if (using_compute_shaders_) {
+		// The images need an immutable storage, the textures allocated by the
+		// constructor are replaced.
+		NewTextures(true);
+	}
+	precomputation_.reset(new Precomputation(key, texture_sizes_,
+		num_scattering_orders,
+		optional_single_mie_scattering_texture_, max_layers_per_draw_,
+		using_compute_shaders_ ? &compute_functions : NULL,
+		program_cache_file_, scattering_order_tolerance_));
+}
 
-	// Finally, the precomputations also require specific GLSL programs, for each
-	// precomputation step. We create and compile them here (they are
-	// automatically destroyed when this method returns, via the Program
-	// destructor).
-	Program compute_transmittance(kVertexShader, glsl_header_ + kComputeTransmittanceShader);
-	Program compute_direct_irradiance(kVertexShader, glsl_header_ + kComputeDirectIrradianceShader);
-	Program compute_single_scattering(kVertexShader, glsl_header_ + kComputeSingleScatteringShader);
-	Program compute_scattering_density(kVertexShader, glsl_header_ + kComputeScatteringDensityShader);
-	Program compute_indirect_irradiance(kVertexShader, glsl_header_ + kComputeIndirectIrradianceShader);
-	Program compute_multiple_scattering(kVertexShader, glsl_header_ + kComputeMultipleScatteringShader);
-	Program compute_multiple_scattering_1(kVertexShader, glsl_header_ + kComputeMultipleScatteringShader_1);
+bool SkyModel::Update(unsigned int max_steps) {
+	if (ready_ || !precomputation_) {
+		return ready_;
+	}
 
+	// The steps draw in their own framebuffer and viewport, without depth test
+	// or culling, restore the caller's.
+	GLint viewport[4];
+	glGetIntegerv(GL_VIEWPORT, viewport);
+	GLboolean depth_test = glIsEnabled(GL_DEPTH_TEST);
+	GLboolean cull_face = glIsEnabled(GL_CULL_FACE);
+	glDisable(GL_DEPTH_TEST);
+	glDisable(GL_CULL_FACE);
+	auto start = std::chrono::steady_clock::now();
+	glBindFramebuffer(GL_FRAMEBUFFER, precomputation_->fbo);
+	for (unsigned int i = 0;
+		i < max_steps && precomputation_->stage != Precomputation::DONE; ++i) {
+		if (precomputation_->compute) {
+			RunComputePrecomputationStep();
+		}
+		else {
+			RunPrecomputationStep();
+		}
+	}
 	CHECK_GL_ERROR_DEBUG();
-	// Compute the transmittance, and store it in transmittance_texture_.
-	glFramebufferTexture2D(
-		GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, transmittance_texture_, 0);
-	// specify depth_renderbufer as depth attachment
-	//glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth_render_buffer);
+	bool done = precomputation_->stage == Precomputation::DONE;
+	if (done) {
+		// So that the time includes the GPU work of the last steps.
+		glFinish();
+	}
+	std::chrono::duration<double, std::milli> elapsed =
+		std::chrono::steady_clock::now() - start;
+	precomputation_time_ += elapsed.count();
 
-	// check for framebuffer complete
-	GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
-	if (status != GL_FRAMEBUFFER_COMPLETE)
-	{
-		printf("Framebuffer object is not complete!\n");
+	if (done) {
+		const Precomputation& p = *precomputation_;
+		scattering_order_count_ = p.scattering_order - 1;
+
+		if (!precomputation_->program_binaries.Save()) {
+			std::cerr << "could not write the program binaries "
+				<< program_cache_file_ << std::endl;
+		}
+		bool compact = transmittance_format_ != FULL_PRECISION ||
+			scattering_format_ != FULL_PRECISION ||
+			irradiance_format_ != FULL_PRECISION;
+		std::vector<AtmosphereCache::Texture> textures;
+		if (!cache_file_.empty() || compact) {
+			precomputation_->UseAttachments(1);
+			ReadTextures(precomputation_->fbo, &textures);
+		}
+		if (!cache_file_.empty()) {
+			SaveCache(precomputation_->key, textures);
+		}
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		// Frees the temporary textures before the compact ones are allocated,
+		// which lowers the peak memory use.
+		precomputation_.reset();
+		if (compact && !UploadTextures(textures, true)) {
+			std::cerr << "could not convert the atmosphere textures" << std::endl;
+		}
+		ready_ = true;
 	}
 
-	glViewport(0, 0, TRANSMITTANCE_TEXTURE_WIDTH, TRANSMITTANCE_TEXTURE_HEIGHT);
-	compute_transmittance.Use();
-	CHECK_GL_ERROR_DEBUG();
-	DrawQuad();
+	glUseProgram(0);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+	if (depth_test) {
+		glEnable(GL_DEPTH_TEST);
+	}
+	if (cull_face) {
+		glEnable(GL_CULL_FACE);
+	}
+	return ready_;
+}
 
-	CHECK_GL_ERROR_DEBUG();
+float SkyModel::GetProgress() const {
+	if (ready_) {
+		return 1.0f;
+	}
+	if (!precomputation_) {
+		return 0.0f;
+	}
+	return static_cast<float>(precomputation_->steps_done) /
+		precomputation_->step_count;
+}
 
-	// Compute the direct irradiance, store it in delta_irradiance_texture, and
-	// initialize irradiance_texture_ with zeros (we don't want the direct
-	// irradiance in irradiance_texture_, but only the irradiance from the sky).
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
-		GL_TEXTURE_2D, delta_irradiance_texture, 0);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1,
-		GL_TEXTURE_2D, irradiance_texture_, 0);
-	glDrawBuffers(2, kDrawBuffers);
-	glViewport(0, 0, IRRADIANCE_TEXTURE_WIDTH, IRRADIANCE_TEXTURE_HEIGHT);
-	compute_direct_irradiance.Use();
-	compute_direct_irradiance.BindTexture2d(
-		"transmittance_texture", transmittance_texture_, 0);
-	DrawQuad();
+/*
+<p>Each step sets all the state it needs, since the application draws other
+things between two steps. Each phase is explained by the inline comments below.
+*/
 
-	CHECK_GL_ERROR_DEBUG();
+void SkyModel::RunPrecomputationStep() {
+	Precomputation& p = *precomputation_;
+	const SkyTextureSizes& sizes = texture_sizes_;
 
-	// Compute the rayleigh and mie single scattering, and store them in
-	// delta_rayleigh_scattering_texture and delta_mie_scattering_texture, as well
-	// as in scattering_texture.
-	glViewport(0, 0, SCATTERING_TEXTURE_WIDTH, SCATTERING_TEXTURE_HEIGHT);
-	compute_single_scattering.Use();
-	compute_single_scattering.BindTexture2d(
-		"transmittance_texture", transmittance_texture_, 0);
-	glDrawBuffers(3, kDrawBuffers);
-	for (unsigned int layer = 0; layer < SCATTERING_TEXTURE_DEPTH; ++layer)
-	{
-		glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
-			delta_rayleigh_scattering_texture, 0, layer);
-		glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1,
-			delta_mie_scattering_texture, 0, layer);
-		glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2,
-			scattering_texture_, 0, layer);
-		compute_single_scattering.BindFloat("layer", layer);
+	switch (p.stage) {
+	case Precomputation::TRANSMITTANCE: {
+		// Compute the transmittance, and store it in transmittance_texture_.
+		const Program& program = p.GetProgram(p.compute_transmittance,
+			glsl_header_, kComputeTransmittanceShader);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+			GL_TEXTURE_2D, transmittance_texture_, 0);
+		p.UseAttachments(1);
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+		{
+			printf("Framebuffer object is not complete!\n");
+		}
+		glViewport(0, 0, sizes.transmittance_width, sizes.transmittance_height);
+		program.Use();
 		DrawQuad();
+		p.stage = Precomputation::DIRECT_IRRADIANCE;
+		break;
 	}
 
-	CHECK_GL_ERROR_DEBUG();
+	case Precomputation::DIRECT_IRRADIANCE: {
+		// Compute the direct irradiance, store it in delta_irradiance_texture, and
+		// initialize irradiance_texture_ with zeros (we don't want the direct
+		// irradiance in irradiance_texture_, but only the irradiance from the sky).
+		const Program& program = p.GetProgram(p.compute_direct_irradiance,
+			glsl_header_, kComputeDirectIrradianceShader);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+			GL_TEXTURE_2D, p.delta_irradiance_texture, 0);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1,
+			GL_TEXTURE_2D, irradiance_texture_, 0);
+		p.UseAttachments(2);
+		glViewport(0, 0, sizes.irradiance_width, sizes.irradiance_height);
+		program.Use();
+		program.BindTexture2d("transmittance_texture", transmittance_texture_, 0);
+		DrawQuad();
+		p.stage = Precomputation::SINGLE_SCATTERING;
+		break;
+	}
+
+	case Precomputation::SINGLE_SCATTERING: {
+		// Compute the rayleigh and mie single scattering, and store them in
+		// delta_rayleigh_scattering_texture and delta_mie_scattering_texture, as
+		// well as in scattering_texture.
+		const Program& program = p.GetProgram(p.compute_single_scattering,
+			glsl_header_, kComputeSingleScatteringShader,
+			kComputeSingleScatteringOutputs, 3, kComputeSingleScatteringLayer,
+			p.single_scattering_layers);
+		const GLuint textures[3] = { p.delta_rayleigh_scattering_texture,
+			p.delta_mie_scattering_texture, scattering_texture_ };
+		p.AttachLayers(textures, 3, p.single_scattering_layers);
+		glViewport(0, 0, sizes.GetScatteringWidth(), sizes.GetScatteringHeight());
+		program.Use();
+		program.BindTexture2d("transmittance_texture", transmittance_texture_, 0);
+		program.BindFloat("layer", p.layer);
+		DrawQuad();
+		if (p.NextLayers(p.single_scattering_layers)) {
+			p.MeasureSingleScattering();
+			p.stage = p.num_scattering_orders >= 2 ?
+				Precomputation::SCATTERING_DENSITY : Precomputation::DONE;
+		}
+		break;
+	}
 
-	// Compute the 2nd, 3rd and 4th order of scattering, in sequence.
-	for (unsigned int scattering_order = 2;
-		scattering_order <= num_scattering_orders;
-		++scattering_order) {
+	// Then the 2nd, 3rd and 4th order of scattering, in sequence.
+	case Precomputation::SCATTERING_DENSITY: {
 		// Compute the scattering density, and store it in
 		// delta_scattering_density_texture.
-		glFramebufferTexture2D(
-			GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, 0, 0);
-		glFramebufferTexture2D(
-			GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, GL_TEXTURE_2D, 0, 0);
-		glDrawBuffers(1, kDrawBuffers);
-		glViewport(0, 0, SCATTERING_TEXTURE_WIDTH, SCATTERING_TEXTURE_HEIGHT);
-		compute_scattering_density.Use();
-		compute_scattering_density.BindTexture2d(
-			"transmittance_texture", transmittance_texture_, 0);
-		compute_scattering_density.BindTexture3d(
-			"single_rayleigh_scattering_texture",
-			delta_rayleigh_scattering_texture,
-			1);
-		compute_scattering_density.BindTexture3d(
-			"single_mie_scattering_texture", delta_mie_scattering_texture, 2);
-		compute_scattering_density.BindTexture3d(
-			"multiple_scattering_texture", delta_multiple_scattering_texture, 3);
-		compute_scattering_density.BindTexture2d(
-			"irradiance_texture", delta_irradiance_texture, 4);
-		compute_scattering_density.BindInt("scattering_order", scattering_order);
-		for (unsigned int layer = 0; layer < SCATTERING_TEXTURE_DEPTH; ++layer)
-		{
-			glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
-				delta_scattering_density_texture, 0, layer);
-			compute_scattering_density.BindFloat("layer", layer);
-			DrawQuad();
+		const Program& program = p.GetProgram(p.compute_scattering_density,
+			glsl_header_, kComputeScatteringDensityShader,
+			kComputeScatteringDensityOutputs, 1, kComputeScatteringDensityLayer,
+			p.layers);
+		p.AttachLayers(&p.delta_scattering_density_texture, 1, p.layers);
+		glViewport(0, 0, sizes.GetScatteringWidth(), sizes.GetScatteringHeight());
+		program.Use();
+		program.BindTexture2d("transmittance_texture", transmittance_texture_, 0);
+		program.BindTexture3d("single_rayleigh_scattering_texture",
+			p.delta_rayleigh_scattering_texture, 1);
+		program.BindTexture3d("single_mie_scattering_texture",
+			p.delta_mie_scattering_texture, 2);
+		program.BindTexture3d("multiple_scattering_texture",
+			p.delta_multiple_scattering_texture, 3);
+		program.BindTexture2d("irradiance_texture",
+			p.delta_irradiance_texture, 4);
+		program.BindInt("scattering_order", p.scattering_order);
+		program.BindFloat("layer", p.layer);
+		DrawQuad();
+		if (p.NextLayers(p.layers)) {
+			p.stage = Precomputation::INDIRECT_IRRADIANCE;
 		}
+		break;
+	}
 
+	case Precomputation::INDIRECT_IRRADIANCE: {
 		// Compute the indirect irradiance, store it in delta_irradiance_texture and
-		// accumulate it in irradiance_texture_.
+		// accumulate it in irradiance_texture_. GLES 3.0 has no per attachment
+		// blending, so this takes two draws: one without blending for
+		// delta_irradiance_texture, which must only hold this order, and one with
+		// additive blending for irradiance_texture_.
+		const Program& program = p.GetProgram(p.compute_indirect_irradiance,
+			glsl_header_, kComputeIndirectIrradianceShader);
 		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
-			GL_TEXTURE_2D, delta_irradiance_texture, 0);
+			GL_TEXTURE_2D, p.delta_irradiance_texture, 0);
 		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1,
 			GL_TEXTURE_2D, irradiance_texture_, 0);
-		glDrawBuffers(2, kDrawBuffers);
-		glViewport(0, 0, IRRADIANCE_TEXTURE_WIDTH, IRRADIANCE_TEXTURE_HEIGHT);
-		compute_indirect_irradiance.Use();
-		compute_indirect_irradiance.BindTexture3d(
-			"single_rayleigh_scattering_texture",
-			delta_rayleigh_scattering_texture,
-			0);
-		compute_indirect_irradiance.BindTexture3d(
-			"single_mie_scattering_texture", delta_mie_scattering_texture, 1);
-		compute_indirect_irradiance.BindTexture3d(
-			"multiple_scattering_texture", delta_multiple_scattering_texture, 2);
-		compute_indirect_irradiance.BindInt("scattering_order", scattering_order);
+		p.UseAttachments(2);
+		glViewport(0, 0, sizes.irradiance_width, sizes.irradiance_height);
+		program.Use();
+		program.BindTexture3d("single_rayleigh_scattering_texture",
+			p.delta_rayleigh_scattering_texture, 0);
+		program.BindTexture3d("single_mie_scattering_texture",
+			p.delta_mie_scattering_texture, 1);
+		program.BindTexture3d("multiple_scattering_texture",
+			p.delta_multiple_scattering_texture, 2);
+		program.BindInt("scattering_order", p.scattering_order);
+		const GLenum kDeltaIrradianceBuffers[] = { GL_COLOR_ATTACHMENT0, GL_NONE };
+		glDrawBuffers(2, kDeltaIrradianceBuffers);
+		DrawQuad();
+		const GLenum kIrradianceBuffers[] = { GL_NONE, GL_COLOR_ATTACHMENT1 };
+		glDrawBuffers(2, kIrradianceBuffers);
 		glEnable(GL_BLEND);
 		glBlendEquationSeparate(GL_FUNC_ADD, GL_FUNC_ADD);
 		glBlendFuncSeparate(GL_ONE, GL_ONE, GL_ONE, GL_ONE);
 		DrawQuad();
 		glDisable(GL_BLEND);
+		p.UseAttachments(2);
+		p.stage = Precomputation::MULTIPLE_SCATTERING;
+		break;
+	}
 
-		// Compute the multiple scattering, store it in
-		// delta_multiple_scattering_texture, and accumulate it in
-		// scattering_texture_.
-		glFramebufferTexture2D(
-			GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, 0, 0);
-		glFramebufferTexture2D(
-			GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, GL_TEXTURE_2D, 0, 0);
-
-		glViewport(0, 0, SCATTERING_TEXTURE_WIDTH, SCATTERING_TEXTURE_HEIGHT);
-		compute_multiple_scattering.Use();
-		compute_multiple_scattering.BindTexture2d(
-			"transmittance_texture", transmittance_texture_, 0);
-		compute_multiple_scattering.BindTexture3d(
-			"scattering_density_texture", delta_scattering_density_texture, 1);
-		glDrawBuffers(1, kDrawBuffers);
-		CHECK_GL_ERROR_DEBUG();
-		for (unsigned int layer = 0; layer < SCATTERING_TEXTURE_DEPTH; ++layer)
-		{
-			glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
-				delta_multiple_scattering_texture, 0, layer);
-			CHECK_GL_ERROR_DEBUG();
-			compute_multiple_scattering.BindFloat("layer", layer);
-			CHECK_GL_ERROR_DEBUG();
-			DrawQuad();
+	case Precomputation::MULTIPLE_SCATTERING: {
+		// Compute the multiple scattering, and store it in
+		// delta_multiple_scattering_texture.
+		const Program& program = p.GetProgram(p.compute_multiple_scattering,
+			glsl_header_, kComputeMultipleScatteringShader,
+			kComputeMultipleScatteringOutputs, 1, kComputeMultipleScatteringLayer,
+			p.layers);
+		p.AttachLayers(&p.delta_multiple_scattering_texture, 1, p.layers);
+		glViewport(0, 0, sizes.GetScatteringWidth(), sizes.GetScatteringHeight());
+		program.Use();
+		program.BindTexture2d("transmittance_texture", transmittance_texture_, 0);
+		program.BindTexture3d("scattering_density_texture",
+			p.delta_scattering_density_texture, 1);
+		program.BindFloat("layer", p.layer);
+		DrawQuad();
+		if (p.NextLayers(p.layers)) {
+			p.MeasureMultipleScattering();
+			p.stage = Precomputation::ACCUMULATE_MULTIPLE_SCATTERING;
 		}
+		break;
+	}
 
-		compute_multiple_scattering_1.Use();
-		compute_multiple_scattering_1.BindTexture3d(
-			"scattering_density_texture", delta_multiple_scattering_texture, 0);
+	case Precomputation::ACCUMULATE_MULTIPLE_SCATTERING: {
+		// Accumulate the multiple scattering in scattering_texture_.
+		const Program& program = p.GetProgram(p.compute_multiple_scattering_1,
+			glsl_header_, kComputeMultipleScatteringShader_1,
+			kComputeMultipleScatteringOutputs_1, 1,
+			kComputeMultipleScatteringLayer_1, p.layers);
+		p.AttachLayers(&scattering_texture_, 1, p.layers);
+		glViewport(0, 0, sizes.GetScatteringWidth(), sizes.GetScatteringHeight());
+		program.Use();
+		program.BindTexture3d("delta_multiple_scattering",
+			p.delta_multiple_scattering_texture, 0);
+		program.BindFloat("layer", p.layer);
 		glEnable(GL_BLEND);
 		glBlendEquationSeparate(GL_FUNC_ADD, GL_FUNC_ADD);
 		glBlendFuncSeparate(GL_ONE, GL_ONE, GL_ONE, GL_ONE);
-		glDrawBuffers(1, kDrawBuffers);
-		for (unsigned int layer = 0; layer < SCATTERING_TEXTURE_DEPTH; ++layer)
-		{
-			glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
-				scattering_texture_, 0, layer);
-			compute_multiple_scattering_1.BindFloat("layer", layer);
-			DrawQuad();
-		}
+		DrawQuad();
 		glDisable(GL_BLEND);
+		if (p.NextLayers(p.layers)) {
+			p.stage = p.HasNextOrder() ?
+				Precomputation::SCATTERING_DENSITY : Precomputation::DONE;
+			++p.scattering_order;
+		}
+		break;
 	}
 
-	CHECK_GL_ERROR_DEBUG();
+	case Precomputation::DONE:
+		return;
+	}
+	++p.steps_done;
+}
 
-	// Delete the temporary resources allocated at the begining of this method.
-	glUseProgram(0);
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
-	glDeleteFramebuffers(1, &fbo);
-	glDeleteTextures(1, &delta_scattering_density_texture);
-	if (optional_single_mie_scattering_texture_ == 0) {
-		glDeleteTextures(1, &delta_mie_scattering_texture);
+/*
+<p>The compute shader path has the same stages, but each one is a single
+dispatch. The images are bound with <code>layout(binding)</code> in the shaders,
+to the units given here:
+*/
+
+void SkyModel::RunComputePrecomputationStep() {
+	Precomputation& p = *precomputation_;
+	const SkyTextureSizes& sizes = texture_sizes_;
+
+	switch (p.stage) {
+	case Precomputation::TRANSMITTANCE: {
+		const Program& program = p.GetComputeProgram(p.compute_transmittance,
+			glsl_header_, kTransmittanceComputeShader);
+		program.Use();
+		p.BindImage(0, transmittance_texture_, false, GL_RGBA32F);
+		p.Dispatch(sizes.transmittance_width, sizes.transmittance_height, 1);
+		p.stage = Precomputation::DIRECT_IRRADIANCE;
+		break;
 	}
-	glDeleteTextures(1, &delta_rayleigh_scattering_texture);
-	glDeleteTextures(1, &delta_irradiance_texture);
 
-	CHECK_GL_ERROR_DEBUG();
+	case Precomputation::DIRECT_IRRADIANCE: {
+		const Program& program = p.GetComputeProgram(p.compute_direct_irradiance,
+			glsl_header_, kDirectIrradianceComputeShader);
+		program.Use();
+		program.BindTexture2d("transmittance_texture", transmittance_texture_, 0);
+		p.BindImage(0, p.delta_irradiance_texture, false, GL_RGBA32F);
+		p.BindImage(1, irradiance_texture_, false, GL_RGBA32F);
+		p.Dispatch(sizes.irradiance_width, sizes.irradiance_height, 1);
+		p.stage = Precomputation::SINGLE_SCATTERING;
+		break;
+	}
+
+	case Precomputation::SINGLE_SCATTERING: {
+		const Program& program = p.GetComputeProgram(p.compute_single_scattering,
+			glsl_header_, kSingleScatteringComputeShader);
+		program.Use();
+		program.BindTexture2d("transmittance_texture", transmittance_texture_, 0);
+		p.BindImage(0, p.delta_rayleigh_scattering_texture, true, GL_RGBA16F);
+		p.BindImage(1, p.delta_mie_scattering_texture, true, GL_RGBA16F);
+		p.BindImage(2, scattering_texture_, true, GL_RGBA16F);
+		p.Dispatch(sizes.GetScatteringWidth(), sizes.GetScatteringHeight(),
+			sizes.GetScatteringDepth());
+		p.MeasureSingleScattering();
+		p.stage = p.num_scattering_orders >= 2 ?
+			Precomputation::SCATTERING_DENSITY : Precomputation::DONE;
+		break;
+	}
+
+	case Precomputation::SCATTERING_DENSITY: {
+		const Program& program = p.GetComputeProgram(p.compute_scattering_density,
+			glsl_header_, kScatteringDensityComputeShader);
+		program.Use();
+		program.BindTexture2d("transmittance_texture", transmittance_texture_, 0);
+		program.BindTexture3d("single_rayleigh_scattering_texture",
+			p.delta_rayleigh_scattering_texture, 1);
+		program.BindTexture3d("single_mie_scattering_texture",
+			p.delta_mie_scattering_texture, 2);
+		program.BindTexture3d("multiple_scattering_texture",
+			p.delta_multiple_scattering_texture, 3);
+		program.BindTexture2d("irradiance_texture",
+			p.delta_irradiance_texture, 4);
+		program.BindInt("scattering_order", p.scattering_order);
+		p.BindImage(0, p.delta_scattering_density_texture, true, GL_RGBA16F);
+		p.Dispatch(sizes.GetScatteringWidth(), sizes.GetScatteringHeight(),
+			sizes.GetScatteringDepth());
+		p.stage = Precomputation::INDIRECT_IRRADIANCE;
+		break;
+	}
+
+	case Precomputation::INDIRECT_IRRADIANCE: {
+		const Program& program = p.GetComputeProgram(
+			p.compute_indirect_irradiance, glsl_header_,
+			kIndirectIrradianceComputeShader);
+		program.Use();
+		program.BindTexture3d("single_rayleigh_scattering_texture",
+			p.delta_rayleigh_scattering_texture, 0);
+		program.BindTexture3d("single_mie_scattering_texture",
+			p.delta_mie_scattering_texture, 1);
+		program.BindTexture3d("multiple_scattering_texture",
+			p.delta_multiple_scattering_texture, 2);
+		program.BindTexture2d("irradiance_texture", irradiance_texture_, 3);
+		program.BindInt("scattering_order", p.scattering_order);
+		p.BindImage(0, p.delta_irradiance_texture, false, GL_RGBA32F);
+		p.BindImage(1, irradiance_texture_, false, GL_RGBA32F);
+		p.Dispatch(sizes.irradiance_width, sizes.irradiance_height, 1);
+		p.stage = Precomputation::MULTIPLE_SCATTERING;
+		break;
+	}
+
+	case Precomputation::MULTIPLE_SCATTERING: {
+		const Program& program = p.GetComputeProgram(
+			p.compute_multiple_scattering, glsl_header_,
+			kMultipleScatteringComputeShader);
+		program.Use();
+		program.BindTexture2d("transmittance_texture", transmittance_texture_, 0);
+		program.BindTexture3d("scattering_density_texture",
+			p.delta_scattering_density_texture, 1);
+		p.BindImage(0, p.delta_multiple_scattering_texture, true, GL_RGBA16F);
+		p.Dispatch(sizes.GetScatteringWidth(), sizes.GetScatteringHeight(),
+			sizes.GetScatteringDepth());
+		p.MeasureMultipleScattering();
+		p.stage = Precomputation::ACCUMULATE_MULTIPLE_SCATTERING;
+		break;
+	}
+
+	case Precomputation::ACCUMULATE_MULTIPLE_SCATTERING: {
+		const Program& program = p.GetComputeProgram(
+			p.compute_multiple_scattering_1, glsl_header_,
+			kAccumulateMultipleScatteringComputeShader);
+		program.Use();
+		program.BindTexture3d("delta_multiple_scattering",
+			p.delta_multiple_scattering_texture, 0);
+		program.BindTexture3d("scattering_texture", scattering_texture_, 1);
+		p.BindImage(0, scattering_texture_, true, GL_RGBA16F);
+		p.Dispatch(sizes.GetScatteringWidth(), sizes.GetScatteringHeight(),
+			sizes.GetScatteringDepth());
+		p.stage = p.HasNextOrder() ?
+			Precomputation::SCATTERING_DENSITY : Precomputation::DONE;
+		++p.scattering_order;
+		break;
+	}
+
+	case Precomputation::DONE:
+		return;
+	}
+	++p.steps_done;
+}
+
+/*
+<p>The cache holds the final textures in the order transmittance, scattering,
+single Mie scattering (only when it has its own texture) and irradiance. The 3D
+textures are 16F on the GPU and are stored as halves, the 2D ones as floats. The
+cache always holds the full precision values, whatever the selected formats:
+*/
+
+bool SkyModel::LoadCache(uint64_t key) {
+	std::vector<AtmosphereCache::Texture> textures;
+	if (!AtmosphereCache::Read(cache_file_, key, &textures)) {
+		return false;
+	}
+	return UploadTextures(textures, false);
+}
+
+// Uploads the textures read from the cache or from the precomputation, in their
+// selected formats. With compact_only, only the textures whose format is not
+// FULL_PRECISION are uploaded (the others already hold these values).
+bool SkyModel::UploadTextures(
+	const std::vector<AtmosphereCache::Texture>& textures, bool compact_only) {
+	const SkyTextureSizes& sizes = texture_sizes_;
+	bool combined = optional_single_mie_scattering_texture_ == 0;
+	if (textures.size() != (combined ? 3u : 4u)) {
+		return false;
+	}
+
+	size_t next = 0;
+	bool uploaded = true;
+	auto upload = [&](GLuint* texture, GLenum compact_format, int width,
+		int height, int depth, int channels, bool half) {
+		const AtmosphereCache::Texture& source = textures[next++];
+		if (!uploaded || (compact_only && compact_format == GL_NONE)) {
+			return;
+		}
+		uploaded = UploadTexture(texture, compact_format, width, height, depth,
+			channels, half, source);
+		compact_textures_ = compact_textures_ ||
+			(uploaded && compact_format != GL_NONE);
+	};
+	upload(&transmittance_texture_, GetCompactFormat(transmittance_format_),
+		sizes.transmittance_width, sizes.transmittance_height, 1, 3, false);
+	upload(&scattering_texture_,
+		combined ? GL_NONE : GetCompactFormat(scattering_format_),
+		sizes.GetScatteringWidth(), sizes.GetScatteringHeight(),
+		sizes.GetScatteringDepth(), combined ? 4 : 3, true);
+	if (!combined) {
+		upload(&optional_single_mie_scattering_texture_,
+			GetCompactFormat(scattering_format_), sizes.GetScatteringWidth(),
+			sizes.GetScatteringHeight(), sizes.GetScatteringDepth(), 3, true);
+	}
+	upload(&irradiance_texture_, GetCompactFormat(irradiance_format_),
+		sizes.irradiance_width, sizes.irradiance_height, 1, 3, false);
+	return uploaded;
+}
+
+void SkyModel::ReadTextures(unsigned int fbo,
+	std::vector<AtmosphereCache::Texture>* textures) const {
+	const SkyTextureSizes& sizes = texture_sizes_;
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+
+	int scattering_channels = optional_single_mie_scattering_texture_ == 0 ? 4 : 3;
+	textures->resize(optional_single_mie_scattering_texture_ != 0 ? 4 : 3);
+	size_t next = 0;
+	ReadTexture(transmittance_texture_, sizes.transmittance_width,
+		sizes.transmittance_height, 1, 3, false, &(*textures)[next++]);
+	ReadTexture(scattering_texture_, sizes.GetScatteringWidth(),
+		sizes.GetScatteringHeight(), sizes.GetScatteringDepth(),
+		scattering_channels, true, &(*textures)[next++]);
+	if (optional_single_mie_scattering_texture_ != 0) {
+		ReadTexture(optional_single_mie_scattering_texture_,
+			sizes.GetScatteringWidth(), sizes.GetScatteringHeight(),
+			sizes.GetScatteringDepth(), 3, true, &(*textures)[next++]);
+	}
+	ReadTexture(irradiance_texture_, sizes.irradiance_width,
+		sizes.irradiance_height, 1, 3, false, &(*textures)[next++]);
+	glFramebufferTexture2D(
+		GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, 0, 0);
+}
+
+void SkyModel::SaveCache(uint64_t key,
+	const std::vector<AtmosphereCache::Texture>& textures) const {
+	if (!AtmosphereCache::Write(cache_file_, key, textures)) {
+		std::cerr << "could not write the atmosphere cache " << cache_file_
+			<< std::endl;
+	}
 }
 
 /*
@@ -1008,26 +2071,33 @@ void SkyModel::SetProgramUniforms(unsigned int program,
 	unsigned int scattering_texture_unit,
 	unsigned int irradiance_texture_unit,
 	unsigned int single_mie_scattering_texture_unit) const {
-	glActiveTexture(GL_TEXTURE0 + transmittance_texture_unit);
-	glBindTexture(GL_TEXTURE_2D, transmittance_texture_);
+	BindTextures(transmittance_texture_unit, scattering_texture_unit,
+		irradiance_texture_unit, single_mie_scattering_texture_unit);
 	glUniform1i(glGetUniformLocation(program, "transmittance_texture"),
 		transmittance_texture_unit);
-
-	glActiveTexture(GL_TEXTURE0 + scattering_texture_unit);
-	glBindTexture(GL_TEXTURE_3D, scattering_texture_);
 	glUniform1i(glGetUniformLocation(program, "scattering_texture"),
 		scattering_texture_unit);
-
-	glActiveTexture(GL_TEXTURE0 + irradiance_texture_unit);
-	glBindTexture(GL_TEXTURE_2D, irradiance_texture_);
 	glUniform1i(glGetUniformLocation(program, "irradiance_texture"),
 		irradiance_texture_unit);
+	if (optional_single_mie_scattering_texture_ != 0) {
+		glUniform1i(glGetUniformLocation(program, "single_mie_scattering_texture"),
+			single_mie_scattering_texture_unit);
+	}
+}
 
+void SkyModel::BindTextures(unsigned int transmittance_texture_unit,
+	unsigned int scattering_texture_unit,
+	unsigned int irradiance_texture_unit,
+	unsigned int single_mie_scattering_texture_unit) const {
+	glActiveTexture(GL_TEXTURE0 + transmittance_texture_unit);
+	glBindTexture(GL_TEXTURE_2D, transmittance_texture_);
+	glActiveTexture(GL_TEXTURE0 + scattering_texture_unit);
+	glBindTexture(GL_TEXTURE_3D, scattering_texture_);
+	glActiveTexture(GL_TEXTURE0 + irradiance_texture_unit);
+	glBindTexture(GL_TEXTURE_2D, irradiance_texture_);
 	if (optional_single_mie_scattering_texture_ != 0) {
 		glActiveTexture(GL_TEXTURE0 + single_mie_scattering_texture_unit);
 		glBindTexture(GL_TEXTURE_3D, optional_single_mie_scattering_texture_);
-		glUniform1i(glGetUniformLocation(program, "single_mie_scattering_texture"),
-			single_mie_scattering_texture_unit);
 	}
 }
 
@@ -121,11 +121,18 @@ along the specified segment at the 3 wavelengths <code>kLambdaR</code>,
 #define GLUT_DISABLE_ATEXIT_HACK 
 #endif  
 
+#include <cstdint>
+#include <memory>
 #include <string>
 #include <vector>
 
+#include "AtmosphereCache.h"
+#include "SkyModelParameters.h"
+
 class SkyModel {
 public:
+	explicit SkyModel(const SkyModelParameters& parameters);
+
 	SkyModel(
 		// The wavelength values, in nanometers, and sorted in increasing order, for
 		// which the solar_irradiance, rayleigh_scattering, mie_scattering,
@@ -182,14 +189,95 @@ public:
 		// Whether to pack the (red component of the) single Mie scattering with the
 		// Rayleigh and multiple scattering in a single texture, or to store the
 		// (3 components of the) single Mie scattering in a separate texture.
-		bool combine_scattering_textures);
+		bool combine_scattering_textures,
+		// The resolutions of the precomputed textures, which trade their memory
+		// and precomputation time against the accuracy of the sky (see the
+		// SkyTextureSizes presets, and the --report option of the
+		// AtmosphereBaker tool for what each one costs and gains).
+		const SkyTextureSizes& texture_sizes = SkyTextureSizes::High());
 
 	~SkyModel();
 
-	std::string getStringFromFile(const char* filename);
-
+	// Uploads the textures from the cache file when it was written with the same
+	// parameters, texture sizes, shaders and number of scattering orders, and
+	// otherwise precomputes them and writes the cache file.
 	void Init(unsigned int num_scattering_orders = 4);
 
+	// The same as Init, but without blocking: BeginInit only loads the cache file
+	// (or allocates what the precomputation needs), and each call to Update then
+	// runs at most max_steps steps of the precomputation, where a step is a 2D
+	// pass or a group of layers of a 3D pass (a whole pass with compute shaders,
+	// see SetUseComputeShaders). Update returns true once the textures are
+	// complete. Changes the framebuffer, program and texture bindings, and
+	// restores the viewport.
+	void BeginInit(unsigned int num_scattering_orders = 4);
+	bool Update(unsigned int max_steps);
+	bool IsReady() const { return ready_; }
+	// Fraction of the precomputation steps done, 1 once ready.
+	float GetProgress() const;
+
+	// An empty file name disables the cache. Must be called before Init.
+	void SetCacheFile(const std::string& filename) { cache_file_ = filename; }
+	bool IsLoadedFromCache() const { return loaded_from_cache_; }
+
+	const SkyTextureSizes& GetTextureSizes() const { return texture_sizes_; }
+
+	// Storage formats of the final textures once they are complete. The
+	// precomputation always writes full precision textures (32-bit float 2D
+	// textures and 16-bit float 3D ones), which are then converted, or uploaded
+	// from the cache file, in the selected formats. R11F_G11F_B10F and RGB9_E5
+	// take 4 bytes per texel instead of 12 (2D) and 6 (3D), but keep fewer bits:
+	// R11F_G11F_B10F has a 6 or 5 bit mantissa per channel, RGB9_E5 a 9 bit
+	// mantissa with an exponent shared by the 3 channels. A combined scattering
+	// texture needs its alpha channel and stays in full precision. The
+	// AtmosphereBaker tool reports the error of each format (--formats).
+	enum TextureFormat {
+		FULL_PRECISION,
+		R11F_G11F_B10F,
+		RGB9_E5
+	};
+	// Must be called before BeginInit.
+	void SetTextureFormats(TextureFormat transmittance, TextureFormat scattering,
+		TextureFormat irradiance) {
+		transmittance_format_ = transmittance;
+		scattering_format_ = scattering;
+		irradiance_format_ = irradiance;
+	}
+	// GPU memory of the final textures, in their current formats.
+	size_t GetTextureMemorySize() const;
+
+	// File of the linked precomputation program binaries, so that a precomputation
+	// (for other parameters, or after the cache file was deleted) does not
+	// compile its shaders again. An empty file name disables it. Must be called
+	// before BeginInit.
+	void SetProgramCacheFile(const std::string& filename) { program_cache_file_ = filename; }
+
+	// Number of 3D texture layers each precomputation draw call writes, with one
+	// color attachment per layer and output. 1 (the default) draws each layer
+	// separately, 0 writes as many as GL_MAX_DRAW_BUFFERS allows. Must be called
+	// before BeginInit.
+	void SetMaxLayersPerDraw(unsigned int layers) { max_layers_per_draw_ = layers; }
+
+	// Adaptive number of scattering orders. With a tolerance above 0, the
+	// precomputation stops after the first order whose multiple scattering adds
+	// less than tolerance times the energy of all the orders so far (the sum of
+	// their texture values, measured on the GPU), and the num_scattering_orders
+	// of Init and BeginInit is only a maximum. With 0 (the default), exactly
+	// num_scattering_orders orders are computed. Must be called before BeginInit.
+	void SetScatteringOrderTolerance(double tolerance) { scattering_order_tolerance_ = tolerance; }
+	// Number of scattering orders computed by the last precomputation, and the
+	// time spent in it in milliseconds (in Update, up to a final glFinish). Both
+	// are 0 when the textures were loaded from the cache file.
+	unsigned int GetScatteringOrderCount() const { return scattering_order_count_; }
+	double GetPrecomputationTime() const { return precomputation_time_; }
+
+	// Whether to precompute with GLES 3.1 compute shaders, one dispatch per pass,
+	// when the context supports them (the default). Otherwise, or with a GLES 3.0
+	// context, the passes draw quads in a framebuffer. Must be called before
+	// BeginInit. IsUsingComputeShaders tells which path the last BeginInit chose.
+	void SetUseComputeShaders(bool use) { use_compute_shaders_ = use; }
+	bool IsUsingComputeShaders() const { return using_compute_shaders_; }
+
 	unsigned int GetShader() const { return atmosphere_shader_; }
 
 	std::string getAtmosphereShaderStr() { return atmosphere_shader_str_;  }
@@ -199,6 +287,12 @@ public:
 		unsigned int scattering_texture_unit,
 		unsigned int irradiance_texture_unit,
 		unsigned int optional_single_mie_scattering_texture_unit = 0) const;
+	// binds the precomputed textures to the texture units only, for the programs
+	// whose uniforms were already set with SetProgramUniforms
+	void BindTextures(unsigned int transmittance_texture_unit,
+		unsigned int scattering_texture_unit,
+		unsigned int irradiance_texture_unit,
+		unsigned int optional_single_mie_scattering_texture_unit = 0) const;
 
 	// Utility method to convert a function of the wavelength to linear sRGB.
 	// 'wavelengths' and 'spectrum' must have the same size. The integral of
@@ -215,13 +309,46 @@ public:
 	static double kLambdaB;
 
 private:
+	struct Precomputation;
+
+	void NewTextures(bool storage);
+	bool LoadCache(uint64_t key);
+	void ReadTextures(unsigned int fbo,
+		std::vector<AtmosphereCache::Texture>* textures) const;
+	void SaveCache(uint64_t key,
+		const std::vector<AtmosphereCache::Texture>& textures) const;
+	bool UploadTextures(const std::vector<AtmosphereCache::Texture>& textures,
+		bool compact_only);
+	void RunPrecomputationStep();
+	void RunComputePrecomputationStep();
+
+	SkyTextureSizes texture_sizes_;
 	std::string glsl_header_;
 	std::string atmosphere_shader_str_;
 	unsigned int transmittance_texture_;
 	unsigned int scattering_texture_;
 	unsigned int optional_single_mie_scattering_texture_;
 	unsigned int irradiance_texture_;
+	// Whether the final textures are the immutable ones of the compute shaders,
+	// and whether some were converted to a compact format.
+	bool storage_textures_;
+	bool compact_textures_;
+	TextureFormat transmittance_format_;
+	TextureFormat scattering_format_;
+	TextureFormat irradiance_format_;
 	unsigned int atmosphere_shader_;
+	std::string cache_file_;
+	uint64_t cache_key_;
+	bool loaded_from_cache_;
+	bool ready_;
+	std::string program_cache_file_;
+	unsigned int max_layers_per_draw_;
+	bool use_compute_shaders_;
+	bool using_compute_shaders_;
+	double scattering_order_tolerance_;
+	unsigned int scattering_order_count_;
+	double precomputation_time_;
+	std::unique_ptr<Precomputation> precomputation_;
 };
 
 #endif  // ATMOSPHERE_MODEL_H_
@@ -0,0 +1,172 @@
+#include "SkyModelParameters.h"
+#include "AtmosphereCache.h"
+#include "SkyModelShaders.h"
+
+#include <cmath>
+
+#include "constants.h"
+
+// Bump when the precomputation passes of SkyModel (their draws, blending or
+// the GLSL header they build) change, which the cache key cannot see otherwise.
+// The shaders of SkyModelShaders.h are hashed instead.
+static const uint32_t kPrecomputationVersion = 2;
+
+// Values from "Reference Solar Spectral Irradiance: ASTM G-173", ETR column
+// (see http://rredc.nrel.gov/solar/spectra/am1.5/ASTMG173/ASTMG173.html),
+// summed and averaged in each bin (e.g. the value for 360nm is the average
+// of the ASTM G-173 values for all wavelengths between 360 and 370nm).
+const double kSkySolarIrradiance[48] = {
+	1.11776, 1.14259, 1.01249, 1.14716, 1.72765, 1.73054, 1.6887, 1.61253,
+	1.91198, 2.03474, 2.02042, 2.02212, 1.93377, 1.95809, 1.91686, 1.8298,
+	1.8685, 1.8931, 1.85149, 1.8504, 1.8341, 1.8345, 1.8147, 1.78158, 1.7533,
+	1.6965, 1.68194, 1.64654, 1.6048, 1.52143, 1.55622, 1.5113, 1.474, 1.4482,
+	1.41018, 1.36775, 1.34188, 1.31429, 1.28303, 1.26758, 1.2367, 1.2082,
+	1.18737, 1.14683, 1.12362, 1.1058, 1.07124, 1.04992
+};
+
+size_t SkyTextureSizes::GetTextureMemorySize(
+	bool combine_scattering_textures) const {
+	size_t texels_2d = (size_t)transmittance_width * transmittance_height +
+		(size_t)irradiance_width * irradiance_height;
+	size_t texels_3d = (size_t)GetScatteringWidth() * GetScatteringHeight() *
+		GetScatteringDepth();
+	// RGBA16F combined scattering, or RGB16F scattering and single Mie scattering.
+	return texels_2d * 3 * sizeof(float) +
+		texels_3d * (combine_scattering_textures ? 4 : 6) * 2;
+}
+
+size_t SkyTextureSizes::GetPrecomputationMemorySize(
+	bool combine_scattering_textures) const {
+	size_t texels_3d = (size_t)GetScatteringWidth() * GetScatteringHeight() *
+		GetScatteringDepth();
+	// The RGB32F delta irradiance, the RGBA16F delta Rayleigh (and multiple)
+	// scattering, the RGB16F scattering density, and the RGB16F delta Mie
+	// scattering when it is not the final single Mie scattering texture.
+	return (size_t)irradiance_width * irradiance_height * 3 * sizeof(float) +
+		texels_3d * (4 + 3 + (combine_scattering_textures ? 3 : 0)) * 2;
+}
+
+SkyTextureSizes SkyTextureSizes::Low() {
+	SkyTextureSizes sizes = { 128, 32, 8, 64, 16, 8, 32, 8 };
+	return sizes;
+}
+
+SkyTextureSizes SkyTextureSizes::Medium() {
+	SkyTextureSizes sizes = { 256, 64, 16, 64, 32, 8, 64, 16 };
+	return sizes;
+}
+
+SkyTextureSizes SkyTextureSizes::High() {
+	SkyTextureSizes sizes = { TRANSMITTANCE_TEXTURE_WIDTH,
+		TRANSMITTANCE_TEXTURE_HEIGHT, SCATTERING_TEXTURE_R_SIZE,
+		SCATTERING_TEXTURE_MU_SIZE, SCATTERING_TEXTURE_MU_S_SIZE,
+		SCATTERING_TEXTURE_NU_SIZE, IRRADIANCE_TEXTURE_WIDTH,
+		IRRADIANCE_TEXTURE_HEIGHT };
+	return sizes;
+}
+
+SkyModelParameters SkyModelParameters::Earth(bool use_constant_solar_spectrum,
+	bool combine_scattering_textures) {
+	const double kPi = 3.1415926535897932;
+	const int kLambdaMin = 360;
+	const int kLambdaMax = 830;
+	// Wavelength independent solar irradiance "spectrum" (not physically
+	// realistic, but was used in the original implementation).
+	const double kConstantSolarIrradiance = 1.5;
+	const double kRayleigh = 1.24062e-6;
+	const double kMieAngstromAlpha = 0.0;
+	const double kMieAngstromBeta = 5.328e-3;
+	const double kMieSingleScatteringAlbedo = 0.9;
+	const double kGroundAlbedo = 0.1;
+
+	SkyModelParameters parameters;
+	parameters.sun_angular_radius = 0.00935 / 2.0;
+	parameters.bottom_radius = 6360000.0;
+	parameters.top_radius = 6420000.0;
+	parameters.rayleigh_scale_height = 8000.0;
+	parameters.mie_scale_height = 1200.0;
+	parameters.mie_phase_function_g = 0.8;
+	parameters.max_sun_zenith_angle = 102.0 / 180.0 * kPi;
+	parameters.length_unit_in_meters = 1000.0;
+	parameters.combine_scattering_textures = combine_scattering_textures;
+	parameters.texture_sizes = SkyTextureSizes::High();
+
+	for (int l = kLambdaMin; l <= kLambdaMax; l += 10) {
+		double lambda = static_cast<double>(l) * 1e-3;  // micro-meters
+		double mie = kMieAngstromBeta / parameters.mie_scale_height *
+			pow(lambda, -kMieAngstromAlpha);
+		parameters.wavelengths.push_back(l);
+		parameters.solar_irradiance.push_back(use_constant_solar_spectrum ?
+			kConstantSolarIrradiance : kSkySolarIrradiance[(l - kLambdaMin) / 10]);
+		parameters.rayleigh_scattering.push_back(kRayleigh * pow(lambda, -4));
+		parameters.mie_scattering.push_back(mie * kMieSingleScatteringAlbedo);
+		parameters.mie_extinction.push_back(mie);
+		parameters.ground_albedo.push_back(kGroundAlbedo);
+	}
+	return parameters;
+}
+
+double SkyModelParameters::Interpolate(const std::vector<double>& spectrum,
+	double wavelength) const {
+	if (wavelength < wavelengths[0]) {
+		return spectrum[0];
+	}
+	for (size_t i = 0; i + 1 < wavelengths.size(); ++i) {
+		if (wavelength < wavelengths[i + 1]) {
+			double u = (wavelength - wavelengths[i]) /
+				(wavelengths[i + 1] - wavelengths[i]);
+			return spectrum[i] * (1.0 - u) + spectrum[i + 1] * u;
+		}
+	}
+	return spectrum[spectrum.size() - 1];
+}
+
+uint64_t SkyModelParameters::GetCacheKey(const std::string& definitions_source,
+	const std::string& functions_source) const {
+	// The raw values, the GLSL header only has them with 6 decimals.
+	uint64_t key = AtmosphereCache::kHashSeed;
+	auto hash = [&key](const void* data, size_t size) {
+		key = AtmosphereCache::Hash(data, size, key);
+	};
+	auto hash_vector = [&hash](const std::vector<double>& v) {
+		uint64_t size = v.size();
+		hash(&size, sizeof(size));
+		if (size > 0) {
+			hash(&v[0], v.size() * sizeof(double));
+		}
+	};
+	auto hash_string = [&hash](const std::string& s) {
+		uint64_t size = s.size();
+		hash(&size, sizeof(size));
+		hash(s.data(), s.size());
+	};
+
+	const double scalars[] = { sun_angular_radius, bottom_radius, top_radius,
+		rayleigh_scale_height, mie_scale_height, mie_phase_function_g,
+		max_sun_zenith_angle, length_unit_in_meters, kSkyLambdaR, kSkyLambdaG,
+		kSkyLambdaB };
+	const int32_t sizes[] = { texture_sizes.transmittance_width,
+		texture_sizes.transmittance_height, texture_sizes.scattering_r_size,
+		texture_sizes.scattering_mu_size, texture_sizes.scattering_mu_s_size,
+		texture_sizes.scattering_nu_size, texture_sizes.irradiance_width,
+		texture_sizes.irradiance_height };
+	const uint32_t flags[] = { kPrecomputationVersion,
+		combine_scattering_textures ? 1u : 0u };
+	hash_vector(wavelengths);
+	hash_vector(solar_irradiance);
+	hash_vector(rayleigh_scattering);
+	hash_vector(mie_scattering);
+	hash_vector(mie_extinction);
+	hash_vector(ground_albedo);
+	hash(scalars, sizeof(scalars));
+	hash(sizes, sizeof(sizes));
+	hash(flags, sizeof(flags));
+	hash_string(definitions_source);
+	hash_string(functions_source);
+	for (size_t i = 0;
+		i < sizeof(kPrecomputationShaders) / sizeof(kPrecomputationShaders[0]);
+		++i) {
+		hash_string(kPrecomputationShaders[i]);
+	}
+	return key;
+}
@@ -0,0 +1,94 @@
+#ifndef SKY_MODEL_PARAMETERS_H_
+#define SKY_MODEL_PARAMETERS_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// The wavelengths, in nanometers, at which the atmosphere shaders evaluate the
+// spectra (SkyModel::kLambdaR, kLambdaG and kLambdaB start with these values).
+const double kSkyLambdaR = 680.0;
+const double kSkyLambdaG = 550.0;
+const double kSkyLambdaB = 440.0;
+
+// The resolutions of the precomputed textures, see constants.h for what each
+// one samples. The scattering textures are 3D textures of nu_size * mu_s_size
+// by mu_size by r_size texels. mu_size must be even (half of the rows are for
+// the view rays which hit the ground), and 2D sizes which are multiples of 8
+// avoid partial compute shader work groups.
+struct SkyTextureSizes {
+	int transmittance_width;
+	int transmittance_height;
+	int scattering_r_size;
+	int scattering_mu_size;
+	int scattering_mu_s_size;
+	int scattering_nu_size;
+	int irradiance_width;
+	int irradiance_height;
+
+	int GetScatteringWidth() const { return scattering_nu_size * scattering_mu_s_size; }
+	int GetScatteringHeight() const { return scattering_mu_size; }
+	int GetScatteringDepth() const { return scattering_r_size; }
+
+	// Size in bytes of the final textures in the formats of the GLES 3.0 path of
+	// SkyModel: RGB32F for the 2D textures, RGB16F for the 3D ones (RGBA16F for
+	// the combined scattering texture).
+	size_t GetTextureMemorySize(bool combine_scattering_textures) const;
+	// Size in bytes of the temporary textures of the precomputation, on top of
+	// the final ones.
+	size_t GetPrecomputationMemorySize(bool combine_scattering_textures) const;
+
+	// Quality presets, from low-end to desktop GPUs. High is the resolution of
+	// the original implementation (the values of constants.h). Medium halves its
+	// altitude and view zenith angle resolutions (4 times less scattering texels),
+	// and Low halves the altitude and Sun zenith angle ones again, as well as the
+	// 2D textures (16 times less scattering texels than High).
+	static SkyTextureSizes Low();
+	static SkyTextureSizes Medium();
+	static SkyTextureSizes High();
+};
+
+// The arguments of the SkyModel constructor, see SkyModel.h for their meaning.
+// Kept free of any OpenGL dependency, so that the offline baker can build the
+// same atmosphere and the same cache key as the application.
+struct SkyModelParameters {
+	std::vector<double> wavelengths;
+	std::vector<double> solar_irradiance;
+	double sun_angular_radius;
+	double bottom_radius;
+	double top_radius;
+	double rayleigh_scale_height;
+	std::vector<double> rayleigh_scattering;
+	double mie_scale_height;
+	std::vector<double> mie_scattering;
+	std::vector<double> mie_extinction;
+	double mie_phase_function_g;
+	std::vector<double> ground_albedo;
+	double max_sun_zenith_angle;
+	double length_unit_in_meters;
+	bool combine_scattering_textures;
+	SkyTextureSizes texture_sizes;
+
+	// The Earth atmosphere of the demo, with the ASTM G-173 solar spectrum or with
+	// a constant one, and the High texture sizes.
+	static SkyModelParameters Earth(bool use_constant_solar_spectrum,
+		bool combine_scattering_textures);
+
+	// Linear interpolation of a spectrum sampled at 'wavelengths'.
+	double Interpolate(const std::vector<double>& spectrum,
+		double wavelength) const;
+
+	// Hash of the parameters, the texture sizes and the GLSL sources of the
+	// precomputation (the given files and the shaders of SkyModelShaders.h).
+	// SkyModel::Init chains the number of scattering orders into it with
+	// AtmosphereCache::Hash to get the key of the cache file.
+	uint64_t GetCacheKey(const std::string& definitions_source,
+		const std::string& functions_source) const;
+};
+
+// The ASTM G-173 solar spectrum used by SkyModelParameters::Earth, in W/m^2/nm,
+// averaged in 10nm bins from 360nm to 830nm.
+extern const double kSkySolarIrradiance[48];
+
+#endif  // SKY_MODEL_PARAMETERS_H_
@@ -0,0 +1,360 @@
+#ifndef SKY_MODEL_SHADERS_H_
+#define SKY_MODEL_SHADERS_H_
+
+// The shaders of the SkyModel precomputation, in a header of their own because
+// SkyModelParameters::GetCacheKey hashes them too, in the application and in the
+// GL-free baker (tools/AtmosphereBaker). Editing one of them thus invalidates
+// the cached textures. They have internal linkage, one copy per including file.
+
+/*
+<h3 id="shaders">Shader definitions</h3>
+
+<p>In order to precompute a texture we attach it to a framebuffer object (FBO)
+and we render a full quad in this FBO. For this we need a basic vertex shader:
+*/
+
+const char kVertexShader[] = 
+R"( #version 300 es
+    layout(location = 0) in vec2 vertex;
+    void main() {
+      gl_Position = vec4(vertex, 0.0, 1.0);
+    })";
+
+/*
+<p>a basic geometry shader (only for 3D textures, to specify in which layer we
+want to write):
+*/
+
+const char kGeometryShader[] = R"(
+    #version 300 es
+    #extension GL_EXT_geometry_shader4 : enable
+    layout(triangles) in;
+    layout(triangle_strip, max_vertices = 3) out;
+    uniform int layer;
+    void main() {
+      gl_Position = gl_PositionIn[0];
+      gl_Layer = layer;
+      EmitVertex();
+      gl_Position = gl_PositionIn[1];
+      gl_Layer = layer;
+      EmitVertex();
+      gl_Position = gl_PositionIn[2];
+      gl_Layer = layer;
+      EmitVertex();
+      EndPrimitive();
+    })";
+
+/*
+<p>and a fragment shader, which depends on the texture we want to compute. This
+is the role of the following shaders, which simply wrap the precomputation
+functions from <a href="functions.glsl.html">functions.glsl</a> in complete
+shaders (with a <code>main</code> function and a proper declaration of the
+shader inputs and outputs). Note that these strings must be concatenated with
+<code>definitions.glsl</code> and <code>functions.glsl</code> (provided as C++
+string literals by the generated <code>.glsl.inc</code> files), as well as with
+a definition of the <code>ATMOSPHERE</code> constant - containing the atmosphere
+parameters, to really get a complete shader:
+*/
+
+const char kComputeTransmittanceShader[] = R"(
+    layout(location = 0) out vec3 transmittance;
+    void main() {
+      transmittance = ComputeTransmittanceToTopAtmosphereBoundaryTexture(
+          ATMOSPHERE, gl_FragCoord.xy);
+    })";
+
+const char kComputeDirectIrradianceShader[] = R"(
+    layout(location = 0) out vec3 delta_irradiance;
+    layout(location = 1) out vec3 irradiance;
+    uniform sampler2D transmittance_texture;
+    void main() {
+      delta_irradiance = ComputeDirectIrradianceTexture(
+          ATMOSPHERE, transmittance_texture, gl_FragCoord.xy);
+      irradiance = vec3(0.0);
+    })";
+
+/*
+<p>The 3D textures are computed several layers per draw call, each layer with its
+own color attachment(s). The shaders of these passes are thus generated by
+<code>MultiLayerShader</code> below, from their uniforms, the outputs of one
+layer and the code computing one layer, where <code>$I</code> is the index of
+the layer in the draw call and <code>$LAYER</code> its z fragment coordinate:
+*/
+
+const char kComputeSingleScatteringShader[] = R"(
+    uniform sampler2D transmittance_texture;
+    uniform float layer;
+)";
+const char* const kComputeSingleScatteringOutputs[] = {
+	"vec3 delta_rayleigh$I", "vec3 delta_mie$I", "vec4 scattering$I" };
+const char kComputeSingleScatteringLayer[] = R"(
+		ComputeSingleScatteringTexture(
+			ATMOSPHERE, transmittance_texture, vec3(gl_FragCoord.xy, $LAYER),
+			delta_rayleigh$I, delta_mie$I);
+		scattering$I = vec4(delta_rayleigh$I.rgb, delta_mie$I.r);
+)";
+
+const char kComputeScatteringDensityShader[] = R"(
+    uniform sampler2D transmittance_texture;
+    uniform sampler3D single_rayleigh_scattering_texture;
+    uniform sampler3D single_mie_scattering_texture;
+    uniform sampler3D multiple_scattering_texture;
+    uniform sampler2D irradiance_texture;
+    uniform int scattering_order;
+    uniform float layer;
+)";
+const char* const kComputeScatteringDensityOutputs[] = {
+	"vec3 scattering_density$I" };
+const char kComputeScatteringDensityLayer[] = R"(
+		scattering_density$I = ComputeScatteringDensityTexture(
+			ATMOSPHERE, transmittance_texture, single_rayleigh_scattering_texture,
+			single_mie_scattering_texture, multiple_scattering_texture,
+			irradiance_texture, vec3(gl_FragCoord.xy, $LAYER),
+			scattering_order);
+)";
+
+const char kComputeIndirectIrradianceShader[] = R"(
+    layout(location = 0) out vec3 delta_irradiance;
+    layout(location = 1) out vec3 irradiance;
+    uniform sampler3D single_rayleigh_scattering_texture;
+    uniform sampler3D single_mie_scattering_texture;
+    uniform sampler3D multiple_scattering_texture;
+    uniform int scattering_order;
+    void main() {
+		delta_irradiance = ComputeIndirectIrradianceTexture(
+			ATMOSPHERE, single_rayleigh_scattering_texture,
+			single_mie_scattering_texture, multiple_scattering_texture,
+			gl_FragCoord.xy, scattering_order - 1);
+		irradiance = delta_irradiance;
+    })";
+
+const char kComputeMultipleScatteringShader[] = R"(
+    uniform sampler2D transmittance_texture;
+    uniform sampler3D scattering_density_texture;
+    uniform float layer;
+)";
+const char* const kComputeMultipleScatteringOutputs[] = {
+	"vec4 delta_multiple_scattering$I" };
+const char kComputeMultipleScatteringLayer[] = R"(
+		float nu;
+		delta_multiple_scattering$I = vec4(ComputeMultipleScatteringTexture(
+			ATMOSPHERE, transmittance_texture, scattering_density_texture,
+			vec3(gl_FragCoord.xy, $LAYER), nu)
+		, 0.0);
+		delta_multiple_scattering$I.a = nu;
+)";
+
+const char kComputeMultipleScatteringShader_1[] = R"(
+	uniform sampler3D delta_multiple_scattering;
+	uniform float layer;
+)";
+const char* const kComputeMultipleScatteringOutputs_1[] = {
+	"vec4 scattering$I" };
+const char kComputeMultipleScatteringLayer_1[] = R"(
+		vec4 color = ComputeMultipleScatteringTexture_1(
+			ATMOSPHERE, delta_multiple_scattering,
+			vec3(gl_FragCoord.xy, $LAYER));
+		scattering$I = vec4(color.rgb / RayleighPhaseFunction(color.a), 0.0);
+)";
+
+/*
+<p>When the context supports GLES 3.1, the same passes are done with compute
+shaders instead, which write all the layers of a 3D texture in a single dispatch
+with <code>imageStore</code>. Images only have 4 channel float formats, and the
+passes which accumulate their result with blending in the fragment shader path
+read the previous value with <code>texelFetch</code> instead. The invocation
+<code>(x, y, z)</code> computes the texel whose fragment coordinates are
+<code>(x, y, z) + 0.5</code>:
+*/
+
+const int kComputeGroupSize = 8;
+
+// The radii squared overflow 16-bit floats, which some GLES 3.1 drivers (such as
+// Mesa's llvmpipe) use for mediump, hence the highp default precision.
+const char kComputeShaderHeader[] = R"(
+    precision highp float;
+    precision highp image2D;
+    precision highp image3D;
+    layout(local_size_x = 8, local_size_y = 8, local_size_z = 1) in;
+)";
+
+const char kTransmittanceComputeShader[] = R"(
+    layout(rgba32f, binding = 0) writeonly uniform image2D transmittance;
+    void main() {
+      ivec2 texel = ivec2(gl_GlobalInvocationID.xy);
+      if (any(greaterThanEqual(texel, imageSize(transmittance)))) {
+        return;
+      }
+      imageStore(transmittance, texel, vec4(
+          ComputeTransmittanceToTopAtmosphereBoundaryTexture(
+              ATMOSPHERE, vec2(texel) + 0.5), 0.0));
+    })";
+
+const char kDirectIrradianceComputeShader[] = R"(
+    layout(rgba32f, binding = 0) writeonly uniform image2D delta_irradiance;
+    layout(rgba32f, binding = 1) writeonly uniform image2D irradiance;
+    uniform sampler2D transmittance_texture;
+    void main() {
+      ivec2 texel = ivec2(gl_GlobalInvocationID.xy);
+      if (any(greaterThanEqual(texel, imageSize(irradiance)))) {
+        return;
+      }
+      imageStore(delta_irradiance, texel, vec4(ComputeDirectIrradianceTexture(
+          ATMOSPHERE, transmittance_texture, vec2(texel) + 0.5), 0.0));
+      imageStore(irradiance, texel, vec4(0.0));
+    })";
+
+const char kSingleScatteringComputeShader[] = R"(
+    layout(rgba16f, binding = 0) writeonly uniform image3D delta_rayleigh;
+    layout(rgba16f, binding = 1) writeonly uniform image3D delta_mie;
+    layout(rgba16f, binding = 2) writeonly uniform image3D scattering;
+    uniform sampler2D transmittance_texture;
+    void main() {
+      ivec3 texel = ivec3(gl_GlobalInvocationID);
+      if (any(greaterThanEqual(texel, imageSize(scattering)))) {
+        return;
+      }
+      vec3 rayleigh;
+      vec3 mie;
+      ComputeSingleScatteringTexture(ATMOSPHERE, transmittance_texture,
+          vec3(texel) + 0.5, rayleigh, mie);
+      imageStore(delta_rayleigh, texel, vec4(rayleigh, 0.0));
+      imageStore(delta_mie, texel, vec4(mie, 0.0));
+      imageStore(scattering, texel, vec4(rayleigh, mie.r));
+    })";
+
+const char kScatteringDensityComputeShader[] = R"(
+    layout(rgba16f, binding = 0) writeonly uniform image3D scattering_density;
+    uniform sampler2D transmittance_texture;
+    uniform sampler3D single_rayleigh_scattering_texture;
+    uniform sampler3D single_mie_scattering_texture;
+    uniform sampler3D multiple_scattering_texture;
+    uniform sampler2D irradiance_texture;
+    uniform int scattering_order;
+    void main() {
+      ivec3 texel = ivec3(gl_GlobalInvocationID);
+      if (any(greaterThanEqual(texel, imageSize(scattering_density)))) {
+        return;
+      }
+      imageStore(scattering_density, texel, vec4(ComputeScatteringDensityTexture(
+          ATMOSPHERE, transmittance_texture, single_rayleigh_scattering_texture,
+          single_mie_scattering_texture, multiple_scattering_texture,
+          irradiance_texture, vec3(texel) + 0.5, scattering_order), 0.0));
+    })";
+
+const char kIndirectIrradianceComputeShader[] = R"(
+    layout(rgba32f, binding = 0) writeonly uniform image2D delta_irradiance;
+    layout(rgba32f, binding = 1) writeonly uniform image2D irradiance;
+    uniform sampler3D single_rayleigh_scattering_texture;
+    uniform sampler3D single_mie_scattering_texture;
+    uniform sampler3D multiple_scattering_texture;
+    uniform sampler2D irradiance_texture;
+    uniform int scattering_order;
+    void main() {
+      ivec2 texel = ivec2(gl_GlobalInvocationID.xy);
+      if (any(greaterThanEqual(texel, imageSize(irradiance)))) {
+        return;
+      }
+      vec3 value = ComputeIndirectIrradianceTexture(
+          ATMOSPHERE, single_rayleigh_scattering_texture,
+          single_mie_scattering_texture, multiple_scattering_texture,
+          vec2(texel) + 0.5, scattering_order - 1);
+      imageStore(delta_irradiance, texel, vec4(value, 0.0));
+      imageStore(irradiance, texel,
+          texelFetch(irradiance_texture, texel, 0) + vec4(value, 0.0));
+    })";
+
+const char kMultipleScatteringComputeShader[] = R"(
+    layout(rgba16f, binding = 0) writeonly uniform image3D delta_multiple_scattering;
+    uniform sampler2D transmittance_texture;
+    uniform sampler3D scattering_density_texture;
+    void main() {
+      ivec3 texel = ivec3(gl_GlobalInvocationID);
+      if (any(greaterThanEqual(texel, imageSize(delta_multiple_scattering)))) {
+        return;
+      }
+      float nu;
+      vec3 value = ComputeMultipleScatteringTexture(ATMOSPHERE,
+          transmittance_texture, scattering_density_texture,
+          vec3(texel) + 0.5, nu);
+      imageStore(delta_multiple_scattering, texel, vec4(value, nu));
+    })";
+
+const char kAccumulateMultipleScatteringComputeShader[] = R"(
+    layout(rgba16f, binding = 0) writeonly uniform image3D scattering;
+    uniform sampler3D delta_multiple_scattering;
+    uniform sampler3D scattering_texture;
+    void main() {
+      ivec3 texel = ivec3(gl_GlobalInvocationID);
+      if (any(greaterThanEqual(texel, imageSize(scattering)))) {
+        return;
+      }
+      vec4 color = ComputeMultipleScatteringTexture_1(
+          ATMOSPHERE, delta_multiple_scattering, vec3(texel) + 0.5);
+      imageStore(scattering, texel, texelFetch(scattering_texture, texel, 0) +
+          vec4(color.rgb / RayleighPhaseFunction(color.a), 0.0));
+    })";
+
+/*
+<p>In the adaptive mode (see <code>SetScatteringOrderTolerance</code>), the
+energy added by each scattering order is measured by summing its 3D texture. The
+following shader reduces it to a small 2D texture, where each fragment sums a
+column of 8x8 texels through all the layers, which is then read back and summed
+on the CPU. The sums need 32-bit floats, hence a header of its own:
+*/
+
+const int kEnergyBlockSize = 8;
+
+const char kComputeEnergyShader[] = R"(#version 300 es
+    precision highp float;
+    precision highp sampler3D;
+    uniform sampler3D source;
+    layout(location = 0) out vec4 energy;
+    void main() {
+      ivec3 size = textureSize(source, 0);
+      ivec2 origin = ivec2(gl_FragCoord.xy) * 8;
+      ivec2 end = min(origin + 8, size.xy);
+      vec3 sum = vec3(0.0);
+      for (int z = 0; z < size.z; ++z) {
+        for (int y = origin.y; y < end.y; ++y) {
+          for (int x = origin.x; x < end.x; ++x) {
+            sum += texelFetch(source, ivec3(x, y, z), 0).rgb;
+          }
+        }
+      }
+      energy = vec4(sum, 0.0);
+    })";
+
+// Every source above, in the order hashed by SkyModelParameters::GetCacheKey.
+const char* const kPrecomputationShaders[] = {
+	kVertexShader,
+	kGeometryShader,
+	kComputeTransmittanceShader,
+	kComputeDirectIrradianceShader,
+	kComputeSingleScatteringShader,
+	kComputeSingleScatteringOutputs[0],
+	kComputeSingleScatteringOutputs[1],
+	kComputeSingleScatteringOutputs[2],
+	kComputeSingleScatteringLayer,
+	kComputeScatteringDensityShader,
+	kComputeScatteringDensityOutputs[0],
+	kComputeScatteringDensityLayer,
+	kComputeIndirectIrradianceShader,
+	kComputeMultipleScatteringShader,
+	kComputeMultipleScatteringOutputs[0],
+	kComputeMultipleScatteringLayer,
+	kComputeMultipleScatteringShader_1,
+	kComputeMultipleScatteringOutputs_1[0],
+	kComputeMultipleScatteringLayer_1,
+	kComputeShaderHeader,
+	kTransmittanceComputeShader,
+	kDirectIrradianceComputeShader,
+	kSingleScatteringComputeShader,
+	kScatteringDensityComputeShader,
+	kIndirectIrradianceComputeShader,
+	kMultipleScatteringComputeShader,
+	kAccumulateMultipleScatteringComputeShader,
+	kComputeEnergyShader
+};
+
+#endif  // SKY_MODEL_SHADERS_H_
@@ -1,6 +1,9 @@
 #include "Terrain.h"
+#include "IndexOptimizer.h"
+#include "TerrainGrid.h"
 #include <fstream>
 #include <iostream>
+#include <algorithm>
 
 using namespace std;
 
@@ -14,8 +17,31 @@ Terrain::Terrain()
 	m_minZ = -100.0f;
 	m_scale = 0.54f;
 
+	m_mode = TERRAIN_MODE_VERTEX_BUFFERS;
+
 	m_indicesVBO = 0;
 	m_positionVBO = 0;
+	m_normalsVBO = 0;
+	m_texCoordsVBO = 0;
+	m_heightTextureId = 0;
+	m_patchVBO = 0;
+	m_patchQuadrantIndices = 0;
+	m_maxLevelOneError = 0.0f;
+	m_rootLevel = 0;
+	m_clipmapVBO = 0;
+	m_clipmapLevels = 0;
+	m_clipmapUploadTexels = 0;
+
+	m_heightmapFile = "ground.bmp";
+	m_streaming = false;
+
+	m_occlusionCulling = true;
+	m_occludedChunks = 0;
+
+	m_chunkCountX = 0;
+	m_chunkCountZ = 0;
+	m_lodFactor = 1.0f;
+	m_maxPixelError = 2.0f;
 }
 
 Terrain::~Terrain()
@@ -25,105 +51,471 @@ Terrain::~Terrain()
 
 void Terrain::init()
 {
-	GLfloat *positions;
-	GLuint *indices;
-	GLfloat *texCoords;
-	GLfloat *normals;
-
 	const char vShaderStr[] =
 		"#version 300 es                                      \n"
 		"uniform mat4 u_mvpMatrix;                            \n"
 		"uniform vec3 u_lightDirection;                       \n"
+		SKY_LIGHTING_GLSL
 		"layout(location = 0) in vec4 a_position;             \n"
 		"layout(location = 1) in vec2 a_texCoord;             \n"
 		"layout(location = 2) in vec3 a_normal;               \n"
-		"out float diffuse;                                   \n"
+		"out vec3 v_lighting;                                 \n"
 		"out vec2 v_texCoord;                                 \n"
 		"void main()                                          \n"
 		"{                                                    \n"
 		"                                                     \n"
-		"   // compute diffuse lighting                       \n"
-		"   diffuse = dot(a_normal, u_lightDirection);        \n"
+		"   // lighting from the sky, or the diffuse          \n"
+		"   // lighting of the fixed light without it         \n"
+		"   v_lighting = u_useSkyLighting ?                   \n"
+		"      skyLighting(a_normal) :                        \n"
+		"      vec3(dot(a_normal, u_lightDirection));         \n"
 		"   v_texCoord = a_texCoord;                          \n"
 		"   gl_Position = u_mvpMatrix * a_position;           \n"
 		"}                                                    \n";
 
+	// rebuilds the vertex from gl_VertexID, which is the chunk local index:
+	// the grid vertices first, then one skirt row per chunk edge.
+	// HEIGHT_UINT selects the raw 16-bit samples of a streamed tile
+	const char vPullingShaderStr[] =
+		"const int CHUNK_SIZE = " TERRAIN_STR(TERRAIN_CHUNK_SIZE) ";            \n"
+		"const int SIDE = CHUNK_SIZE + 1;                                        \n"
+		"uniform mat4 u_mvpMatrix;                                               \n"
+		"uniform vec3 u_lightDirection;                                          \n"
+		SKY_LIGHTING_GLSL
+		"#ifdef HEIGHT_UINT                                                      \n"
+		"uniform highp usampler2D s_heightMap;                                   \n"
+		"#else                                                                   \n"
+		"uniform sampler2D s_heightMap;                                          \n"
+		"#endif                                                                  \n"
+		"uniform ivec2 u_tileOrigin;                                             \n"
+		"uniform ivec2 u_chunkOrigin;                                            \n"
+		"uniform float u_skirtHeight;                                            \n"
+		"uniform vec4 u_grid;        // step, min height, height scale, size     \n"
+		"uniform vec2 u_texScale;                                                \n"
+		"out vec3 v_lighting;                                                    \n"
+		"out vec2 v_texCoord;                                                    \n"
+		"float height(int i, int j)                                              \n"
+		"{                                                                       \n"
+		"   return u_grid.y + u_grid.z * float(texelFetch(s_heightMap, ivec2(j, i) - u_tileOrigin.yx, 0).r);\n"
+		"}                                                                       \n"
+		"void main()                                                             \n"
+		"{                                                                       \n"
+		"   int li = gl_VertexID / SIDE;                                         \n"
+		"   int lj = gl_VertexID - li * SIDE;                                    \n"
+		"   bool skirt = gl_VertexID >= SIDE * SIDE;                             \n"
+		"   if (skirt)                                                           \n"
+		"   {                                                                    \n"
+		"      int edge = li - SIDE;                                             \n"
+		"      li = edge == 0 ? 0 : (edge == 1 ? CHUNK_SIZE : lj);               \n"
+		"      lj = edge == 2 ? 0 : (edge == 3 ? CHUNK_SIZE : lj);               \n"
+		"   }                                                                    \n"
+		"   int last = int(u_grid.w) - 1;                                        \n"
+		"   int i = min(u_chunkOrigin.x + li, last);                             \n"
+		"   int j = min(u_chunkOrigin.y + lj, last);                             \n"
+		"                                                                        \n"
+		"   // same forward differences as genSquareGrid                         \n"
+		"   int r1 = min(i + 1, last);                                           \n"
+		"   int c1 = min(j + 1, last);                                           \n"
+		"   float h = height(i, j);                                              \n"
+		"   float dx = height(r1, j) - height(r1 - 1, j);                        \n"
+		"   float dz = height(i, c1) - height(i, c1 - 1);                        \n"
+		"   vec3 normal = normalize(vec3(-dx, 1.0, -dz));                        \n"
+		"                                                                        \n"
+		"   // ambient and sun lighting from the sky, or the diffuse             \n"
+		"   // lighting of the fixed light without it                            \n"
+		"   v_lighting = u_useSkyLighting ? skyLighting(normal) :                \n"
+		"      vec3(dot(normal, u_lightDirection));                              \n"
+		"   v_texCoord = vec2(float(j), float(i)) * u_texScale;                  \n"
+		"   h = skirt ? u_skirtHeight : h;                                       \n"
+		"   gl_Position = u_mvpMatrix * vec4(float(i) * u_grid.x, h, float(j) * u_grid.x, 1.0);\n"
+		"}                                                                       \n";
+
+	// places the shared patch over a quadtree node. Odd patch vertices slide onto their
+	// even neighbour as the camera moves away, so at the end of a level's range the patch
+	// is exactly the next coarser level and there is nothing to pop
+	const char vCdlodShaderStr[] =
+		"#version 300 es                                                         \n"
+		"uniform mat4 u_mvpMatrix;                                               \n"
+		"uniform vec3 u_lightDirection;                                          \n"
+		SKY_LIGHTING_GLSL
+		"uniform vec3 u_cameraPos;                                               \n"
+		"uniform sampler2D s_heightMap;                                          \n"
+		"uniform ivec2 u_nodeOrigin;                                             \n"
+		"uniform int u_nodeStep;     // grid samples between two patch vertices  \n"
+		"uniform vec2 u_morph;       // distance the morph starts at, 1 / its length\n"
+		"uniform vec4 u_grid;        // step, min height, height scale, size     \n"
+		"uniform vec2 u_texScale;                                                \n"
+		"layout(location = 0) in vec2 a_patchPos;                                \n"
+		"out vec3 v_lighting;                                                    \n"
+		"out vec2 v_texCoord;                                                    \n"
+		"float height(ivec2 g)                                                   \n"
+		"{                                                                       \n"
+		"   return u_grid.y + u_grid.z * texelFetch(s_heightMap, g.yx, 0).r;     \n"
+		"}                                                                       \n"
+		"vec3 gridNormal(ivec2 g)                                                \n"
+		"{                                                                       \n"
+		"   // same forward differences as genSquareGrid                         \n"
+		"   ivec2 g1 = min(g + 1, int(u_grid.w) - 1);                            \n"
+		"   float dx = height(ivec2(g1.x, g.y)) - height(ivec2(g1.x - 1, g.y));  \n"
+		"   float dz = height(ivec2(g.x, g1.y)) - height(ivec2(g.x, g1.y - 1));  \n"
+		"   return normalize(vec3(-dx, 1.0, -dz));                               \n"
+		"}                                                                       \n"
+		"void main()                                                             \n"
+		"{                                                                       \n"
+		"   int last = int(u_grid.w) - 1;                                        \n"
+		"   ivec2 local = ivec2(a_patchPos);                                     \n"
+		"   ivec2 fine = min(u_nodeOrigin + local * u_nodeStep, last);           \n"
+		"   ivec2 coarse = min(u_nodeOrigin + (local - (local & 1)) * u_nodeStep, last);\n"
+		"   vec3 finePos = vec3(float(fine.x) * u_grid.x, height(fine), float(fine.y) * u_grid.x);\n"
+		"   vec3 coarsePos = vec3(float(coarse.x) * u_grid.x, height(coarse), float(coarse.y) * u_grid.x);\n"
+		"                                                                        \n"
+		"   float morph = clamp((distance(finePos, u_cameraPos) - u_morph.x) * u_morph.y, 0.0, 1.0);\n"
+		"   vec3 position = mix(finePos, coarsePos, morph);                      \n"
+		"   vec3 normal = normalize(mix(gridNormal(fine), gridNormal(coarse), morph));\n"
+		"                                                                        \n"
+		"   // ambient and sun lighting from the sky, or the diffuse             \n"
+		"   // lighting of the fixed light without it                            \n"
+		"   v_lighting = u_useSkyLighting ? skyLighting(normal) :                \n"
+		"      vec3(dot(normal, u_lightDirection));                              \n"
+		"   v_texCoord = position.zx / u_grid.x * u_texScale;                    \n"
+		"   gl_Position = u_mvpMatrix * vec4(position, 1.0);                     \n"
+		"}                                                                       \n";
+
+	// one clipmap level. The textures hold the heights of the level's window and wrap
+	// around as the window follows the camera; near the outer edge the heights blend
+	// into the coarser level so the two meet without cracks
+	const char vClipmapShaderStr[] =
+		"#version 300 es                                                         \n"
+		"const int SIZE = " TERRAIN_STR(TERRAIN_CLIPMAP_SIZE) ";                 \n"
+		"const int N = SIZE + 1;                                                 \n"
+		"const float BLEND = float(" TERRAIN_STR(TERRAIN_CLIPMAP_BLEND) ");      \n"
+		"uniform mat4 u_mvpMatrix;                                               \n"
+		"uniform vec3 u_lightDirection;                                          \n"
+		SKY_LIGHTING_GLSL
+		"uniform highp sampler2D s_heightMap;                                    \n"
+		"uniform highp sampler2D s_coarseLevel;                                  \n"
+		"uniform ivec2 u_levelOrigin;                                            \n"
+		"uniform ivec2 u_originTexel;                                            \n"
+		"uniform ivec2 u_coarseOffset;  // origin - 2 * coarse origin           \n"
+		"uniform ivec2 u_coarseOriginTexel;                                      \n"
+		"uniform float u_levelUnit;     // grid samples per level unit           \n"
+		"uniform float u_morphStart;                                             \n"
+		"uniform vec4 u_grid;           // step, min height, height scale, size  \n"
+		"uniform vec2 u_texScale;                                                \n"
+		"layout(location = 0) in vec2 a_gridPos;                                 \n"
+		"out vec3 v_lighting;                                                    \n"
+		"out vec2 v_texCoord;                                                    \n"
+		"float levelHeight(ivec2 g)                                              \n"
+		"{                                                                       \n"
+		"   return texelFetch(s_heightMap, ((u_originTexel + g) % N).yx, 0).r;   \n"
+		"}                                                                       \n"
+		"float coarseHeight(ivec2 c)                                             \n"
+		"{                                                                       \n"
+		"   return texelFetch(s_coarseLevel, ((u_coarseOriginTexel + c) % N).yx, 0).r;\n"
+		"}                                                                       \n"
+		"void main()                                                             \n"
+		"{                                                                       \n"
+		"   ivec2 local = ivec2(a_gridPos);                                      \n"
+		"                                                                        \n"
+		"   // odd vertices take the height of the coarse edge or diagonal they lie on\n"
+		"   ivec2 f = u_coarseOffset + local;                                    \n"
+		"   ivec2 odd = f & 1;                                                   \n"
+		"   float h = levelHeight(local);                                        \n"
+		"   float hc = 0.5 * (coarseHeight((f - odd) / 2) + coarseHeight((f + odd) / 2));\n"
+		"   vec2 d = abs(a_gridPos - float(SIZE / 2));                           \n"
+		"   float morph = clamp((max(d.x, d.y) - u_morphStart) / BLEND, 0.0, 1.0);\n"
+		"                                                                        \n"
+		"   // forward differences per grid sample, like genSquareGrid           \n"
+		"   ivec2 g1 = min(local + 1, SIZE);                                     \n"
+		"   ivec2 c0 = min((f - odd) / 2, SIZE - 1);                             \n"
+		"   float dx = levelHeight(ivec2(g1.x, local.y)) - levelHeight(ivec2(g1.x - 1, local.y));\n"
+		"   float dz = levelHeight(ivec2(local.x, g1.y)) - levelHeight(ivec2(local.x, g1.y - 1));\n"
+		"   float cdx = 0.5 * (coarseHeight(c0 + ivec2(1, 0)) - coarseHeight(c0));\n"
+		"   float cdz = 0.5 * (coarseHeight(c0 + ivec2(0, 1)) - coarseHeight(c0));\n"
+		"   vec2 slope = mix(vec2(dx, dz), vec2(cdx, cdz), morph) / u_levelUnit;  \n"
+		"   vec3 normal = normalize(vec3(-slope.x, 1.0, -slope.y));              \n"
+		"                                                                        \n"
+		"   // the rings of the coarse levels reach past the heightmap, flatten them onto its border\n"
+		"   vec2 xz = clamp(vec2(u_levelOrigin + local) * u_levelUnit, 0.0, u_grid.w - 1.0) * u_grid.x;\n"
+		"                                                                        \n"
+		"   // ambient and sun lighting from the sky, or the diffuse             \n"
+		"   // lighting of the fixed light without it                            \n"
+		"   v_lighting = u_useSkyLighting ? skyLighting(normal) :                \n"
+		"      vec3(dot(normal, u_lightDirection));                              \n"
+		"   v_texCoord = xz.yx / u_grid.x * u_texScale;                          \n"
+		"   gl_Position = u_mvpMatrix * vec4(xz.x, mix(h, hc, morph), xz.y, 1.0);\n"
+		"}                                                                       \n";
+
 	const char fShaderStr[] =
 		"#version 300 es                                        \n"
 		"precision mediump float;                               \n"
+		AERIAL_PERSPECTIVE_GLSL
+		SKY_LIGHTING_FRAGMENT_GLSL
 		"in vec2 v_texCoord;                                    \n"
-		"in float diffuse;                                      \n"
+		"in vec3 v_lighting;                                    \n"
 		"layout(location = 0) out vec4 outColor;                \n"
 		"uniform sampler2D s_texture;                           \n"
 		"void main()                                            \n"
 		"{                                                      \n"
-		"  outColor = texture(s_texture, v_texCoord) * diffuse; \n"
+		"  outColor = texture(s_texture, v_texCoord);           \n"
+		"  if (u_useSkyLighting)                                \n"
+		"    outColor.rgb = shadeSkyLighting(outColor.rgb, v_lighting);\n"
+		"  else                                                 \n"
+		"    outColor *= v_lighting.x;                          \n"
+		"  outColor.rgb = applyAerialPerspective(outColor.rgb); \n"
 		"}                                                      \n";
 
-	m_program = esLoadProgram(vShaderStr, fShaderStr);
+	// a tiled heightmap is streamed and only works with vertex pulling
+	m_streaming = false;
+	if (m_heightmapFile.size() > 4 && m_heightmapFile.compare(m_heightmapFile.size() - 4, 4, ".thm") == 0)
+	{
+		m_streaming = m_tiles.open(m_heightmapFile.c_str());
+		if (m_streaming && (m_tiles.getTileSize() % TERRAIN_CHUNK_SIZE != 0 || m_tiles.getWidth() != m_tiles.getHeight()))
+		{
+			cout << m_heightmapFile << ": tiles must be square and a multiple of " << TERRAIN_CHUNK_SIZE << " quads" << endl;
+			m_tiles.close();
+			m_streaming = false;
+		}
+		if (!m_streaming)
+		{
+			m_heightmapFile = "ground.bmp";
+		}
+	}
+	if (m_streaming)
+	{
+		m_mode = TERRAIN_MODE_VERTEX_PULLING;
+	}
+
+	if (m_mode == TERRAIN_MODE_VERTEX_PULLING)
+	{
+		std::string pullingSource = std::string("#version 300 es\n") + (m_streaming ? "#define HEIGHT_UINT\n" : "") + vPullingShaderStr;
+		m_program = esLoadProgram(pullingSource.c_str(), fShaderStr);
+
+		m_heightMapLoc = glGetUniformLocation(m_program, "s_heightMap");
+		m_tileOriginLoc = glGetUniformLocation(m_program, "u_tileOrigin");
+		m_chunkOriginLoc = glGetUniformLocation(m_program, "u_chunkOrigin");
+		m_skirtHeightLoc = glGetUniformLocation(m_program, "u_skirtHeight");
+		m_gridLoc = glGetUniformLocation(m_program, "u_grid");
+		m_texScaleLoc = glGetUniformLocation(m_program, "u_texScale");
+	}
+	else if (m_mode == TERRAIN_MODE_CDLOD)
+	{
+		m_program = esLoadProgram(vCdlodShaderStr, fShaderStr);
+
+		m_heightMapLoc = glGetUniformLocation(m_program, "s_heightMap");
+		m_cameraPosLoc = glGetUniformLocation(m_program, "u_cameraPos");
+		m_nodeOriginLoc = glGetUniformLocation(m_program, "u_nodeOrigin");
+		m_nodeStepLoc = glGetUniformLocation(m_program, "u_nodeStep");
+		m_morphLoc = glGetUniformLocation(m_program, "u_morph");
+		m_gridLoc = glGetUniformLocation(m_program, "u_grid");
+		m_texScaleLoc = glGetUniformLocation(m_program, "u_texScale");
+	}
+	else if (m_mode == TERRAIN_MODE_CLIPMAP)
+	{
+		m_program = esLoadProgram(vClipmapShaderStr, fShaderStr);
+
+		m_heightMapLoc = glGetUniformLocation(m_program, "s_heightMap");
+		m_coarseLevelLoc = glGetUniformLocation(m_program, "s_coarseLevel");
+		m_levelOriginLoc = glGetUniformLocation(m_program, "u_levelOrigin");
+		m_originTexelLoc = glGetUniformLocation(m_program, "u_originTexel");
+		m_coarseOffsetLoc = glGetUniformLocation(m_program, "u_coarseOffset");
+		m_coarseOriginTexelLoc = glGetUniformLocation(m_program, "u_coarseOriginTexel");
+		m_levelUnitLoc = glGetUniformLocation(m_program, "u_levelUnit");
+		m_morphStartLoc = glGetUniformLocation(m_program, "u_morphStart");
+		m_gridLoc = glGetUniformLocation(m_program, "u_grid");
+		m_texScaleLoc = glGetUniformLocation(m_program, "u_texScale");
+	}
+	else
+	{
+		m_program = esLoadProgram(vShaderStr, fShaderStr);
+	}
 
 	m_mvpLoc = glGetUniformLocation(m_program, "u_mvpMatrix");
 	m_textureLoc = glGetUniformLocation(m_program, "s_texture");
 	m_lightLoc = glGetUniformLocation(m_program, "u_lightDirection");
+	m_skyLighting.init(m_program);
+	m_aerialPerspective.init(m_program);
+
+	unsigned char *buffer = nullptr;
+	if (m_streaming)
+	{
+		// nothing is read here, the tiles near the camera are paged in while drawing
+		m_width = m_tiles.getWidth();
+		m_height = m_tiles.getHeight();
+		m_tileTextures.assign(m_tiles.getTilesX() * m_tiles.getTilesZ(), 0);
+	}
+	else
+	{
+		buffer = loadBMP(m_heightmapFile.c_str(), &m_width, &m_height);
 
-	unsigned char *buffer = loadBMP("ground.bmp", &m_width, &m_height);
-	m_numIndices = genSquareGrid(m_width, &positions, &texCoords, &normals, &indices, buffer);
+		m_heights.resize(m_width * m_width);
+		for (int i = 0; i < m_width * m_width; ++i)
+		{
+			m_heights[i] = m_minZ + m_scale * buffer[i];
+		}
+		m_pyramid.build(&m_heights[0], m_width, m_width, m_step);
+	}
 
 	int texWidth, texHeight;
 	m_textureId = loadTexture("Grass2.png", &texWidth, &texHeight);
 
-	glGenBuffers(1, &m_indicesVBO);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_indicesVBO);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, m_numIndices * sizeof (GLuint), indices, GL_STATIC_DRAW);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	// split the grid into chunks
+	buildChunks();
 
-	// normal VBO for base terrain
-	glGenBuffers(1, &m_normalsVBO);
-	glBindBuffer(GL_ARRAY_BUFFER, m_normalsVBO);
-	glBufferData(GL_ARRAY_BUFFER, m_width * m_height * sizeof (GLfloat)* 3, normals, GL_STATIC_DRAW);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-	free(normals);
+	if (m_streaming)
+	{
+		// the tile textures are created by updateTiles as the tiles come in
+	}
+	else if (m_mode == TERRAIN_MODE_CLIPMAP)
+	{
+		// the level textures are filled by updateClipmap once the camera is known
+		genClipmapGrid();
+	}
+	else if (m_mode == TERRAIN_MODE_VERTEX_PULLING || m_mode == TERRAIN_MODE_CDLOD)
+	{
+		// the heightmap is all the vertex data there is
+		glGenTextures(1, &m_heightTextureId);
+		glBindTexture(GL_TEXTURE_2D, m_heightTextureId);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		glTexStorage2D(GL_TEXTURE_2D, 1, GL_R8, m_width, m_width);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_width, m_width, GL_RED, GL_UNSIGNED_BYTE, buffer);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glBindTexture(GL_TEXTURE_2D, 0);
+	}
+	else
+	{
+		GLfloat *positions;
+		GLfloat *texCoords;
+		GLfloat *normals;
 
-	// texCoord VBO for base terrain
-	glGenBuffers(1, &m_texCoordsVBO);
-	glBindBuffer(GL_ARRAY_BUFFER, m_texCoordsVBO);
-	glBufferData(GL_ARRAY_BUFFER, m_width * m_height * sizeof (GLfloat)* 2, texCoords, GL_STATIC_DRAW);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-	free(texCoords);
+		genSquareGrid(m_width, &positions, &texCoords, &normals, nullptr, buffer);
 
-	glGenBuffers(1, &m_positionVBO);
-	glBindBuffer(GL_ARRAY_BUFFER, m_positionVBO);
-	glBufferData(GL_ARRAY_BUFFER, 3 * sizeof(GLfloat) * m_width * m_height, positions, GL_STATIC_DRAW);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
+		// every chunk gets its own run of vertices in the VBOs
+		uploadChunkVertices(positions, texCoords, normals);
+
+		free(normals);
+		free(texCoords);
+		free(positions);
+	}
 
-	free(indices);
-	free(positions);
 	delete buffer;
+
+	if (m_mode == TERRAIN_MODE_CDLOD)
+	{
+		genPatch();
+
+		// decides how far out the full resolution grid is needed
+		m_maxLevelOneError = 0.0f;
+		for (size_t c = 0; c < m_chunks.size(); ++c)
+		{
+			m_maxLevelOneError = std::max(m_maxLevelOneError, m_chunks[c].lodError[1]);
+		}
+	}
+
+	// the chunks all have the same layout, so one index list per LOD serves all of them.
+	// A chunk has fewer than 65536 vertices, so the lists fit in 16 bits without splitting
+	std::vector<GLushort> indices;
+	bool chunkLods = (m_mode == TERRAIN_MODE_VERTEX_BUFFERS || m_mode == TERRAIN_MODE_VERTEX_PULLING);
+	for (int lod = 0; lod < TERRAIN_MAX_LODS && chunkLods; ++lod)
+	{
+		std::vector<GLuint> lodIndices;
+		int count = genLodIndices(lod, lodIndices);
+
+#ifdef INDEX_OPTIMIZER_REPORT
+		float before = IndexOptimizer::computeACMR(&lodIndices[0], count);
+#endif
+		IndexOptimizer::optimizeVertexCache(&lodIndices[0], count, TERRAIN_CHUNK_VERTICES);
+#ifdef INDEX_OPTIMIZER_REPORT
+		printf("terrain LOD %d: %d triangles, ACMR %.3f -> %.3f\n", lod, count / 3,
+			before, IndexOptimizer::computeACMR(&lodIndices[0], count));
+#endif
+
+		m_lodIndexOffset[lod] = (GLuint)indices.size();
+		m_lodIndexCount[lod] = count;
+		for (int k = 0; k < count; ++k)
+		{
+			indices.push_back((GLushort)lodIndices[k]);
+		}
+	}
+	if (!indices.empty())
+	{
+		m_numIndices = (int)indices.size();
+
+		glGenBuffers(1, &m_indicesVBO);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_indicesVBO);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, m_numIndices * sizeof (GLushort), &indices[0], GL_STATIC_DRAW);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	}
+
+	// the root covers a power of two of chunks, so every node below it splits evenly
+	// and the nodes of one level all have the same size, which CDLOD relies on
+	int rootChunks = 1;
+	m_rootLevel = 0;
+	while (rootChunks < std::max(m_chunkCountX, m_chunkCountZ))
+	{
+		rootChunks *= 2;
+		m_rootLevel++;
+	}
+	for (int level = 0; level < TERRAIN_MAX_NODE_LEVELS; ++level)
+	{
+		m_levelDiagonal[level] = 0.0f;
+	}
+
+	m_nodes.clear();
+	buildQuadTree(0, 0, rootChunks, rootChunks);
 }
 
 void Terrain::draw(ESContext *esContext)
 {
-	glUseProgram(m_program);
+	m_frustum.extract(esContext->mvp_matrix);
+	m_cameraPos = esContext->camera_pos;
 
-	glEnable(GL_CULL_FACE);
+	// pixels covered by one world unit at distance one
+	m_lodFactor = esContext->height * 0.5f * esContext->perspective_matrix[1][1];
 
-	// Load the vertex position
-	glBindBuffer(GL_ARRAY_BUFFER, m_positionVBO);
-	glVertexAttribPointer(POSITION_LOC, 3, GL_FLOAT,
-		GL_FALSE, 3 * sizeof (GLfloat), (const void *)NULL);
-	glEnableVertexAttribArray(POSITION_LOC);
+	if (m_streaming)
+	{
+		updateTiles();
+	}
 
-	// Load the texcoord position
-	glBindBuffer(GL_ARRAY_BUFFER, m_texCoordsVBO);
-	glVertexAttribPointer(TEXCOORD_LOC, 2, GL_FLOAT,
-		GL_FALSE, 2 * sizeof (GLfloat), (const void *)NULL);
-	glEnableVertexAttribArray(TEXCOORD_LOC);
+	m_drawList.clear();
+	m_patchList.clear();
+	if (m_mode == TERRAIN_MODE_CLIPMAP)
+	{
+		// the rings follow the camera and are always drawn
+		updateClipmap();
+	}
+	else if (!m_nodes.empty())
+	{
+		if (m_mode == TERRAIN_MODE_CDLOD)
+		{
+			computeLodRanges();
+			selectPatches(0, false);
+		}
+		else
+		{
+			selectChunks(0, false);
+		}
+	}
 
-	// Load the texcoord position
-	glBindBuffer(GL_ARRAY_BUFFER, m_normalsVBO);
-	glVertexAttribPointer(NORMAL_LOC, 3, GL_FLOAT,
-		GL_FALSE, 3 * sizeof (GLfloat), (const void *)NULL);
-	glEnableVertexAttribArray(NORMAL_LOC);
+	m_occludedChunks = 0;
+	if (m_occlusionCulling && !m_pyramid.isEmpty() && m_drawList.size() > 1)
+	{
+		cullOccludedChunks(esContext->mvp_matrix, esContext->width, esContext->height);
+	}
+
+	if (m_mode != TERRAIN_MODE_CLIPMAP && m_drawList.empty() && m_patchList.empty())
+	{
+		return;
+	}
+
+	glUseProgram(m_program);
+
+	glEnable(GL_CULL_FACE);
 
 	// Bind the index buffer
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_indicesVBO);
@@ -139,90 +531,1410 @@ void Terrain::draw(ESContext *esContext)
 
 	glUniform3f(m_lightLoc, 0.86f, 0.64f, 0.49f);
 
-	glDrawElements(GL_TRIANGLES, m_numIndices, GL_UNSIGNED_INT, (const void *)NULL);
+	// the block of the sky lighting, or the fixed light when there is none
+	m_skyLighting.bind();
+
+	// the volume of the atmosphere between the camera and the mesh, if any
+	m_aerialPerspective.bind(esContext);
+
+	if (m_mode == TERRAIN_MODE_CLIPMAP)
+	{
+		glUniform1i(m_heightMapLoc, 1);
+		glUniform1i(m_coarseLevelLoc, 2);
+		glUniform4f(m_gridLoc, m_step, m_minZ, m_scale, (float)m_width);
+		glUniform2f(m_texScaleLoc, 11.0f / m_width, 11.0f / m_height);
+
+		glBindBuffer(GL_ARRAY_BUFFER, m_clipmapVBO);
+		glVertexAttribPointer(POSITION_LOC, 2, GL_FLOAT,
+			GL_FALSE, 2 * sizeof (GLfloat), (const void *)NULL);
+		glEnableVertexAttribArray(POSITION_LOC);
+
+		const int n = TERRAIN_CLIPMAP_SIZE + 1;
+
+		// finest first, it covers the most pixels
+		for (int level = 0; level < m_clipmapLevels; ++level)
+		{
+			const TerrainClipmapLevel &clip = m_clipmap[level];
+
+			glActiveTexture(GL_TEXTURE1);
+			glBindTexture(GL_TEXTURE_2D, clip.texture);
+			glUniform2i(m_levelOriginLoc, clip.originX, clip.originZ);
+			glUniform2i(m_originTexelLoc, ((clip.originX % n) + n) % n, ((clip.originZ % n) + n) % n);
+			glUniform1f(m_levelUnitLoc, (float)(1 << level));
+
+			// the coarsest level has nothing to blend into and samples itself
+			const TerrainClipmapLevel &coarse = m_clipmap[std::min(level + 1, m_clipmapLevels - 1)];
+			glActiveTexture(GL_TEXTURE2);
+			glBindTexture(GL_TEXTURE_2D, coarse.texture);
+			if (level + 1 < m_clipmapLevels)
+			{
+				glUniform2i(m_coarseOffsetLoc, clip.originX - 2 * coarse.originX, clip.originZ - 2 * coarse.originZ);
+				glUniform2i(m_coarseOriginTexelLoc, ((coarse.originX % n) + n) % n, ((coarse.originZ % n) + n) % n);
+				glUniform1f(m_morphStartLoc, (float)(TERRAIN_CLIPMAP_SIZE / 2 - TERRAIN_CLIPMAP_BLEND));
+			}
+			else
+			{
+				glUniform2i(m_coarseOffsetLoc, 0, 0);
+				glUniform2i(m_coarseOriginTexelLoc, 0, 0);
+				glUniform1f(m_morphStartLoc, (float)TERRAIN_CLIPMAP_SIZE);
+			}
+
+			TerrainClipmapRange ranges[3];
+			int rangeCount = 0;
+			if (level == 0)
+			{
+				ranges[rangeCount++] = TERRAIN_CLIPMAP_FULL;
+			}
+			else
+			{
+				// the finer level sits one quad further in when it snapped to the far side
+				const TerrainClipmapLevel &fine = m_clipmap[level - 1];
+				int holeX = fine.originX / 2 - clip.originX;
+				int holeZ = fine.originZ / 2 - clip.originZ;
+				ranges[rangeCount++] = TERRAIN_CLIPMAP_RING;
+				ranges[rangeCount++] = holeX > TERRAIN_CLIPMAP_SIZE / 4 ? TERRAIN_CLIPMAP_ROW_LOW : TERRAIN_CLIPMAP_ROW_HIGH;
+				ranges[rangeCount++] = holeZ > TERRAIN_CLIPMAP_SIZE / 4 ? TERRAIN_CLIPMAP_COLUMN_LOW : TERRAIN_CLIPMAP_COLUMN_HIGH;
+			}
+
+			for (int r = 0; r < rangeCount; ++r)
+			{
+				glDrawElements(GL_TRIANGLES, m_clipmapIndexCount[ranges[r]], GL_UNSIGNED_SHORT,
+					(const void *)(m_clipmapIndexOffset[ranges[r]] * sizeof (GLushort)));
+			}
+		}
+
+		glDisableVertexAttribArray(POSITION_LOC);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		glActiveTexture(GL_TEXTURE1);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		glActiveTexture(GL_TEXTURE0);
+	}
+	else if (m_mode == TERRAIN_MODE_CDLOD)
+	{
+		glActiveTexture(GL_TEXTURE1);
+		glBindTexture(GL_TEXTURE_2D, m_heightTextureId);
+		glUniform1i(m_heightMapLoc, 1);
+
+		// the R8 texture returns height / 255
+		glUniform4f(m_gridLoc, m_step, m_minZ, m_scale * 255.0f, (float)m_width);
+		glUniform2f(m_texScaleLoc, 11.0f / m_width, 11.0f / m_height);
+		glUniform3f(m_cameraPosLoc, m_cameraPos.x, m_cameraPos.y, m_cameraPos.z);
+
+		// every node draws the same patch, only the uniforms place it
+		glBindBuffer(GL_ARRAY_BUFFER, m_patchVBO);
+		glVertexAttribPointer(POSITION_LOC, 2, GL_FLOAT,
+			GL_FALSE, 2 * sizeof (GLfloat), (const void *)NULL);
+		glEnableVertexAttribArray(POSITION_LOC);
+
+		for (size_t i = 0; i < m_patchList.size(); ++i)
+		{
+			const TerrainNode &node = m_nodes[m_patchList[i].first];
+			int quadrant = m_patchList[i].second;
+
+			if (node.level == m_rootLevel)
+			{
+				// nothing is coarser than the root
+				glUniform2f(m_morphLoc, FLT_MAX, 0.0f);
+			}
+			else
+			{
+				float end = m_lodRanges[node.level];
+				float start = end - TERRAIN_MORPH_FRACTION * (end - (node.level > 0 ? m_lodRanges[node.level - 1] : 0.0f));
+				glUniform2f(m_morphLoc, start, 1.0f / (end - start));
+			}
+
+			glUniform2i(m_nodeOriginLoc, node.originX, node.originZ);
+			glUniform1i(m_nodeStepLoc, 1 << node.level);
+
+			GLsizei first = quadrant < 0 ? 0 : quadrant * m_patchQuadrantIndices;
+			GLsizei count = quadrant < 0 ? 4 * m_patchQuadrantIndices : m_patchQuadrantIndices;
+			glDrawElements(GL_TRIANGLES, count, GL_UNSIGNED_SHORT, (const void *)(first * sizeof (GLushort)));
+		}
+
+		glDisableVertexAttribArray(POSITION_LOC);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		glActiveTexture(GL_TEXTURE0);
+	}
+	else if (m_mode == TERRAIN_MODE_VERTEX_PULLING)
+	{
+		glActiveTexture(GL_TEXTURE1);
+		glBindTexture(GL_TEXTURE_2D, m_heightTextureId);
+		glUniform1i(m_heightMapLoc, 1);
+
+		if (m_streaming)
+		{
+			glUniform4f(m_gridLoc, m_step, m_tiles.getHeightOffset(), m_tiles.getHeightScale(), (float)m_width);
+		}
+		else
+		{
+			// the R8 texture returns height / 255
+			glUniform4f(m_gridLoc, m_step, m_minZ, m_scale * 255.0f, (float)m_width);
+			glUniform2i(m_tileOriginLoc, 0, 0);
+		}
+		glUniform2f(m_texScaleLoc, 11.0f / m_width, 11.0f / m_height);
+
+		int boundTile = -1;
+		for (size_t i = 0; i < m_drawList.size(); ++i)
+		{
+			const TerrainChunk &chunk = m_chunks[m_drawList[i].first];
+			int lod = m_drawList[i].second;
+
+			if (m_streaming && chunk.tile != boundTile)
+			{
+				boundTile = chunk.tile;
+				glBindTexture(GL_TEXTURE_2D, m_tileTextures[boundTile]);
+				glUniform2i(m_tileOriginLoc, (boundTile % m_tiles.getTilesX()) * m_tiles.getTileSize(),
+					(boundTile / m_tiles.getTilesX()) * m_tiles.getTileSize());
+			}
+
+			glUniform2i(m_chunkOriginLoc, chunk.originX, chunk.originZ);
+			glUniform1f(m_skirtHeightLoc, chunk.boundsMin.y);
+
+			glDrawElements(GL_TRIANGLES, m_lodIndexCount[lod], GL_UNSIGNED_SHORT,
+				(const void *)(m_lodIndexOffset[lod] * sizeof (GLushort)));
+		}
+
+		glBindTexture(GL_TEXTURE_2D, 0);
+		glActiveTexture(GL_TEXTURE0);
+	}
+	else
+	{
+		glEnableVertexAttribArray(POSITION_LOC);
+		glEnableVertexAttribArray(TEXCOORD_LOC);
+		glEnableVertexAttribArray(NORMAL_LOC);
+
+		for (size_t i = 0; i < m_drawList.size(); ++i)
+		{
+			const TerrainChunk &chunk = m_chunks[m_drawList[i].first];
+			int lod = m_drawList[i].second;
+			size_t base = chunk.baseVertex;
+
+			// point the attributes at the chunk's vertices, the indices are chunk local
+			glBindBuffer(GL_ARRAY_BUFFER, m_positionVBO);
+			glVertexAttribPointer(POSITION_LOC, 3, GL_FLOAT,
+				GL_FALSE, 3 * sizeof (GLfloat), (const void *)(base * 3 * sizeof (GLfloat)));
+
+			glBindBuffer(GL_ARRAY_BUFFER, m_texCoordsVBO);
+			glVertexAttribPointer(TEXCOORD_LOC, 2, GL_FLOAT,
+				GL_FALSE, 2 * sizeof (GLfloat), (const void *)(base * 2 * sizeof (GLfloat)));
+
+			glBindBuffer(GL_ARRAY_BUFFER, m_normalsVBO);
+			glVertexAttribPointer(NORMAL_LOC, 3, GL_FLOAT,
+				GL_FALSE, 3 * sizeof (GLfloat), (const void *)(base * 3 * sizeof (GLfloat)));
+
+			glDrawElements(GL_TRIANGLES, m_lodIndexCount[lod], GL_UNSIGNED_SHORT,
+				(const void *)(m_lodIndexOffset[lod] * sizeof (GLushort)));
+		}
+
+		glDisableVertexAttribArray(POSITION_LOC);
+		glDisableVertexAttribArray(TEXCOORD_LOC);
+		glDisableVertexAttribArray(NORMAL_LOC);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
 
-	glDisableVertexAttribArray(POSITION_LOC);
-	glDisableVertexAttribArray(TEXCOORD_LOC);
-	glDisableVertexAttribArray(NORMAL_LOC);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 
 	glDisable(GL_CULL_FACE);
 }
 
-int Terrain::genSquareGrid(int size, GLfloat **vertices, GLfloat **texCoord, GLfloat **normals, GLuint **indices, unsigned char *buffer)
+float Terrain::gridHeight(int i, int j) const
 {
-	int i, j;
-	int numIndices = (size - 1) * (size - 1) * 2 * 3;
-	int numVertices = size * size;
+	if (m_streaming)
+	{
+		unsigned short sample = 0;
+		m_tiles.getSample(i, j, sample);
+		return m_tiles.getHeightOffset() + m_tiles.getHeightScale() * sample;
+	}
 
-	// Allocate memory for buffers
-	if (vertices != nullptr)
+	i = std::min(std::max(i, 0), m_width - 1);
+	j = std::min(std::max(j, 0), m_width - 1);
+	return m_heights[j + i * m_width];
+}
+
+float Terrain::getHeight(float x, float z) const
+{
+	if (!m_pyramid.isEmpty())
 	{
-		float stepSize = (float)size - 1;
-		*vertices = (GLfloat *)malloc(sizeof (GLfloat)* 3 * numVertices);
-		*texCoord = (GLfloat *)malloc(sizeof (GLfloat)* 2 * numVertices);
+		return m_pyramid.sample(x, z);
+	}
 
-		for (i = 0; i < size; ++i) // row
-		{
-			for (j = 0; j < size; ++j) // column
-			{
-				(*vertices)[3 * (j + i * size)] = i * m_step;
-				(*vertices)[3 * (j + i * size) + 1] = m_minZ + m_scale * buffer[j + i * size];
-				(*vertices)[3 * (j + i * size) + 2] = j * m_step;
+	// streaming, one sample at a time from whatever tiles are resident
+	float gi = std::min(std::max(x / m_step, 0.0f), (float)(m_width - 1));
+	float gj = std::min(std::max(z / m_step, 0.0f), (float)(m_width - 1));
+	int i = (int)gi;
+	int j = (int)gj;
+	float u = gi - i;
+	float v = gj - j;
+	float h0 = gridHeight(i, j) + (gridHeight(i + 1, j) - gridHeight(i, j)) * u;
+	float h1 = gridHeight(i, j + 1) + (gridHeight(i + 1, j + 1) - gridHeight(i, j + 1)) * u;
+	return h0 + (h1 - h0) * v;
+}
+
+void Terrain::getHeights(const float *x, const float *z, float *heights, int count) const
+{
+	if (!m_pyramid.isEmpty())
+	{
+		m_pyramid.sampleBatch(x, z, heights, count);
+		return;
+	}
+
+	for (int k = 0; k < count; ++k)
+	{
+		heights[k] = getHeight(x[k], z[k]);
+	}
+}
+
+bool Terrain::raycast(const glm::vec3 &origin, const glm::vec3 &direction, float maxDistance, glm::vec3 &hit) const
+{
+	float t;
+	if (!m_pyramid.raycast(origin, direction, maxDistance, t))
+	{
+		return false;
+	}
+
+	hit = origin + direction * t;
+	return true;
+}
+
+bool Terrain::setHeights(int i0, int j0, int rows, int columns, const float *heights)
+{
+	if (m_streaming || m_heights.empty())
+	{
+		return false;
+	}
 
-				(*texCoord)[2 * (j + i * size)] = 11.0f / m_width * j;
-				(*texCoord)[2 * (j + i * size) + 1] = 11.0f / m_height * i;
+	// clip to the grid, the source keeps its own row length
+	int first = std::max(i0, 0);
+	int last = std::min(i0 + rows, m_width) - 1;
+	int firstColumn = std::max(j0, 0);
+	int lastColumn = std::min(j0 + columns, m_width) - 1;
+	if (first > last || firstColumn > lastColumn)
+	{
+		return false;
+	}
 
-				//printf("%d  %f, %d  %f\n", 2 * (j + i * size), 110.0f / m_width * j, 2 * (j + i * size) + 1, 110.0f / m_height * i);
+	// the R8 texture of the pulling modes only holds whole steps of m_scale, the heights
+	// kept here are rounded the same way so the queries agree with what is drawn
+	bool quantize = (m_mode == TERRAIN_MODE_VERTEX_PULLING || m_mode == TERRAIN_MODE_CDLOD);
+	for (int i = first; i <= last; ++i)
+	{
+		for (int j = firstColumn; j <= lastColumn; ++j)
+		{
+			float h = heights[(j - j0) + (i - i0) * columns];
+			if (quantize)
+			{
+				float level = floorf((h - m_minZ) / m_scale + 0.5f);
+				h = m_minZ + m_scale * std::min(std::max(level, 0.0f), 255.0f);
 			}
+			m_heights[j + i * m_width] = h;
 		}
 	}
 
-	if (normals != nullptr)
+	m_pyramid.update(first, firstColumn, last, lastColumn);
+	updateDeformedChunks(first, firstColumn, last, lastColumn);
+	uploadDeformedHeights(first, firstColumn, last, lastColumn);
+	return true;
+}
+
+bool Terrain::addCrater(float x, float z, float radius, float depth)
+{
+	return deformDisc(x, z, radius, depth, false);
+}
+
+bool Terrain::flatten(float x, float z, float radius, float height)
+{
+	return deformDisc(x, z, radius, height, true);
+}
+
+bool Terrain::deformDisc(float x, float z, float radius, float value, bool flattenTo)
+{
+	if (m_heights.empty() || radius <= 0.0f)
+	{
+		return false;
+	}
+
+	int i0 = std::max((int)floorf((x - radius) / m_step), 0);
+	int i1 = std::min((int)ceilf((x + radius) / m_step), m_width - 1);
+	int j0 = std::max((int)floorf((z - radius) / m_step), 0);
+	int j1 = std::min((int)ceilf((z + radius) / m_step), m_width - 1);
+	if (i0 > i1 || j0 > j1)
 	{
-		*normals = (GLfloat *)malloc(sizeof(GLfloat) * 3 * numVertices);
+		return false;
+	}
 
-		float xPixelSize = 1 / g_winWidth;
-		float yPixelSize = 1 / g_winHeight;
-		for (i = 0; i < size; ++i) // row
+	int rows = i1 - i0 + 1;
+	int columns = j1 - j0 + 1;
+	std::vector<float> heights(rows * columns);
+	for (int i = i0; i <= i1; ++i)
+	{
+		for (int j = j0; j <= j1; ++j)
 		{
-			for (j = 0; j < size; ++j) // column
+			float h = m_heights[j + i * m_width];
+			float r = glm::length(glm::vec2(i * m_step - x, j * m_step - z)) / radius;
+			if (r < 1.0f)
 			{
-				/* update the normal */
-				float height = (*vertices)[3 * (j + i * size) + 1];
-				glm::vec3 dx = glm::vec3(1, (*vertices)[3 * (j + (i + 1) * size) + 1] - height, 0.0);
-				glm::vec3 dy = glm::vec3(0.0, (*vertices)[3 * (j + 1 + i * size) + 1] - height, 1);
-
-				glm::vec3 result = glm::normalize(glm::cross(dy, dx));
-				(*normals)[3 * (j + i * size)] = result.x;
-				(*normals)[3 * (j + i * size) + 1] = result.y;
-				(*normals)[3 * (j + i * size) + 2] = result.z;
+				if (flattenTo)
+				{
+					// all the way inside half the radius, easing out towards the rim
+					float w = std::min((1.0f - r) * 2.0f, 1.0f);
+					h += (value - h) * w * w * (3.0f - 2.0f * w);
+				}
+				else
+				{
+					// a parabolic bowl
+					h -= value * (1.0f - r * r);
+				}
 			}
+			heights[(j - j0) + (i - i0) * columns] = h;
 		}
 	}
 
-	// Generate the indices
-	if (indices != nullptr)
+	return setHeights(i0, j0, rows, columns, &heights[0]);
+}
+
+void Terrain::updateDeformedChunks(int i0, int j0, int i1, int j1)
+{
+	// chunks share their border samples, so a sample can belong to two chunks per axis
+	int cx0 = std::max(i0 - 1, 0) / TERRAIN_CHUNK_SIZE;
+	int cz0 = std::max(j0 - 1, 0) / TERRAIN_CHUNK_SIZE;
+	int cx1 = std::min(i1 / TERRAIN_CHUNK_SIZE, m_chunkCountX - 1);
+	int cz1 = std::min(j1 / TERRAIN_CHUNK_SIZE, m_chunkCountZ - 1);
+
+	for (int cz = cz0; cz <= cz1; ++cz)
+	{
+		for (int cx = cx0; cx <= cx1; ++cx)
+		{
+			TerrainChunk &chunk = m_chunks[cx + cz * m_chunkCountX];
+			computeChunkBounds(chunk);
+			computeLodErrors(chunk);
+			m_maxLevelOneError = std::max(m_maxLevelOneError, chunk.lodError[1]);
+		}
+	}
+
+	if (!m_nodes.empty())
+	{
+		refreshNodeBounds(0, cx0, cz0, cx1, cz1);
+	}
+}
+
+void Terrain::refreshNodeBounds(int index, int cx0, int cz0, int cx1, int cz1)
+{
+	TerrainNode &node = m_nodes[index];
+	int nx = node.originX / TERRAIN_CHUNK_SIZE;
+	int nz = node.originZ / TERRAIN_CHUNK_SIZE;
+	int size = 1 << node.level;
+	if (nx > cx1 || nx + size <= cx0 || nz > cz1 || nz + size <= cz0)
 	{
-		*indices = (GLuint *)malloc(sizeof (GLuint)* numIndices);
+		return;
+	}
 
-		for (i = 0; i < size - 1; ++i)
+	if (node.chunk >= 0)
+	{
+		node.boundsMin = m_chunks[node.chunk].boundsMin;
+		node.boundsMax = m_chunks[node.chunk].boundsMax;
+	}
+	else
+	{
+		node.boundsMin = glm::vec3(FLT_MAX);
+		node.boundsMax = glm::vec3(-FLT_MAX);
+		for (int c = 0; c < 4; ++c)
 		{
-			for (j = 0; j < size - 1; ++j)
+			if (node.children[c] >= 0)
 			{
-				// two triangles per quad
-				(*indices)[6 * (j + i * (size - 1))] = j + (i)* (size);
-				(*indices)[6 * (j + i * (size - 1)) + 1] = j + (i)* (size)+1;
-				(*indices)[6 * (j + i * (size - 1)) + 2] = j + (i + 1) * (size)+1;
-
-				(*indices)[6 * (j + i * (size - 1)) + 3] = j + (i)* (size);
-				(*indices)[6 * (j + i * (size - 1)) + 4] = j + (i + 1) * (size)+1;
-				(*indices)[6 * (j + i * (size - 1)) + 5] = j + (i + 1) * (size);
+				refreshNodeBounds(node.children[c], cx0, cz0, cx1, cz1);
+				node.boundsMin = glm::min(node.boundsMin, m_nodes[node.children[c]].boundsMin);
+				node.boundsMax = glm::max(node.boundsMax, m_nodes[node.children[c]].boundsMax);
 			}
 		}
 	}
 
+	m_levelDiagonal[node.level] = std::max(m_levelDiagonal[node.level], glm::length(node.boundsMax - node.boundsMin));
+}
+
+void Terrain::uploadDeformedHeights(int i0, int j0, int i1, int j1)
+{
+	const int size = m_width;
+	const int side = TERRAIN_CHUNK_SIZE + 1;
+
+	if (m_mode == TERRAIN_MODE_VERTEX_BUFFERS)
+	{
+		// normals are forward differences, so the row and column before the edit change
+		// too, and the last row when the one before it was edited
+		int ni0 = std::max(i0 - 1, 0);
+		int nj0 = std::max(j0 - 1, 0);
+		int ni1 = (i1 == size - 2) ? size - 1 : i1;
+		int nj1 = (j1 == size - 2) ? size - 1 : j1;
+
+		int cx0 = std::max(ni0 - 1, 0) / TERRAIN_CHUNK_SIZE;
+		int cz0 = std::max(nj0 - 1, 0) / TERRAIN_CHUNK_SIZE;
+		int cx1 = std::min(ni1 / TERRAIN_CHUNK_SIZE, m_chunkCountX - 1);
+		int cz1 = std::min(nj1 / TERRAIN_CHUNK_SIZE, m_chunkCountZ - 1);
+
+		std::vector<GLfloat> positions(3 * 4 * side);
+		std::vector<GLfloat> normals(3 * 4 * side);
+
+		for (int cz = cz0; cz <= cz1; ++cz)
+		{
+			for (int cx = cx0; cx <= cx1; ++cx)
+			{
+				const TerrainChunk &chunk = m_chunks[cx + cz * m_chunkCountX];
+
+				// the changed part of each chunk row is one run of vertices; padded border
+				// chunks repeat the last sample, which the clamping below takes care of
+				int lj0 = std::max(nj0 - chunk.originZ, 0);
+				int lj1 = (nj1 == size - 1) ? side - 1 : std::min(nj1 - chunk.originZ, side - 1);
+				for (int li = 0; li < side && lj0 <= lj1; ++li)
+				{
+					int i = std::min(chunk.originX + li, size - 1);
+					if (i < ni0 || i > ni1)
+					{
+						continue;
+					}
+
+					for (int lj = lj0; lj <= lj1; ++lj)
+					{
+						int j = std::min(chunk.originZ + lj, size - 1);
+						glm::vec3 normal = gridNormal(i, j);
+						GLfloat *p = &positions[3 * (lj - lj0)];
+						GLfloat *n = &normals[3 * (lj - lj0)];
+						p[0] = i * m_step;
+						p[1] = gridHeight(i, j);
+						p[2] = j * m_step;
+						n[0] = normal.x;
+						n[1] = normal.y;
+						n[2] = normal.z;
+					}
+
+					GLintptr offset = (chunk.baseVertex + lj0 + li * side) * 3 * sizeof (GLfloat);
+					GLsizeiptr bytes = (lj1 - lj0 + 1) * 3 * sizeof (GLfloat);
+					glBindBuffer(GL_ARRAY_BUFFER, m_positionVBO);
+					glBufferSubData(GL_ARRAY_BUFFER, offset, bytes, &positions[0]);
+					glBindBuffer(GL_ARRAY_BUFFER, m_normalsVBO);
+					glBufferSubData(GL_ARRAY_BUFFER, offset, bytes, &normals[0]);
+				}
+
+				// the skirts follow the edge vertices and hang from the new lowest point
+				for (int edge = 0; edge < 4; ++edge)
+				{
+					for (int k = 0; k < side; ++k)
+					{
+						int li = (edge == 0) ? 0 : (edge == 1) ? TERRAIN_CHUNK_SIZE : k;
+						int lj = (edge == 2) ? 0 : (edge == 3) ? TERRAIN_CHUNK_SIZE : k;
+						int i = std::min(chunk.originX + li, size - 1);
+						int j = std::min(chunk.originZ + lj, size - 1);
+						glm::vec3 normal = gridNormal(i, j);
+						GLfloat *p = &positions[3 * (edge * side + k)];
+						GLfloat *n = &normals[3 * (edge * side + k)];
+						p[0] = i * m_step;
+						p[1] = chunk.boundsMin.y;
+						p[2] = j * m_step;
+						n[0] = normal.x;
+						n[1] = normal.y;
+						n[2] = normal.z;
+					}
+				}
+
+				GLintptr offset = (chunk.baseVertex + side * side) * 3 * sizeof (GLfloat);
+				GLsizeiptr bytes = 4 * side * 3 * sizeof (GLfloat);
+				glBindBuffer(GL_ARRAY_BUFFER, m_positionVBO);
+				glBufferSubData(GL_ARRAY_BUFFER, offset, bytes, &positions[0]);
+				glBindBuffer(GL_ARRAY_BUFFER, m_normalsVBO);
+				glBufferSubData(GL_ARRAY_BUFFER, offset, bytes, &normals[0]);
+			}
+		}
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+	else if (m_mode == TERRAIN_MODE_VERTEX_PULLING || m_mode == TERRAIN_MODE_CDLOD)
+	{
+		// the vertex shader derives the normals, only the heights go up
+		int rows = i1 - i0 + 1;
+		int columns = j1 - j0 + 1;
+		std::vector<unsigned char> texels(rows * columns);
+		for (int i = i0; i <= i1; ++i)
+		{
+			for (int j = j0; j <= j1; ++j)
+			{
+				float level = floorf((m_heights[j + i * size] - m_minZ) / m_scale + 0.5f);
+				texels[(j - j0) + (i - i0) * columns] = (unsigned char)std::min(std::max(level, 0.0f), 255.0f);
+			}
+		}
+
+		glBindTexture(GL_TEXTURE_2D, m_heightTextureId);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, j0, i0, columns, rows, GL_RED, GL_UNSIGNED_BYTE, &texels[0]);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		glBindTexture(GL_TEXTURE_2D, 0);
+	}
+	else if (m_mode == TERRAIN_MODE_CLIPMAP)
+	{
+		const int n = TERRAIN_CLIPMAP_SIZE + 1;
+
+		for (int level = 0; level < m_clipmapLevels; ++level)
+		{
+			const TerrainClipmapLevel &clip = m_clipmap[level];
+			if (!clip.valid)
+			{
+				continue;
+			}
+
+			// level samples on the edited grid samples; past the border the level repeats
+			// the border samples, so an edit touching the border reaches to the window edge
+			int scale = 1 << level;
+			int x0 = (i0 == 0) ? clip.originX : (i0 + scale - 1) / scale;
+			int x1 = (i1 == size - 1) ? clip.originX + n : i1 / scale + 1;
+			int z0 = (j0 == 0) ? clip.originZ : (j0 + scale - 1) / scale;
+			int z1 = (j1 == size - 1) ? clip.originZ + n : j1 / scale + 1;
+
+			x0 = std::max(x0, clip.originX);
+			x1 = std::min(x1, clip.originX + n);
+			z0 = std::max(z0, clip.originZ);
+			z1 = std::min(z1, clip.originZ + n);
+			if (x0 < x1 && z0 < z1)
+			{
+				uploadClipmapRegion(level, x0, x1, z0, z1);
+			}
+		}
+		glBindTexture(GL_TEXTURE_2D, 0);
+	}
+}
+
+glm::vec3 Terrain::gridNormal(int i, int j) const
+{
+	// forward differences like genSquareGrid, the last row and column reuse the one before
+	int r1 = std::min(i + 1, m_width - 1);
+	int c1 = std::min(j + 1, m_width - 1);
+	float dx = gridHeight(r1, j) - gridHeight(std::max(r1 - 1, 0), j);
+	float dz = gridHeight(i, c1) - gridHeight(i, std::max(c1 - 1, 0));
+	return glm::normalize(glm::vec3(-dx, 1.0f, -dz));
+}
+
+void Terrain::updateTiles()
+{
+	m_tiles.update(m_cameraPos.x / m_step, m_cameraPos.z / m_step);
+
+	std::vector<int> tiles;
+	m_tiles.takeEvictedTiles(tiles);
+	for (size_t k = 0; k < tiles.size(); ++k)
+	{
+		glDeleteTextures(1, &m_tileTextures[tiles[k]]);
+		m_tileTextures[tiles[k]] = 0;
+	}
+
+	tiles.clear();
+	m_tiles.takeLoadedTiles(tiles);
+	for (size_t k = 0; k < tiles.size(); ++k)
+	{
+		int tile = tiles[k];
+		int side = m_tiles.getTileSamplesPerSide();
+
+		glGenTextures(1, &m_tileTextures[tile]);
+		glBindTexture(GL_TEXTURE_2D, m_tileTextures[tile]);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 2);
+		glTexStorage2D(GL_TEXTURE_2D, 1, GL_R16UI, side, side);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, side, side, GL_RED_INTEGER, GL_UNSIGNED_SHORT, m_tiles.getTileSamples(tile));
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+		// the real LOD errors of the tile's chunks are known now
+		int chunksPerTile = m_tiles.getTileSize() / TERRAIN_CHUNK_SIZE;
+		int cx0 = (tile % m_tiles.getTilesX()) * chunksPerTile;
+		int cz0 = (tile / m_tiles.getTilesX()) * chunksPerTile;
+		for (int cz = cz0; cz < std::min(cz0 + chunksPerTile, m_chunkCountZ); ++cz)
+		{
+			for (int cx = cx0; cx < std::min(cx0 + chunksPerTile, m_chunkCountX); ++cx)
+			{
+				computeLodErrors(m_chunks[cx + cz * m_chunkCountX]);
+			}
+		}
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void Terrain::buildChunks()
+{
+	const int size = m_width;
+
+	m_chunkCountX = (size - 1 + TERRAIN_CHUNK_SIZE - 1) / TERRAIN_CHUNK_SIZE;
+	m_chunkCountZ = (size - 1 + TERRAIN_CHUNK_SIZE - 1) / TERRAIN_CHUNK_SIZE;
+	m_chunks.resize(m_chunkCountX * m_chunkCountZ);
+
+	for (int cz = 0; cz < m_chunkCountZ; ++cz)
+	{
+		for (int cx = 0; cx < m_chunkCountX; ++cx)
+		{
+			int index = cx + cz * m_chunkCountX;
+			TerrainChunk &chunk = m_chunks[index];
+			chunk.originX = cx * TERRAIN_CHUNK_SIZE;
+			chunk.originZ = cz * TERRAIN_CHUNK_SIZE;
+			chunk.baseVertex = index * TERRAIN_CHUNK_VERTICES;
+			chunk.boundsMin = glm::vec3(FLT_MAX);
+			chunk.boundsMax = glm::vec3(-FLT_MAX);
+			chunk.tile = -1;
+
+			if (m_streaming)
+			{
+				// until its tile is paged in a chunk is not drawn, and its bounds come
+				// from the sample range stored for the whole tile
+				int tileSize = m_tiles.getTileSize();
+				chunk.tile = chunk.originX / tileSize + (chunk.originZ / tileSize) * m_tiles.getTilesX();
+				const TiledHeightmapRange &range = m_tiles.getTileRange(chunk.tile);
+				chunk.boundsMin = glm::vec3(chunk.originX * m_step,
+					m_tiles.getHeightOffset() + m_tiles.getHeightScale() * range.minSample - m_step,
+					chunk.originZ * m_step);
+				chunk.boundsMax = glm::vec3(std::min(chunk.originX + TERRAIN_CHUNK_SIZE, size - 1) * m_step,
+					m_tiles.getHeightOffset() + m_tiles.getHeightScale() * range.maxSample,
+					std::min(chunk.originZ + TERRAIN_CHUNK_SIZE, size - 1) * m_step);
+				for (int lod = 0; lod < TERRAIN_MAX_LODS; ++lod)
+				{
+					chunk.lodError[lod] = 0.0f;
+				}
+				continue;
+			}
+
+			computeChunkBounds(chunk);
+			computeLodErrors(chunk);
+		}
+	}
+}
+
+void Terrain::computeChunkBounds(TerrainChunk &chunk)
+{
+	const int size = m_width;
+	const int side = TERRAIN_CHUNK_SIZE + 1;
+
+	chunk.boundsMin = glm::vec3(FLT_MAX);
+	chunk.boundsMax = glm::vec3(-FLT_MAX);
+	for (int li = 0; li < side; ++li)
+	{
+		for (int lj = 0; lj < side; ++lj)
+		{
+			int i = std::min(chunk.originX + li, size - 1);
+			int j = std::min(chunk.originZ + lj, size - 1);
+			glm::vec3 p(i * m_step, gridHeight(i, j), j * m_step);
+			chunk.boundsMin = glm::min(chunk.boundsMin, p);
+			chunk.boundsMax = glm::max(chunk.boundsMax, p);
+		}
+	}
+
+	// skirts hang below the lowest vertex of the chunk, so a neighbour drawn at
+	// another LOD never shows a crack along the shared edge
+	chunk.boundsMin.y -= m_step;
+}
+
+void Terrain::uploadChunkVertices(const GLfloat *positions, const GLfloat *texCoords, const GLfloat *normals)
+{
+	const int size = m_width;
+	const int side = TERRAIN_CHUNK_SIZE + 1;
+
+	int numVertices = (int)m_chunks.size() * TERRAIN_CHUNK_VERTICES;
+	GLfloat *chunkPositions = (GLfloat *)malloc(sizeof (GLfloat)* 3 * numVertices);
+	GLfloat *chunkTexCoords = (GLfloat *)malloc(sizeof (GLfloat)* 2 * numVertices);
+	GLfloat *chunkNormals = (GLfloat *)malloc(sizeof (GLfloat)* 3 * numVertices);
+
+	for (size_t c = 0; c < m_chunks.size(); ++c)
+	{
+		const TerrainChunk &chunk = m_chunks[c];
+
+		for (int li = 0; li < side; ++li)
+		{
+			for (int lj = 0; lj < side; ++lj)
+			{
+				// chunks on the far border are padded by repeating the last grid vertex,
+				// which only produces degenerate triangles
+				int i = std::min(chunk.originX + li, size - 1);
+				int j = std::min(chunk.originZ + lj, size - 1);
+				int src = j + i * size;
+				int dst = chunk.baseVertex + lj + li * side;
+
+				memcpy(&chunkPositions[3 * dst], &positions[3 * src], 3 * sizeof (GLfloat));
+				memcpy(&chunkTexCoords[2 * dst], &texCoords[2 * src], 2 * sizeof (GLfloat));
+				memcpy(&chunkNormals[3 * dst], &normals[3 * src], 3 * sizeof (GLfloat));
+			}
+		}
+
+		for (int edge = 0; edge < 4; ++edge)
+		{
+			for (int k = 0; k < side; ++k)
+			{
+				int li = (edge == 0) ? 0 : (edge == 1) ? TERRAIN_CHUNK_SIZE : k;
+				int lj = (edge == 2) ? 0 : (edge == 3) ? TERRAIN_CHUNK_SIZE : k;
+				int src = chunk.baseVertex + lj + li * side;
+				int dst = chunk.baseVertex + side * side + edge * side + k;
+
+				memcpy(&chunkPositions[3 * dst], &chunkPositions[3 * src], 3 * sizeof (GLfloat));
+				memcpy(&chunkTexCoords[2 * dst], &chunkTexCoords[2 * src], 2 * sizeof (GLfloat));
+				memcpy(&chunkNormals[3 * dst], &chunkNormals[3 * src], 3 * sizeof (GLfloat));
+				chunkPositions[3 * dst + 1] = chunk.boundsMin.y;
+			}
+		}
+	}
+
+	glGenBuffers(1, &m_positionVBO);
+	glBindBuffer(GL_ARRAY_BUFFER, m_positionVBO);
+	glBufferData(GL_ARRAY_BUFFER, numVertices * sizeof (GLfloat)* 3, chunkPositions, GL_STATIC_DRAW);
+
+	// texCoord VBO for base terrain
+	glGenBuffers(1, &m_texCoordsVBO);
+	glBindBuffer(GL_ARRAY_BUFFER, m_texCoordsVBO);
+	glBufferData(GL_ARRAY_BUFFER, numVertices * sizeof (GLfloat)* 2, chunkTexCoords, GL_STATIC_DRAW);
+
+	// normal VBO for base terrain
+	glGenBuffers(1, &m_normalsVBO);
+	glBindBuffer(GL_ARRAY_BUFFER, m_normalsVBO);
+	glBufferData(GL_ARRAY_BUFFER, numVertices * sizeof (GLfloat)* 3, chunkNormals, GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	free(chunkPositions);
+	free(chunkTexCoords);
+	free(chunkNormals);
+}
+
+void Terrain::computeLodErrors(TerrainChunk &chunk)
+{
+	chunk.lodError[0] = 0.0f;
+
+	for (int lod = 1; lod < TERRAIN_MAX_LODS; ++lod)
+	{
+		int step = 1 << lod;
+		float maxError = 0.0f;
+
+		for (int qi = 0; qi < TERRAIN_CHUNK_SIZE; qi += step)
+		{
+			for (int qj = 0; qj < TERRAIN_CHUNK_SIZE; qj += step)
+			{
+				int i = chunk.originX + qi;
+				int j = chunk.originZ + qj;
+				float ha = gridHeight(i, j);
+				float hb = gridHeight(i, j + step);
+				float hc = gridHeight(i + step, j + step);
+				float hd = gridHeight(i + step, j);
+
+				// compare every full resolution vertex with the coarse triangle covering it,
+				// the quad is split along a-c like in genLodIndices
+				for (int u = 0; u <= step; ++u)
+				{
+					for (int v = 0; v <= step; ++v)
+					{
+						float fu = (float)u / step;
+						float fv = (float)v / step;
+						float coarse = (fv >= fu) ? ha + fv * (hb - ha) + fu * (hc - hb)
+							: ha + fu * (hd - ha) + fv * (hc - hd);
+						maxError = std::max(maxError, fabsf(gridHeight(i + u, j + v) - coarse));
+					}
+				}
+			}
+		}
+
+		// a coarser level is never allowed to look better than a finer one
+		chunk.lodError[lod] = std::max(maxError, chunk.lodError[lod - 1]);
+	}
+}
+
+int Terrain::genLodIndices(int lod, std::vector<GLuint> &indices)
+{
+	const int side = TERRAIN_CHUNK_SIZE + 1;
+	const int last = TERRAIN_CHUNK_SIZE;
+	int step = 1 << lod;
+	size_t first = indices.size();
+
+#define GRID_INDEX(li, lj) (GLuint)((lj) + (li) * side)
+#define SKIRT_INDEX(edge, k) (GLuint)(side * side + (edge) * side + (k))
+
+	for (int i = 0; i < TERRAIN_CHUNK_SIZE; i += step)
+	{
+		for (int j = 0; j < TERRAIN_CHUNK_SIZE; j += step)
+		{
+			// two triangles per quad
+			indices.push_back(GRID_INDEX(i, j));
+			indices.push_back(GRID_INDEX(i, j + step));
+			indices.push_back(GRID_INDEX(i + step, j + step));
+
+			indices.push_back(GRID_INDEX(i, j));
+			indices.push_back(GRID_INDEX(i + step, j + step));
+			indices.push_back(GRID_INDEX(i + step, j));
+		}
+	}
+
+	// one quad per edge segment between the top edge vertices and the skirt row,
+	// walked so that the skirt faces out of the chunk
+	for (int k = 0; k < TERRAIN_CHUNK_SIZE; k += step)
+	{
+		GLuint skirt[4][4] =
+		{
+			// top a, top b, bottom a, bottom b
+			{ GRID_INDEX(0, k), GRID_INDEX(0, k + step), SKIRT_INDEX(0, k), SKIRT_INDEX(0, k + step) },
+			{ GRID_INDEX(last, k + step), GRID_INDEX(last, k), SKIRT_INDEX(1, k + step), SKIRT_INDEX(1, k) },
+			{ GRID_INDEX(k + step, 0), GRID_INDEX(k, 0), SKIRT_INDEX(2, k + step), SKIRT_INDEX(2, k) },
+			{ GRID_INDEX(k, last), GRID_INDEX(k + step, last), SKIRT_INDEX(3, k), SKIRT_INDEX(3, k + step) },
+		};
+
+		for (int edge = 0; edge < 4; ++edge)
+		{
+			indices.push_back(skirt[edge][0]);
+			indices.push_back(skirt[edge][2]);
+			indices.push_back(skirt[edge][1]);
+
+			indices.push_back(skirt[edge][1]);
+			indices.push_back(skirt[edge][2]);
+			indices.push_back(skirt[edge][3]);
+		}
+	}
+
+#undef GRID_INDEX
+#undef SKIRT_INDEX
+
+	return (int)(indices.size() - first);
+}
+
+int Terrain::buildQuadTree(int x0, int z0, int x1, int z1)
+{
+	int index = (int)m_nodes.size();
+	m_nodes.push_back(TerrainNode());
+
+	TerrainNode node;
+	node.boundsMin = glm::vec3(FLT_MAX);
+	node.boundsMax = glm::vec3(-FLT_MAX);
+	node.chunk = -1;
+	node.originX = x0 * TERRAIN_CHUNK_SIZE;
+	node.originZ = z0 * TERRAIN_CHUNK_SIZE;
+	node.level = 0;
+	while ((1 << node.level) < x1 - x0)
+	{
+		node.level++;
+	}
+
+	if (x1 - x0 == 1 && z1 - z0 == 1)
+	{
+		node.chunk = x0 + z0 * m_chunkCountX;
+		node.boundsMin = m_chunks[node.chunk].boundsMin;
+		node.boundsMax = m_chunks[node.chunk].boundsMax;
+		for (int c = 0; c < 4; ++c)
+		{
+			node.children[c] = -1;
+		}
+	}
+	else
+	{
+		int mx = x0 + (x1 - x0) / 2;
+		int mz = z0 + (z1 - z0) / 2;
+		int rects[4][4] =
+		{
+			{ x0, z0, mx, mz },
+			{ mx, z0, x1, mz },
+			{ x0, mz, mx, z1 },
+			{ mx, mz, x1, z1 },
+		};
+
+		for (int c = 0; c < 4; ++c)
+		{
+			node.children[c] = -1;
+
+			// children past the last chunk are left out
+			if (rects[c][0] < m_chunkCountX && rects[c][1] < m_chunkCountZ)
+			{
+				// the recursion grows m_nodes, so only keep indices around
+				int child = buildQuadTree(rects[c][0], rects[c][1], rects[c][2], rects[c][3]);
+				node.children[c] = child;
+				node.boundsMin = glm::min(node.boundsMin, m_nodes[child].boundsMin);
+				node.boundsMax = glm::max(node.boundsMax, m_nodes[child].boundsMax);
+			}
+		}
+	}
+
+	m_levelDiagonal[node.level] = std::max(m_levelDiagonal[node.level], glm::length(node.boundsMax - node.boundsMin));
+
+	m_nodes[index] = node;
+	return index;
+}
+
+void Terrain::selectChunks(int index, bool inside)
+{
+	const TerrainNode &node = m_nodes[index];
+
+	// once a node is completely inside the frustum its children need no more tests
+	if (!inside)
+	{
+		FrustumResult result = m_frustum.classifyBox(node.boundsMin, node.boundsMax);
+		if (result == FRUSTUM_OUTSIDE)
+		{
+			return;
+		}
+		inside = (result == FRUSTUM_INSIDE);
+	}
+
+	if (node.chunk >= 0)
+	{
+		if (m_streaming && m_tileTextures[m_chunks[node.chunk].tile] == 0)
+		{
+			return;
+		}
+		m_drawList.push_back(std::make_pair(node.chunk, selectLod(m_chunks[node.chunk])));
+		return;
+	}
+
+	for (int c = 0; c < 4; ++c)
+	{
+		if (node.children[c] >= 0)
+		{
+			selectChunks(node.children[c], inside);
+		}
+	}
+}
+
+int Terrain::selectLod(const TerrainChunk &chunk) const
+{
+	// distance from the camera to the closest point of the chunk bounds
+	glm::vec3 closest = glm::clamp(m_cameraPos, chunk.boundsMin, chunk.boundsMax);
+	float distance = glm::length(m_cameraPos - closest);
+
+	// the coarsest LOD whose error projects to less than m_maxPixelError pixels
+	for (int lod = TERRAIN_MAX_LODS - 1; lod > 0; --lod)
+	{
+		if (chunk.lodError[lod] * m_lodFactor <= m_maxPixelError * distance)
+		{
+			return lod;
+		}
+	}
+
+	return 0;
+}
+
+// two triangles for each quad of rows [i0, i1) and columns [j0, j1) of a grid with side
+// vertices per row, split along the same diagonal as genLodIndices
+static void appendGridQuads(std::vector<GLuint> &indices, int side, int i0, int i1, int j0, int j1)
+{
+	for (int i = i0; i < i1; ++i)
+	{
+		for (int j = j0; j < j1; ++j)
+		{
+			indices.push_back(j + i * side);
+			indices.push_back(j + 1 + i * side);
+			indices.push_back(j + 1 + (i + 1) * side);
+
+			indices.push_back(j + i * side);
+			indices.push_back(j + 1 + (i + 1) * side);
+			indices.push_back(j + (i + 1) * side);
+		}
+	}
+}
+
+void Terrain::cullOccludedChunks(const glm::mat4 &viewProjection, int width, int height)
+{
+	// front to back, so the nearest chunks become the occluders of the ones behind them
+	m_drawOrder.clear();
+	for (size_t i = 0; i < m_drawList.size(); ++i)
+	{
+		const TerrainChunk &chunk = m_chunks[m_drawList[i].first];
+		glm::vec3 closest = glm::clamp(m_cameraPos, chunk.boundsMin, chunk.boundsMax);
+		m_drawOrder.push_back(std::make_pair(glm::length(m_cameraPos - closest), (int)i));
+	}
+	std::sort(m_drawOrder.begin(), m_drawOrder.end());
+
+	int rows = (width > 0) ? TERRAIN_OCCLUSION_WIDTH * height / width : TERRAIN_OCCLUSION_WIDTH / 2;
+	if (m_occlusion.getWidth() != TERRAIN_OCCLUSION_WIDTH || m_occlusion.getHeight() != std::max(rows, 1))
+	{
+		m_occlusion.resize(TERRAIN_OCCLUSION_WIDTH, rows);
+	}
+	m_occlusion.begin(viewProjection);
+
+	std::vector<std::pair<int, int> > visible;
+	visible.reserve(m_drawList.size());
+	int occluders = 0;
+	for (size_t i = 0; i < m_drawOrder.size(); ++i)
+	{
+		const std::pair<int, int> &entry = m_drawList[m_drawOrder[i].second];
+		const TerrainChunk &chunk = m_chunks[entry.first];
+		if (occluders > 0 && m_occlusion.isBoxOccluded(chunk.boundsMin, chunk.boundsMax))
+		{
+			m_occludedChunks++;
+			continue;
+		}
+
+		visible.push_back(entry);
+		if (occluders < TERRAIN_MAX_OCCLUDERS)
+		{
+			drawChunkOccluder(chunk);
+			occluders++;
+		}
+	}
+
+	// drawn front to back now, which also helps early depth rejection on the GPU
+	m_drawList.swap(visible);
+}
+
+void Terrain::drawChunkOccluder(const TerrainChunk &chunk)
+{
+	const int cells = TERRAIN_CHUNK_SIZE >> TERRAIN_OCCLUDER_LEVEL;
+	const int side = cells + 1;
+
+	if (m_occluderIndices.empty())
+	{
+		std::vector<GLuint> indices;
+		appendGridQuads(indices, side, 0, cells, 0, cells);
+		m_occluderIndices.assign(indices.begin(), indices.end());
+		m_occluderVertices.resize(side * side);
+	}
+
+	// every vertex takes the lowest of the pyramid cells around it, so each occluder quad
+	// stays below the surface of the cell it spans and can only hide what the terrain hides
+	int ci0 = chunk.originX >> TERRAIN_OCCLUDER_LEVEL;
+	int cj0 = chunk.originZ >> TERRAIN_OCCLUDER_LEVEL;
+	for (int vi = 0; vi < side; ++vi)
+	{
+		int ci = ci0 + vi;
+		int i = std::min(ci << TERRAIN_OCCLUDER_LEVEL, m_width - 1);
+		for (int vj = 0; vj < side; ++vj)
+		{
+			int cj = cj0 + vj;
+			int j = std::min(cj << TERRAIN_OCCLUDER_LEVEL, m_width - 1);
+			float h = std::min(std::min(m_pyramid.getCellMinHeight(TERRAIN_OCCLUDER_LEVEL, ci - 1, cj - 1),
+				m_pyramid.getCellMinHeight(TERRAIN_OCCLUDER_LEVEL, ci - 1, cj)),
+				std::min(m_pyramid.getCellMinHeight(TERRAIN_OCCLUDER_LEVEL, ci, cj - 1),
+				m_pyramid.getCellMinHeight(TERRAIN_OCCLUDER_LEVEL, ci, cj)));
+			m_occluderVertices[vj + vi * side] = glm::vec3(i * m_step, h, j * m_step);
+		}
+	}
+
+	m_occlusion.drawMesh(&m_occluderVertices[0], side * side, &m_occluderIndices[0], (int)m_occluderIndices.size());
+}
+
+float Terrain::getOccludedFraction() const
+{
+	int tested = (int)m_drawList.size() + m_occludedChunks;
+	return tested > 0 ? (float)m_occludedChunks / tested : 0.0f;
+}
+
+void Terrain::genPatch()
+{
+	const int side = TERRAIN_CHUNK_SIZE + 1;
+	const int half = TERRAIN_CHUNK_SIZE / 2;
+
+	// the patch only holds grid coordinates, a few kilobytes whatever the heightmap size
+	std::vector<GLfloat> positions(2 * side * side);
+	for (int li = 0; li < side; ++li)
+	{
+		for (int lj = 0; lj < side; ++lj)
+		{
+			positions[2 * (lj + li * side)] = (GLfloat)li;
+			positions[2 * (lj + li * side) + 1] = (GLfloat)lj;
+		}
+	}
+
+	glGenBuffers(1, &m_patchVBO);
+	glBindBuffer(GL_ARRAY_BUFFER, m_patchVBO);
+	glBufferData(GL_ARRAY_BUFFER, positions.size() * sizeof (GLfloat), &positions[0], GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	// one range per quadrant in the order of TerrainNode::children, so a node whose
+	// children are only partly drawn can fill in the rest at its own level
+	std::vector<GLushort> indices;
+	for (int quadrant = 0; quadrant < 4; ++quadrant)
+	{
+		int i0 = (quadrant & 1) * half;
+		int j0 = (quadrant >> 1) * half;
+
+		// the chunk LOD diagonal makes the morphed patch match the coarser level exactly
+		std::vector<GLuint> quadrantIndices;
+		appendGridQuads(quadrantIndices, side, i0, i0 + half, j0, j0 + half);
+
+		IndexOptimizer::optimizeVertexCache(&quadrantIndices[0], (int)quadrantIndices.size(), side * side);
+		for (size_t k = 0; k < quadrantIndices.size(); ++k)
+		{
+			indices.push_back((GLushort)quadrantIndices[k]);
+		}
+	}
+
+	m_patchQuadrantIndices = (GLsizei)(indices.size() / 4);
+	m_numIndices = (int)indices.size();
+
+	glGenBuffers(1, &m_indicesVBO);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_indicesVBO);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, m_numIndices * sizeof (GLushort), &indices[0], GL_STATIC_DRAW);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+}
+
+void Terrain::computeLodRanges()
+{
+	// the full resolution grid ends where dropping every other vertex costs less than
+	// m_maxPixelError pixels on screen
+	m_lodRanges[0] = std::max(m_maxLevelOneError * m_lodFactor / m_maxPixelError, m_levelDiagonal[0]);
+
+	for (int level = 1; level < m_rootLevel; ++level)
+	{
+		// every node has to fit between the end of its own range and the start of the
+		// next level's morph, then neighbours are at most one level apart and their
+		// shared edge is fully morphed on the finer side
+		float previous = m_lodRanges[level - 1];
+		m_lodRanges[level] = std::max(2.0f * previous, previous + m_levelDiagonal[level - 1] / (1.0f - TERRAIN_MORPH_FRACTION));
+	}
+
+	m_lodRanges[m_rootLevel] = FLT_MAX;
+}
+
+bool Terrain::selectPatches(int index, bool inside)
+{
+	const TerrainNode &node = m_nodes[index];
+
+	// a node out of its level's range is left to its parent, which draws that quadrant
+	glm::vec3 closest = glm::clamp(m_cameraPos, node.boundsMin, node.boundsMax);
+	float distance = glm::length(m_cameraPos - closest);
+	if (distance > m_lodRanges[node.level])
+	{
+		return false;
+	}
+
+	if (!inside)
+	{
+		FrustumResult result = m_frustum.classifyBox(node.boundsMin, node.boundsMax);
+		if (result == FRUSTUM_OUTSIDE)
+		{
+			// taken care of, there is just nothing to draw
+			return true;
+		}
+		inside = (result == FRUSTUM_INSIDE);
+	}
+
+	if (node.level == 0 || distance > m_lodRanges[node.level - 1])
+	{
+		m_patchList.push_back(std::make_pair(index, -1));
+		return true;
+	}
+
+	for (int c = 0; c < 4; ++c)
+	{
+		if (node.children[c] >= 0 && !selectPatches(node.children[c], inside))
+		{
+			m_patchList.push_back(std::make_pair(index, c));
+		}
+	}
+
+	return true;
+}
+
+void Terrain::genClipmapGrid()
+{
+	const int size = TERRAIN_CLIPMAP_SIZE;
+	const int side = TERRAIN_CLIPMAP_SIZE + 1;
+
+	// enough levels for the coarsest to reach across the whole map from anywhere on it
+	m_clipmapLevels = 1;
+	while (m_clipmapLevels < TERRAIN_CLIPMAP_MAX_LEVELS && (size << (m_clipmapLevels - 1)) < 2 * m_width)
+	{
+		m_clipmapLevels++;
+	}
+
+	for (int level = 0; level < m_clipmapLevels; ++level)
+	{
+		TerrainClipmapLevel &clip = m_clipmap[level];
+		clip.valid = false;
+		clip.originX = 0;
+		clip.originZ = 0;
+
+		glGenTextures(1, &clip.texture);
+		glBindTexture(GL_TEXTURE_2D, clip.texture);
+		glTexStorage2D(GL_TEXTURE_2D, 1, GL_R32F, side, side);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	// every level draws the same grid, scaled by the vertex shader
+	std::vector<GLfloat> positions(2 * side * side);
+	for (int li = 0; li < side; ++li)
+	{
+		for (int lj = 0; lj < side; ++lj)
+		{
+			positions[2 * (lj + li * side)] = (GLfloat)li;
+			positions[2 * (lj + li * side) + 1] = (GLfloat)lj;
+		}
+	}
+
+	glGenBuffers(1, &m_clipmapVBO);
+	glBindBuffer(GL_ARRAY_BUFFER, m_clipmapVBO);
+	glBufferData(GL_ARRAY_BUFFER, positions.size() * sizeof (GLfloat), &positions[0], GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	// the finer level covers quads [q, q + size / 2) on each axis, with q one of
+	// size / 4 and size / 4 + 1 depending on how the two levels snapped
+	const int inner0 = size / 4;
+	const int inner1 = size - size / 4 + 1;
+
+	std::vector<GLuint> ranges[TERRAIN_CLIPMAP_RANGE_COUNT];
+	appendGridQuads(ranges[TERRAIN_CLIPMAP_FULL], side, 0, size, 0, size);
+	appendGridQuads(ranges[TERRAIN_CLIPMAP_RING], side, 0, inner0, 0, size);
+	appendGridQuads(ranges[TERRAIN_CLIPMAP_RING], side, inner1, size, 0, size);
+	appendGridQuads(ranges[TERRAIN_CLIPMAP_RING], side, inner0, inner1, 0, inner0);
+	appendGridQuads(ranges[TERRAIN_CLIPMAP_RING], side, inner0, inner1, inner1, size);
+
+	// the row and the column overlap in one corner quad, drawing it twice is harmless
+	appendGridQuads(ranges[TERRAIN_CLIPMAP_ROW_LOW], side, inner0, inner0 + 1, inner0, inner1);
+	appendGridQuads(ranges[TERRAIN_CLIPMAP_ROW_HIGH], side, inner1 - 1, inner1, inner0, inner1);
+	appendGridQuads(ranges[TERRAIN_CLIPMAP_COLUMN_LOW], side, inner0, inner1, inner0, inner0 + 1);
+	appendGridQuads(ranges[TERRAIN_CLIPMAP_COLUMN_HIGH], side, inner0, inner1, inner1 - 1, inner1);
+
+	std::vector<GLushort> indices;
+	for (int r = 0; r < TERRAIN_CLIPMAP_RANGE_COUNT; ++r)
+	{
+		IndexOptimizer::optimizeVertexCache(&ranges[r][0], (int)ranges[r].size(), side * side);
+
+		m_clipmapIndexOffset[r] = (GLuint)indices.size();
+		m_clipmapIndexCount[r] = (GLsizei)ranges[r].size();
+		for (size_t k = 0; k < ranges[r].size(); ++k)
+		{
+			indices.push_back((GLushort)ranges[r][k]);
+		}
+	}
+	m_numIndices = (int)indices.size();
+
+	glGenBuffers(1, &m_indicesVBO);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_indicesVBO);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, m_numIndices * sizeof (GLushort), &indices[0], GL_STATIC_DRAW);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+}
+
+void Terrain::updateClipmap()
+{
+	const int n = TERRAIN_CLIPMAP_SIZE + 1;
+
+	m_clipmapUploadTexels = 0;
+	for (int level = 0; level < m_clipmapLevels; ++level)
+	{
+		TerrainClipmapLevel &clip = m_clipmap[level];
+		float unit = m_step * (1 << level);
+
+		// snapped to whole units of the next coarser level, so every level lies on the
+		// grid of the one around it
+		int originX = 2 * (int)floorf(m_cameraPos.x / unit * 0.5f) - TERRAIN_CLIPMAP_SIZE / 2;
+		int originZ = 2 * (int)floorf(m_cameraPos.z / unit * 0.5f) - TERRAIN_CLIPMAP_SIZE / 2;
+
+		if (!clip.valid || abs(originX - clip.originX) >= n || abs(originZ - clip.originZ) >= n)
+		{
+			uploadClipmapRegion(level, originX, originX + n, originZ, originZ + n);
+		}
+		else
+		{
+			// only the L-shaped strip that came into view: the new rows across the whole
+			// window, then the new columns along the rows that were kept
+			int keptX0 = std::max(originX, clip.originX);
+			int keptX1 = std::min(originX, clip.originX) + n;
+
+			if (originX < clip.originX)
+			{
+				uploadClipmapRegion(level, originX, clip.originX, originZ, originZ + n);
+			}
+			else if (originX > clip.originX)
+			{
+				uploadClipmapRegion(level, clip.originX + n, originX + n, originZ, originZ + n);
+			}
+
+			if (originZ < clip.originZ)
+			{
+				uploadClipmapRegion(level, keptX0, keptX1, originZ, clip.originZ);
+			}
+			else if (originZ > clip.originZ)
+			{
+				uploadClipmapRegion(level, keptX0, keptX1, clip.originZ + n, originZ + n);
+			}
+		}
+
+		clip.originX = originX;
+		clip.originZ = originZ;
+		clip.valid = true;
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void Terrain::uploadClipmapRegion(int level, int x0, int x1, int z0, int z1)
+{
+	const int n = TERRAIN_CLIPMAP_SIZE + 1;
+	int scale = 1 << level;
+
+	glBindTexture(GL_TEXTURE_2D, m_clipmap[level].texture);
+
+	// sample (x, z) of the level lives in texel (z mod n, x mod n), so a region crossing
+	// the wrap goes up in as many as four pieces
+	for (int x = x0; x < x1;)
+	{
+		int tx = ((x % n) + n) % n;
+		int xEnd = std::min(x1, x + n - tx);
+
+		for (int z = z0; z < z1;)
+		{
+			int tz = ((z % n) + n) % n;
+			int zEnd = std::min(z1, z + n - tz);
+			int columns = zEnd - z;
+
+			m_clipmapScratch.resize((xEnd - x) * columns);
+			for (int i = x; i < xEnd; ++i)
+			{
+				for (int j = z; j < zEnd; ++j)
+				{
+					m_clipmapScratch[(j - z) + (i - x) * columns] = gridHeight(i * scale, j * scale);
+				}
+			}
+
+			glTexSubImage2D(GL_TEXTURE_2D, 0, tz, tx, columns, xEnd - x, GL_RED, GL_FLOAT, &m_clipmapScratch[0]);
+			m_clipmapUploadTexels += (int)m_clipmapScratch.size();
+			z = zEnd;
+		}
+
+		x = xEnd;
+	}
+}
+
+int Terrain::genSquareGrid(int size, GLfloat **vertices, GLfloat **texCoord, GLfloat **normals, GLuint **indices, unsigned char *buffer)
+{
+	int numIndices = (size - 1) * (size - 1) * 2 * 3;
+	int numVertices = size * size;
+
+	if (vertices == nullptr)
+	{
+		return numIndices;
+	}
+
+	SquareGridJob job;
+	job.size = size;
+	job.buffer = buffer;
+	job.step = m_step;
+	job.minZ = m_minZ;
+	job.scale = m_scale;
+	job.texScaleU = 11.0f / m_width;
+	job.texScaleV = 11.0f / m_height;
+
+	// Allocate memory for buffers
+	job.vertices = *vertices = (GLfloat *)malloc(sizeof (GLfloat)* 3 * numVertices);
+	job.texCoord = *texCoord = (GLfloat *)malloc(sizeof (GLfloat)* 2 * numVertices);
+	job.normals = nullptr;
+	job.indices = nullptr;
+	if (normals != nullptr)
+	{
+		job.normals = *normals = (GLfloat *)malloc(sizeof (GLfloat)* 3 * numVertices);
+	}
+	if (indices != nullptr)
+	{
+		job.indices = *indices = (GLuint *)malloc(sizeof (GLuint)* numIndices);
+	}
+
+	if (job.vertices == nullptr || job.texCoord == nullptr
+		|| (normals != nullptr && job.normals == nullptr) || (indices != nullptr && job.indices == nullptr))
+	{
+		return 0;
+	}
+
+	genSquareGridBands(job);
+
+	if (job.indices != nullptr)
+	{
+		IndexOptimizer::optimizeVertexCache(job.indices, numIndices, numVertices);
+	}
+
 	return numIndices;
 }
 
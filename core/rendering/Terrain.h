@@ -2,6 +2,93 @@
 #define TERRAIN_H
 
 #include <gles_include.h>
+#include <Frustum.h>
+#include <TiledHeightmap.h>
+#include <HeightPyramid.h>
+#include <OcclusionBuffer.h>
+#include <AerialPerspective.h>
+#include <SkyLighting.h>
+#include <vector>
+
+// quads along one side of a chunk, must be a power of two
+#define TERRAIN_CHUNK_SIZE     32
+// one LOD per power of two up to the chunk size: 1, 2, 4 ... 32
+#define TERRAIN_MAX_LODS       6
+// grid vertices of a chunk followed by one skirt row per chunk edge, must stay below
+// 65536 so the chunk index lists fit in GL_UNSIGNED_SHORT
+#define TERRAIN_CHUNK_VERTICES ((TERRAIN_CHUNK_SIZE + 1) * (TERRAIN_CHUNK_SIZE + 1) + 4 * (TERRAIN_CHUNK_SIZE + 1))
+
+// deepest quadtree supported by CDLOD, a root node of 2^15 chunks is far beyond any heightmap
+#define TERRAIN_MAX_NODE_LEVELS 16
+// part of each CDLOD level's distance range over which its vertices morph into the next level
+#define TERRAIN_MORPH_FRACTION 0.3f
+
+// quads along one side of a clipmap level, must be a power of two
+#define TERRAIN_CLIPMAP_SIZE 128
+#define TERRAIN_CLIPMAP_MAX_LEVELS 10
+// quads next to a level's outer edge over which its heights blend into the coarser level
+#define TERRAIN_CLIPMAP_BLEND 12
+
+// columns of the CPU occlusion buffer, the rows follow the aspect ratio
+#define TERRAIN_OCCLUSION_WIDTH 256
+// nearest chunks drawn into the occlusion buffer each frame
+#define TERRAIN_MAX_OCCLUDERS 64
+// height pyramid level whose cells become the occluder quads, 8 x 8 grid quads each
+#define TERRAIN_OCCLUDER_LEVEL 3
+
+// pastes a numeric define into shader source
+#define TERRAIN_STR2(x) #x
+#define TERRAIN_STR(x)  TERRAIN_STR2(x)
+
+enum TerrainMode
+{
+	TERRAIN_MODE_VERTEX_BUFFERS,    // position, texcoord and normal VBOs, 32 bytes per vertex
+	TERRAIN_MODE_VERTEX_PULLING,    // only the heightmap texture, the vertex shader rebuilds the rest from gl_VertexID
+	TERRAIN_MODE_CDLOD,             // one shared grid patch drawn for every quadtree node, geomorphed by camera distance
+	TERRAIN_MODE_CLIPMAP,           // nested rings around the camera, each with a toroidal height texture
+};
+
+// index ranges of the shared clipmap grid
+enum TerrainClipmapRange
+{
+	TERRAIN_CLIPMAP_FULL,           // the whole grid, only drawn for the finest level
+	TERRAIN_CLIPMAP_RING,           // what the finer level never covers
+	TERRAIN_CLIPMAP_ROW_LOW,        // the rest is one row and one column on either side of the
+	TERRAIN_CLIPMAP_ROW_HIGH,       // finer level, depending on where it snapped to
+	TERRAIN_CLIPMAP_COLUMN_LOW,
+	TERRAIN_CLIPMAP_COLUMN_HIGH,
+	TERRAIN_CLIPMAP_RANGE_COUNT,
+};
+
+struct TerrainChunk
+{
+	int originX;                        // grid row of the first chunk vertex
+	int originZ;                        // grid column of the first chunk vertex
+	GLuint baseVertex;                  // first vertex of the chunk in the VBOs
+	int tile;                           // tile holding the chunk's heights when streaming, -1 otherwise
+	glm::vec3 boundsMin;
+	glm::vec3 boundsMax;
+	float lodError[TERRAIN_MAX_LODS];   // max height deviation of each LOD from the full grid
+};
+
+struct TerrainClipmapLevel
+{
+	GLuint texture;                     // R32F heights, addressed modulo TERRAIN_CLIPMAP_SIZE + 1
+	int originX;                        // level units (2^level grid samples) of the first vertex
+	int originZ;
+	bool valid;                         // false until the texture has been filled
+};
+
+struct TerrainNode
+{
+	glm::vec3 boundsMin;
+	glm::vec3 boundsMax;
+	int children[4];                    // -1 when the child does not exist
+	int chunk;                          // chunk index for leaves, -1 otherwise
+	int originX;                        // grid row of the node's first vertex
+	int originZ;                        // grid column of the node's first vertex
+	int level;                          // the node covers 2^level chunks per side, 0 for leaves
+};
 
 class Terrain
 {
@@ -13,19 +100,121 @@ public:
 	int genSquareGrid(int size, GLfloat **vertices, GLfloat **texCoord, GLfloat **normals, GLuint **indices, unsigned char *buffer);
 	unsigned char *loadBMP(const char *filename, int *width, int *height);
 	void draw(ESContext *esContext);
+
+	// must be called before init(), a .thm heightmap is streamed and implies vertex pulling
+	void setMode(TerrainMode mode) { m_mode = mode; }
+	void setHeightmap(const char *filename) { m_heightmapFile = filename; }
+	bool isStreaming() const { return m_streaming; }
+	int getResidentTileCount() const { return m_tiles.getResidentTileCount(); }
+	TerrainMode getMode() const { return m_mode; }
+
+	// the atmosphere between the camera and the terrain, none by default
+	void setAerialPerspective(const AerialPerspective *aerialPerspective) { m_aerialPerspective.setAerialPerspective(aerialPerspective); }
+	// the ambient and sun lighting of the sky, the fixed diffuse light by default
+	void setSkyLighting(const SkyLighting *skyLighting) { m_skyLighting.setSkyLighting(skyLighting); }
+
+	void setMaxPixelError(float pixels) { m_maxPixelError = pixels; }
+	int getVisibleChunkCount() const { return (int)m_drawList.size(); }
+	int getVisiblePatchCount() const { return (int)m_patchList.size(); }
+	int getClipmapUploadTexels() const { return m_clipmapUploadTexels; }
+	int getChunkCount() const { return (int)m_chunks.size(); }
+
+	// chunks inside the frustum but hidden behind nearer terrain are skipped in the chunk
+	// modes. Not while streaming, the occluders come from the full height grid
+	void setOcclusionCulling(bool enabled) { m_occlusionCulling = enabled; }
+	int getOccludedChunkCount() const { return m_occludedChunks; }
+	// share of the chunks that passed the frustum test and were then found hidden
+	float getOccludedFraction() const;
+
+	// CPU queries in world units, bilinear between grid samples. While streaming the heights
+	// only come from the resident tiles and raycasts are not available
+	float getHeight(float x, float z) const;
+	void getHeights(const float *x, const float *z, float *heights, int count) const;
+	bool raycast(const glm::vec3 &origin, const glm::vec3 &direction, float maxDistance, glm::vec3 &hit) const;
+
+	// runtime edits, not while streaming. Only samples [i0, i0 + rows) x [j0, j0 + columns),
+	// read from heights with a row length of columns, and the normals next to them are
+	// recomputed and uploaded, so the cost follows the size of the edit
+	bool setHeights(int i0, int j0, int rows, int columns, const float *heights);
+	bool addCrater(float x, float z, float radius, float depth);
+	bool flatten(float x, float z, float radius, float height);
+
 private:
+	void buildChunks();
+	void computeChunkBounds(TerrainChunk &chunk);
+	void uploadChunkVertices(const GLfloat *positions, const GLfloat *texCoords, const GLfloat *normals);
+	void computeLodErrors(TerrainChunk &chunk);
+	int genLodIndices(int lod, std::vector<GLuint> &indices);
+	int buildQuadTree(int x0, int z0, int x1, int z1);
+	void selectChunks(int node, bool inside);
+	int selectLod(const TerrainChunk &chunk) const;
+	void cullOccludedChunks(const glm::mat4 &viewProjection, int width, int height);
+	void drawChunkOccluder(const TerrainChunk &chunk);
+	void genPatch();
+	void computeLodRanges();
+	bool selectPatches(int node, bool inside);
+	void genClipmapGrid();
+	void updateClipmap();
+	void uploadClipmapRegion(int level, int x0, int x1, int z0, int z1);
+	float gridHeight(int i, int j) const;
+	glm::vec3 gridNormal(int i, int j) const;
+	bool deformDisc(float x, float z, float radius, float value, bool flattenTo);
+	void updateDeformedChunks(int i0, int j0, int i1, int j1);
+	void refreshNodeBounds(int index, int cx0, int cz0, int cx1, int cz1);
+	void uploadDeformedHeights(int i0, int j0, int i1, int j1);
+	void updateTiles();
+
 	int m_width;
 	int m_height;
 
+	TerrainMode m_mode;
 
 	GLuint m_program;
 
 	GLuint m_textureId;
-	
+
 	GLint  m_mvpLoc;
 	GLint  m_textureLoc;
 	GLint  m_lightLoc;
 
+	// sky lighting
+	SkyLightingBinding m_skyLighting;
+
+	// aerial perspective
+	AerialPerspectiveBinding m_aerialPerspective;
+
+	// vertex pulling
+	GLuint m_heightTextureId;
+	GLint  m_heightMapLoc;
+	GLint  m_chunkOriginLoc;
+	GLint  m_skirtHeightLoc;
+	GLint  m_gridLoc;
+	GLint  m_texScaleLoc;
+	GLint  m_tileOriginLoc;
+
+	// CDLOD
+	GLuint m_patchVBO;
+	GLint  m_cameraPosLoc;
+	GLint  m_nodeOriginLoc;
+	GLint  m_nodeStepLoc;
+	GLint  m_morphLoc;
+
+	// clipmap
+	GLuint m_clipmapVBO;
+	GLint  m_coarseLevelLoc;
+	GLint  m_levelOriginLoc;
+	GLint  m_originTexelLoc;
+	GLint  m_coarseOffsetLoc;
+	GLint  m_coarseOriginTexelLoc;
+	GLint  m_levelUnitLoc;
+	GLint  m_morphStartLoc;
+
+	// streaming
+	std::string m_heightmapFile;
+	bool m_streaming;
+	TiledHeightmap m_tiles;
+	std::vector<GLuint> m_tileTextures;     // one R16UI texture per resident tile, 0 otherwise
+
 	GLuint m_indicesVBO;
 	GLuint m_positionVBO;
 	GLuint m_normalsVBO;
@@ -35,6 +224,52 @@ private:
 	float m_step;
 	float m_minZ;
 	float m_scale;
+
+	// row-major heights of the full grid, kept for LOD error and bounds
+	std::vector<float> m_heights;
+	HeightPyramid m_pyramid;
+
+	int m_chunkCountX;
+	int m_chunkCountZ;
+	std::vector<TerrainChunk> m_chunks;
+	std::vector<TerrainNode> m_nodes;
+
+	// all chunks share the same local index lists, one range per LOD
+	GLuint m_lodIndexOffset[TERRAIN_MAX_LODS];
+	GLsizei m_lodIndexCount[TERRAIN_MAX_LODS];
+
+	// chunk index and LOD of every chunk that survived culling this frame
+	std::vector<std::pair<int, int> > m_drawList;
+
+	// CDLOD: the patch index buffer holds one range per node quadrant, in child order
+	GLsizei m_patchQuadrantIndices;
+	float m_maxLevelOneError;                       // largest error of any chunk drawn with every other vertex
+	float m_levelDiagonal[TERRAIN_MAX_NODE_LEVELS]; // longest bounding box diagonal of the nodes of each level
+	float m_lodRanges[TERRAIN_MAX_NODE_LEVELS];     // a level is drawn up to this distance from the camera
+	int m_rootLevel;
+
+	// node index and quadrant of every patch drawn this frame, quadrant -1 for the whole node
+	std::vector<std::pair<int, int> > m_patchList;
+
+	int m_clipmapLevels;
+	TerrainClipmapLevel m_clipmap[TERRAIN_CLIPMAP_MAX_LEVELS];
+	GLuint m_clipmapIndexOffset[TERRAIN_CLIPMAP_RANGE_COUNT];
+	GLsizei m_clipmapIndexCount[TERRAIN_CLIPMAP_RANGE_COUNT];
+	std::vector<float> m_clipmapScratch;
+	int m_clipmapUploadTexels;              // heights sent to the clipmap textures last frame
+
+	// occlusion culling, the occluder of a chunk is a coarse grid lying below its surface
+	bool m_occlusionCulling;
+	int m_occludedChunks;
+	OcclusionBuffer m_occlusion;
+	std::vector<glm::vec3> m_occluderVertices;
+	std::vector<GLushort> m_occluderIndices;
+	std::vector<std::pair<float, int> > m_drawOrder;
+
+	Frustum m_frustum;
+	glm::vec3 m_cameraPos;
+	float m_lodFactor;
+	float m_maxPixelError;
 };
 
 #endif TERRAIN_H
\ No newline at end of file
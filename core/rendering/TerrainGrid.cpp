@@ -0,0 +1,175 @@
+#include "TerrainGrid.h"
+#include <algorithm>
+#include <cmath>
+#include <thread>
+#include <vector>
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE2__)
+#define TERRAIN_USE_SSE
+#include <emmintrin.h>
+#endif
+
+static void heightRow(const SquareGridJob &job, int row, float *heights)
+{
+	const unsigned char *src = job.buffer + row * job.size;
+	int j = 0;
+#ifdef TERRAIN_USE_SSE
+	__m128 minZ = _mm_set1_ps(job.minZ);
+	__m128 scale = _mm_set1_ps(job.scale);
+	__m128i zero = _mm_setzero_si128();
+	for (; j + 16 <= job.size; j += 16)
+	{
+		// widen 16 bytes to 4x4 ints, then to floats
+		__m128i bytes = _mm_loadu_si128((const __m128i *)(src + j));
+		__m128i lo = _mm_unpacklo_epi8(bytes, zero);
+		__m128i hi = _mm_unpackhi_epi8(bytes, zero);
+		__m128i words[4] =
+		{
+			_mm_unpacklo_epi16(lo, zero), _mm_unpackhi_epi16(lo, zero),
+			_mm_unpacklo_epi16(hi, zero), _mm_unpackhi_epi16(hi, zero),
+		};
+		for (int k = 0; k < 4; ++k)
+		{
+			__m128 h = _mm_add_ps(minZ, _mm_mul_ps(scale, _mm_cvtepi32_ps(words[k])));
+			_mm_storeu_ps(heights + j + 4 * k, h);
+		}
+	}
+#endif
+	for (; j < job.size; ++j)
+	{
+		heights[j] = job.minZ + job.scale * src[j];
+	}
+}
+
+static void genSquareGridBand(const SquareGridJob &job, int rowBegin, int rowEnd)
+{
+	const int size = job.size;
+
+	// SoA scratch for one row: the height rows the normals need, then positions and normals
+	std::vector<float> scratch(8 * size);
+	float *h0 = &scratch[0];
+	float *h1 = h0 + size;
+	float *px = h1 + size;
+	float *pz = px + size;
+	float *nx = pz + size;
+	float *ny = nx + size;
+	float *nz = ny + size;
+	float *py = nz + size;
+
+	for (int i = rowBegin; i < rowEnd; ++i)
+	{
+		float *vertices = job.vertices + 3 * i * size;
+		float *texCoord = job.texCoord + 2 * i * size;
+
+		heightRow(job, i, py);
+
+		for (int j = 0; j < size; ++j)
+		{
+			px[j] = i * job.step;
+			pz[j] = j * job.step;
+
+			texCoord[2 * j] = job.texScaleU * j;
+			texCoord[2 * j + 1] = job.texScaleV * i;
+		}
+
+		if (job.normals != nullptr)
+		{
+			// forward differences, the last row and column reuse the one before them
+			int r1 = std::min(i + 1, size - 1);
+			int r0 = std::max(r1 - 1, 0);
+			heightRow(job, r0, h0);
+			heightRow(job, r1, h1);
+
+			// the normal of cross((0, dz, 1), (1, dx, 0)) is (-dx, 1, -dz)
+			int j = 0;
+#ifdef TERRAIN_USE_SSE
+			__m128 one = _mm_set1_ps(1.0f);
+			__m128 sign = _mm_set1_ps(-0.0f);
+			for (; j + 5 <= size; j += 4)
+			{
+				__m128 dx = _mm_sub_ps(_mm_loadu_ps(h1 + j), _mm_loadu_ps(h0 + j));
+				__m128 dz = _mm_sub_ps(_mm_loadu_ps(py + j + 1), _mm_loadu_ps(py + j));
+				__m128 len = _mm_sqrt_ps(_mm_add_ps(one, _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dz, dz))));
+				__m128 invLen = _mm_div_ps(one, len);
+				_mm_storeu_ps(nx + j, _mm_xor_ps(_mm_mul_ps(dx, invLen), sign));
+				_mm_storeu_ps(ny + j, invLen);
+				_mm_storeu_ps(nz + j, _mm_xor_ps(_mm_mul_ps(dz, invLen), sign));
+			}
+#endif
+			for (; j < size; ++j)
+			{
+				int c1 = std::min(j + 1, size - 1);
+				int c0 = std::max(c1 - 1, 0);
+				float dx = h1[j] - h0[j];
+				float dz = py[c1] - py[c0];
+				float invLen = 1.0f / sqrtf(1.0f + dx * dx + dz * dz);
+				nx[j] = -dx * invLen;
+				ny[j] = invLen;
+				nz[j] = -dz * invLen;
+			}
+
+			float *normals = job.normals + 3 * i * size;
+			for (j = 0; j < size; ++j)
+			{
+				normals[3 * j] = nx[j];
+				normals[3 * j + 1] = ny[j];
+				normals[3 * j + 2] = nz[j];
+			}
+		}
+
+		// pack for upload
+		for (int j = 0; j < size; ++j)
+		{
+			vertices[3 * j] = px[j];
+			vertices[3 * j + 1] = py[j];
+			vertices[3 * j + 2] = pz[j];
+		}
+	}
+
+	if (job.indices != nullptr)
+	{
+		for (int i = rowBegin; i < std::min(rowEnd, size - 1); ++i)
+		{
+			unsigned int *indices = job.indices + 6 * i * (size - 1);
+			for (int j = 0; j < size - 1; ++j)
+			{
+				// two triangles per quad
+				indices[6 * j] = j + (i)* (size);
+				indices[6 * j + 1] = j + (i)* (size)+1;
+				indices[6 * j + 2] = j + (i + 1) * (size)+1;
+
+				indices[6 * j + 3] = j + (i)* (size);
+				indices[6 * j + 4] = j + (i + 1) * (size)+1;
+				indices[6 * j + 5] = j + (i + 1) * (size);
+			}
+		}
+	}
+}
+
+
+void genSquareGridBands(const SquareGridJob &job)
+{
+	int size = job.size;
+
+	// split the rows into one band per hardware thread, small grids stay on this thread
+	int bands = (int)std::thread::hardware_concurrency();
+	bands = std::max(1, std::min(bands, size / TERRAIN_MIN_BAND_ROWS));
+	int rowsPerBand = (size + bands - 1) / bands;
+
+	std::vector<std::thread> workers;
+	for (int band = 1; band < bands; ++band)
+	{
+		int rowBegin = band * rowsPerBand;
+		int rowEnd = std::min(rowBegin + rowsPerBand, size);
+		if (rowBegin < rowEnd)
+		{
+			workers.push_back(std::thread(genSquareGridBand, std::cref(job), rowBegin, rowEnd));
+		}
+	}
+	genSquareGridBand(job, 0, std::min(rowsPerBand, size));
+
+	for (size_t i = 0; i < workers.size(); ++i)
+	{
+		workers[i].join();
+	}
+}
@@ -0,0 +1,28 @@
+#ifndef TERRAIN_GRID_H
+#define TERRAIN_GRID_H
+
+// genSquareGridBands does not start a thread for fewer rows than this
+#define TERRAIN_MIN_BAND_ROWS 64
+
+// everything one row band of Terrain::genSquareGrid needs, the bands only write their own rows.
+// Vertex (i, j) lies at (i * step, minZ + scale * buffer[j + i * size], j * step). Kept free
+// of GL so that tools/TerrainBenchmark builds it too
+struct SquareGridJob
+{
+	int size;
+	const unsigned char *buffer;
+	float step;
+	float minZ;
+	float scale;
+	float texScaleU;
+	float texScaleV;
+	float *vertices;        // 3 per vertex
+	float *texCoord;        // 2 per vertex
+	float *normals;         // 3 per vertex, or nullptr
+	unsigned int *indices;  // 6 per grid quad, or nullptr
+};
+
+// fills the arrays of the job, the rows split into one band per hardware thread
+void genSquareGridBands(const SquareGridJob &job);
+
+#endif // TERRAIN_GRID_H
@@ -0,0 +1,497 @@
+#include "TiledHeightmap.h"
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN 1
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+using namespace std;
+
+TiledHeightmap::TiledHeightmap()
+{
+	memset(&m_header, 0, sizeof (m_header));
+#ifdef _WIN32
+	m_file = INVALID_HANDLE_VALUE;
+	m_mapping = NULL;
+#else
+	m_file = -1;
+#endif
+	m_residentRadius = 2;
+	m_stop = false;
+
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	m_granularity = info.dwAllocationGranularity;
+#else
+	m_granularity = (size_t)sysconf(_SC_PAGESIZE);
+#endif
+}
+
+TiledHeightmap::~TiledHeightmap()
+{
+	close();
+}
+
+bool TiledHeightmap::open(const char *filename)
+{
+	close();
+
+	ifstream file(filename, ios::binary | ios::in);
+	if (!file)
+	{
+		return false;
+	}
+
+	file.read((char *)&m_header, sizeof (m_header));
+	if (!file || m_header.magic != TILED_HEIGHTMAP_MAGIC || m_header.tileSize == 0)
+	{
+		cout << filename << " is not a tiled heightmap" << endl;
+		return false;
+	}
+
+	int tileCount = m_header.tilesX * m_header.tilesZ;
+	m_ranges.resize(tileCount);
+	file.read((char *)&m_ranges[0], tileCount * sizeof (TiledHeightmapRange));
+	file.close();
+
+#ifdef _WIN32
+	m_file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, NULL);
+	if (m_file == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+	// maps nothing yet, the views are created per tile
+	m_mapping = CreateFileMappingA(m_file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (m_mapping == NULL)
+	{
+		CloseHandle(m_file);
+		m_file = INVALID_HANDLE_VALUE;
+		return false;
+	}
+#else
+	m_file = ::open(filename, O_RDONLY);
+	if (m_file < 0)
+	{
+		return false;
+	}
+#endif
+
+	m_samples.assign(tileCount, nullptr);
+	m_tileStates.assign(tileCount, TILE_UNLOADED);
+	m_views.assign(tileCount, nullptr);
+	m_stop = false;
+	m_worker = std::thread(&TiledHeightmap::workerMain, this);
+
+	return true;
+}
+
+void TiledHeightmap::close()
+{
+	if (m_worker.joinable())
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stop = true;
+		}
+		m_wake.notify_all();
+		m_worker.join();
+	}
+
+	for (size_t tile = 0; tile < m_views.size(); ++tile)
+	{
+		unmapTile((int)tile);
+	}
+
+#ifdef _WIN32
+	if (m_mapping != NULL)
+	{
+		CloseHandle(m_mapping);
+		m_mapping = NULL;
+	}
+	if (m_file != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(m_file);
+		m_file = INVALID_HANDLE_VALUE;
+	}
+#else
+	if (m_file >= 0)
+	{
+		::close(m_file);
+		m_file = -1;
+	}
+#endif
+
+	m_samples.clear();
+	m_tileStates.clear();
+	m_views.clear();
+	m_ranges.clear();
+	m_queue.clear();
+	m_loaded.clear();
+	m_evicted.clear();
+	m_active.clear();
+}
+
+bool TiledHeightmap::write(const char *filename, const unsigned short *samples, int width, int height,
+	int tileSize, float heightOffset, float heightScale)
+{
+	FILE *file = fopen(filename, "wb");
+	if (file == NULL)
+	{
+		return false;
+	}
+
+	const int side = tileSize + 2;
+
+	TiledHeightmapHeader header;
+	memset(&header, 0, sizeof (header));
+	header.magic = TILED_HEIGHTMAP_MAGIC;
+	header.width = width;
+	header.height = height;
+	header.tileSize = tileSize;
+	header.tilesX = (width - 1 + tileSize - 1) / tileSize;
+	header.tilesZ = (height - 1 + tileSize - 1) / tileSize;
+	header.heightOffset = heightOffset;
+	header.heightScale = heightScale;
+
+	int tileCount = header.tilesX * header.tilesZ;
+	unsigned long long tileBytes = side * side * sizeof (unsigned short);
+	header.dataOffset = sizeof (header) + tileCount * sizeof (TiledHeightmapRange);
+	header.tileStride = tileBytes;
+
+	// one tile at a time, the ranges are known once every tile is written
+	std::vector<TiledHeightmapRange> ranges(tileCount);
+	std::vector<unsigned short> tile(side * side);
+	bool ok = fwrite(&header, sizeof (header), 1, file) == 1
+		&& fwrite(&ranges[0], sizeof (TiledHeightmapRange), tileCount, file) == (size_t)tileCount;
+	for (unsigned int tz = 0; ok && tz < header.tilesZ; ++tz)
+	{
+		for (unsigned int tx = 0; ok && tx < header.tilesX; ++tx)
+		{
+			TiledHeightmapRange &range = ranges[tx + tz * header.tilesX];
+			range.minSample = 0xffff;
+			range.maxSample = 0;
+
+			for (int r = 0; r < side; ++r)
+			{
+				for (int c = 0; c < side; ++c)
+				{
+					int i = std::min((int)tx * tileSize + r, width - 1);
+					int j = std::min((int)tz * tileSize + c, height - 1);
+					unsigned short sample = samples[j + i * height];
+					tile[c + r * side] = sample;
+					range.minSample = std::min(range.minSample, sample);
+					range.maxSample = std::max(range.maxSample, sample);
+				}
+			}
+
+			ok = fwrite(&tile[0], sizeof (unsigned short), tile.size(), file) == tile.size();
+		}
+	}
+
+	// the tiles are written in table order, so their order matches the ranges
+	ok = ok && fseek(file, sizeof (header), SEEK_SET) == 0
+		&& fwrite(&ranges[0], sizeof (TiledHeightmapRange), tileCount, file) == (size_t)tileCount;
+	fclose(file);
+
+	return ok;
+}
+
+bool TiledHeightmap::convertBMP(const char *bmpFile, const char *filename, int tileSize,
+	float heightOffset, float heightScale)
+{
+	ifstream file(bmpFile, ios::binary | ios::in);
+	if (!file)
+	{
+		cout << "cannot open " << bmpFile << endl;
+		return false;
+	}
+	BITMAPFILEHEADER bmfh;
+	BITMAPINFOHEADER bmih;
+	file.read((char*)&bmfh, sizeof(bmfh));
+	file.read((char*)&bmih, sizeof(bmih));
+	if (bmih.biBitCount != 8)
+	{
+		cout << bmpFile << " is not an 8-bit grey image " << bmih.biBitCount << endl;
+		return false;
+	}
+	file.seekg(bmfh.bfOffBits);
+	int size = bmih.biHeight * bmih.biWidth;
+	std::vector<unsigned char> buffer(size);
+	file.read((char *)&buffer[0], size);
+	file.close();
+
+	// spread the bytes over the full 16-bit range
+	std::vector<unsigned short> samples(size);
+	for (int i = 0; i < size; ++i)
+	{
+		samples[i] = buffer[i] * 257;
+	}
+
+	return write(filename, &samples[0], bmih.biHeight, bmih.biWidth, tileSize, heightOffset, heightScale / 257.0f);
+}
+
+void TiledHeightmap::update(float i, float j)
+{
+	if (!isOpen())
+	{
+		return;
+	}
+
+	const int tileSize = m_header.tileSize;
+	int centerX = (int)floorf(i / tileSize);
+	int centerZ = (int)floorf(j / tileSize);
+
+	std::vector<std::pair<int, int> > wanted;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		int x0 = std::max(centerX - m_residentRadius, 0);
+		int x1 = std::min(centerX + m_residentRadius, (int)m_header.tilesX - 1);
+		int z0 = std::max(centerZ - m_residentRadius, 0);
+		int z1 = std::min(centerZ + m_residentRadius, (int)m_header.tilesZ - 1);
+		for (int tz = z0; tz <= z1; ++tz)
+		{
+			for (int tx = x0; tx <= x1; ++tx)
+			{
+				int tile = tx + tz * m_header.tilesX;
+				if (m_tileStates[tile] == TILE_UNLOADED)
+				{
+					m_active.push_back(tile);
+				}
+				if (m_tileStates[tile] == TILE_UNLOADED || m_tileStates[tile] == TILE_QUEUED)
+				{
+					m_tileStates[tile] = TILE_QUEUED;
+					wanted.push_back(std::make_pair(std::max(abs(tx - centerX), abs(tz - centerZ)), tile));
+				}
+			}
+		}
+
+		// one tile of slack so moving along a tile border does not thrash
+		for (size_t k = 0; k < m_active.size();)
+		{
+			int tile = m_active[k];
+			int tx = tile % m_header.tilesX;
+			int tz = tile / m_header.tilesX;
+			if (std::max(abs(tx - centerX), abs(tz - centerZ)) > m_residentRadius + 1)
+			{
+				if (m_tileStates[tile] == TILE_QUEUED)
+				{
+					m_tileStates[tile] = TILE_UNLOADED;
+				}
+				else if (m_tileStates[tile] == TILE_RESIDENT)
+				{
+					unmapTile(tile);
+					m_tileStates[tile] = TILE_UNLOADED;
+					m_samples[tile] = nullptr;
+					m_loaded.erase(std::remove(m_loaded.begin(), m_loaded.end(), tile), m_loaded.end());
+					m_evicted.push_back(tile);
+				}
+			}
+
+			// a loading tile is evicted on a later update, once it is resident
+			if (m_tileStates[tile] == TILE_UNLOADED)
+			{
+				m_active[k] = m_active.back();
+				m_active.pop_back();
+			}
+			else
+			{
+				++k;
+			}
+		}
+
+		// nearest tiles first
+		std::sort(wanted.begin(), wanted.end());
+		m_queue.clear();
+		for (size_t k = 0; k < wanted.size(); ++k)
+		{
+			m_queue.push_back(wanted[k].second);
+		}
+	}
+
+	if (!wanted.empty())
+	{
+		m_wake.notify_one();
+	}
+}
+
+void TiledHeightmap::takeLoadedTiles(std::vector<int> &tiles)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	for (size_t k = 0; k < m_loaded.size(); ++k)
+	{
+		int tile = m_loaded[k];
+		unsigned long long offset;
+		size_t bytes;
+		size_t skip;
+		getTileMapping(tile, offset, bytes, skip);
+		m_samples[tile] = (const unsigned short *)((const char *)m_views[tile] + skip);
+		tiles.push_back(tile);
+	}
+	m_loaded.clear();
+}
+
+void TiledHeightmap::takeEvictedTiles(std::vector<int> &tiles)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	tiles.insert(tiles.end(), m_evicted.begin(), m_evicted.end());
+	m_evicted.clear();
+}
+
+const unsigned short *TiledHeightmap::getTileSamples(int tile) const
+{
+	return m_samples[tile];
+}
+
+bool TiledHeightmap::getSample(int i, int j, unsigned short &sample) const
+{
+	const int tileSize = m_header.tileSize;
+	const int side = tileSize + 2;
+
+	i = std::min(std::max(i, 0), (int)m_header.width - 1);
+	j = std::min(std::max(j, 0), (int)m_header.height - 1);
+
+	// the tiles overlap by two samples, so up to four of them hold (i, j)
+	for (int tx = std::min(i / tileSize, (int)m_header.tilesX - 1); tx >= 0 && i - tx * tileSize < side; --tx)
+	{
+		for (int tz = std::min(j / tileSize, (int)m_header.tilesZ - 1); tz >= 0 && j - tz * tileSize < side; --tz)
+		{
+			const unsigned short *samples = m_samples[tx + tz * m_header.tilesX];
+			if (samples != nullptr)
+			{
+				sample = samples[(j - tz * tileSize) + (i - tx * tileSize) * side];
+				return true;
+			}
+		}
+	}
+
+	return false;
+}
+
+int TiledHeightmap::getResidentTileCount() const
+{
+	int count = 0;
+	for (size_t tile = 0; tile < m_samples.size(); ++tile)
+	{
+		if (m_samples[tile] != nullptr)
+		{
+			++count;
+		}
+	}
+	return count;
+}
+
+void TiledHeightmap::workerMain()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	while (!m_stop)
+	{
+		if (m_queue.empty())
+		{
+			m_wake.wait(lock);
+			continue;
+		}
+
+		int tile = m_queue.front();
+		m_queue.pop_front();
+		if (m_tileStates[tile] != TILE_QUEUED)
+		{
+			continue;
+		}
+
+		// map and fault the tile in without holding the lock, nobody else touches
+		// a tile while it is loading
+		m_tileStates[tile] = TILE_LOADING;
+		lock.unlock();
+		bool mapped = mapTile(tile);
+		lock.lock();
+
+		if (mapped)
+		{
+			m_tileStates[tile] = TILE_RESIDENT;
+			m_loaded.push_back(tile);
+		}
+		else
+		{
+			m_tileStates[tile] = TILE_UNLOADED;
+		}
+	}
+}
+
+void TiledHeightmap::getTileMapping(int tile, unsigned long long &offset, size_t &bytes, size_t &skip) const
+{
+	const int side = m_header.tileSize + 2;
+	unsigned long long start = m_header.dataOffset + tile * m_header.tileStride;
+
+	offset = start / m_granularity * m_granularity;
+	skip = (size_t)(start - offset);
+	bytes = skip + side * side * sizeof (unsigned short);
+}
+
+bool TiledHeightmap::mapTile(int tile)
+{
+	unsigned long long offset;
+	size_t bytes;
+	size_t skip;
+	getTileMapping(tile, offset, bytes, skip);
+
+#ifdef _WIN32
+	void *view = MapViewOfFile(m_mapping, FILE_MAP_READ, (DWORD)(offset >> 32), (DWORD)offset, bytes);
+#else
+	void *view = mmap(NULL, bytes, PROT_READ, MAP_PRIVATE, m_file, (off_t)offset);
+	if (view == MAP_FAILED)
+	{
+		view = nullptr;
+	}
+#endif
+	if (view == nullptr)
+	{
+		return false;
+	}
+
+	// touch every page of the tile here so the render thread never waits on a page fault
+	volatile unsigned char sum = 0;
+	for (size_t b = skip; b < bytes; b += 4096)
+	{
+		sum += ((const unsigned char *)view)[b];
+	}
+	sum += ((const unsigned char *)view)[bytes - 1];
+
+	m_views[tile] = view;
+	return true;
+}
+
+void TiledHeightmap::unmapTile(int tile)
+{
+	if (m_views[tile] == nullptr)
+	{
+		return;
+	}
+
+#ifdef _WIN32
+	UnmapViewOfFile(m_views[tile]);
+#else
+	unsigned long long offset;
+	size_t bytes;
+	size_t skip;
+	getTileMapping(tile, offset, bytes, skip);
+	munmap(m_views[tile], bytes);
+#endif
+	m_views[tile] = nullptr;
+}
@@ -0,0 +1,126 @@
+#ifndef TILED_HEIGHTMAP_H
+#define TILED_HEIGHTMAP_H
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#define TILED_HEIGHTMAP_MAGIC      0x314d4854  // "THM1"
+
+// The file is a TiledHeightmapHeader, one TiledHeightmapRange per tile, then the tiles,
+// packed. A tile is mapped through the range of whole allocation granules (64 KB on
+// Windows, a page elsewhere) that contains it, so neighbouring tiles may share a granule.
+// Tile (x, z) holds (tileSize + 2)^2 16-bit samples, row-major along i, starting at grid
+// sample (x * tileSize, z * tileSize) and clamped at the map border. The extra row and
+// column let a tile be drawn and lit without its neighbours.
+struct TiledHeightmapHeader
+{
+	unsigned int magic;
+	unsigned int width;                 // samples along i
+	unsigned int height;                // samples along j
+	unsigned int tileSize;              // quads per tile side
+	unsigned int tilesX;
+	unsigned int tilesZ;
+	float heightOffset;                 // height = heightOffset + heightScale * sample
+	float heightScale;
+	unsigned long long dataOffset;      // file offset of the first tile
+	unsigned long long tileStride;      // bytes from one tile to the next
+};
+
+struct TiledHeightmapRange
+{
+	unsigned short minSample;
+	unsigned short maxSample;
+};
+
+enum TileState
+{
+	TILE_UNLOADED,
+	TILE_QUEUED,
+	TILE_LOADING,
+	TILE_RESIDENT,
+};
+
+class TiledHeightmap
+{
+public:
+	TiledHeightmap();
+	~TiledHeightmap();
+
+	// reads the header and tile ranges, no tile is paged in yet
+	bool open(const char *filename);
+	void close();
+	bool isOpen() const { return m_samples.size() > 0; }
+
+	static bool write(const char *filename, const unsigned short *samples, int width, int height,
+		int tileSize, float heightOffset, float heightScale);
+	// converts an 8-bit grey BMP, byte b ends up at height heightOffset + heightScale * b
+	static bool convertBMP(const char *bmpFile, const char *filename, int tileSize,
+		float heightOffset, float heightScale);
+
+	// queues the tiles within the resident radius of grid position (i, j), nearest first,
+	// and unmaps the ones that moved out of it. Never waits for the disk.
+	void update(float i, float j);
+
+	// tiles that became resident or were evicted since the last call
+	void takeLoadedTiles(std::vector<int> &tiles);
+	void takeEvictedTiles(std::vector<int> &tiles);
+
+	// null unless the tile is resident, valid until the next update()
+	const unsigned short *getTileSamples(int tile) const;
+	// looks in every resident tile that contains the sample
+	bool getSample(int i, int j, unsigned short &sample) const;
+
+	void setResidentRadius(int tiles) { m_residentRadius = tiles; }
+	int getResidentTileCount() const;
+
+	int getWidth() const { return m_header.width; }
+	int getHeight() const { return m_header.height; }
+	int getTileSize() const { return m_header.tileSize; }
+	int getTileSamplesPerSide() const { return m_header.tileSize + 2; }
+	int getTilesX() const { return m_header.tilesX; }
+	int getTilesZ() const { return m_header.tilesZ; }
+	float getHeightOffset() const { return m_header.heightOffset; }
+	float getHeightScale() const { return m_header.heightScale; }
+	const TiledHeightmapRange &getTileRange(int tile) const { return m_ranges[tile]; }
+
+private:
+	void workerMain();
+	bool mapTile(int tile);
+	void unmapTile(int tile);
+	// the granule aligned file range mapped for a tile, and where its samples start in it
+	void getTileMapping(int tile, unsigned long long &offset, size_t &bytes, size_t &skip) const;
+
+	TiledHeightmapHeader m_header;
+	std::vector<TiledHeightmapRange> m_ranges;
+	size_t m_granularity;
+
+#ifdef _WIN32
+	void *m_file;
+	void *m_mapping;
+#else
+	int m_file;
+#endif
+
+	// main thread view of the resident tiles, filled by takeLoadedTiles
+	std::vector<const unsigned short *> m_samples;
+	// every tile that is not TILE_UNLOADED
+	std::vector<int> m_active;
+	int m_residentRadius;
+
+	// everything below is shared with the worker and guarded by m_mutex,
+	// a view is only written by whoever moved its tile to TILE_LOADING
+	std::mutex m_mutex;
+	std::vector<TileState> m_tileStates;
+	std::vector<void *> m_views;        // start of the mapped range, not of the samples
+	std::condition_variable m_wake;
+	std::deque<int> m_queue;
+	std::vector<int> m_loaded;
+	std::vector<int> m_evicted;
+	bool m_stop;
+	std::thread m_worker;
+};
+
+#endif // TILED_HEIGHTMAP_H
@@ -46,6 +46,8 @@ sRGB luminance values).
 #define GLUT_DISABLE_ATEXIT_HACK 
 #endif  
 
+// The default texture sizes, i.e. SkyTextureSizes::High(). SkyModel takes the
+// sizes it uses as a constructor argument, and puts them in its GLSL header.
 const int TRANSMITTANCE_TEXTURE_WIDTH = 256;
 const int TRANSMITTANCE_TEXTURE_HEIGHT = 64;
 
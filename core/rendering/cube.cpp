@@ -1,13 +1,14 @@
 #include "cube.h"
+#include "IndexOptimizer.h"
 
 #include <glm/gtx/transform.hpp>
 
 #define POSITION_LOC    0
 #define TEXCOORD_LOC    1
+#define NORMAL_LOC      2
 
 Cube::Cube()
 {
-
 }
 
 Cube::~Cube()
@@ -20,11 +21,16 @@ GLboolean Cube::init()
 	const char vShaderStr[] =
 		"#version 300 es										  \n"
 		"uniform mat4 u_mvpMatrix;								  \n"
+		SKY_LIGHTING_GLSL
 		"layout(location = 0) in vec4 a_position;				  \n"
 		"layout(location = 1) in vec2 a_texCoord;                 \n"
+		"layout(location = 2) in vec3 a_normal;                   \n"
 		"out vec2 v_texCoord;						     		  \n"
+		"out vec3 v_lighting;                                     \n"
 		"void main()											  \n"
 		"{														  \n"
+		"    // the cube is only translated, its normals are in world space\n"
+		"    v_lighting = skyLighting(a_normal);                  \n"
 		"    v_texCoord = a_texCoord;                             \n"
 		"    gl_Position = u_mvpMatrix * a_position;              \n"
 		"}";
@@ -33,12 +39,18 @@ GLboolean Cube::init()
 	const char fShaderStr[] =
 		"#version 300 es                                     \n"
 		"precision mediump float;                            \n"
+		AERIAL_PERSPECTIVE_GLSL
+		SKY_LIGHTING_FRAGMENT_GLSL
 		"in vec2 v_texCoord;                                 \n"
+		"in vec3 v_lighting;                                 \n"
 		"out vec4 outColor;                                  \n"
 		"uniform sampler2D s_texture;                        \n"
 		"void main()                                         \n"
 		"{                                                   \n"
 		"  outColor = texture( s_texture, v_texCoord );      \n"
+		"  if (u_useSkyLighting)                             \n"
+		"    outColor.rgb = shadeSkyLighting(outColor.rgb, v_lighting);\n"
+		"  outColor.rgb = applyAerialPerspective(outColor.rgb);\n"
 		"}                                                   \n";
 
 	// Create the program object
@@ -48,6 +60,10 @@ GLboolean Cube::init()
 
 	m_textureLoc = glGetUniformLocation(m_program, "s_texture");
 
+	m_skyLighting.init(m_program);
+
+	m_aerialPerspective.init(m_program);
+
 	int width, height;
 
 	m_texture = loadTexture("checker.png", &width, &height);
@@ -62,31 +78,52 @@ GLboolean Cube::init()
 
 	m_numIndices = genCube(1.0f, &vertices, &normals, &texCoords, &indices);
 
+	// reorder for the vertex cache and renumber the vertices in order of use, which
+	// also lets the cube use 16-bit indices
+#ifdef INDEX_OPTIMIZER_REPORT
+	float before = IndexOptimizer::computeACMR(indices, m_numIndices);
+#endif
+	IndexOptimizer::optimizeVertexCache(indices, m_numIndices, 24);
+
+	std::vector<GLushort> indices16;
+	std::vector<GLuint> remap;
+	std::vector<IndexBatch> batches;
+	IndexOptimizer::splitIndices16(indices, m_numIndices, 24, INDEX_MAX_BATCH_VERTICES, indices16, remap, batches);
+#ifdef INDEX_OPTIMIZER_REPORT
+	printf("cube: ACMR %.3f -> %.3f\n", before, IndexOptimizer::computeACMR(&indices16[0], m_numIndices));
+#endif
+	free(indices);
+
+	int numVertices = (int)remap.size();
+	std::vector<GLfloat> attribute(numVertices * 3);
+
 	// Index buffer for base terrain
 	glGenBuffers(1, &m_indicesIBO);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_indicesIBO);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, m_numIndices * sizeof (GLuint), indices, GL_STATIC_DRAW);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, m_numIndices * sizeof (GLushort), &indices16[0], GL_STATIC_DRAW);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-	free(indices);
 
 	// Position VBO for base terrain
+	IndexOptimizer::remapVertices(vertices, 3, remap, &attribute[0]);
 	glGenBuffers(1, &m_positionVBO);
 	glBindBuffer(GL_ARRAY_BUFFER, m_positionVBO);
-	glBufferData(GL_ARRAY_BUFFER, 24 * sizeof (GLfloat)* 3, vertices, GL_STATIC_DRAW);
+	glBufferData(GL_ARRAY_BUFFER, numVertices * sizeof (GLfloat)* 3, &attribute[0], GL_STATIC_DRAW);
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
 	free(vertices);
 
 	// normal VBO for base terrain
+	IndexOptimizer::remapVertices(normals, 3, remap, &attribute[0]);
 	glGenBuffers(1, &m_normalsVBO);
 	glBindBuffer(GL_ARRAY_BUFFER, m_normalsVBO);
-	glBufferData(GL_ARRAY_BUFFER, 24 * sizeof (GLfloat)* 3, normals, GL_STATIC_DRAW);
+	glBufferData(GL_ARRAY_BUFFER, numVertices * sizeof (GLfloat)* 3, &attribute[0], GL_STATIC_DRAW);
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
 	free(normals);
 
 	// texCoord VBO for base terrain
+	IndexOptimizer::remapVertices(texCoords, 2, remap, &attribute[0]);
 	glGenBuffers(1, &m_texCoordsVBO);
 	glBindBuffer(GL_ARRAY_BUFFER, m_texCoordsVBO);
-	glBufferData(GL_ARRAY_BUFFER, 24 * sizeof (GLfloat)* 2, texCoords, GL_STATIC_DRAW);
+	glBufferData(GL_ARRAY_BUFFER, numVertices * sizeof (GLfloat)* 2, &attribute[0], GL_STATIC_DRAW);
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
 	free(texCoords);
 
@@ -111,6 +148,12 @@ void Cube::draw(ESContext *esContext)
 		GL_FALSE, 2 * sizeof (GLfloat), (const void *)NULL);
 	glEnableVertexAttribArray(TEXCOORD_LOC);
 
+	// Load the normals
+	glBindBuffer(GL_ARRAY_BUFFER, m_normalsVBO);
+	glVertexAttribPointer(NORMAL_LOC, 3, GL_FLOAT,
+		GL_FALSE, 3 * sizeof (GLfloat), (const void *)NULL);
+	glEnableVertexAttribArray(NORMAL_LOC);
+
 	// Bind the index buffer
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_indicesIBO);
 
@@ -121,15 +164,22 @@ void Cube::draw(ESContext *esContext)
 	// Set the texture sampler to texture unit to 0
 	glUniform1i(m_textureLoc, 0);
 
+	// the volume of the atmosphere between the camera and the mesh, if any
+	m_aerialPerspective.bind(esContext);
+
+	// the block of the sky lighting, unlit when there is none
+	m_skyLighting.bind();
+
 	// Load the MVP matrix
 	glm::mat4 mvp = esContext->mvp_matrix * m_modelMatrix;
 	glUniformMatrix4fv(m_mvpLoc, 1, GL_FALSE, &mvp[0][0]);
 
 	// Draw the cube
-	glDrawElements(GL_TRIANGLES, m_numIndices, GL_UNSIGNED_INT, (const void *)NULL);
+	glDrawElements(GL_TRIANGLES, m_numIndices, GL_UNSIGNED_SHORT, (const void *)NULL);
 
 	glDisableVertexAttribArray(POSITION_LOC);
 	glDisableVertexAttribArray(TEXCOORD_LOC);
+	glDisableVertexAttribArray(NORMAL_LOC);
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 	glBindTexture(GL_TEXTURE_2D, 0);
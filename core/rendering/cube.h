@@ -3,6 +3,8 @@
 
 #include <gles_include.h>
 #include <glm/glm.hpp>
+#include <AerialPerspective.h>
+#include <SkyLighting.h>
 
 class Cube
 {
@@ -13,6 +15,11 @@ public:
 	GLboolean init();
 	void draw(ESContext *esContext);
 	int genCube(float scale, GLfloat **vertices, GLfloat **normals, GLfloat **texCoords, GLuint **indices);
+
+	// the atmosphere between the camera and the cube, none by default
+	void setAerialPerspective(const AerialPerspective *aerialPerspective) { m_aerialPerspective.setAerialPerspective(aerialPerspective); }
+	// the ambient and sun lighting of the sky, unlit by default
+	void setSkyLighting(const SkyLighting *skyLighting) { m_skyLighting.setSkyLighting(skyLighting); }
 private:
 	GLuint m_program;
 	GLuint m_texture;
@@ -24,6 +31,8 @@ private:
 	GLint m_mvpLoc;
 	GLint m_textureLoc;
 	glm::mat4 m_modelMatrix;
+	AerialPerspectiveBinding m_aerialPerspective;
+	SkyLightingBinding m_skyLighting;
 };
 
 #endif CUBE_H
\ No newline at end of file
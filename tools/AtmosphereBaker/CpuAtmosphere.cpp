@@ -0,0 +1,515 @@
+#include "CpuAtmosphere.h"
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <thread>
+
+#include <glm/glm.hpp>
+
+// The GLSL precomputation code, compiled as C++. The shim below provides the
+// GLSL types and built-in functions it uses, and the samplers implement the
+// GL_LINEAR and GL_CLAMP_TO_EDGE sampling of the GPU textures.
+namespace atmosphere_cpu {
+
+using glm::vec2;
+using glm::vec3;
+using glm::vec4;
+using glm::dot;
+using glm::exp;
+using glm::length;
+using glm::max;
+using glm::min;
+using glm::normalize;
+using std::cos;
+using std::floor;
+using std::pow;
+using std::sin;
+using std::sqrt;
+
+struct sampler2D {
+	int width;
+	int height;
+	std::vector<vec4> texels;
+
+	const vec4& Fetch(int x, int y) const {
+		x = x < 0 ? 0 : (x >= width ? width - 1 : x);
+		y = y < 0 ? 0 : (y >= height ? height - 1 : y);
+		return texels[x + y * width];
+	}
+};
+
+struct sampler3D {
+	int width;
+	int height;
+	int depth;
+	std::vector<vec4> texels;
+
+	const vec4& Fetch(int x, int y, int z) const {
+		x = x < 0 ? 0 : (x >= width ? width - 1 : x);
+		y = y < 0 ? 0 : (y >= height ? height - 1 : y);
+		z = z < 0 ? 0 : (z >= depth ? depth - 1 : z);
+		return texels[x + (y + z * height) * width];
+	}
+};
+
+inline vec4 texture(const sampler2D& sampler, const vec2& uv) {
+	float x = uv.x * sampler.width - 0.5f;
+	float y = uv.y * sampler.height - 0.5f;
+	float x0 = std::floor(x);
+	float y0 = std::floor(y);
+	int i = static_cast<int>(x0);
+	int j = static_cast<int>(y0);
+	float u = x - x0;
+	float v = y - y0;
+	return glm::mix(
+		glm::mix(sampler.Fetch(i, j), sampler.Fetch(i + 1, j), u),
+		glm::mix(sampler.Fetch(i, j + 1), sampler.Fetch(i + 1, j + 1), u), v);
+}
+
+inline vec4 texture(const sampler3D& sampler, const vec3& uvw) {
+	float x = uvw.x * sampler.width - 0.5f;
+	float y = uvw.y * sampler.height - 0.5f;
+	float z = uvw.z * sampler.depth - 0.5f;
+	float x0 = std::floor(x);
+	float y0 = std::floor(y);
+	float z0 = std::floor(z);
+	int i = static_cast<int>(x0);
+	int j = static_cast<int>(y0);
+	int k = static_cast<int>(z0);
+	float u = x - x0;
+	float v = y - y0;
+	float w = z - z0;
+	vec4 front = glm::mix(
+		glm::mix(sampler.Fetch(i, j, k), sampler.Fetch(i + 1, j, k), u),
+		glm::mix(sampler.Fetch(i, j + 1, k), sampler.Fetch(i + 1, j + 1, k), u),
+		v);
+	vec4 back = glm::mix(
+		glm::mix(sampler.Fetch(i, j, k + 1), sampler.Fetch(i + 1, j, k + 1), u),
+		glm::mix(sampler.Fetch(i, j + 1, k + 1),
+			sampler.Fetch(i + 1, j + 1, k + 1), u),
+		v);
+	return glm::mix(front, back, w);
+}
+
+inline float clamp(float x, float min_value, float max_value) {
+	return x < min_value ? min_value : (x > max_value ? max_value : x);
+}
+inline float min(float a, float b) { return a < b ? a : b; }
+inline float max(float a, float b) { return a > b ? a : b; }
+inline float mod(float a, float b) { return a - b * std::floor(a / b); }
+inline float smoothstep(float edge0, float edge1, float x) {
+	float t = clamp((x - edge0) / (edge1 - edge0), 0.0f, 1.0f);
+	return t * t * (3.0f - 2.0f * t);
+}
+
+// GLSL literals such as 0.5 are floats, C++ ones are doubles.
+inline vec2 operator*(const vec2& v, double s) { return v * float(s); }
+inline vec3 operator*(const vec3& v, double s) { return v * float(s); }
+inline vec4 operator*(const vec4& v, double s) { return v * float(s); }
+inline vec3 operator*(double s, const vec3& v) { return float(s) * v; }
+inline vec4 operator*(double s, const vec4& v) { return float(s) * v; }
+inline vec3 operator/(const vec3& v, double s) { return v / float(s); }
+
+// The texture sizes, which are constants of the GLSL header in SkyModel. They are
+// set by SetTextureSizes before the code below runs, so that a single baker can
+// bake any resolution (which also means one bake at a time).
+int TRANSMITTANCE_TEXTURE_WIDTH;
+int TRANSMITTANCE_TEXTURE_HEIGHT;
+int SCATTERING_TEXTURE_R_SIZE;
+int SCATTERING_TEXTURE_MU_SIZE;
+int SCATTERING_TEXTURE_MU_S_SIZE;
+int SCATTERING_TEXTURE_NU_SIZE;
+int IRRADIANCE_TEXTURE_WIDTH;
+int IRRADIANCE_TEXTURE_HEIGHT;
+
+void SetTextureSizes(const SkyTextureSizes& sizes) {
+	TRANSMITTANCE_TEXTURE_WIDTH = sizes.transmittance_width;
+	TRANSMITTANCE_TEXTURE_HEIGHT = sizes.transmittance_height;
+	SCATTERING_TEXTURE_R_SIZE = sizes.scattering_r_size;
+	SCATTERING_TEXTURE_MU_SIZE = sizes.scattering_mu_size;
+	SCATTERING_TEXTURE_MU_S_SIZE = sizes.scattering_mu_s_size;
+	SCATTERING_TEXTURE_NU_SIZE = sizes.scattering_nu_size;
+	IRRADIANCE_TEXTURE_WIDTH = sizes.irradiance_width;
+	IRRADIANCE_TEXTURE_HEIGHT = sizes.irradiance_height;
+}
+
+#define IN(x) const x&
+#define OUT(x) x&
+#define TEMPLATE(x)
+#define TEMPLATE_ARGUMENT(x)
+#undef assert
+#define assert(x)
+
+// COMBINED_SCATTERING_TEXTURES is not defined: it only changes the rendering
+// functions, and the baker packs the combined texture itself.
+#include "definitions.c"
+#include "functions.c"
+
+}  // namespace atmosphere_cpu
+
+namespace {
+
+using atmosphere_cpu::AtmosphereParameters;
+using atmosphere_cpu::sampler2D;
+using atmosphere_cpu::sampler3D;
+using glm::vec2;
+using glm::vec3;
+using glm::vec4;
+
+// The GLSL header of SkyModel has the parameters with std::to_string, i.e. with
+// 6 decimals. Rounding them the same way gives the same atmosphere.
+double Rounded(double value) {
+	return std::stod(std::to_string(value));
+}
+
+vec3 ToVec3(const SkyModelParameters& parameters,
+	const std::vector<double>& spectrum, double scale) {
+	return vec3(
+		Rounded(parameters.Interpolate(spectrum, kSkyLambdaR) * scale),
+		Rounded(parameters.Interpolate(spectrum, kSkyLambdaG) * scale),
+		Rounded(parameters.Interpolate(spectrum, kSkyLambdaB) * scale));
+}
+
+AtmosphereParameters NewAtmosphere(const SkyModelParameters& parameters) {
+	const double unit = parameters.length_unit_in_meters;
+	AtmosphereParameters atmosphere;
+	atmosphere.solar_irradiance =
+		ToVec3(parameters, parameters.solar_irradiance, 1.0);
+	atmosphere.sun_angular_radius = Rounded(parameters.sun_angular_radius);
+	atmosphere.bottom_radius = Rounded(parameters.bottom_radius / unit);
+	atmosphere.top_radius = Rounded(parameters.top_radius / unit);
+	atmosphere.rayleigh_scale_height =
+		Rounded(parameters.rayleigh_scale_height / unit);
+	atmosphere.rayleigh_scattering =
+		ToVec3(parameters, parameters.rayleigh_scattering, unit);
+	atmosphere.mie_scale_height = Rounded(parameters.mie_scale_height / unit);
+	atmosphere.mie_scattering =
+		ToVec3(parameters, parameters.mie_scattering, unit);
+	atmosphere.mie_extinction =
+		ToVec3(parameters, parameters.mie_extinction, unit);
+	atmosphere.mie_phase_function_g = Rounded(parameters.mie_phase_function_g);
+	atmosphere.ground_albedo = ToVec3(parameters, parameters.ground_albedo, 1.0);
+	atmosphere.mu_s_min = Rounded(cos(parameters.max_sun_zenith_angle));
+	return atmosphere;
+}
+
+sampler2D NewTexture2d(int width, int height) {
+	sampler2D texture;
+	texture.width = width;
+	texture.height = height;
+	texture.texels.assign((size_t)width * height, vec4(0.0f));
+	return texture;
+}
+
+sampler3D NewTexture3d(const SkyTextureSizes& sizes) {
+	sampler3D texture;
+	texture.width = sizes.GetScatteringWidth();
+	texture.height = sizes.GetScatteringHeight();
+	texture.depth = sizes.GetScatteringDepth();
+	texture.texels.assign(
+		(size_t)texture.width * texture.height * texture.depth, vec4(0.0f));
+	return texture;
+}
+
+// What a 16-bit float texture keeps of a value.
+float ToHalf(float value) {
+	return AtmosphereCache::HalfToFloat(AtmosphereCache::FloatToHalf(value));
+}
+
+// Calls body(index) for index in [0, count), spread over thread_count threads.
+void ParallelFor(int count, int thread_count,
+	const std::function<void(int)>& body) {
+	std::atomic<int> next(0);
+	auto worker = [&next, count, &body]() {
+		for (int index = next++; index < count; index = next++) {
+			body(index);
+		}
+	};
+	std::vector<std::thread> threads;
+	for (int i = 1; i < thread_count; ++i) {
+		threads.push_back(std::thread(worker));
+	}
+	worker();
+	for (size_t i = 0; i < threads.size(); ++i) {
+		threads[i].join();
+	}
+}
+
+// Runs a "fragment shader" on each texel of a 2D or 3D target, one row per task.
+// The shader gets gl_FragCoord (with the layer + 0.5 in z) and the texel index.
+class Passes {
+public:
+	Passes(const SkyTextureSizes& sizes, int thread_count, bool emulate_half,
+		bool verbose) :
+		sizes_(sizes),
+		thread_count_(thread_count),
+		emulate_half_(emulate_half),
+		verbose_(verbose) {
+	}
+
+	void Run2d(const char* name, int width, int height,
+		const std::function<void(const vec2&, size_t)>& shader) const {
+		auto start = std::chrono::steady_clock::now();
+		ParallelFor(height, thread_count_, [width, &shader](int y) {
+			for (int x = 0; x < width; ++x) {
+				shader(vec2(x + 0.5f, y + 0.5f), x + (size_t)y * width);
+			}
+		});
+		Report(name, start);
+	}
+
+	void Run3d(const char* name,
+		const std::function<void(const vec3&, size_t)>& shader) const {
+		auto start = std::chrono::steady_clock::now();
+		const int width = sizes_.GetScatteringWidth();
+		const int height = sizes_.GetScatteringHeight();
+		ParallelFor(height * sizes_.GetScatteringDepth(), thread_count_,
+			[width, height, &shader](int row) {
+			int y = row % height;
+			int layer = row / height;
+			size_t offset = (size_t)row * width;
+			for (int x = 0; x < width; ++x) {
+				shader(vec3(x + 0.5f, y + 0.5f, layer + 0.5f), offset + x);
+			}
+		});
+		Report(name, start);
+	}
+
+	// The value stored in a 16-bit float texture.
+	vec4 Half(const vec4& value) const {
+		if (!emulate_half_) {
+			return value;
+		}
+		return vec4(ToHalf(value.x), ToHalf(value.y), ToHalf(value.z),
+			ToHalf(value.w));
+	}
+
+private:
+	void Report(const char* name,
+		std::chrono::steady_clock::time_point start) const {
+		if (verbose_) {
+			std::chrono::duration<double> seconds =
+				std::chrono::steady_clock::now() - start;
+			printf("  %-28s %8.2f s\n", name, seconds.count());
+		}
+	}
+
+	SkyTextureSizes sizes_;
+	int thread_count_;
+	bool emulate_half_;
+	bool verbose_;
+};
+
+template<class Sampler>
+AtmosphereCache::Texture ToCacheTexture(const Sampler& sampler, int depth,
+	int channels, bool half) {
+	AtmosphereCache::Texture texture;
+	texture.width = sampler.width;
+	texture.height = sampler.height;
+	texture.depth = depth;
+	texture.channels = channels;
+	texture.half = half;
+	texture.data.resize(texture.GetTexelCount() *
+		(half ? sizeof(unsigned short) : sizeof(float)));
+	unsigned short* halfs = reinterpret_cast<unsigned short*>(&texture.data[0]);
+	float* floats = reinterpret_cast<float*>(&texture.data[0]);
+	for (size_t i = 0; i < sampler.texels.size(); ++i) {
+		for (int c = 0; c < channels; ++c) {
+			float value = sampler.texels[i][c];
+			if (half) {
+				halfs[i * channels + c] = AtmosphereCache::FloatToHalf(value);
+			}
+			else {
+				floats[i * channels + c] = value;
+			}
+		}
+	}
+	return texture;
+}
+
+// The inverse of ToCacheTexture, with an alpha of 1 for RGB textures.
+template<class Sampler>
+void FromCacheTexture(const AtmosphereCache::Texture& texture, Sampler* sampler) {
+	const unsigned short* halfs =
+		reinterpret_cast<const unsigned short*>(&texture.data[0]);
+	const float* floats = reinterpret_cast<const float*>(&texture.data[0]);
+	sampler->texels.assign(texture.GetTexelCount() / texture.channels,
+		vec4(0.0f, 0.0f, 0.0f, 1.0f));
+	for (size_t i = 0; i < sampler->texels.size(); ++i) {
+		for (int c = 0; c < texture.channels; ++c) {
+			size_t j = i * texture.channels + c;
+			sampler->texels[i][c] =
+				texture.half ? AtmosphereCache::HalfToFloat(halfs[j]) : floats[j];
+		}
+	}
+}
+
+}  // anonymous namespace
+
+void BakeAtmosphere(const SkyModelParameters& parameters,
+	const CpuAtmosphereOptions& options,
+	std::vector<AtmosphereCache::Texture>* textures) {
+	using namespace atmosphere_cpu;
+	const SkyTextureSizes& sizes = parameters.texture_sizes;
+	SetTextureSizes(sizes);
+	const AtmosphereParameters atmosphere = NewAtmosphere(parameters);
+	const Passes passes(sizes, options.thread_count, options.emulate_half,
+		options.verbose);
+
+	// The same textures as SkyModel::Init, where the 32-bit float ones are the 2D
+	// ones and the 16-bit float ones the 3D ones. The RGB textures read with an
+	// alpha of 1, and delta_multiple_scattering is delta_rayleigh_scattering.
+	sampler2D transmittance = NewTexture2d(
+		sizes.transmittance_width, sizes.transmittance_height);
+	sampler2D irradiance = NewTexture2d(
+		sizes.irradiance_width, sizes.irradiance_height);
+	sampler2D delta_irradiance = NewTexture2d(
+		sizes.irradiance_width, sizes.irradiance_height);
+	sampler3D scattering = NewTexture3d(sizes);
+	sampler3D delta_rayleigh = NewTexture3d(sizes);
+	sampler3D delta_mie = NewTexture3d(sizes);
+	sampler3D delta_scattering_density = NewTexture3d(sizes);
+	sampler3D& delta_multiple = delta_rayleigh;
+
+	passes.Run2d("transmittance", sizes.transmittance_width,
+		sizes.transmittance_height,
+		[&](const vec2& frag_coord, size_t i) {
+		transmittance.texels[i] = vec4(
+			ComputeTransmittanceToTopAtmosphereBoundaryTexture(atmosphere,
+				frag_coord), 1.0f);
+	});
+
+	passes.Run2d("direct irradiance", sizes.irradiance_width,
+		sizes.irradiance_height,
+		[&](const vec2& frag_coord, size_t i) {
+		delta_irradiance.texels[i] = vec4(ComputeDirectIrradianceTexture(
+			atmosphere, transmittance, frag_coord), 1.0f);
+		irradiance.texels[i] = vec4(0.0f, 0.0f, 0.0f, 1.0f);
+	});
+
+	passes.Run3d("single scattering", [&](const vec3& frag_coord, size_t i) {
+		vec3 rayleigh;
+		vec3 mie;
+		ComputeSingleScatteringTexture(atmosphere, transmittance, frag_coord,
+			rayleigh, mie);
+		delta_rayleigh.texels[i] = passes.Half(vec4(rayleigh, 0.0f));
+		delta_mie.texels[i] = passes.Half(vec4(mie, 1.0f));
+		scattering.texels[i] = passes.Half(parameters.combine_scattering_textures ?
+			vec4(rayleigh, mie.r) : vec4(rayleigh, 1.0f));
+	});
+
+	for (unsigned int scattering_order = 2;
+		scattering_order <= options.num_scattering_orders;
+		++scattering_order) {
+		if (options.verbose) {
+			printf(" order %u\n", scattering_order);
+		}
+		passes.Run3d("scattering density", [&](const vec3& frag_coord, size_t i) {
+			delta_scattering_density.texels[i] = passes.Half(vec4(
+				ComputeScatteringDensityTexture(atmosphere, transmittance,
+					delta_rayleigh, delta_mie, delta_multiple, delta_irradiance,
+					frag_coord, scattering_order), 1.0f));
+		});
+
+		// delta_irradiance only holds this order, irradiance accumulates all of
+		// them, as in SkyModel::Init.
+		passes.Run2d("indirect irradiance", sizes.irradiance_width,
+			sizes.irradiance_height,
+			[&](const vec2& frag_coord, size_t i) {
+			vec3 value = ComputeIndirectIrradianceTexture(atmosphere,
+				delta_rayleigh, delta_mie, delta_multiple, frag_coord,
+				scattering_order - 1);
+			delta_irradiance.texels[i] = vec4(value, 0.0f);
+			irradiance.texels[i] += vec4(value, 0.0f);
+		});
+
+		passes.Run3d("multiple scattering", [&](const vec3& frag_coord, size_t i) {
+			float nu;
+			vec3 value = ComputeMultipleScatteringTexture(atmosphere,
+				transmittance, delta_scattering_density, frag_coord, nu);
+			delta_multiple.texels[i] = passes.Half(vec4(value, nu));
+		});
+
+		passes.Run3d("accumulate scattering", [&](const vec3& frag_coord, size_t i) {
+			vec4 color = ComputeMultipleScatteringTexture_1(atmosphere,
+				delta_multiple, frag_coord);
+			vec3 value = vec3(color) / RayleighPhaseFunction(color.a);
+			scattering.texels[i] = passes.Half(scattering.texels[i] +
+				vec4(value, 0.0f));
+		});
+	}
+
+	textures->clear();
+	textures->push_back(ToCacheTexture(transmittance, 1, 3, false));
+	textures->push_back(ToCacheTexture(scattering, sizes.GetScatteringDepth(),
+		parameters.combine_scattering_textures ? 4 : 3, true));
+	if (!parameters.combine_scattering_textures) {
+		textures->push_back(ToCacheTexture(delta_mie, sizes.GetScatteringDepth(),
+			3, true));
+	}
+	textures->push_back(ToCacheTexture(irradiance, 1, 3, false));
+}
+
+void RenderSkyRadiance(const SkyModelParameters& parameters,
+	const std::vector<AtmosphereCache::Texture>& textures,
+	std::vector<float>* sky_radiance, std::vector<float>* ground_radiance) {
+	using namespace atmosphere_cpu;
+	const SkyTextureSizes& sizes = parameters.texture_sizes;
+	SetTextureSizes(sizes);
+	const AtmosphereParameters atmosphere = NewAtmosphere(parameters);
+
+	sampler2D transmittance;
+	transmittance.width = sizes.transmittance_width;
+	transmittance.height = sizes.transmittance_height;
+	FromCacheTexture(textures[0], &transmittance);
+	sampler3D scattering;
+	scattering.width = sizes.GetScatteringWidth();
+	scattering.height = sizes.GetScatteringHeight();
+	scattering.depth = sizes.GetScatteringDepth();
+	sampler3D single_mie_scattering = scattering;
+	FromCacheTexture(textures[1], &scattering);
+	FromCacheTexture(textures[2], &single_mie_scattering);
+
+	// Cameras from the ground to the top of the atmosphere, Suns from the zenith
+	// to below the horizon, and view rays every 5 degrees of zenith angle and 15
+	// degrees of azimuth from the Sun.
+	const double kPi = 3.1415926535897932;
+	const double kAltitudes[] = { 10.0, 1000.0, 5000.0, 20000.0, 50000.0 };
+	const double kSunZenithAngles[] = { 0.0, 30.0, 60.0, 80.0, 88.0, 92.0, 96.0 };
+	const float bottom_radius = atmosphere.bottom_radius;
+	sky_radiance->clear();
+	ground_radiance->clear();
+	for (size_t a = 0; a < sizeof(kAltitudes) / sizeof(kAltitudes[0]); ++a) {
+		const float r =
+			bottom_radius + kAltitudes[a] / parameters.length_unit_in_meters;
+		vec3 camera(0.0f, 0.0f, r);
+		for (size_t s = 0;
+			s < sizeof(kSunZenithAngles) / sizeof(kSunZenithAngles[0]); ++s) {
+			double theta_s = kSunZenithAngles[s] * kPi / 180.0;
+			vec3 sun_direction(std::sin(theta_s), 0.0, std::cos(theta_s));
+			for (int i = 0; i <= 36; ++i) {
+				double theta = i * 5.0 * kPi / 180.0;
+				for (int j = 0; j <= 12; ++j) {
+					double phi = j * 15.0 * kPi / 180.0;
+					vec3 view_ray(std::sin(theta) * std::cos(phi),
+						std::sin(theta) * std::sin(phi), std::cos(theta));
+					vec3 sky_transmittance;
+					vec3 value = GetSkyRadiance(atmosphere, transmittance,
+						scattering, single_mie_scattering, camera, view_ray, 0.0f,
+						sun_direction, sky_transmittance);
+					std::vector<float>* radiance =
+						RayIntersectsGround(atmosphere, r, view_ray.z) ?
+						ground_radiance : sky_radiance;
+					radiance->push_back(value.r);
+					radiance->push_back(value.g);
+					radiance->push_back(value.b);
+				}
+			}
+		}
+	}
+}
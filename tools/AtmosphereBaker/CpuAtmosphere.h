@@ -0,0 +1,39 @@
+#ifndef CPU_ATMOSPHERE_H_
+#define CPU_ATMOSPHERE_H_
+
+#include <vector>
+
+#include "AtmosphereCache.h"
+#include "SkyModelParameters.h"
+
+struct CpuAtmosphereOptions {
+	unsigned int num_scattering_orders;
+	int thread_count;
+	// Rounds what the GPU stores in 16-bit float textures to half precision, so
+	// that the results can be compared with a cache file written by SkyModel.
+	bool emulate_half;
+	// Prints the duration of each pass.
+	bool verbose;
+};
+
+// Runs the precomputation of SkyModel::Init on the CPU, with the GLSL code of
+// core/definitions.c and core/functions.c compiled as C++, and returns the final
+// textures in the order and format of the SkyModel cache file: transmittance,
+// scattering, single Mie scattering (only without combine_scattering_textures)
+// and irradiance.
+void BakeAtmosphere(const SkyModelParameters& parameters,
+	const CpuAtmosphereOptions& options,
+	std::vector<AtmosphereCache::Texture>* textures);
+
+// Renders the sky with GetSkyRadiance of core/functions.c and the textures that
+// BakeAtmosphere returns without combine_scattering_textures, for a fixed set of
+// camera altitudes, Sun directions and view directions, and returns the RGB
+// radiance of the view rays which reach the top of the atmosphere and of those
+// which hit the ground (the aerial perspective in front of the ground). The
+// samples do not depend on the texture sizes, so that bakes at different
+// resolutions can be compared with each other.
+void RenderSkyRadiance(const SkyModelParameters& parameters,
+	const std::vector<AtmosphereCache::Texture>& textures,
+	std::vector<float>* sky_radiance, std::vector<float>* ground_radiance);
+
+#endif  // CPU_ATMOSPHERE_H_
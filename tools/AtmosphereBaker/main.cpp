@@ -0,0 +1,459 @@
+// Offline baker for the precomputed atmosphere textures of SkyModel.
+//
+// Runs the precomputation on the CPU and writes a cache file that SkyModel::Init
+// loads instead of precomputing on the GPU (same parameters, same key). With
+// --validate, compares the result with a cache file written by SkyModel instead.
+// With --report, bakes each texture size preset and prints what it costs (texture
+// memory, bake time) and what it loses (sky radiance error against a bake at a
+// higher resolution than High). With --formats, prints the error of the compact
+// texture formats of SkyModel::SetTextureFormats against full precision.
+//
+//   AtmosphereBaker [--orders N] [--combined] [--constant-solar] [--threads N]
+//                   [--source-dir DIR] [--full-precision] [--preset NAME]
+//                   [--output FILE | --validate FILE [--tolerance T] | --report |
+//                    --formats]
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "AtmosphereCache.h"
+#include "CpuAtmosphere.h"
+#include "SkyModelParameters.h"
+
+namespace {
+
+const char* kTextureNames[] = {
+	"transmittance", "scattering", "single mie scattering", "irradiance" };
+
+bool ReadFile(const std::string& filename, std::string* content) {
+	std::ifstream file(filename.c_str());
+	if (!file) {
+		return false;
+	}
+	std::ostringstream buffer;
+	buffer << file.rdbuf();
+	*content = buffer.str();
+	return true;
+}
+
+float GetValue(const AtmosphereCache::Texture& texture, size_t i) {
+	if (texture.half) {
+		return AtmosphereCache::HalfToFloat(
+			reinterpret_cast<const unsigned short*>(&texture.data[0])[i]);
+	}
+	return reinterpret_cast<const float*>(&texture.data[0])[i];
+}
+
+// Prints the error of each texture and returns the largest relative error, or a
+// negative value if the textures do not have the same layout.
+double Compare(const std::vector<AtmosphereCache::Texture>& textures,
+	const std::vector<AtmosphereCache::Texture>& references) {
+	if (textures.size() != references.size()) {
+		fprintf(stderr, "%u textures, the reference has %u\n",
+			(unsigned int)textures.size(), (unsigned int)references.size());
+		return -1.0;
+	}
+	// The single Mie scattering texture is only there without combined textures.
+	std::vector<const char*> names(kTextureNames, kTextureNames + 4);
+	if (textures.size() == 3) {
+		names.erase(names.begin() + 2);
+	}
+	double max_relative_error = 0.0;
+	printf("%-24s %12s %12s %12s %12s\n", "texture", "max value",
+		"max abs err", "max rel err", "rms err");
+	for (size_t t = 0; t < textures.size(); ++t) {
+		const AtmosphereCache::Texture& texture = textures[t];
+		const AtmosphereCache::Texture& reference = references[t];
+		if (texture.width != reference.width ||
+			texture.height != reference.height ||
+			texture.depth != reference.depth ||
+			texture.channels != reference.channels) {
+			fprintf(stderr, "texture %u has another size than the reference\n",
+				(unsigned int)t);
+			return -1.0;
+		}
+		// Relative to the largest reference value of the texture, since small
+		// values are dominated by the rounding of the 16-bit float textures.
+		size_t count = texture.GetTexelCount();
+		double max_value = 0.0;
+		for (size_t i = 0; i < count; ++i) {
+			max_value = std::max(max_value, (double)std::fabs(GetValue(reference, i)));
+		}
+		double max_error = 0.0;
+		double sum_squared_error = 0.0;
+		for (size_t i = 0; i < count; ++i) {
+			double error = std::fabs(
+				(double)GetValue(texture, i) - GetValue(reference, i));
+			max_error = std::max(max_error, error);
+			sum_squared_error += error * error;
+		}
+		double relative_error = max_value > 0.0 ? max_error / max_value : max_error;
+		max_relative_error = std::max(max_relative_error, relative_error);
+		printf("%-24s %12g %12g %12g %12g\n",
+			t < names.size() ? names[t] : "?", max_value, max_error,
+			relative_error, std::sqrt(sum_squared_error / count));
+	}
+	return max_relative_error;
+}
+
+bool GetPreset(const std::string& name, SkyTextureSizes* sizes) {
+	if (name == "low") {
+		*sizes = SkyTextureSizes::Low();
+	}
+	else if (name == "medium") {
+		*sizes = SkyTextureSizes::Medium();
+	}
+	else if (name == "high") {
+		*sizes = SkyTextureSizes::High();
+	}
+	else {
+		return false;
+	}
+	return true;
+}
+
+// Prints the mean and 95th percentile of the relative error of radiance samples
+// against the reference ones. Values below 0.1% of the largest reference value
+// (the night sky) are compared with that value instead.
+void PrintRadianceError(const std::vector<float>& radiance,
+	const std::vector<float>& reference) {
+	float max_value = 0.0f;
+	for (size_t i = 0; i < reference.size(); ++i) {
+		max_value = std::max(max_value, reference[i]);
+	}
+	const double floor = 1e-3 * max_value;
+	std::vector<double> errors(radiance.size());
+	double sum = 0.0;
+	for (size_t i = 0; i < radiance.size(); ++i) {
+		errors[i] = std::fabs((double)radiance[i] - reference[i]) /
+			std::max((double)reference[i], floor);
+		sum += errors[i];
+	}
+	std::sort(errors.begin(), errors.end());
+	printf(" %9.4f %9.4f", sum / errors.size(), errors[errors.size() * 95 / 100]);
+}
+
+// Rounds a value to an unsigned float with a 5-bit exponent and the given number
+// of mantissa bits, as the channels of GL_R11F_G11F_B10F (6, 6 and 5 bits).
+float ToSmallFloat(float value, int mantissa_bits) {
+	if (!(value > 0.0f)) {
+		return 0.0f;
+	}
+	int exponent;
+	std::frexp(value, &exponent);
+	// Values below 2^-14 are denormals, with the step of the smallest exponent.
+	double step = std::ldexp(1.0, std::max(exponent - 1, -14) - mantissa_bits);
+	double max_value = (2.0 - std::ldexp(1.0, -mantissa_bits)) * 32768.0;
+	return (float)std::min(std::floor(value / step + 0.5) * step, max_value);
+}
+
+// Rounds an RGB value to GL_RGB9_E5, as in the OpenGL ES 3.0 specification: 9
+// mantissa bits per channel and a 5-bit exponent shared by the 3 channels.
+void ToRgb9E5(const float* rgb, float* result) {
+	const int kMantissaBits = 9;
+	const int kBias = 15;
+	const double kMaxValue = 511.0 / 512.0 * 65536.0;
+	double max_channel = 0.0;
+	double channels[3];
+	for (int c = 0; c < 3; ++c) {
+		channels[c] = std::min(std::max((double)rgb[c], 0.0), kMaxValue);
+		max_channel = std::max(max_channel, channels[c]);
+	}
+	if (max_channel == 0.0) {
+		result[0] = result[1] = result[2] = 0.0f;
+		return;
+	}
+	int exponent = std::max(-kBias - 1, (int)std::floor(std::log2(max_channel))) +
+		1 + kBias;
+	double step = std::ldexp(1.0, exponent - kBias - kMantissaBits);
+	if (std::floor(max_channel / step + 0.5) == (1 << kMantissaBits)) {
+		step *= 2.0;
+	}
+	for (int c = 0; c < 3; ++c) {
+		result[c] = (float)(std::floor(channels[c] / step + 0.5) * step);
+	}
+}
+
+// Returns the values of an RGB texture after a round trip through a compact
+// format, as 32-bit floats.
+AtmosphereCache::Texture ToCompactFormat(const AtmosphereCache::Texture& texture,
+	bool rgb9_e5) {
+	AtmosphereCache::Texture result = texture;
+	result.half = false;
+	result.data.resize(texture.GetTexelCount() * sizeof(float));
+	float* values = reinterpret_cast<float*>(&result.data[0]);
+	for (size_t i = 0; i < texture.GetTexelCount(); i += 3) {
+		float rgb[3] = {
+			GetValue(texture, i), GetValue(texture, i + 1), GetValue(texture, i + 2) };
+		if (rgb9_e5) {
+			ToRgb9E5(rgb, values + i);
+		}
+		else {
+			values[i] = ToSmallFloat(rgb[0], 6);
+			values[i + 1] = ToSmallFloat(rgb[1], 6);
+			values[i + 2] = ToSmallFloat(rgb[2], 5);
+		}
+	}
+	return result;
+}
+
+// The --formats mode. Like the radiance of --report, it uses a separate single
+// Mie scattering texture, since a combined one needs an alpha channel, which the
+// compact formats do not have.
+int Formats(const SkyModelParameters& parameters,
+	const CpuAtmosphereOptions& options) {
+	const char* kFormatNames[] = { "R11F_G11F_B10F", "RGB9_E5" };
+	SkyModelParameters bake_parameters = parameters;
+	bake_parameters.combine_scattering_textures = false;
+	printf("baking the textures\n");
+	std::vector<AtmosphereCache::Texture> textures;
+	BakeAtmosphere(bake_parameters, options, &textures);
+	std::vector<float> sky_reference;
+	std::vector<float> ground_reference;
+	RenderSkyRadiance(bake_parameters, textures, &sky_reference,
+		&ground_reference);
+
+	const double kMegabyte = 1024.0 * 1024.0;
+	size_t texel_count = 0;
+	for (size_t t = 0; t < textures.size(); ++t) {
+		texel_count += textures[t].GetTexelCount() / textures[t].channels;
+	}
+	printf("\nfull precision: %.2f MB\n",
+		bake_parameters.texture_sizes.GetTextureMemorySize(false) / kMegabyte);
+	for (int f = 0; f < 2; ++f) {
+		std::vector<AtmosphereCache::Texture> compact_textures;
+		for (size_t t = 0; t < textures.size(); ++t) {
+			compact_textures.push_back(ToCompactFormat(textures[t], f == 1));
+		}
+		printf("\n%s: %.2f MB\n", kFormatNames[f], texel_count * 4 / kMegabyte);
+		Compare(compact_textures, textures);
+		std::vector<float> sky_radiance;
+		std::vector<float> ground_radiance;
+		RenderSkyRadiance(bake_parameters, compact_textures, &sky_radiance,
+			&ground_radiance);
+		printf("%-24s %9s %9s %9s %9s\n%-24s", "radiance", "sky err", "sky p95",
+			"gnd err", "gnd p95", "");
+		PrintRadianceError(sky_radiance, sky_reference);
+		PrintRadianceError(ground_radiance, ground_reference);
+		printf("\n");
+	}
+	printf("\nerr and p95: mean and 95th percentile of the relative radiance error\n"
+		"of the view rays which see the sky or the ground, with all the textures\n"
+		"in this format, against the full precision ones.\n");
+	return 0;
+}
+
+// The --report mode. The reference doubles the altitude and view zenith angle
+// resolutions of High, the ones which the lower presets reduce the most.
+int Report(const SkyModelParameters& parameters,
+	const CpuAtmosphereOptions& options) {
+	const char* kPresetNames[] = { "low", "medium", "high", "reference" };
+	std::vector<SkyTextureSizes> presets;
+	presets.push_back(SkyTextureSizes::Low());
+	presets.push_back(SkyTextureSizes::Medium());
+	presets.push_back(SkyTextureSizes::High());
+	presets.push_back(SkyTextureSizes::High());
+	presets.back().scattering_r_size *= 2;
+	presets.back().scattering_mu_size *= 2;
+
+	// The radiance is rendered with separate single Mie scattering textures, but
+	// the memory is the one of the textures SkyModel allocates for 'parameters'.
+	SkyModelParameters bake_parameters = parameters;
+	bake_parameters.combine_scattering_textures = false;
+	std::vector<double> seconds(presets.size());
+	std::vector<std::vector<float> > sky_radiances(presets.size());
+	std::vector<std::vector<float> > ground_radiances(presets.size());
+	for (size_t p = 0; p < presets.size(); ++p) {
+		printf("baking the %s textures\n", kPresetNames[p]);
+		bake_parameters.texture_sizes = presets[p];
+		std::vector<AtmosphereCache::Texture> textures;
+		auto start = std::chrono::steady_clock::now();
+		BakeAtmosphere(bake_parameters, options, &textures);
+		std::chrono::duration<double> duration =
+			std::chrono::steady_clock::now() - start;
+		seconds[p] = duration.count();
+		RenderSkyRadiance(bake_parameters, textures, &sky_radiances[p],
+			&ground_radiances[p]);
+	}
+
+	const double kMegabyte = 1024.0 * 1024.0;
+	printf("\n%-10s %-14s %9s %9s %9s %9s %9s %9s %9s\n", "preset",
+		"scattering", "MB", "temp MB", "bake s", "sky err", "sky p95",
+		"gnd err", "gnd p95");
+	for (size_t p = 0; p < presets.size(); ++p) {
+		const SkyTextureSizes& sizes = presets[p];
+		char scattering[32];
+		snprintf(scattering, sizeof(scattering), "%dx%dx%d",
+			sizes.GetScatteringWidth(), sizes.GetScatteringHeight(),
+			sizes.GetScatteringDepth());
+		printf("%-10s %-14s %9.2f %9.2f %9.2f", kPresetNames[p], scattering,
+			sizes.GetTextureMemorySize(parameters.combine_scattering_textures) /
+			kMegabyte,
+			sizes.GetPrecomputationMemorySize(
+				parameters.combine_scattering_textures) / kMegabyte,
+			seconds[p]);
+		PrintRadianceError(sky_radiances[p], sky_radiances.back());
+		PrintRadianceError(ground_radiances[p], ground_radiances.back());
+		printf("\n");
+	}
+	printf("MB: final textures, temp MB: temporary precomputation textures,\n"
+		"err and p95: mean and 95th percentile of the relative radiance error of\n"
+		"the view rays which see the sky or the ground, against the reference.\n"
+		"The bake times are on the CPU, SkyModel prints the GPU ones.\n");
+	return 0;
+}
+
+void PrintUsage() {
+	printf(
+		"usage: AtmosphereBaker [options]\n"
+		"  --orders N          number of scattering orders (default 4)\n"
+		"  --combined          combine the single Mie scattering with the scattering\n"
+		"  --constant-solar    use a constant solar spectrum\n"
+		"  --threads N         worker threads (default: all cores)\n"
+		"  --source-dir DIR    directory of definitions.c and functions.c (default core)\n"
+		"  --full-precision    do not round the 16-bit float textures to half\n"
+		"  --preset NAME       texture sizes: low, medium or high (default high)\n"
+		"  --output FILE       cache file to write (default atmosphere.cache)\n"
+		"  --validate FILE     compare with a cache file written by SkyModel instead\n"
+		"  --tolerance T       max relative error accepted by --validate (default 0.01)\n"
+		"  --report            compare the memory, bake time and error of the presets\n"
+		"  --formats           error of the compact texture formats of SkyModel\n");
+}
+
+}  // anonymous namespace
+
+int main(int argc, char* argv[]) {
+	unsigned int num_scattering_orders = 4;
+	bool combined = false;
+	bool constant_solar = false;
+	int thread_count = (int)std::thread::hardware_concurrency();
+	bool full_precision = false;
+	std::string source_dir = "core";
+	std::string output = "atmosphere.cache";
+	std::string validate;
+	double tolerance = 0.01;
+	SkyTextureSizes texture_sizes = SkyTextureSizes::High();
+	bool report = false;
+	bool formats = false;
+
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		bool has_value = i + 1 < argc;
+		if (arg == "--orders" && has_value) {
+			num_scattering_orders = (unsigned int)atoi(argv[++i]);
+		}
+		else if (arg == "--combined") {
+			combined = true;
+		}
+		else if (arg == "--constant-solar") {
+			constant_solar = true;
+		}
+		else if (arg == "--threads" && has_value) {
+			thread_count = atoi(argv[++i]);
+		}
+		else if (arg == "--source-dir" && has_value) {
+			source_dir = argv[++i];
+		}
+		else if (arg == "--full-precision") {
+			full_precision = true;
+		}
+		else if (arg == "--output" && has_value) {
+			output = argv[++i];
+		}
+		else if (arg == "--validate" && has_value) {
+			validate = argv[++i];
+		}
+		else if (arg == "--tolerance" && has_value) {
+			tolerance = atof(argv[++i]);
+		}
+		else if (arg == "--preset" && has_value &&
+			GetPreset(argv[i + 1], &texture_sizes)) {
+			++i;
+		}
+		else if (arg == "--report") {
+			report = true;
+		}
+		else if (arg == "--formats") {
+			formats = true;
+		}
+		else {
+			PrintUsage();
+			return arg == "--help" ? 0 : 1;
+		}
+	}
+	if (thread_count < 1) {
+		thread_count = 1;
+	}
+
+	// The sources are only needed for the cache key, the code itself is compiled
+	// into the baker. Both must match the ones the application runs with.
+	std::string definitions;
+	std::string functions;
+	if (!ReadFile(source_dir + "/definitions.c", &definitions) ||
+		!ReadFile(source_dir + "/functions.c", &functions)) {
+		fprintf(stderr, "could not read the atmosphere sources in %s\n",
+			source_dir.c_str());
+		return 1;
+	}
+	SkyModelParameters parameters =
+		SkyModelParameters::Earth(constant_solar, combined);
+	parameters.texture_sizes = texture_sizes;
+	uint64_t key = AtmosphereCache::Hash(&num_scattering_orders,
+		sizeof(num_scattering_orders),
+		parameters.GetCacheKey(definitions, functions));
+
+	std::vector<AtmosphereCache::Texture> references;
+	if (!validate.empty() &&
+		!AtmosphereCache::Read(validate, key, &references)) {
+		fprintf(stderr, "%s is missing or was written with other parameters\n",
+			validate.c_str());
+		return 1;
+	}
+
+	CpuAtmosphereOptions options;
+	options.num_scattering_orders = num_scattering_orders;
+	options.thread_count = thread_count;
+	options.emulate_half = !full_precision;
+	options.verbose = !report && !formats;
+	if (report) {
+		return Report(parameters, options);
+	}
+	if (formats) {
+		return Formats(parameters, options);
+	}
+
+	printf("baking %u scattering orders with %d threads\n",
+		num_scattering_orders, thread_count);
+	std::vector<AtmosphereCache::Texture> textures;
+	auto start = std::chrono::steady_clock::now();
+	BakeAtmosphere(parameters, options, &textures);
+	std::chrono::duration<double> seconds =
+		std::chrono::steady_clock::now() - start;
+	printf("baked in %.2f s\n", seconds.count());
+
+	if (!validate.empty()) {
+		double error = Compare(textures, references);
+		if (error < 0.0 || error > tolerance) {
+			printf("FAILED (tolerance %g)\n", tolerance);
+			return 2;
+		}
+		printf("OK (tolerance %g)\n", tolerance);
+		return 0;
+	}
+
+	if (!AtmosphereCache::Write(output, key, textures)) {
+		fprintf(stderr, "could not write %s\n", output.c_str());
+		return 1;
+	}
+	printf("wrote %s\n", output.c_str());
+	return 0;
+}
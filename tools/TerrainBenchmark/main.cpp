@@ -0,0 +1,261 @@
+// Benchmarks of the CPU side of Terrain, outside of the application.
+//
+// grid: times genSquareGridBands against a single threaded scalar generator on
+// synthetic 1k, 4k and 8k heightmaps, and prints the largest difference between
+// their outputs. A size that does not fit in memory, as 8k may not in a 32-bit
+// build, is reported as skipped.
+//
+// pyramid: checks the HeightPyramid queries on a 513x513 grid of waves and noise.
+// 100k batched samples, some of them outside the grid, are compared with and
+// timed against the scalar ones; 2000 downward raycasts are timed and compared
+// with a brute-force march in 0.01 steps.
+//
+//   TerrainBenchmark [grid] [pyramid]
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "HeightPyramid.h"
+#include "TerrainGrid.h"
+
+// the Terrain defaults
+static const float kStep = 2.0f;
+static const float kMinZ = -100.0f;
+static const float kScale = 0.54f;
+
+// the generator genSquareGridBands replaced, one row at a time through the interleaved arrays
+static void genSquareGridScalar(const SquareGridJob &job)
+{
+	int size = job.size;
+
+	for (int i = 0; i < size; ++i) // row
+	{
+		for (int j = 0; j < size; ++j) // column
+		{
+			job.vertices[3 * (j + i * size)] = i * job.step;
+			job.vertices[3 * (j + i * size) + 1] = job.minZ + job.scale * job.buffer[j + i * size];
+			job.vertices[3 * (j + i * size) + 2] = j * job.step;
+
+			job.texCoord[2 * (j + i * size)] = job.texScaleU * j;
+			job.texCoord[2 * (j + i * size) + 1] = job.texScaleV * i;
+		}
+	}
+
+	for (int i = 0; i < size; ++i) // row
+	{
+		for (int j = 0; j < size; ++j) // column
+		{
+			// same edge handling as genSquareGridBands so the results can be compared
+			int r1 = std::min(i + 1, size - 1);
+			int c1 = std::min(j + 1, size - 1);
+			float h00 = job.vertices[3 * (j + (r1 - 1) * size) + 1];
+			glm::vec3 dx = glm::vec3(1, job.vertices[3 * (j + r1 * size) + 1] - h00, 0.0);
+			float h0 = job.vertices[3 * (c1 - 1 + i * size) + 1];
+			glm::vec3 dy = glm::vec3(0.0, job.vertices[3 * (c1 + i * size) + 1] - h0, 1);
+
+			glm::vec3 result = glm::normalize(glm::cross(dy, dx));
+			job.normals[3 * (j + i * size)] = result.x;
+			job.normals[3 * (j + i * size) + 1] = result.y;
+			job.normals[3 * (j + i * size) + 2] = result.z;
+		}
+	}
+}
+
+static void benchmarkGenSquareGrid()
+{
+	static const int sizes[] = { 1024, 4096, 8192 };
+
+	for (int s = 0; s < 3; ++s)
+	{
+		int size = sizes[s];
+
+		unsigned char *buffer = new unsigned char[size * size];
+		for (int i = 0; i < size * size; ++i)
+		{
+			buffer[i] = (unsigned char)((i * 2654435761u) >> 24);
+		}
+
+		SquareGridJob jobs[2];
+		bool allocated = true;
+		for (int k = 0; k < 2; ++k)
+		{
+			SquareGridJob &job = jobs[k];
+			job.size = size;
+			job.buffer = buffer;
+			job.step = kStep;
+			job.minZ = kMinZ;
+			job.scale = kScale;
+			job.texScaleU = 11.0f / size;
+			job.texScaleV = 11.0f / size;
+			job.vertices = (float *)malloc(sizeof(float) * 3 * size * size);
+			job.texCoord = (float *)malloc(sizeof(float) * 2 * size * size);
+			job.normals = (float *)malloc(sizeof(float) * 3 * size * size);
+			job.indices = nullptr;
+			allocated = allocated && job.vertices != nullptr && job.texCoord != nullptr && job.normals != nullptr;
+		}
+
+		if (allocated)
+		{
+			std::chrono::high_resolution_clock::time_point t0 = std::chrono::high_resolution_clock::now();
+			genSquareGridScalar(jobs[0]);
+			std::chrono::high_resolution_clock::time_point t1 = std::chrono::high_resolution_clock::now();
+			genSquareGridBands(jobs[1]);
+			std::chrono::high_resolution_clock::time_point t2 = std::chrono::high_resolution_clock::now();
+
+			float maxError = 0.0f;
+			for (int i = 0; i < 3 * size * size; ++i)
+			{
+				maxError = std::max(maxError, fabsf(jobs[0].vertices[i] - jobs[1].vertices[i]));
+				maxError = std::max(maxError, fabsf(jobs[0].normals[i] - jobs[1].normals[i]));
+			}
+
+			double scalarMs = std::chrono::duration<double, std::milli>(t1 - t0).count();
+			double bandMs = std::chrono::duration<double, std::milli>(t2 - t1).count();
+			printf("genSquareGrid %dx%d: scalar %.1f ms, banded %.1f ms (%.2fx), max difference %g\n",
+				size, size, scalarMs, bandMs, scalarMs / bandMs, maxError);
+		}
+		else
+		{
+			printf("genSquareGrid %dx%d: skipped, out of memory\n", size, size);
+		}
+
+		for (int k = 0; k < 2; ++k)
+		{
+			free(jobs[k].vertices);
+			free(jobs[k].texCoord);
+			free(jobs[k].normals);
+		}
+		delete[] buffer;
+	}
+}
+
+static void benchmarkHeightPyramid()
+{
+	const int size = 513;
+	const float spacing = 2.0f;
+	const float maxT = 3000.0f;
+	const float marchStep = 0.01f;
+
+	// waves with some noise, between -145 and -55
+	std::vector<float> heights(size * size);
+	srand(1);
+	for (int i = 0; i < size; ++i)
+	{
+		for (int j = 0; j < size; ++j)
+		{
+			heights[j + i * size] = -100.0f + 40.0f * sinf(i * 0.05f) * cosf(j * 0.07f) + (rand() % 100) * 0.05f;
+		}
+	}
+	HeightPyramid pyramid;
+	pyramid.build(&heights[0], size, size, spacing);
+
+	// samples, some of them outside the grid
+	const int numSamples = 100000;
+	std::vector<float> x(numSamples), z(numSamples), scalar(numSamples), batched(numSamples);
+	for (int k = 0; k < numSamples; ++k)
+	{
+		x[k] = rand() / (float)RAND_MAX * 1100.0f - 20.0f;
+		z[k] = rand() / (float)RAND_MAX * 1100.0f - 20.0f;
+	}
+	std::chrono::high_resolution_clock::time_point t0 = std::chrono::high_resolution_clock::now();
+	for (int k = 0; k < numSamples; ++k)
+	{
+		scalar[k] = pyramid.sample(x[k], z[k]);
+	}
+	std::chrono::high_resolution_clock::time_point t1 = std::chrono::high_resolution_clock::now();
+	pyramid.sampleBatch(&x[0], &z[0], &batched[0], numSamples);
+	std::chrono::high_resolution_clock::time_point t2 = std::chrono::high_resolution_clock::now();
+	int differences = 0;
+	for (int k = 0; k < numSamples; ++k)
+	{
+		differences += scalar[k] != batched[k] ? 1 : 0;
+	}
+	double scalarMs = std::chrono::duration<double, std::milli>(t1 - t0).count();
+	double batchMs = std::chrono::duration<double, std::milli>(t2 - t1).count();
+	printf("HeightPyramid %d samples: scalar %.2f ms, batched %.2f ms (%.2fx), %d different\n",
+		numSamples, scalarMs, batchMs, scalarMs / batchMs, differences);
+
+	// downward rays from above the grid, the march takes the first sample on or below the
+	// surface, within the grid
+	const int numRays = 2000;
+	int hits = 0;
+	int mismatches = 0;
+	double raycastMs = 0.0;
+	for (int r = 0; r < numRays; ++r)
+	{
+		glm::vec3 origin(rand() / (float)RAND_MAX * 1200.0f - 100.0f, 20.0f + rand() % 100,
+			rand() / (float)RAND_MAX * 1200.0f - 100.0f);
+		glm::vec3 direction(rand() / (float)RAND_MAX - 0.5f, -rand() / (float)RAND_MAX * 0.5f,
+			rand() / (float)RAND_MAX - 0.5f);
+		direction = glm::normalize(direction);
+
+		float t = 0.0f;
+		std::chrono::high_resolution_clock::time_point r0 = std::chrono::high_resolution_clock::now();
+		bool hit = pyramid.raycast(origin, direction, maxT, t);
+		raycastMs += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - r0).count();
+
+		float marchT = -1.0f;
+		for (float s = 0.0f; s < maxT; s += marchStep)
+		{
+			glm::vec3 p = origin + direction * s;
+			if (p.x < 0.0f || p.z < 0.0f || p.x > (size - 1) * spacing || p.z > (size - 1) * spacing)
+			{
+				continue;
+			}
+			if (p.y <= pyramid.sample(p.x, p.z))
+			{
+				marchT = s;
+				break;
+			}
+		}
+
+		// the march stops within a step after the exact intersection
+		if (hit != (marchT >= 0.0f) || (hit && fabsf(t - marchT) > 5.0f * marchStep))
+		{
+			++mismatches;
+		}
+		hits += hit ? 1 : 0;
+	}
+	printf("HeightPyramid %d raycasts: %d hits, %.2f us per ray, %d disagree with the march\n",
+		numRays, hits, raycastMs * 1000.0 / numRays, mismatches);
+}
+
+int main(int argc, char **argv)
+{
+	// no argument runs every benchmark
+	bool grid = argc < 2;
+	bool pyramid = argc < 2;
+	for (int i = 1; i < argc; ++i)
+	{
+		if (strcmp(argv[i], "grid") == 0)
+		{
+			grid = true;
+		}
+		else if (strcmp(argv[i], "pyramid") == 0)
+		{
+			pyramid = true;
+		}
+		else
+		{
+			fprintf(stderr, "usage: TerrainBenchmark [grid] [pyramid]\n");
+			return 1;
+		}
+	}
+
+	if (grid)
+	{
+		benchmarkGenSquareGrid();
+	}
+	if (pyramid)
+	{
+		benchmarkHeightPyramid();
+	}
+	return 0;
+}
@@ -0,0 +1,101 @@
+#!/usr/bin/env python
+# Embeds the GLSL files of core into the executable, so that the shaders do not
+# depend on the working directory. Writes core/rendering/EmbeddedShaderFiles.cpp,
+# which defines ShaderSources::kFiles (see ShaderSources.h). The project runs it
+# before each build, and the file is only rewritten when the sources changed.
+#
+#   python tools/embed_shaders.py [CORE_DIR [OUTPUT]]
+#
+# Each file becomes an array of pieces, each one a concatenation of one string
+# literal per line, since MSVC limits a string literal to 16K characters and a
+# concatenation of literals to 64K bytes (functions.c is larger).
+
+import io
+import os
+import sys
+
+FILES = ['definitions.c', 'functions.c', 'demo.c']
+MAX_PIECE_SIZE = 60000
+
+
+def Escape(line):
+    result = []
+    for byte in bytearray(line):
+        if byte == ord('\\') or byte == ord('"') or byte == ord('?'):
+            result.append('\\' + chr(byte))
+        elif byte == ord('\n'):
+            result.append('\\n')
+        elif byte == ord('\t'):
+            result.append('\\t')
+        elif byte < 32 or byte > 126:
+            result.append('\\%03o' % byte)
+        else:
+            result.append(chr(byte))
+    return ''.join(result)
+
+
+def Pieces(data):
+    pieces = [[]]
+    size = 0
+    for line in data.splitlines(True):
+        if size + len(line) > MAX_PIECE_SIZE and pieces[-1]:
+            pieces.append([])
+            size = 0
+        pieces[-1].append(line)
+        size += len(line)
+    return pieces
+
+
+def Generate(core_dir):
+    out = []
+    out.append('// Generated by tools/embed_shaders.py from the GLSL files of core, do not\n')
+    out.append('// edit. The project runs it again when these files change.\n')
+    out.append('\n')
+    out.append('#include "ShaderSources.h"\n')
+    out.append('\n')
+    out.append('namespace {\n')
+    names = []
+    for index, name in enumerate(FILES):
+        with open(os.path.join(core_dir, name), 'rb') as f:
+            data = f.read().replace(b'\r\n', b'\n')
+        array = 'kFile%dPieces' % index
+        names.append((name, array))
+        out.append('\n')
+        out.append('// %s\n' % name)
+        out.append('const char* const %s[] = {\n' % array)
+        for piece in Pieces(data):
+            lines = ['\t"%s"' % Escape(line) for line in piece]
+            out.append('\n'.join(lines) + ',\n')
+        out.append('};\n')
+    out.append('\n')
+    out.append('}  // anonymous namespace\n')
+    out.append('\n')
+    out.append('const ShaderSources::File ShaderSources::kFiles[] = {\n')
+    for name, array in names:
+        out.append('\t{ "%s", %s, sizeof(%s) / sizeof(%s[0]) },\n' %
+                   (name, array, array, array))
+    out.append('};\n')
+    out.append('\n')
+    out.append('const size_t ShaderSources::kFileCount =\n')
+    out.append('\tsizeof(ShaderSources::kFiles) / sizeof(ShaderSources::kFiles[0]);\n')
+    return ''.join(out)
+
+
+def main():
+    root = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+    core_dir = sys.argv[1] if len(sys.argv) > 1 else os.path.join(root, 'core')
+    output = sys.argv[2] if len(sys.argv) > 2 else os.path.join(
+        root, 'core', 'rendering', 'EmbeddedShaderFiles.cpp')
+    content = Generate(core_dir).encode('ascii')
+    # Keeps the timestamp of an up to date file, which would be compiled again.
+    if os.path.exists(output):
+        with open(output, 'rb') as f:
+            if f.read() == content:
+                return 0
+    with io.open(output, 'wb') as f:
+        f.write(content)
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())